@@ -12,7 +12,10 @@
 
 #include <EGL/egl.h>
 #include <assert.h>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <memory>
 #include <mutex>
@@ -38,27 +41,76 @@ em_egl_state_restore(const EmEglState *ees, EGLDisplay display)
 }
 
 namespace {
+using Clock = std::chrono::steady_clock;
+
+/// Usage statistics, only written by whoever holds the mutex, read by anyone.
+struct EmEglMutexCounters
+{
+	std::atomic<uint64_t> lock_count{0};
+	std::atomic<uint64_t> contended_count{0};
+	std::atomic<uint64_t> wait_ns_total{0};
+	std::atomic<uint64_t> wait_ns_max{0};
+	std::atomic<uint64_t> hold_ns_total{0};
+	std::atomic<uint64_t> hold_ns_max{0};
+};
+
 struct EmEglMutex
 {
 	EmEglMutexIface base;
 	std::mutex mutex;
 	EmEglState old_state;
 
+	/// When the current holder got the mutex.
+	Clock::time_point locked_at;
+	EmEglMutexCounters counters;
+
 	EmEglMutex(EGLDisplay display, EGLContext context);
 };
 static_assert(std::is_standard_layout<EmEglMutex>::value,
               "Must be standard layout to use the casts required for this interface-implementation style");
 
+inline uint64_t
+ns_between(Clock::time_point begin, Clock::time_point end)
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+}
+
+/// Only called with the mutex held, so there is a single writer.
+inline void
+add_sample(std::atomic<uint64_t> &total, std::atomic<uint64_t> &max, uint64_t ns)
+{
+	total.store(total.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+	if (ns > max.load(std::memory_order_relaxed)) {
+		max.store(ns, std::memory_order_relaxed);
+	}
+}
+
 bool
 egl_mutex_begin(EmEglMutexIface *eemi, EGLSurface draw, EGLSurface read)
 {
 	auto *eem = reinterpret_cast<EmEglMutex *>(eemi);
-	std::unique_lock<std::mutex> lock(eem->mutex);
+	Clock::time_point start = Clock::now();
+	std::unique_lock<std::mutex> lock(eem->mutex, std::try_to_lock);
+	bool contended = !lock.owns_lock();
+	if (contended) {
+		lock.lock();
+	}
+	eem->locked_at = Clock::now();
+
+	EmEglMutexCounters &c = eem->counters;
+	c.lock_count.store(c.lock_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	if (contended) {
+		c.contended_count.store(c.contended_count.load(std::memory_order_relaxed) + 1,
+		                        std::memory_order_relaxed);
+	}
+	add_sample(c.wait_ns_total, c.wait_ns_max, ns_between(start, eem->locked_at));
+
 	em_egl_state_save(&eem->old_state);
 	// ALOGI("%s : make current display=%p, draw surface=%p, read surface=%p, context=%p", __FUNCTION__,
 	//       eem->base.display, draw, read, eem->base.context);
 	if (eglMakeCurrent(eem->base.display, draw, read, eem->base.context) == EGL_FALSE) {
 		ALOGE("%s: Failed make egl context current", __FUNCTION__);
+		add_sample(eem->counters.hold_ns_total, eem->counters.hold_ns_max, ns_between(eem->locked_at, Clock::now()));
 		lock.unlock();
 		return false;
 	}
@@ -73,6 +125,20 @@ egl_mutex_end(EmEglMutexIface *eemi)
 	std::unique_lock<std::mutex> lock(eem->mutex, std::adopt_lock);
 	// ALOGI("%s: Make egl context un-current", __FUNCTION__);
 	em_egl_state_restore(&eem->old_state, eem->base.display);
+	add_sample(eem->counters.hold_ns_total, eem->counters.hold_ns_max, ns_between(eem->locked_at, Clock::now()));
+}
+
+void
+egl_mutex_get_stats(EmEglMutexIface *eemi, EmEglMutexStats *out_stats)
+{
+	auto *eem = reinterpret_cast<EmEglMutex *>(eemi);
+	const EmEglMutexCounters &c = eem->counters;
+	out_stats->lock_count = c.lock_count.load(std::memory_order_relaxed);
+	out_stats->contended_count = c.contended_count.load(std::memory_order_relaxed);
+	out_stats->wait_ns_total = c.wait_ns_total.load(std::memory_order_relaxed);
+	out_stats->wait_ns_max = c.wait_ns_max.load(std::memory_order_relaxed);
+	out_stats->hold_ns_total = c.hold_ns_total.load(std::memory_order_relaxed);
+	out_stats->hold_ns_max = c.hold_ns_max.load(std::memory_order_relaxed);
 }
 
 void
@@ -89,6 +155,7 @@ inline EmEglMutex::EmEglMutex(EGLDisplay display, EGLContext context)
 	base.begin = egl_mutex_begin;
 	base.end = egl_mutex_end;
 	base.destroy = egl_mutex_destroy;
+	base.get_stats = egl_mutex_get_stats;
 }
 
 } // namespace
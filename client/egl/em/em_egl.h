@@ -12,6 +12,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -38,6 +39,25 @@ em_egl_state_restore(const EmEglState *ees, EGLDisplay display);
 
 struct EmEglMutexIface;
 
+/*!
+ * How an EGL mutex has been used so far, to see how much the threads sharing a context get in each other's way.
+ */
+typedef struct EmEglMutexStats
+{
+	uint64_t lock_count;
+
+	//! How many of the locks found the mutex already held by another thread.
+	uint64_t contended_count;
+
+	//! Time spent waiting to get the mutex.
+	uint64_t wait_ns_total;
+	uint64_t wait_ns_max;
+
+	//! Time between getting the mutex and giving it back.
+	uint64_t hold_ns_total;
+	uint64_t hold_ns_max;
+} EmEglMutexStats;
+
 /*!
  * Interface for controlling access to an EGL context.
  */
@@ -65,6 +85,11 @@ typedef struct EmEglMutexIface
 	 * Free this structure.
 	 */
 	void (*destroy)(struct EmEglMutexIface *eem);
+
+	/*!
+	 * Optional, may be NULL: report usage so far.
+	 */
+	void (*get_stats)(struct EmEglMutexIface *eem, EmEglMutexStats *out_stats);
 } EmEglMutexIface;
 
 /*!
@@ -90,6 +115,21 @@ em_egl_mutex_end(EmEglMutexIface *eemi)
 	(eemi->end)(eemi);
 }
 
+/*!
+ * Get usage statistics, if the implementation keeps any.
+ *
+ * @return false if it doesn't, @p out_stats is left alone then.
+ */
+static inline bool
+em_egl_mutex_get_stats(EmEglMutexIface *eemi, EmEglMutexStats *out_stats)
+{
+	if (eemi->get_stats == NULL) {
+		return false;
+	}
+	(eemi->get_stats)(eemi, out_stats);
+	return true;
+}
+
 /*!
  * Free the implementation of this interface stored in the pointed-to variable, checking for null and setting to null
  * after destruction.
@@ -109,7 +149,7 @@ em_egl_mutex_destroy(EmEglMutexIface **ptr_eemi)
 }
 
 /*!
- * Create a default implementation of the @ref EmEglMutexIface interface.
+ * Create a default implementation of the @ref EmEglMutexIface interface, which keeps usage statistics.
  */
 EmEglMutexIface *
 em_egl_mutex_create(EGLDisplay display, EGLContext context);
@@ -0,0 +1,141 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief App state, OpenXR event handling and remote rendering setup shared by the Android and desktop clients.
+ * @author Moshi Turner <moses@collabora.com>
+ * @author Rylie Pavlik <rpavlik@collabora.com>
+ */
+#include "ClientCommon.hpp"
+#include "EglData.hpp"
+
+#include "em/em_app_log.h"
+#include "em/em_stream_client.h"
+
+#include <chrono>
+#include <thread>
+
+
+namespace {
+
+void
+connected_cb(EmConnection *connection, struct em_state *state)
+{
+	ALOGI("%s: Got signal that we are connected!", __FUNCTION__);
+
+	state->connected = true;
+}
+
+} // namespace
+
+bool
+poll_xr_events(em_state &state)
+{
+	XrResult result = XR_SUCCESS;
+	XrEventDataBuffer buffer;
+	buffer.type = XR_TYPE_EVENT_DATA_BUFFER;
+	buffer.next = NULL;
+
+	while (xrPollEvent(state.instance, &buffer) == XR_SUCCESS) {
+		if (buffer.type == XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED) {
+			XrEventDataSessionStateChanged *event = (XrEventDataSessionStateChanged *)&buffer;
+
+			switch (event->state) {
+			case XR_SESSION_STATE_IDLE: ALOGI("OpenXR session is now IDLE"); break;
+			case XR_SESSION_STATE_READY: {
+				ALOGI("OpenXR session is now READY, beginning session");
+				XrSessionBeginInfo beginInfo = {};
+				beginInfo.type = XR_TYPE_SESSION_BEGIN_INFO;
+				beginInfo.primaryViewConfigurationType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO;
+
+				result = xrBeginSession(state.session, &beginInfo);
+
+				if (XR_FAILED(result)) {
+					ALOGI("Failed to begin OpenXR session (%d)", result);
+				}
+			} break;
+			case XR_SESSION_STATE_SYNCHRONIZED: ALOGI("OpenXR session is now SYNCHRONIZED"); break;
+			case XR_SESSION_STATE_VISIBLE: ALOGI("OpenXR session is now VISIBLE"); break;
+			case XR_SESSION_STATE_FOCUSED: ALOGI("OpenXR session is now FOCUSED"); break;
+			case XR_SESSION_STATE_STOPPING:
+				ALOGI("OpenXR session is now STOPPING");
+				xrEndSession(state.session);
+				break;
+			case XR_SESSION_STATE_LOSS_PENDING: ALOGI("OpenXR session is now LOSS_PENDING"); break;
+			case XR_SESSION_STATE_EXITING: ALOGI("OpenXR session is now EXITING"); break;
+			default: ALOGI("OpenXR session state is now %d", event->state); break;
+			}
+
+			state.sessionState = event->state;
+		}
+
+		buffer.type = XR_TYPE_EVENT_DATA_BUFFER;
+	}
+
+	// If session isn't ready, return. We'll be called again and will poll events again.
+	if (state.sessionState < XR_SESSION_STATE_READY) {
+		ALOGI("Waiting for session ready state!");
+		using namespace std::chrono_literals;
+		std::this_thread::sleep_for(100ms);
+		return false;
+	}
+
+	return true;
+}
+
+bool
+remote_client_start(em_state &state, const EglData &eglData, em_remote_client &out)
+{
+	out.eglMutex = em_egl_mutex_create(eglData.display, eglData.context);
+	if (!out.eglMutex) {
+		ALOGE("%s: Failed to create the EGL mutex.", __FUNCTION__);
+		return false;
+	}
+
+	// Set up our own objects
+	ALOGI("%s: creating stream client object", __FUNCTION__);
+	EmStreamClient *stream_client = em_stream_client_new();
+
+	ALOGI("%s: telling stream client about EGL", __FUNCTION__);
+	// retaining ownership
+	em_stream_client_set_egl_context(stream_client, out.eglMutex, false, eglData.surface);
+
+	ALOGI("%s: creating connection object", __FUNCTION__);
+	state.connection = g_object_ref_sink(em_connection_new_localhost());
+
+	g_signal_connect(state.connection, "connected", G_CALLBACK(connected_cb), &state);
+
+	ALOGI("%s: starting connection", __FUNCTION__);
+	em_connection_connect(state.connection);
+
+	XrExtent2Di eye_extents{static_cast<int32_t>(state.width), static_cast<int32_t>(state.height)};
+	// On failure this has already destroyed the stream client.
+	out.experience =
+	    em_remote_experience_new(state.connection, stream_client, state.instance, state.session, &eye_extents);
+	if (!out.experience) {
+		ALOGE("%s: Failed during remote experience init.", __FUNCTION__);
+		em_connection_disconnect(state.connection);
+		g_clear_object(&state.connection);
+		em_egl_mutex_destroy(&out.eglMutex);
+		return false;
+	}
+
+	ALOGI("%s: starting stream client mainloop thread", __FUNCTION__);
+	em_stream_client_spawn_thread(stream_client, state.connection);
+	return true;
+}
+
+void
+remote_client_stop(em_state &state, em_remote_client &rc)
+{
+	em_connection_disconnect(state.connection);
+	g_clear_object(&state.connection);
+	// without gobject for stream client, the EmRemoteExperience takes ownership
+	// g_clear_object(&stream_client);
+
+	em_remote_experience_destroy(&rc.experience);
+
+	em_egl_mutex_destroy(&rc.eglMutex);
+}
@@ -0,0 +1,68 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief App state, OpenXR event handling and remote rendering setup shared by the Android and desktop clients.
+ */
+
+#pragma once
+
+#include "em/em_connection.h"
+#include "em/em_egl.h"
+#include "em/em_remote_experience.h"
+
+#include <openxr/openxr.h>
+
+#include <stdint.h>
+
+struct EglData;
+
+#define XR_LOAD(fn) xrGetInstanceProcAddr(state.instance, #fn, (PFN_xrVoidFunction *)&fn);
+
+struct em_state
+{
+	bool connected;
+
+	XrInstance instance;
+	XrSystemId system;
+	XrSession session;
+	XrSessionState sessionState;
+
+	uint32_t width;
+	uint32_t height;
+
+	EmConnection *connection;
+};
+
+/// The remote rendering objects, created once the OpenXR session exists.
+struct em_remote_client
+{
+	EmEglMutexIface *eglMutex;
+	EmRemoteExperience *experience;
+};
+
+/**
+ * Poll for OpenXR events, and handle them: begin and end the session as the runtime asks.
+ *
+ * @param state app state, sessionState is kept up to date
+ *
+ * @return true if the session is ready and we should go to the render code. Sleeps a bit before returning false.
+ */
+bool
+poll_xr_events(em_state &state);
+
+/**
+ * Create the stream client, connection and remote experience for the session in @p state, and start streaming.
+ *
+ * Call gst_init first.
+ *
+ * @return false on failure, with everything created so far cleaned up.
+ */
+bool
+remote_client_start(em_state &state, const EglData &eglData, em_remote_client &out);
+
+/// Disconnect and destroy what @ref remote_client_start created.
+void
+remote_client_stop(em_state &state, em_remote_client &rc);
@@ -14,13 +14,19 @@
 #include "em/render/GLError.h"
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 
 #include <stdexcept>
 
 EglData::EglData()
 {
 
+#ifdef __ANDROID__
 	display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+#else
+	// Headless: Mesa's surfaceless platform works without any window system, llvmpipe included.
+	display = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+#endif
 
 	if (display == EGL_NO_DISPLAY) {
 		ALOGE("Failed to get EGL display");
@@ -37,6 +43,13 @@ EglData::EglData()
 #define MAX_CONFIGS 1024
 	EGLConfig configs[MAX_CONFIGS];
 
+#ifdef __ANDROID__
+	const EGLint surfaceType = EGL_PBUFFER_BIT | EGL_WINDOW_BIT;
+#else
+	// Surfaceless displays have no window configs.
+	const EGLint surfaceType = EGL_PBUFFER_BIT;
+#endif
+
 	// RGBA8, multisample not required, ES3, pbuffer and window
 	const EGLint attributes[] = {
 	    EGL_RED_SIZE,
@@ -58,7 +71,7 @@ EglData::EglData()
 	    EGL_OPENGL_ES3_BIT,
 
 	    EGL_SURFACE_TYPE,
-	    (EGL_PBUFFER_BIT | EGL_WINDOW_BIT),
+	    surfaceType,
 
 	    EGL_NONE,
 	};
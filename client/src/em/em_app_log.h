@@ -18,11 +18,26 @@
 #define ALOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
 #define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 #else
+#include <stdarg.h>
+#include <stdio.h>
+
+// Desktop builds log to stderr, one line per message like logcat.
+static inline void
+em_app_log_stderr(char level, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	fprintf(stderr, "%c/" LOG_TAG ": ", level);
+	vfprintf(stderr, fmt, args);
+	fputc('\n', stderr);
+	va_end(args);
+}
+
 #define ALOGV(...)
-#define ALOGD(...)
-#define ALOGI(...)
-#define ALOGW(...)
-#define ALOGE(...)
+#define ALOGD(...) em_app_log_stderr('D', __VA_ARGS__)
+#define ALOGI(...) em_app_log_stderr('I', __VA_ARGS__)
+#define ALOGW(...) em_app_log_stderr('W', __VA_ARGS__)
+#define ALOGE(...) em_app_log_stderr('E', __VA_ARGS__)
 #endif
 
 #endif
@@ -46,6 +46,16 @@ struct _EmConnection
 	GstPipeline *pipeline;
 	GstElement *webrtcbin;
 	GstWebRTCDataChannel *datachannel;
+	//! Unordered and unreliable, for tracking only. Optional, the server might not offer it.
+	GstWebRTCDataChannel *tracking_channel;
+
+	//! Protects tracking_channel, pending_tracking and send_stats, the channels call us back from their own thread.
+	GMutex send_lock;
+	//! Newest tracking message, held back while the channel has too much buffered.
+	GBytes *pending_tracking;
+	//! pending_tracking is a compact tracking keyframe, which later deltas decode against.
+	bool pending_tracking_keyframe;
+	struct em_connection_send_stats send_stats;
 
 	enum em_status status;
 };
@@ -66,6 +76,7 @@ enum
 	SIGNAL_STATUS_CHANGE,
 	SIGNAL_ON_NEED_PIPELINE,
 	SIGNAL_ON_DROP_PIPELINE,
+	SIGNAL_ON_MESSAGE_DATA,
 	N_SIGNALS
 };
 
@@ -84,6 +95,21 @@ static GParamSpec *properties[N_PROPERTIES] = {
 
 #define DEFAULT_WEBSOCKET_URI "ws://127.0.0.1:8080/ws"
 
+#define TRACKING_CHANNEL_LABEL "tracking"
+
+/*!
+ * Hold tracking back once this much is waiting to go out, a few messages worth.
+ *
+ * Anything more would just be poses arriving late, better to send the newest one once the channel drains.
+ */
+#define TRACKING_HIGH_WATER_BYTES 1024
+
+//! Channels tell us when they drain below this.
+#define BUFFERED_AMOUNT_LOW_THRESHOLD 256
+
+//! Past this the link is stalled, reliable messages sent now would only arrive stale.
+#define RELIABLE_MAX_BUFFERED_BYTES (256 * 1024)
+
 
 /* GObject method implementations */
 
@@ -119,6 +145,7 @@ em_connection_get_property(GObject *object, guint property_id, GValue *value, GP
 static void
 em_connection_init(EmConnection *emconn)
 {
+	g_mutex_init(&emconn->send_lock);
 	emconn->ws_cancel = g_cancellable_new();
 	emconn->soup_session = soup_session_new();
 	emconn->websocket_uri = g_strdup(DEFAULT_WEBSOCKET_URI);
@@ -141,6 +168,7 @@ em_connection_finalize(GObject *object)
 	EmConnection *self = EM_CONNECTION(object);
 
 	g_free(self->websocket_uri);
+	g_mutex_clear(&self->send_lock);
 }
 
 static void
@@ -236,6 +264,16 @@ em_connection_class_init(EmConnectionClass *klass)
 	 */
 	signals[SIGNAL_ON_DROP_PIPELINE] = g_signal_new("on-drop-pipeline", G_OBJECT_CLASS_TYPE(klass),
 	                                                G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+
+	/**
+	 * EmConnection::on-message-data
+	 * @object: the #EmConnection
+	 * @data: the #GBytes received, do not keep a reference without adding one
+	 *
+	 * Emitted for each binary message the server sends over the data channel, from a GStreamer thread.
+	 */
+	signals[SIGNAL_ON_MESSAGE_DATA] = g_signal_new("on-message-data", G_OBJECT_CLASS_TYPE(klass), G_SIGNAL_RUN_LAST,
+	                                               0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_BYTES);
 	ALOGE("RYLIE: %s: End", __FUNCTION__);
 }
 
@@ -307,13 +345,56 @@ emconn_disconnect_internal(EmConnection *emconn, enum em_status status)
 	gst_clear_object(&emconn->webrtcbin);
 	gst_clear_object(&emconn->datachannel);
 	gst_clear_object(&emconn->pipeline);
+
+	g_mutex_lock(&emconn->send_lock);
+	gst_clear_object(&emconn->tracking_channel);
+	g_clear_pointer(&emconn->pending_tracking, g_bytes_unref);
+	emconn->pending_tracking_keyframe = false;
+	g_mutex_unlock(&emconn->send_lock);
+
 	emconn_update_status(emconn, status);
 }
 
 
+static bool
+emconn_is_tracking_channel(GstWebRTCDataChannel *datachannel)
+{
+	gchar *label = NULL;
+	g_object_get(datachannel, "label", &label, NULL);
+	bool is_tracking = g_strcmp0(label, TRACKING_CHANNEL_LABEL) == 0;
+	g_free(label);
+	return is_tracking;
+}
+
+/*!
+ * The tracking channel is only there to keep poses from queueing behind each other: losing it is no reason to drop
+ * the connection, tracking goes over the main channel from then on. Whatever was held back for it goes out once the
+ * main channel drains.
+ */
+static void
+emconn_tracking_channel_lost(EmConnection *emconn, GstWebRTCDataChannel *datachannel, const char *what)
+{
+	g_mutex_lock(&emconn->send_lock);
+	GstWebRTCDataChannel *channel = NULL;
+	if (emconn->tracking_channel == datachannel) {
+		channel = g_steal_pointer(&emconn->tracking_channel);
+	}
+	g_mutex_unlock(&emconn->send_lock);
+
+	if (channel != NULL) {
+		ALOGW("%s: Tracking data channel %s, sending tracking over the main channel", __FUNCTION__, what);
+		g_signal_handlers_disconnect_by_data(channel, emconn);
+		gst_object_unref(channel);
+	}
+}
+
 static void
 emconn_data_channel_error_cb(GstWebRTCDataChannel *datachannel, EmConnection *emconn)
 {
+	if (emconn_is_tracking_channel(datachannel)) {
+		emconn_tracking_channel_lost(emconn, datachannel, "failed");
+		return;
+	}
 	ALOGE("RYLIE: %s: error", __FUNCTION__);
 	emconn_disconnect_internal(emconn, EM_STATUS_DISCONNECTED_ERROR);
 	// abort();
@@ -322,6 +403,10 @@ emconn_data_channel_error_cb(GstWebRTCDataChannel *datachannel, EmConnection *em
 static void
 emconn_data_channel_close_cb(GstWebRTCDataChannel *datachannel, EmConnection *emconn)
 {
+	if (emconn_is_tracking_channel(datachannel)) {
+		emconn_tracking_channel_lost(emconn, datachannel, "closed");
+		return;
+	}
 	ALOGI("RYLIE: %s: Data channel closed", __FUNCTION__);
 	emconn_disconnect_internal(emconn, EM_STATUS_DISCONNECTED_REMOTE_CLOSE);
 }
@@ -332,6 +417,46 @@ emconn_data_channel_message_string_cb(GstWebRTCDataChannel *datachannel, gchar *
 	ALOGI("RYLIE: %s: Received data channel message: %s", __FUNCTION__, str);
 }
 
+static void
+emconn_data_channel_message_data_cb(GstWebRTCDataChannel *datachannel, GBytes *data, EmConnection *emconn)
+{
+	g_signal_emit(emconn, signals[SIGNAL_ON_MESSAGE_DATA], 0, data);
+}
+
+static void
+count_tracking_sent(EmConnection *emconn, gboolean success)
+{
+	g_mutex_lock(&emconn->send_lock);
+	if (success) {
+		emconn->send_stats.tracking_sent++;
+	} else {
+		emconn->send_stats.tracking_failed++;
+	}
+	g_mutex_unlock(&emconn->send_lock);
+}
+
+static void
+emconn_data_channel_buffered_amount_low_cb(GstWebRTCDataChannel *datachannel, EmConnection *emconn)
+{
+	g_mutex_lock(&emconn->send_lock);
+	GstWebRTCDataChannel *tracking_channel =
+	    emconn->tracking_channel != NULL ? emconn->tracking_channel : emconn->datachannel;
+	if (datachannel != tracking_channel) {
+		g_mutex_unlock(&emconn->send_lock);
+		return;
+	}
+
+	GBytes *pending = g_steal_pointer(&emconn->pending_tracking);
+	emconn->pending_tracking_keyframe = false;
+	g_mutex_unlock(&emconn->send_lock);
+
+	if (pending != NULL) {
+		gboolean success = gst_webrtc_data_channel_send_data_full(datachannel, pending, NULL);
+		g_bytes_unref(pending);
+		count_tracking_sent(emconn, success);
+	}
+}
+
 static void
 emconn_connect_internal(EmConnection *emconn, enum em_status status);
 
@@ -356,13 +481,32 @@ emconn_webrtc_prepare_data_channel_cb(GstElement *webrtc,
 	g_signal_connect(data_channel, "on-close", G_CALLBACK(emconn_data_channel_close_cb), emconn);
 	g_signal_connect(data_channel, "on-error", G_CALLBACK(emconn_data_channel_error_cb), emconn);
 	g_signal_connect(data_channel, "on-message-string", G_CALLBACK(emconn_data_channel_message_string_cb), emconn);
+	g_signal_connect(data_channel, "on-message-data", G_CALLBACK(emconn_data_channel_message_data_cb), emconn);
 }
 
 static void
 emconn_webrtc_on_data_channel_cb(GstElement *webrtcbin, GstWebRTCDataChannel *data_channel, EmConnection *emconn)
 {
 
-	ALOGI("Successfully created datachannel");
+	gchar *label = NULL;
+	g_object_get(data_channel, "label", &label, NULL);
+	ALOGI("Successfully created datachannel %s", label);
+
+	bool is_tracking = g_strcmp0(label, TRACKING_CHANNEL_LABEL) == 0;
+	g_free(label);
+
+	// Tracking may fall back to the main channel, so watch both drain.
+	g_object_set(data_channel, "buffered-amount-low-threshold", (guint64)BUFFERED_AMOUNT_LOW_THRESHOLD, NULL);
+	g_signal_connect(data_channel, "on-buffered-amount-low", G_CALLBACK(emconn_data_channel_buffered_amount_low_cb),
+	                 emconn);
+
+	if (is_tracking) {
+		g_mutex_lock(&emconn->send_lock);
+		g_assert_null(emconn->tracking_channel);
+		emconn->tracking_channel = GST_WEBRTC_DATA_CHANNEL(g_object_ref(data_channel));
+		g_mutex_unlock(&emconn->send_lock);
+		return;
+	}
 
 	g_assert_null(emconn->datachannel);
 
@@ -680,7 +824,88 @@ em_connection_send_bytes(EmConnection *emconn, GBytes *bytes)
 		return false;
 	}
 
-	gboolean success = gst_webrtc_data_channel_send_data_full(emconn->datachannel, bytes, NULL);
+	g_mutex_lock(&emconn->send_lock);
+	guint64 buffered = 0;
+	g_object_get(emconn->datachannel, "buffered-amount", &buffered, NULL);
+	bool stalled = buffered > RELIABLE_MAX_BUFFERED_BYTES;
+	g_mutex_unlock(&emconn->send_lock);
+
+	gboolean success = FALSE;
+	if (!stalled) {
+		success = gst_webrtc_data_channel_send_data_full(emconn->datachannel, bytes, NULL);
+	}
+
+	g_mutex_lock(&emconn->send_lock);
+	if (success) {
+		emconn->send_stats.reliable_sent++;
+	} else {
+		emconn->send_stats.reliable_dropped++;
+	}
+	g_mutex_unlock(&emconn->send_lock);
 
 	return success == TRUE;
 }
+
+bool
+em_connection_send_tracking_bytes(EmConnection *emconn, GBytes *bytes, bool keyframe)
+{
+	if (emconn->status != EM_STATUS_CONNECTED) {
+		ALOGW("RYLIE: Cannot send bytes when status is %s", em_status_to_string(emconn->status));
+		return false;
+	}
+
+	// Read under the lock, so the buffered-amount-low callback cannot run between deciding to hold this message
+	// and actually holding it, which would leave it stuck until the next one.
+	g_mutex_lock(&emconn->send_lock);
+
+	// Our own reference, the tracking channel may go away while we send over it.
+	GstWebRTCDataChannel *channel = emconn->tracking_channel != NULL ? emconn->tracking_channel : emconn->datachannel;
+	gst_object_ref(channel);
+
+	guint64 buffered = 0;
+	g_object_get(channel, "buffered-amount", &buffered, NULL);
+
+	// Whatever we were holding is older than this one either way, but a keyframe is only replaced by another
+	// keyframe: the deltas after it are undecodable without it, so it goes out first instead.
+	GBytes *held_keyframe = NULL;
+	if (emconn->pending_tracking != NULL) {
+		if (emconn->pending_tracking_keyframe && !keyframe) {
+			held_keyframe = g_steal_pointer(&emconn->pending_tracking);
+		} else {
+			g_clear_pointer(&emconn->pending_tracking, g_bytes_unref);
+			emconn->send_stats.tracking_superseded++;
+		}
+		emconn->pending_tracking_keyframe = false;
+	}
+
+	bool defer = buffered > TRACKING_HIGH_WATER_BYTES;
+	if (defer) {
+		// Sent from the buffered-amount-low callback, unless something newer comes along first.
+		emconn->pending_tracking = g_bytes_ref(bytes);
+		emconn->pending_tracking_keyframe = keyframe;
+		emconn->send_stats.tracking_deferred++;
+	}
+	g_mutex_unlock(&emconn->send_lock);
+
+	gboolean success = TRUE;
+	if (held_keyframe != NULL) {
+		success = gst_webrtc_data_channel_send_data_full(channel, held_keyframe, NULL);
+		g_bytes_unref(held_keyframe);
+		count_tracking_sent(emconn, success);
+	}
+	if (!defer) {
+		success = gst_webrtc_data_channel_send_data_full(channel, bytes, NULL);
+		count_tracking_sent(emconn, success);
+	}
+	gst_object_unref(channel);
+
+	return success == TRUE;
+}
+
+void
+em_connection_get_send_stats(EmConnection *emconn, struct em_connection_send_stats *out_stats)
+{
+	g_mutex_lock(&emconn->send_lock);
+	*out_stats = emconn->send_stats;
+	g_mutex_unlock(&emconn->send_lock);
+}
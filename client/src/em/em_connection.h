@@ -14,11 +14,32 @@
 #include <glib-object.h>
 #include <gst/gstpipeline.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 G_BEGIN_DECLS
 
 #define EM_TYPE_CONNECTION em_connection_get_type()
 
+/*!
+ * What the send policies did with the messages handed to them.
+ */
+struct em_connection_send_stats
+{
+	//! Tracking messages handed to the data channel.
+	uint64_t tracking_sent;
+	//! Tracking messages held back because the channel had too much buffered.
+	uint64_t tracking_deferred;
+	//! Held back tracking messages replaced by a newer one before they could be sent.
+	uint64_t tracking_superseded;
+	//! Tracking messages the data channel refused.
+	uint64_t tracking_failed;
+
+	//! Other messages handed to the data channel.
+	uint64_t reliable_sent;
+	//! Other messages dropped because the link looked stalled, or refused by the data channel.
+	uint64_t reliable_dropped;
+};
+
 G_DECLARE_FINAL_TYPE(EmConnection, em_connection, EM, CONNECTION, GObject)
 
 /*!
@@ -55,11 +76,38 @@ em_connection_disconnect(EmConnection *emconn);
 /*!
  * Send a message to the server
  *
+ * Dropped, returning false, if the data channel already has a lot buffered: it would arrive too late to matter.
+ *
  * @memberof EmConnection
  */
 bool
 em_connection_send_bytes(EmConnection *emconn, GBytes *bytes);
 
+/*!
+ * Send a tracking message to the server.
+ *
+ * Goes over the unordered, unreliable tracking channel if the server offered one, otherwise over the main channel.
+ * Either way, the server drops anything older than what it has already seen.
+ *
+ * If the channel is backed up the message is held instead, and sent once the channel drains unless a newer one
+ * replaces it first: the newest pose always wins. A held compact tracking keyframe is the exception, it is sent
+ * right away when a delta comes along, since that delta and the ones after it decode against it.
+ *
+ * @param keyframe whether @p bytes carry a compact tracking keyframe.
+ *
+ * @memberof EmConnection
+ */
+bool
+em_connection_send_tracking_bytes(EmConnection *emconn, GBytes *bytes, bool keyframe);
+
+/*!
+ * Get a snapshot of the send counters.
+ *
+ * @memberof EmConnection
+ */
+void
+em_connection_get_send_stats(EmConnection *emconn, struct em_connection_send_stats *out_stats);
+
 /*!
  * Assign a pipeline for use.
  *
@@ -31,23 +31,40 @@ FrameDataAccumulator::recordDisplayTime(int64_t frameId, int64_t displayTime)
 }
 
 void
-FrameDataAccumulator::emitCompleteRecords(PfnEmitUpMessage pfn, void *userdata)
+FrameDataAccumulator::emitCompleteRecords(PfnEmitUpMessage pfn, void *userdata, bool batched)
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
+	// As few messages as possible, each with as many frames as fit.
+	em_proto_UpMessage message = em_proto_UpMessage_init_default;
+	constexpr pb_size_t kMaxFrames = sizeof(message.frames) / sizeof(message.frames[0]);
 	m_accum.visitAll([&](id_data_accum::IdType id, FrameData const &data) {
 		if (data.decodeTime != 0 && data.displayTime != 0) {
-			em_proto_UpMessage message = em_proto_UpMessage_init_default;
-			message.has_frame = true;
-			message.frame.frame_sequence_id = id;
-			message.frame.decode_complete_time = data.decodeTime;
-			message.frame.display_time = data.displayTime;
+			em_proto_UpFrameMessage frame = em_proto_UpFrameMessage_init_default;
+			frame.frame_sequence_id = id;
+			frame.decode_complete_time = data.decodeTime;
+			frame.display_time = data.displayTime;
 
-			pfn(&message, userdata);
+			if (!batched) {
+				em_proto_UpMessage single = em_proto_UpMessage_init_default;
+				single.has_frame = true;
+				single.frame = frame;
+				pfn(&single, userdata);
+				return id_data_accum::Command::Drop;
+			}
+
+			message.frames[message.frames_count++] = frame;
+			if (message.frames_count == kMaxFrames) {
+				pfn(&message, userdata);
+				message = em_proto_UpMessage_init_default;
+			}
 
 			return id_data_accum::Command::Drop;
 		}
 		return id_data_accum::Command::Keep;
 	});
+	if (message.frames_count > 0) {
+		pfn(&message, userdata);
+	}
 }
 
 
@@ -42,13 +42,15 @@ public:
 	void
 	recordDisplayTime(int64_t frameId, int64_t displayTime);
 
+	/// Hand the frames that have both times to @p pfn. Batched into as few UpMessage::frames as fit if @p batched,
+	/// which only servers that advertise batched_frame_reports take, otherwise one UpMessage::frame each.
 	void
-	emitCompleteRecords(PfnEmitUpMessage pfn, void *userdata);
+	emitCompleteRecords(PfnEmitUpMessage pfn, void *userdata, bool batched);
 
 private:
-	/// basically arbitrary
-	static constexpr std::size_t kMaxFrameData = 5;
-	IdDataAccumulator<FrameData, kMaxFrameData> m_accum;
+	/// Frames between decoding and being reported: a bit over 100 ms at 144 Hz, the ring keeps lookups O(1) anyway.
+	static constexpr std::size_t kMaxFrameData = 16;
+	RingIdDataAccumulator<FrameData, kMaxFrameData> m_accum;
 	std::mutex m_mutex;
 };
 } // namespace em
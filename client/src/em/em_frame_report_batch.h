@@ -0,0 +1,113 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Collects frame timing reports so several go up in one UpMessage
+ * @ingroup em_client
+ */
+#pragma once
+
+#include "electricmaple.pb.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! Most frames one UpMessage can carry, set in electricmaple.options.
+#define EM_FRAME_REPORT_BATCH_CAPACITY                                                                                 \
+	(sizeof(((em_proto_UpMessage *)NULL)->frames) / sizeof(((em_proto_UpMessage *)NULL)->frames[0]))
+
+//! Frames to collect before sending, a third to a quarter of the packets at 90 to 120 Hz.
+#define EM_FRAME_REPORT_BATCH_DEFAULT_FRAMES 4
+
+//! Longest a report waits for company, so the server's timing stats don't go stale when frames stop coming.
+#define EM_FRAME_REPORT_BATCH_DEFAULT_MAX_AGE_NS (50 * 1000 * 1000)
+
+/*!
+ * Frame timing reports waiting to be sent. Initialize with @ref em_frame_report_batch_init.
+ *
+ * Only used from the frame loop, not thread safe.
+ */
+struct em_frame_report_batch
+{
+	em_proto_UpFrameMessage frames[EM_FRAME_REPORT_BATCH_CAPACITY];
+	uint32_t count;
+
+	//! When the oldest waiting report was added.
+	int64_t oldest_ns;
+
+	//! Send once this many are waiting, at most EM_FRAME_REPORT_BATCH_CAPACITY.
+	uint32_t max_frames;
+
+	//! Send once the oldest one waited this long.
+	int64_t max_age_ns;
+};
+
+static inline void
+em_frame_report_batch_init(struct em_frame_report_batch *b, uint32_t max_frames, int64_t max_age_ns)
+{
+	memset(b, 0, sizeof(*b));
+	if (max_frames < 1) {
+		max_frames = 1;
+	}
+	if (max_frames > EM_FRAME_REPORT_BATCH_CAPACITY) {
+		max_frames = EM_FRAME_REPORT_BATCH_CAPACITY;
+	}
+	b->max_frames = max_frames;
+	b->max_age_ns = max_age_ns;
+}
+
+/*!
+ * Add the timing of one frame at @p now_ns.
+ *
+ * @return false if the batch is full, take it first.
+ */
+static inline bool
+em_frame_report_batch_add(struct em_frame_report_batch *b, const em_proto_UpFrameMessage *frame, int64_t now_ns)
+{
+	if (b->count == EM_FRAME_REPORT_BATCH_CAPACITY) {
+		return false;
+	}
+	if (b->count == 0) {
+		b->oldest_ns = now_ns;
+	}
+	b->frames[b->count++] = *frame;
+	return true;
+}
+
+//! Whether the waiting reports should be sent at @p now_ns, because there are enough of them or they're old.
+static inline bool
+em_frame_report_batch_due(const struct em_frame_report_batch *b, int64_t now_ns)
+{
+	if (b->count == 0) {
+		return false;
+	}
+	return b->count >= b->max_frames || now_ns - b->oldest_ns >= b->max_age_ns;
+}
+
+/*!
+ * Move the waiting reports into @p message, oldest first, and start over.
+ *
+ * @return false if there were none.
+ */
+static inline bool
+em_frame_report_batch_take(struct em_frame_report_batch *b, em_proto_UpMessage *message)
+{
+	if (b->count == 0) {
+		return false;
+	}
+	memcpy(message->frames, b->frames, b->count * sizeof(b->frames[0]));
+	message->frames_count = (pb_size_t)b->count;
+	b->count = 0;
+	return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
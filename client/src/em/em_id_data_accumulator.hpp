@@ -293,8 +293,270 @@ namespace id_data_accum {
 	{
 		return std::count_if(m_data.begin(), m_data.end(), &isPairPopulated);
 	}
+
+	/*!
+	 * Collecting data for increasing key values, like @ref IdDataAccumulator but finding an ID's slot directly from
+	 * the ID instead of searching for it, so the capacity can be big enough for high frame rates without each update
+	 * getting slower.
+	 *
+	 * Each ID goes into slot `id % Capacity`, so this relies on the IDs (mostly) increasing by one: a new ID replaces
+	 * whatever older one is in its slot, which is at least Capacity IDs behind it then.
+	 *
+	 * @tparam ValueType the data structure associated with each key
+	 * @tparam Capacity the number of slots, in elements.
+	 */
+	template <typename ValueType, std::size_t Capacity> class RingIdDataAccumulator
+	{
+	public:
+		static_assert(Capacity > 0, "Need at least one slot");
+
+		/// Constructor
+		RingIdDataAccumulator();
+
+		/// Clear all entries.
+		void
+		clear();
+
+		/// Get a pointer to the value corresponding to that ID, or nullptr if not found.
+		ValueType *
+		getForId(IdType id);
+
+		/// Get a pointer to the const value corresponding to that ID, or nullptr if not found.
+		ValueType const *
+		getConstForId(IdType id) const;
+
+		/// Get a pointer to the const value corresponding to that ID, or nullptr if not found.
+		ValueType const *
+		getForId(IdType id) const;
+
+		/// Get the number of entries in progress
+		size_t
+		size() const
+		{
+			return m_count;
+		}
+
+		/*!
+		 * Add a data structure with the given ID, replacing the older entry in its slot if there is one.
+		 *
+		 * @param id ID of data
+		 * @param value The structure you'd like to add
+		 * @return true if the data was actually added, false if its slot holds a newer ID already.
+		 *
+		 * @throws if the ID already exists or is the sentinel
+		 */
+		bool
+		addDataFor(IdType id, ValueType &&value);
+
+		/*!
+		 * Look for a data structure with the given ID. If it exists, call the functor on it.
+		 *
+		 * @param id ID of data
+		 * @param dataUpdater A functor taking ValueType& that will update the data for that key, if found
+		 * @return true if the ID was found and functor was called.
+		 */
+		template <typename F>
+		bool
+		updateDataFor(IdType id, F &&dataUpdater)
+		{
+			ValueType *ptr = getForId(id);
+			if (ptr) {
+				dataUpdater(*ptr);
+				return true;
+			}
+			// we didn't find it
+			return false;
+		}
+
+		/*!
+		 * Call your functor on all populated entries, so you can emit them if they're ready to go.
+		 *
+		 * Entries are visited in ID order as long as they are all within Capacity of each other, which they are
+		 * unless an ID was skipped.
+		 *
+		 * @param dataHandler A functor taking IdType and ValueType& that will do stuff with the data and return
+		 * @ref Command
+		 *
+		 * @return true if any in-progress structures remain
+		 */
+		template <typename F>
+		bool
+		visitAll(F &&dataHandler)
+		{
+			IdType oldestKept = kSentinel;
+			forEachPopulated(*this, [&](PairType &p) {
+				Command cmd = dataHandler(p.first, p.second);
+				switch (cmd) {
+				case Command::Drop:
+					markPairUnpopulated(p);
+					--m_count;
+					break;
+				case Command::Keep:
+					if (oldestKept == kSentinel || p.first < oldestKept) {
+						oldestKept = p.first;
+					}
+					break;
+				}
+			});
+			m_oldest = oldestKept;
+			return m_count > 0;
+		}
+
+		/*!
+		 * Call your functor on all populated entries, as const.
+		 *
+		 * @param dataHandler A functor taking IdType and const ValueType& that will do stuff with the data
+		 *
+		 * @return true if any entries exist and were visited
+		 */
+		template <typename F>
+		bool
+		constVisitAll(F &&dataHandler) const
+		{
+			forEachPopulated(*this, [&](PairType const &p) { dataHandler(p.first, p.second); });
+			return m_count > 0;
+		}
+
+	private:
+		using PairType = std::pair<IdType, ValueType>;
+		using ArrayType = std::array<PairType, Capacity>;
+
+		/// Call @p f on the populated pairs of @p self, stopping as soon as it has seen all of them.
+		template <typename Self, typename F>
+		static void
+		forEachPopulated(Self &self, F &&f)
+		{
+			std::size_t remaining = self.m_count;
+			if (remaining == 0) {
+				return;
+			}
+			if (self.m_newest - self.m_oldest < static_cast<IdType>(Capacity)) {
+				// Everything is in the window of the newest Capacity IDs, so just look at those.
+				for (IdType id = self.m_oldest; remaining > 0 && id <= self.m_newest; ++id) {
+					auto &p = self.m_data[slotFor(id)];
+					if (isPairPopulated(p) && p.first == id) {
+						--remaining;
+						f(p);
+					}
+				}
+				return;
+			}
+			for (auto &p : self.m_data) {
+				if (remaining == 0) {
+					break;
+				}
+				if (isPairPopulated(p)) {
+					--remaining;
+					f(p);
+				}
+			}
+		}
+
+		static std::size_t
+		slotFor(IdType id)
+		{
+			return static_cast<std::size_t>(static_cast<std::uint64_t>(id) % Capacity);
+		}
+		static bool
+		isPairPopulated(PairType const &p)
+		{
+			return p.first != kSentinel;
+		}
+		static void
+		markPairUnpopulated(PairType &p)
+		{
+			p.first = kSentinel;
+			p.second = {};
+		}
+		ArrayType m_data;
+		std::size_t m_count = 0;
+		/// No entry is newer than this.
+		IdType m_newest = kSentinel;
+		/// No entry is older than this, exact after visiting.
+		IdType m_oldest = kSentinel;
+	};
+
+	template <typename ValueType, std::size_t Capacity>
+	inline RingIdDataAccumulator<ValueType, Capacity>::RingIdDataAccumulator()
+	{
+		clear();
+	}
+
+	template <typename ValueType, std::size_t Capacity>
+	inline void
+	RingIdDataAccumulator<ValueType, Capacity>::clear()
+	{
+		for (auto &p : m_data) {
+			markPairUnpopulated(p);
+		}
+		m_count = 0;
+		m_newest = kSentinel;
+		m_oldest = kSentinel;
+	}
+
+	template <typename ValueType, std::size_t Capacity>
+	inline bool
+	RingIdDataAccumulator<ValueType, Capacity>::addDataFor(IdType id, ValueType &&value)
+	{
+		if (id == kSentinel) {
+			throw std::logic_error("Sentinel ID passed to addDataFor");
+		}
+		PairType &p = m_data[slotFor(id)];
+		if (isPairPopulated(p)) {
+			if (p.first == id) {
+				throw std::logic_error("ID already present in accumulator");
+			}
+			if (p.first > id) {
+				// Do not replace a newer entry with an older one
+				return false;
+			}
+			// TODO do we notify about forgetting this?
+		} else {
+			++m_count;
+		}
+
+		p.first = id;
+		p.second = std::move(value);
+		if (m_count == 1 || id > m_newest) {
+			m_newest = id;
+		}
+		if (m_count == 1 || id < m_oldest) {
+			m_oldest = id;
+		}
+		return true;
+	}
+
+	template <typename ValueType, std::size_t Capacity>
+	inline ValueType *
+	RingIdDataAccumulator<ValueType, Capacity>::getForId(IdType id)
+	{
+		PairType &p = m_data[slotFor(id)];
+		if (id == kSentinel || p.first != id) {
+			return nullptr;
+		}
+		return &(p.second);
+	}
+
+	template <typename ValueType, std::size_t Capacity>
+	inline ValueType const *
+	RingIdDataAccumulator<ValueType, Capacity>::getConstForId(IdType id) const
+	{
+		PairType const &p = m_data[slotFor(id)];
+		if (id == kSentinel || p.first != id) {
+			return nullptr;
+		}
+		return &(p.second);
+	}
+
+	template <typename ValueType, std::size_t Capacity>
+	inline ValueType const *
+	RingIdDataAccumulator<ValueType, Capacity>::getForId(IdType id) const
+	{
+		return getConstForId(id);
+	}
 }; // namespace id_data_accum
 
 using id_data_accum::IdDataAccumulator;
+using id_data_accum::RingIdDataAccumulator;
 
 } // namespace em
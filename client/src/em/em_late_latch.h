@@ -0,0 +1,76 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Scheduling for rendering as late in the frame as the measured render cost allows
+ * @ingroup em_client
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! What the render cost estimate starts at, before anything was measured.
+#define EM_LATE_LATCH_INITIAL_COST_NS (4 * 1000 * 1000)
+
+//! Head room on top of the render cost estimate, for scheduling jitter and the submission itself.
+#define EM_LATE_LATCH_DEFAULT_MARGIN_NS (2 * 1000 * 1000)
+
+/*!
+ * Render cost estimate for late latching. Initialize with @ref em_late_latch_init.
+ *
+ * Only used from the frame loop, not thread safe.
+ */
+struct em_late_latch
+{
+	//! Follows a cost going up right away and one going down slowly, so a single cheap frame can't make us late.
+	int64_t cost_ns;
+
+	int64_t margin_ns;
+};
+
+static inline void
+em_late_latch_init(struct em_late_latch *ll, int64_t margin_ns)
+{
+	ll->cost_ns = EM_LATE_LATCH_INITIAL_COST_NS;
+	ll->margin_ns = margin_ns;
+}
+
+//! Add how long one frame took from starting to render until the GPU was done with it.
+static inline void
+em_late_latch_record(struct em_late_latch *ll, int64_t cost_ns)
+{
+	if (cost_ns < 0) {
+		return;
+	}
+	if (cost_ns >= ll->cost_ns) {
+		ll->cost_ns = cost_ns;
+	} else {
+		// Rounded up so it gets all the way down eventually.
+		ll->cost_ns -= (ll->cost_ns - cost_ns + 15) / 16;
+	}
+}
+
+/*!
+ * When to pick the sample and locate the views, so rendering is done by the end of the frame's budget.
+ *
+ * @param frame_start_ns When xrWaitFrame returned, which starts the app's budget of one display period.
+ * @param display_period_ns The predicted display period from xrWaitFrame.
+ *
+ * @return the time to start rendering at, never before @p frame_start_ns.
+ */
+static inline int64_t
+em_late_latch_start_time(const struct em_late_latch *ll, int64_t frame_start_ns, int64_t display_period_ns)
+{
+	int64_t start_ns = frame_start_ns + display_period_ns - ll->cost_ns - ll->margin_ns;
+	return start_ns > frame_start_ns ? start_ns : frame_start_ns;
+}
+
+#ifdef __cplusplus
+}
+#endif
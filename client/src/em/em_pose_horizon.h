@@ -0,0 +1,120 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Estimates how far past its own display time a head pose we send ends up being shown
+ * @ingroup em_client
+ *
+ * A pose goes out stamped with the display time we predicted it for. The server renders a frame from it, encodes it,
+ * we decode it and show it some frames later. The server echoes the sequence_idx of the tracking message it rendered
+ * from, so when a frame gets shown we know how far past that pose's display time it really was: the round trip plus
+ * encoding, decoding and whatever queueing happened on either side.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! How many sent poses to remember, about half a second with the tracking sampler at 500 Hz.
+#define EM_POSE_HORIZON_HISTORY 256
+
+//! Longest horizon to predict for, past this a prediction does more harm than good.
+#define EM_POSE_HORIZON_MAX_NS (200 * 1000 * 1000)
+
+//! The estimate moves 1/EM_POSE_HORIZON_SMOOTHING of the way to each new measurement.
+#define EM_POSE_HORIZON_SMOOTHING 8
+
+/*!
+ * Sent poses and the horizon estimate. Initialize with @ref em_pose_horizon_init.
+ *
+ * Not thread safe.
+ */
+struct em_pose_horizon
+{
+	struct
+	{
+		int64_t sequence_idx;
+		int64_t display_time_ns;
+	} sent[EM_POSE_HORIZON_HISTORY];
+
+	//! Smoothed horizon, valid once has_estimate is set.
+	int64_t horizon_ns;
+	bool has_estimate;
+};
+
+static inline void
+em_pose_horizon_init(struct em_pose_horizon *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+//! Remember that the pose with @p sequence_idx went out predicted for @p display_time_ns.
+static inline void
+em_pose_horizon_record_sent(struct em_pose_horizon *h, int64_t sequence_idx, int64_t display_time_ns)
+{
+	if (sequence_idx <= 0) {
+		return;
+	}
+	uint32_t slot = (uint32_t)(sequence_idx % EM_POSE_HORIZON_HISTORY);
+	h->sent[slot].sequence_idx = sequence_idx;
+	h->sent[slot].display_time_ns = display_time_ns;
+}
+
+/*!
+ * A frame rendered from the pose with @p sequence_idx is shown at @p shown_display_time_ns.
+ *
+ * @return false if that pose is unknown or too old to still be remembered, the estimate is unchanged.
+ */
+static inline bool
+em_pose_horizon_record_shown(struct em_pose_horizon *h, int64_t sequence_idx, int64_t shown_display_time_ns)
+{
+	if (sequence_idx <= 0) {
+		return false;
+	}
+	uint32_t slot = (uint32_t)(sequence_idx % EM_POSE_HORIZON_HISTORY);
+	if (h->sent[slot].sequence_idx != sequence_idx) {
+		return false;
+	}
+
+	int64_t measured = shown_display_time_ns - h->sent[slot].display_time_ns;
+	if (measured < 0) {
+		measured = 0;
+	}
+	if (measured > EM_POSE_HORIZON_MAX_NS) {
+		measured = EM_POSE_HORIZON_MAX_NS;
+	}
+
+	if (!h->has_estimate) {
+		h->horizon_ns = measured;
+		h->has_estimate = true;
+	} else {
+		h->horizon_ns += (measured - h->horizon_ns) / EM_POSE_HORIZON_SMOOTHING;
+	}
+	return true;
+}
+
+/*!
+ * How much later than its own display time a pose sent now will probably be shown.
+ *
+ * @return false while nothing has been measured yet.
+ */
+static inline bool
+em_pose_horizon_get(const struct em_pose_horizon *h, int64_t *out_horizon_ns)
+{
+	if (!h->has_estimate) {
+		return false;
+	}
+	*out_horizon_ns = h->horizon_ns;
+	return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
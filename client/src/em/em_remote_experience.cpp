@@ -13,30 +13,67 @@
 
 #include "em_app_log.h"
 #include "em_connection.h"
+#include "em_frame_report_batch.h"
+#include "em_late_latch.h"
+#include "em_pose_horizon.h"
+#include "em_send_buffer_pool.hpp"
 #include "em_stream_client.h"
 #include "gst_common.h"
+#include "render/GLGpuTimer.h"
 #include "render/GLSwapchain.h"
 #include "render/render.hpp"
 
+#include "pb_decode.h"
 #include "pb_encode.h"
 #include "electricmaple.pb.h"
+#include "em_compact_tracking.h"
 
 #include "render/xr_platform_deps.h"
 
+#include "os/os_threading.h"
+
 #include <GLES3/gl3.h>
 #include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cinttypes>
 #include <cstdint>
+#include <cerrno>
 #include <cstdlib>
 #include <ctime>
 #include <exception>
-#include <linux/time.h>
 #include <memory>
 #include <openxr/openxr.h>
 #include <openxr/openxr_platform.h>
 
 
+static constexpr size_t kUpBufferSize = em_proto_UpMessage_size + 10;
+
+/*!
+ * Enough for a few frames worth of tracking and timing messages sitting in the SCTP send buffer, even with the tracking
+ * sampler running at a few hundred Hz. Past that, messages from the frame loop and the sampler are dropped, while the
+ * odd message from elsewhere falls back to allocating.
+ */
+static constexpr size_t kUpBufferCount = 64;
+
+//! Past this the sampler mostly sends the same pose again.
+static constexpr uint32_t kMaxTrackingRateHz = 1000;
+
+//! The sampler stops once the frame loop has not submitted a frame for this long.
+static constexpr int64_t kTrackingSamplerStaleNs = 100 * 1000 * 1000;
+
+using UpBufferPool = em::SendBufferPool<kUpBufferSize, kUpBufferCount>;
+
+//! An encoded upstream message on its way to the sender thread.
+struct em_up_send
+{
+	UpBufferPool::Buffer *buffer;
+	size_t length;
+	//! Goes out with em_connection_send_tracking_bytes instead of em_connection_send_bytes.
+	bool tracking;
+	bool keyframe;
+};
+
 struct _EmRemoteExperience
 {
 	EmConnection *connection;
@@ -44,8 +81,25 @@ struct _EmRemoteExperience
 	std::unique_ptr<Renderer> renderer;
 	struct em_sample *prev_sample;
 
+	//! Only used from the frame loop.
+	EmReprojectionMode reprojectionMode;
+
+	//! Only used from the frame loop.
+	struct
+	{
+		bool enabled;
+		struct em_late_latch schedule;
+		//! Render cost comes in a frame or two late, from here. Tagged with the CPU time spent submitting.
+		GLGpuTimer gpuTimer;
+	} lateLatch;
+
 	XrExtent2Di eye_extents;
 
+	//! The render context stays current from one frame to the next. Only used from the frame loop.
+	bool eglHeld;
+
+	//! Both eyes are drawn in one pass instead of one layer of the swapchain at a time. Only used from the frame loop.
+	bool multiview;
 
 	PFN_xrConvertTimespecTimeToTimeKHR convertTimespecTimeToTime;
 
@@ -67,76 +121,367 @@ struct _EmRemoteExperience
 	GLSwapchain swapchainBuffers;
 
 	std::atomic_int64_t nextUpMessage{1};
-};
 
-static constexpr size_t kUpBufferSize = em_proto_UpMessage_size + 10;
+	//! Encoded upstream messages live here until the data channel lets go of them.
+	UpBufferPool::Ptr upBuffers;
 
-bool
-em_remote_experience_emit_upmessage(EmRemoteExperience *exp, em_proto_UpMessage *upMessage)
+	//! Hands the data channel what the frame loop and the tracking sampler encode, so they never allocate to send.
+	struct
+	{
+		struct os_thread_helper thread;
+		//! Protected by the thread helper's lock.
+		em::SendQueue<struct em_up_send, kUpBufferCount> queue;
+	} sender;
+
+	//! Compact tracking version the server told us it decodes, 0 until we hear from it.
+	std::atomic_uint32_t serverCompactTrackingVersion{0};
+
+	//! Whether the server told us it reads several frame reports per message.
+	std::atomic_bool serverBatchesFrameReports{false};
+
+	//! Only used from the frame loop.
+	struct em_frame_report_batch frameReports;
+
+	struct
+	{
+		std::atomic_bool needKeyframe;
+
+		//! Only used by whoever sends tracking: the sampler thread while it runs, the frame loop otherwise.
+		int64_t nextSequenceIdx;
+		struct em_compact_tracking_encoder encoder;
+
+		//! The frame loop measures it, the sender reads it.
+		struct em_pose_horizon horizon;
+		struct os_mutex horizonMutex;
+	} tracking;
+
+	//! Sends the head pose at a fixed rate on its own thread, instead of once per frame from the frame loop.
+	struct
+	{
+		struct os_thread_helper thread;
+
+		//! 0 while the frame loop sends tracking. Only changed while the thread is stopped.
+		uint32_t rateHz;
+
+		//! How far ahead of now the frame loop last predicted display, 0 while it is not submitting frames.
+		std::atomic<int64_t> displayLeadNs;
+
+		//! CLOCK_MONOTONIC time the frame loop last set displayLeadNs.
+		std::atomic<int64_t> leadUpdatedNs;
+	} trackingSampler;
+
+	//! Times the head could not be located, to only log now and then when it keeps failing.
+	std::atomic_uint64_t locateFailures{0};
+};
+
+//! Set the message ID and encode into a pooled buffer, or return nullptr if they are all in flight.
+static UpBufferPool::Buffer *
+em_remote_experience_encode_upmessage(EmRemoteExperience *exp, em_proto_UpMessage *upMessage, size_t *outLength)
 {
 	int64_t message_id = exp->nextUpMessage++;
 	upMessage->up_message_id = message_id;
 
-	uint8_t buffer[kUpBufferSize];
-	pb_ostream_t os = pb_ostream_from_buffer(buffer, sizeof(buffer));
+	UpBufferPool::Buffer *pooled = exp->upBuffers->acquire();
+	if (pooled == nullptr) {
+		return nullptr;
+	}
 
+	pb_ostream_t os = pb_ostream_from_buffer(pooled->data(), pooled->size());
 	pb_encode(&os, &em_proto_UpMessage_msg, upMessage);
+	*outLength = os.bytes_written;
+	return pooled;
+}
+
+//! No copy, the buffer goes back to the pool when the last reference to the GBytes is dropped.
+static GBytes *
+wrap_up_buffer(UpBufferPool::Buffer *buffer, size_t length)
+{
+	return g_bytes_new_with_free_func(buffer->data(), length, &UpBufferPool::release, buffer);
+}
+
+bool
+em_remote_experience_emit_upmessage(EmRemoteExperience *exp, em_proto_UpMessage *upMessage)
+{
+	size_t length = 0;
+	UpBufferPool::Buffer *pooled = em_remote_experience_encode_upmessage(exp, upMessage, &length);
+
+	GBytes *bytes = nullptr;
+	if (pooled != nullptr) {
+		bytes = wrap_up_buffer(pooled, length);
+	} else {
+		// Everything is stuck in flight, don't stop sending over it.
+		ALOGW("%s: Out of send buffers (%" PRIu64 " times so far), allocating", __FUNCTION__,
+		      exp->upBuffers->exhaustedCount());
+
+		uint8_t buffer[kUpBufferSize];
+		pb_ostream_t os = pb_ostream_from_buffer(buffer, sizeof(buffer));
+		pb_encode(&os, &em_proto_UpMessage_msg, upMessage);
+		bytes = g_bytes_new(buffer, os.bytes_written);
+	}
 
-	ALOGI("RYLIE: Sending message");
-	GBytes *bytes = g_bytes_new(buffer, os.bytes_written);
 	bool bResult = em_connection_send_bytes(exp->connection, bytes);
 	g_bytes_unref(bytes);
 	return bResult;
 }
 
+/*!
+ * Encode the message and leave it for the sender thread, without allocating. For the frame loop and the tracking
+ * sampler.
+ *
+ * @return false if it was dropped because every send buffer is in flight.
+ */
+static bool
+em_remote_experience_queue_upmessage(EmRemoteExperience *exp,
+                                     em_proto_UpMessage *upMessage,
+                                     bool tracking,
+                                     bool keyframe)
+{
+	struct em_up_send send = {};
+	send.buffer = em_remote_experience_encode_upmessage(exp, upMessage, &send.length);
+	if (send.buffer == nullptr) {
+		uint64_t exhausted = exp->upBuffers->exhaustedCount();
+		// Only now and then, it tends to keep happening once it starts.
+		if ((exhausted & (exhausted - 1)) == 0) {
+			ALOGW("%s: Out of send buffers (%" PRIu64 " times so far), dropping", __FUNCTION__, exhausted);
+		}
+		return false;
+	}
+	send.tracking = tracking;
+	send.keyframe = keyframe;
+
+	// There is a queue slot for every buffer, so this can't fail.
+	os_thread_helper_lock(&exp->sender.thread);
+	exp->sender.queue.push(send);
+	os_thread_helper_signal_locked(&exp->sender.thread);
+	os_thread_helper_unlock(&exp->sender.thread);
+	return true;
+}
+
+//! Sends what em_remote_experience_queue_upmessage leaves in the queue, in order.
+static void *
+sender_thread_func(void *ptr)
+{
+	EmRemoteExperience *exp = (EmRemoteExperience *)ptr;
+	struct os_thread_helper *oth = &exp->sender.thread;
+
+	os_thread_helper_lock(oth);
+	while (os_thread_helper_is_running_locked(oth)) {
+		struct em_up_send send;
+		if (!exp->sender.queue.pop(send)) {
+			os_thread_helper_wait_locked(oth);
+			continue;
+		}
+		os_thread_helper_unlock(oth);
+
+		GBytes *bytes = wrap_up_buffer(send.buffer, send.length);
+		if (send.tracking) {
+			if (!em_connection_send_tracking_bytes(exp->connection, bytes, send.keyframe)) {
+				ALOGE("RYLIE: Could not queue HMD pose message!");
+			}
+		} else {
+			em_connection_send_bytes(exp->connection, bytes);
+		}
+		g_bytes_unref(bytes);
+
+		os_thread_helper_lock(oth);
+	}
+	os_thread_helper_unlock(oth);
+
+	return NULL;
+}
+
+//! Stop the sender thread, dropping whatever it had not sent yet.
 static void
-em_remote_experience_report_pose(EmRemoteExperience *exp, XrTime predictedDisplayTime)
+stop_sender(EmRemoteExperience *exp)
 {
-	XrResult result = XR_SUCCESS;
+	os_thread_helper_stop_and_wait(&exp->sender.thread);
 
+	struct em_up_send send;
+	while (exp->sender.queue.pop(send)) {
+		UpBufferPool::release(send.buffer);
+	}
+}
 
+/*!
+ * Answer a clock sync ping right away, the server measures the round trip around us.
+ *
+ * @param receiveTime a timespec from CLOCK_MONOTONIC indicating when the ping arrived.
+ */
+static void
+em_remote_experience_answer_clock_sync(EmRemoteExperience *exp,
+                                       const em_proto_ClockSyncPing *ping,
+                                       const struct timespec *receiveTime)
+{
+	XrTime xrTimeReceive = 0;
+	XrResult result = exp->convertTimespecTimeToTime(exp->xr_not_owned.instance, receiveTime, &xrTimeReceive);
+	if (XR_FAILED(result)) {
+		ALOGE("%s: Failed to convert receive time (%d)", __FUNCTION__, result);
+		return;
+	}
+
+	em_proto_UpMessage upMsg = em_proto_UpMessage_init_default;
+	upMsg.has_clock_sync_pong = true;
+	upMsg.clock_sync_pong.id = ping->id;
+	upMsg.clock_sync_pong.server_send_time = ping->server_send_time;
+	upMsg.clock_sync_pong.client_receive_time = xrTimeReceive;
+
+	struct timespec sendTime;
+	XrTime xrTimeSend = 0;
+	if (0 != clock_gettime(CLOCK_MONOTONIC, &sendTime) ||
+	    XR_FAILED(exp->convertTimespecTimeToTime(exp->xr_not_owned.instance, &sendTime, &xrTimeSend))) {
+		ALOGE("%s: Failed to get send time", __FUNCTION__);
+		return;
+	}
+	upMsg.clock_sync_pong.client_send_time = xrTimeSend;
+
+	em_remote_experience_emit_upmessage(exp, &upMsg);
+}
+
+//! A new server, or the same one again, says what it supports once the data channel is up: forget what the old one did.
+static void
+em_remote_experience_on_connected(EmConnection *connection, EmRemoteExperience *exp)
+{
+	exp->serverCompactTrackingVersion = 0;
+	exp->serverBatchesFrameReports = false;
+}
+
+static void
+em_remote_experience_on_message_data(EmConnection *connection, GBytes *data, EmRemoteExperience *exp)
+{
+	// Before anything else, in case this is a clock sync ping.
+	struct timespec receiveTime;
+	clock_gettime(CLOCK_MONOTONIC, &receiveTime);
+
+	gsize n = 0;
+	const pb_byte_t *buf = static_cast<const pb_byte_t *>(g_bytes_get_data(data, &n));
+	pb_istream_t is = pb_istream_from_buffer(buf, n);
+
+	em_proto_DownMessage message = em_proto_DownMessage_init_default;
+	if (!pb_decode(&is, &em_proto_DownMessage_msg, &message)) {
+		ALOGW("%s: Could not decode down message: %s", __FUNCTION__, PB_GET_ERROR(&is));
+		return;
+	}
+
+	if (message.has_capabilities) {
+		ALOGI("%s: Server decodes compact tracking version %u", __FUNCTION__,
+		      message.capabilities.compact_tracking_version);
+		exp->serverCompactTrackingVersion = message.capabilities.compact_tracking_version;
+		exp->serverBatchesFrameReports = message.capabilities.batched_frame_reports;
+		// Sent on every (re)connect, and the server starts from scratch each time.
+		exp->tracking.needKeyframe = true;
+	}
+
+	if (message.tracking_keyframe_request) {
+		// A keyframe got lost, everything relative to it is undecodable until the next one.
+		exp->tracking.needKeyframe = true;
+	}
+
+	if (message.has_clock_sync_ping) {
+		em_remote_experience_answer_clock_sync(exp, &message.clock_sync_ping, &receiveTime);
+	}
+}
+
+//! Where the head is at @p time in our local space, false if the runtime can't tell.
+static bool
+locate_head(EmRemoteExperience *exp, XrTime time, em_proto_Pose *out_pose)
+{
 	XrSpaceLocation hmdLocalLocation = {};
 	hmdLocalLocation.type = XR_TYPE_SPACE_LOCATION;
 	hmdLocalLocation.next = NULL;
-	result =
-	    xrLocateSpace(exp->xr_owned.viewSpace, exp->xr_owned.worldSpace, predictedDisplayTime, &hmdLocalLocation);
+	XrResult result = xrLocateSpace(exp->xr_owned.viewSpace, exp->xr_owned.worldSpace, time, &hmdLocalLocation);
 	if (result != XR_SUCCESS) {
-		ALOGE("Bad!");
-		return;
+		return false;
 	}
 
-	XrPosef hmdLocalPose = hmdLocalLocation.pose;
+	const XrPosef &hmdLocalPose = hmdLocalLocation.pose;
+
+	out_pose->has_position = true;
+	out_pose->has_orientation = true;
+	out_pose->position.x = hmdLocalPose.position.x;
+	out_pose->position.y = hmdLocalPose.position.y;
+	out_pose->position.z = hmdLocalPose.position.z;
 
+	out_pose->orientation.w = hmdLocalPose.orientation.w;
+	out_pose->orientation.x = hmdLocalPose.orientation.x;
+	out_pose->orientation.y = hmdLocalPose.orientation.y;
+	out_pose->orientation.z = hmdLocalPose.orientation.z;
+	return true;
+}
+
+/*!
+ * Send the head pose for @p predictedDisplayTime. Once we know how much later than that frames rendered from it get
+ * shown, also send the pose predicted for then, the server picks whichever fits the frame it renders.
+ */
+static void
+em_remote_experience_report_pose(EmRemoteExperience *exp, XrTime predictedDisplayTime)
+{
 	em_proto_TrackingMessage tracking = em_proto_TrackingMessage_init_default;
 
 	tracking.has_P_localSpace_viewSpace = true;
-	tracking.P_localSpace_viewSpace.has_position = true;
-	tracking.P_localSpace_viewSpace.has_orientation = true;
-	tracking.P_localSpace_viewSpace.position.x = hmdLocalPose.position.x;
-	tracking.P_localSpace_viewSpace.position.y = hmdLocalPose.position.y;
-	tracking.P_localSpace_viewSpace.position.z = hmdLocalPose.position.z;
+	if (!locate_head(exp, predictedDisplayTime, &tracking.P_localSpace_viewSpace)) {
+		// Happens every sample while tracking is lost, log at 1, 2, 4, 8... failures.
+		uint64_t failures = ++exp->locateFailures;
+		if ((failures & (failures - 1)) == 0) {
+			ALOGE("%s: Could not locate the head (%" PRIu64 " times so far)", __FUNCTION__, failures);
+		}
+		return;
+	}
 
-	tracking.P_localSpace_viewSpace.orientation.w = hmdLocalPose.orientation.w;
-	tracking.P_localSpace_viewSpace.orientation.x = hmdLocalPose.orientation.x;
-	tracking.P_localSpace_viewSpace.orientation.y = hmdLocalPose.orientation.y;
-	tracking.P_localSpace_viewSpace.orientation.z = hmdLocalPose.orientation.z;
+	tracking.timestamp = predictedDisplayTime;
+	tracking.sequence_idx = exp->tracking.nextSequenceIdx++;
+
+	int64_t horizon_ns = 0;
+	bool hasHorizon = false;
+	os_mutex_lock(&exp->tracking.horizonMutex);
+	em_pose_horizon_record_sent(&exp->tracking.horizon, tracking.sequence_idx, predictedDisplayTime);
+	hasHorizon = em_pose_horizon_get(&exp->tracking.horizon, &horizon_ns);
+	os_mutex_unlock(&exp->tracking.horizonMutex);
+
+	// Version 1 compact tracking has no room for it.
+	uint32_t compactVersion = exp->serverCompactTrackingVersion;
+	if ((compactVersion == 0 || compactVersion >= 2) && hasHorizon && horizon_ns > 0) {
+		XrTime pipelinedTime = predictedDisplayTime + horizon_ns;
+		tracking.has_P_localSpace_viewSpace_pipelined =
+		    locate_head(exp, pipelinedTime, &tracking.P_localSpace_viewSpace_pipelined);
+		if (tracking.has_P_localSpace_viewSpace_pipelined) {
+			tracking.pipelined_timestamp = pipelinedTime;
+		}
+	}
 
 	em_proto_UpMessage upMessage = em_proto_UpMessage_init_default;
-	upMessage.has_tracking = true;
-	upMessage.tracking = tracking;
-
-	if (!em_remote_experience_emit_upmessage(exp, &upMessage)) {
-		ALOGE("RYLIE: Could not queue HMD pose message!");
+	bool keyframe = false;
+	if (compactVersion >= 1) {
+		if (exp->tracking.needKeyframe.exchange(false)) {
+			em_compact_tracking_encoder_force_keyframe(&exp->tracking.encoder);
+		}
+		upMessage.has_compact_tracking = true;
+		em_compact_tracking_encode(&exp->tracking.encoder, &tracking, &upMessage.compact_tracking);
+		keyframe = upMessage.compact_tracking.keyframe_sequence_idx == upMessage.compact_tracking.sequence_idx;
+	} else {
+		upMessage.has_tracking = true;
+		upMessage.tracking = tracking;
 	}
+
+	em_remote_experience_queue_upmessage(exp, &upMessage, true, keyframe);
 }
 
 static void
 em_remote_experience_dispose(EmRemoteExperience *exp)
 {
+	// These send over the connection, so they go first, the sampler before the sender it queues for.
+	os_thread_helper_stop_and_wait(&exp->trackingSampler.thread);
+	stop_sender(exp);
+
 	if (exp->stream_client) {
 		em_stream_client_stop(exp->stream_client);
+		// The frame loop's hold first, the mutex is not reentrant.
+		if (exp->eglHeld) {
+			em_stream_client_egl_end(exp->stream_client);
+			exp->eglHeld = false;
+		}
 		if (exp->renderer) {
 			em_stream_client_egl_begin_pbuffer(exp->stream_client);
+			exp->lateLatch.gpuTimer.reset();
 			exp->renderer->reset();
 			exp->renderer = nullptr;
 			em_stream_client_egl_end(exp->stream_client);
@@ -147,6 +492,14 @@ em_remote_experience_dispose(EmRemoteExperience *exp)
 		}
 	}
 	if (exp->connection) {
+		struct em_connection_send_stats stats;
+		em_connection_get_send_stats(exp->connection, &stats);
+		ALOGI("%s: tracking sent %" PRIu64 ", deferred %" PRIu64 ", superseded %" PRIu64 ", failed %" PRIu64
+		      "; other sent %" PRIu64 ", dropped %" PRIu64,
+		      __FUNCTION__, stats.tracking_sent, stats.tracking_deferred, stats.tracking_superseded,
+		      stats.tracking_failed, stats.reliable_sent, stats.reliable_dropped);
+
+		g_signal_handlers_disconnect_by_data(exp->connection, exp);
 		em_connection_disconnect(exp->connection);
 	}
 	// stream client is not gobject (yet?)
@@ -154,6 +507,9 @@ em_remote_experience_dispose(EmRemoteExperience *exp)
 	g_clear_object(&exp->connection);
 	exp->swapchainBuffers.reset();
 
+	// Buffers may still sit in a send queue, those keep the pool alive until they are released.
+	exp->upBuffers = nullptr;
+
 	if (exp->renderer) {
 		ALOGW(
 		    "%s: Renderer outlived stream client somehow (should not happen), "
@@ -180,6 +536,10 @@ em_remote_experience_finalize(EmRemoteExperience *exp)
 		xrDestroySpace(exp->xr_owned.worldSpace);
 		exp->xr_owned.worldSpace = XR_NULL_HANDLE;
 	}
+
+	os_thread_helper_destroy(&exp->trackingSampler.thread);
+	os_thread_helper_destroy(&exp->sender.thread);
+	os_mutex_destroy(&exp->tracking.horizonMutex);
 }
 
 EmRemoteExperience *
@@ -196,6 +556,19 @@ em_remote_experience_new(EmConnection *connection,
 	self->eye_extents = *eye_extents;
 	self->xr_not_owned.instance = instance;
 	self->xr_not_owned.session = session;
+	self->upBuffers = UpBufferPool::create();
+	self->tracking.nextSequenceIdx = 1;
+	self->reprojectionMode = EM_REPROJECTION_ORIENTATION;
+	em_late_latch_init(&self->lateLatch.schedule, EM_LATE_LATCH_DEFAULT_MARGIN_NS);
+	em_frame_report_batch_init(&self->frameReports, EM_FRAME_REPORT_BATCH_DEFAULT_FRAMES,
+	                           EM_FRAME_REPORT_BATCH_DEFAULT_MAX_AGE_NS);
+	em_compact_tracking_encoder_init(&self->tracking.encoder, EM_COMPACT_TRACKING_DEFAULT_KEYFRAME_INTERVAL);
+	em_pose_horizon_init(&self->tracking.horizon);
+	os_mutex_init(&self->tracking.horizonMutex);
+	os_thread_helper_init(&self->trackingSampler.thread);
+	os_thread_helper_init(&self->sender.thread);
+	g_signal_connect(self->connection, "on-message-data", G_CALLBACK(em_remote_experience_on_message_data), self);
+	g_signal_connect(self->connection, "connected", G_CALLBACK(em_remote_experience_on_connected), self);
 
 	// Get the extension function for converting times.
 	{
@@ -214,6 +587,20 @@ em_remote_experience_new(EmConnection *connection,
 	// Quest requires the EGL context to be current when calling xrCreateSwapchain
 	em_stream_client_egl_begin_pbuffer(stream_client);
 
+	// First, the swapchain layout depends on what the renderer can do.
+	try {
+		ALOGI("%s: Setup renderer...", __FUNCTION__);
+		self->renderer = std::make_unique<Renderer>();
+		self->renderer->setupRender();
+	} catch (std::exception const &e) {
+		ALOGE("%s: Caught exception setting up renderer: %s", __FUNCTION__, e.what());
+		self->renderer->reset();
+		em_stream_client_egl_end(stream_client);
+		em_remote_experience_destroy(&self);
+		return nullptr;
+	}
+	self->lateLatch.gpuTimer.init();
+
 	{
 		ALOGI("%s: Creating OpenXR Swapchain...", __FUNCTION__);
 		// OpenXR swapchain
@@ -221,11 +608,12 @@ em_remote_experience_new(EmConnection *connection,
 		swapchainInfo.type = XR_TYPE_SWAPCHAIN_CREATE_INFO;
 		swapchainInfo.usageFlags = XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT;
 		swapchainInfo.format = GL_SRGB8_ALPHA8;
-		swapchainInfo.width = self->eye_extents.width * 2;
+		// One layer per eye.
+		swapchainInfo.width = self->eye_extents.width;
 		swapchainInfo.height = self->eye_extents.height;
 		swapchainInfo.sampleCount = 1;
 		swapchainInfo.faceCount = 1;
-		swapchainInfo.arraySize = 1;
+		swapchainInfo.arraySize = 2;
 		swapchainInfo.mipCount = 1;
 
 		XrResult result = xrCreateSwapchain(session, &swapchainInfo, &self->xr_owned.swapchain);
@@ -238,7 +626,8 @@ em_remote_experience_new(EmConnection *connection,
 		}
 	}
 
-	if (!self->swapchainBuffers.enumerateAndGenerateFramebuffers(self->xr_owned.swapchain)) {
+	if (!self->swapchainBuffers.enumerateAndGenerateFramebuffers(self->xr_owned.swapchain, 2,
+	                                                             self->renderer->supportsMultiview())) {
 		ALOGE("%s: Failed to enumerate swapchain images or associate them with framebuffer object names.",
 		      __FUNCTION__);
 		em_stream_client_egl_end(stream_client);
@@ -246,20 +635,6 @@ em_remote_experience_new(EmConnection *connection,
 		return nullptr;
 	}
 
-
-	try {
-		ALOGI("%s: Setup renderer...", __FUNCTION__);
-		self->renderer = std::make_unique<Renderer>();
-		self->renderer->setupRender();
-	} catch (std::exception const &e) {
-		ALOGE("%s: Caught exception setting up renderer: %s", __FUNCTION__, e.what());
-		self->renderer->reset();
-		em_stream_client_egl_end(stream_client);
-		em_remote_experience_destroy(&self);
-		return nullptr;
-	}
-
-
 	em_stream_client_egl_end(stream_client);
 
 	{
@@ -291,6 +666,12 @@ em_remote_experience_new(EmConnection *connection,
 		}
 	}
 
+	if (os_thread_helper_start(&self->sender.thread, sender_thread_func, self) != 0) {
+		ALOGE("%s: Failed to start the sender thread", __FUNCTION__);
+		em_remote_experience_destroy(&self);
+		return nullptr;
+	}
+
 	ALOGI("%s: done", __FUNCTION__);
 	return self;
 }
@@ -312,6 +693,123 @@ em_remote_experience_destroy(EmRemoteExperience **ptr_exp)
 	*ptr_exp = NULL;
 }
 
+void
+em_remote_experience_set_reprojection_mode(EmRemoteExperience *exp, EmReprojectionMode mode)
+{
+	exp->reprojectionMode = mode;
+}
+
+void
+em_remote_experience_set_late_latch(EmRemoteExperience *exp, bool enabled)
+{
+	exp->lateLatch.enabled = enabled;
+}
+
+bool
+em_remote_experience_set_multiview(EmRemoteExperience *exp, bool enabled)
+{
+	if (enabled && !exp->swapchainBuffers.hasMultiview()) {
+		ALOGW("%s: No GL_OVR_multiview2, drawing one eye at a time", __FUNCTION__);
+		enabled = false;
+	}
+	exp->multiview = enabled;
+	return enabled;
+}
+
+static int64_t
+timespec_to_ns(const struct timespec *ts)
+{
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void
+sleep_until_ns(int64_t wake_ns)
+{
+	struct timespec wakeTime = {.tv_sec = (time_t)(wake_ns / 1000000000), .tv_nsec = (long)(wake_ns % 1000000000)};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeTime, NULL) == EINTR) {
+	}
+}
+
+/*!
+ * Sends the head pose every period, stamped the way the frame loop would stamp it: now plus how far ahead the frame
+ * loop last predicted display. Only sends while the frame loop submits frames it renders: it waits for the first
+ * prediction, and stops again once the session is hidden or the frame loop stops.
+ */
+static void *
+tracking_sampler_thread_func(void *ptr)
+{
+	EmRemoteExperience *exp = (EmRemoteExperience *)ptr;
+	struct os_thread_helper *oth = &exp->trackingSampler.thread;
+	const int64_t period_ns = 1000000000 / exp->trackingSampler.rateHz;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t next_ns = timespec_to_ns(&now);
+
+	os_thread_helper_lock(oth);
+	while (os_thread_helper_is_running_locked(oth)) {
+		os_thread_helper_unlock(oth);
+
+		int64_t lead_ns = exp->trackingSampler.displayLeadNs;
+		if (lead_ns != 0 && timespec_to_ns(&now) - exp->trackingSampler.leadUpdatedNs > kTrackingSamplerStaleNs) {
+			// No frame for a while, the session is not running anymore.
+			exp->trackingSampler.displayLeadNs.compare_exchange_strong(lead_ns, 0);
+			lead_ns = 0;
+		}
+
+		XrTime nowXr = 0;
+		if (lead_ns != 0 &&
+		    XR_SUCCEEDED(exp->convertTimespecTimeToTime(exp->xr_not_owned.instance, &now, &nowXr))) {
+			em_remote_experience_report_pose(exp, nowXr + lead_ns);
+		}
+
+		// After a hitch, carry on from now instead of sending a burst to catch up.
+		next_ns += period_ns;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (next_ns < timespec_to_ns(&now)) {
+			next_ns = timespec_to_ns(&now);
+		}
+		sleep_until_ns(next_ns);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		os_thread_helper_lock(oth);
+	}
+	os_thread_helper_unlock(oth);
+
+	return NULL;
+}
+
+void
+em_remote_experience_set_tracking_rate(EmRemoteExperience *exp, uint32_t hz)
+{
+	os_thread_helper_stop_and_wait(&exp->trackingSampler.thread);
+
+	exp->trackingSampler.rateHz = hz < kMaxTrackingRateHz ? hz : kMaxTrackingRateHz;
+	if (exp->trackingSampler.rateHz == 0) {
+		return;
+	}
+
+	if (os_thread_helper_start(&exp->trackingSampler.thread, tracking_sampler_thread_func, exp) != 0) {
+		ALOGE("%s: Could not start the tracking sampler thread, sending tracking once per frame", __FUNCTION__);
+		exp->trackingSampler.rateHz = 0;
+		return;
+	}
+	ALOGI("%s: Sampling tracking at %u Hz", __FUNCTION__, exp->trackingSampler.rateHz);
+}
+
+/*!
+ * Sleep until as late in the frame as the render cost seen so far allows, so the newest sample and the freshest view
+ * poses make it into this frame instead of the next one.
+ */
+static void
+late_latch_wait(EmRemoteExperience *exp, const struct timespec *frameStartTime, XrDuration displayPeriod)
+{
+	int64_t start_ns =
+	    em_late_latch_start_time(&exp->lateLatch.schedule, timespec_to_ns(frameStartTime), (int64_t)displayPeriod);
+
+	sleep_until_ns(start_ns);
+}
+
 EmPollRenderResult
 em_remote_experience_poll_and_render_frame(EmRemoteExperience *exp)
 {
@@ -324,6 +822,8 @@ em_remote_experience_poll_and_render_frame(EmRemoteExperience *exp)
 		ALOGE("xrWaitFrame failed");
 		return EM_POLL_RENDER_RESULT_ERROR_WAITFRAME;
 	}
+	struct timespec frameStartTime;
+	clock_gettime(CLOCK_MONOTONIC, &frameStartTime);
 
 	XrFrameBeginInfo beginfo = {.type = XR_TYPE_FRAME_BEGIN_INFO};
 
@@ -340,6 +840,9 @@ em_remote_experience_poll_and_render_frame(EmRemoteExperience *exp)
 		return EM_POLL_RENDER_RESULT_SHOULD_NOT_RENDER;
 	}
 
+	if (exp->lateLatch.enabled && frameState.shouldRender == XR_TRUE) {
+		late_latch_wait(exp, &frameStartTime, frameState.predictedDisplayPeriod);
+	}
 
 	XrViewLocateInfo locateInfo = {.type = XR_TYPE_VIEW_LOCATE_INFO,
 	                               .viewConfigurationType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO,
@@ -366,7 +869,6 @@ em_remote_experience_poll_and_render_frame(EmRemoteExperience *exp)
 	layer.type = XR_TYPE_COMPOSITION_LAYER_PROJECTION;
 	layer.viewCount = 2;
 
-	// TODO use multiview/array swapchain instead of two draw calls for side by side?
 	XrCompositionLayerProjectionView projectionViews[2] = {};
 	projectionViews[0].type = XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW;
 
@@ -376,9 +878,13 @@ em_remote_experience_poll_and_render_frame(EmRemoteExperience *exp)
 
 	// Render
 
-	if (!em_stream_client_egl_begin_pbuffer(exp->stream_client)) {
-		ALOGE("FRED: mainloop_one: Failed make egl context current");
-		return EM_POLL_RENDER_RESULT_ERROR_EGL;
+	if (!exp->eglHeld) {
+		if (!em_stream_client_egl_begin_pbuffer(exp->stream_client)) {
+			ALOGE("FRED: mainloop_one: Failed make egl context current");
+			return EM_POLL_RENDER_RESULT_ERROR_EGL;
+		}
+		// Nobody else needs the render context then, so it stays current instead of changing twice a frame.
+		exp->eglHeld = em_stream_client_has_own_egl_context(exp->stream_client);
 	}
 	bool shouldRender = frameState.shouldRender == XR_TRUE;
 	EmPollRenderResult prResult = EM_POLL_RENDER_RESULT_SHOULD_NOT_RENDER;
@@ -397,14 +903,52 @@ em_remote_experience_poll_and_render_frame(EmRemoteExperience *exp)
 
 	xrEndFrame(session, &endInfo);
 
-	em_stream_client_egl_end(exp->stream_client);
+	if (!exp->eglHeld) {
+		em_stream_client_egl_end(exp->stream_client);
+	}
 
-	em_remote_experience_report_pose(exp, frameState.predictedDisplayTime);
+	if (exp->trackingSampler.rateHz == 0) {
+		em_remote_experience_report_pose(exp, frameState.predictedDisplayTime);
+	} else if (!shouldRender) {
+		// Not visible, so nothing would use the poses.
+		exp->trackingSampler.displayLeadNs = 0;
+	} else {
+		// The sampler thread sends the poses, it only needs to know how far ahead display is.
+		XrTime frameStartXr = 0;
+		if (XR_SUCCEEDED(
+		        exp->convertTimespecTimeToTime(exp->xr_not_owned.instance, &frameStartTime, &frameStartXr))) {
+			exp->trackingSampler.leadUpdatedNs = timespec_to_ns(&frameStartTime);
+			exp->trackingSampler.displayLeadNs = frameState.predictedDisplayTime - frameStartXr;
+		}
+	}
 	return prResult;
 }
 
+//! Send the frame reports collected so far in one message, or one message each if the server doesn't take batches.
+static void
+send_frame_reports(EmRemoteExperience *exp)
+{
+	em_proto_UpMessage upMsg = em_proto_UpMessage_init_default;
+	if (!em_frame_report_batch_take(&exp->frameReports, &upMsg)) {
+		return;
+	}
+	if (exp->serverBatchesFrameReports) {
+		em_remote_experience_queue_upmessage(exp, &upMsg, false, false);
+		return;
+	}
+
+	// Batched before a reconnect to a server that doesn't know about batches.
+	for (pb_size_t i = 0; i < upMsg.frames_count; i++) {
+		em_proto_UpMessage single = em_proto_UpMessage_init_default;
+		single.has_frame = true;
+		single.frame = upMsg.frames[i];
+		em_remote_experience_queue_upmessage(exp, &single, false, false);
+	}
+}
+
 static void
 report_frame_timing(EmRemoteExperience *exp,
+                    int64_t frameSequenceId,
                     const struct timespec *beginFrameTime,
                     const struct timespec *decodeEndTime,
                     XrTime predictedDisplayTime)
@@ -422,15 +966,106 @@ report_frame_timing(EmRemoteExperience *exp,
 		return;
 	}
 	em_proto_UpFrameMessage msg = em_proto_UpFrameMessage_init_default;
-	// TODO frame ID
-	// msg.frame_sequence_id = ???;
+	msg.frame_sequence_id = frameSequenceId;
 	msg.decode_complete_time = xrTimeDecodeEnd;
 	msg.begin_frame_time = xrTimeBeginFrame;
 	msg.display_time = predictedDisplayTime;
-	em_proto_UpMessage upMsg = em_proto_UpMessage_init_default;
-	upMsg.frame = msg;
-	upMsg.has_frame = true;
-	em_remote_experience_emit_upmessage(exp, &upMsg);
+
+	if (!exp->serverBatchesFrameReports) {
+		// Whatever was batched for the previous server goes first.
+		send_frame_reports(exp);
+
+		em_proto_UpMessage upMsg = em_proto_UpMessage_init_default;
+		upMsg.frame = msg;
+		upMsg.has_frame = true;
+		em_remote_experience_queue_upmessage(exp, &upMsg, false, false);
+		return;
+	}
+
+	int64_t now_ns = timespec_to_ns(beginFrameTime);
+	if (!em_frame_report_batch_add(&exp->frameReports, &msg, now_ns)) {
+		// Can't happen as long as the batch is sent when due, but don't lose the frame if it does.
+		send_frame_reports(exp);
+		em_frame_report_batch_add(&exp->frameReports, &msg, now_ns);
+	}
+	if (em_frame_report_batch_due(&exp->frameReports, now_ns)) {
+		send_frame_reports(exp);
+	}
+}
+
+/*!
+ * Draw @p sample into a fresh swapchain image, reprojected from the pose it was rendered with to @p views.
+ */
+static void
+render_sample(EmRemoteExperience *exp, const struct em_sample *sample, const XrView *views)
+{
+	uint32_t width = exp->eye_extents.width;
+	uint32_t height = exp->eye_extents.height;
+
+	uint32_t imageIndex;
+	XrResult result = xrAcquireSwapchainImage(exp->xr_owned.swapchain, NULL, &imageIndex);
+
+	if (XR_FAILED(result)) {
+		ALOGE("Failed to acquire swapchain image (%d)", result);
+		std::abort();
+	}
+
+	XrSwapchainImageWaitInfo waitInfo = {.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO,
+	                                     .timeout = XR_INFINITE_DURATION};
+
+	result = xrWaitSwapchainImage(exp->xr_owned.swapchain, &waitInfo);
+
+	if (XR_FAILED(result)) {
+		ALOGE("Failed to wait for swapchain image (%d)", result);
+		std::abort();
+	}
+
+	// Only the GL work counts, not however long the runtime made us wait for the image.
+	struct timespec renderStartTime;
+	clock_gettime(CLOCK_MONOTONIC, &renderStartTime);
+	if (exp->lateLatch.enabled) {
+		exp->lateLatch.gpuTimer.begin();
+	}
+
+	bool reproject = exp->reprojectionMode == EM_REPROJECTION_ORIENTATION && sample->has_render_pose;
+	struct em_reprojection eyes[2];
+	for (uint32_t eye = 0; eye < 2; eye++) {
+		// Without a pose to go from, the same orientation twice shows the frame as is.
+		const XrQuaternionf &current = views[eye].pose.orientation;
+		const XrQuaternionf &rendered = reproject ? sample->render_pose.orientation : current;
+		em_reprojection_compute(&rendered, &current, &views[eye].fov, &sample->eye_rects[eye], &eyes[eye]);
+	}
+
+	glViewport(0, 0, width, height);
+	if (exp->multiview) {
+		glBindFramebuffer(GL_FRAMEBUFFER, exp->swapchainBuffers.multiviewFramebufferNameAtSwapchainIndex(imageIndex));
+		exp->renderer->drawMultiview(sample->frame_texture_id, sample->frame_texture_target, eyes);
+	} else {
+		for (uint32_t eye = 0; eye < 2; eye++) {
+			glBindFramebuffer(GL_FRAMEBUFFER, exp->swapchainBuffers.framebufferNameAtSwapchainIndex(imageIndex, eye));
+			exp->renderer->draw(sample->frame_texture_id, sample->frame_texture_target, eyes, eye);
+		}
+	}
+
+	if (exp->lateLatch.enabled) {
+		struct timespec renderEndTime;
+		clock_gettime(CLOCK_MONOTONIC, &renderEndTime);
+		exp->lateLatch.gpuTimer.end(timespec_to_ns(&renderEndTime) - timespec_to_ns(&renderStartTime));
+
+		// Never waits, whatever frames finished by now get counted. Submitting and the GPU running it mostly happen
+		// one after the other, so together they are what the deadline has to leave room for.
+		int64_t gpuNs = 0;
+		int64_t cpuNs = 0;
+		while (exp->lateLatch.gpuTimer.poll(gpuNs, cpuNs)) {
+			em_late_latch_record(&exp->lateLatch.schedule, cpuNs + gpuNs);
+		}
+	}
+
+	// Release
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	xrReleaseSwapchainImage(exp->xr_owned.swapchain, NULL);
 }
 
 EmPollRenderResult
@@ -441,9 +1076,6 @@ em_remote_experience_inner_poll_and_render_frame(EmRemoteExperience *exp,
                                                  XrCompositionLayerProjection *projectionLayer,
                                                  XrCompositionLayerProjectionView *projectionViews)
 {
-	XrSession session = exp->xr_not_owned.session;
-	XrResult result;
-
 	// TODO these may not be the extents of the frame we receive, thus introducing repeated scaling!
 	uint32_t width = exp->eye_extents.width;
 	uint32_t height = exp->eye_extents.height;
@@ -463,59 +1095,40 @@ em_remote_experience_inner_poll_and_render_frame(EmRemoteExperience *exp,
 
 	projectionLayer->space = exp->xr_owned.worldSpace;
 
-	projectionViews[0].subImage.swapchain = exp->xr_owned.swapchain;
-	projectionViews[0].pose = views[0].pose; // TODO use poses from server
-	projectionViews[0].fov = views[0].fov;
-	projectionViews[0].subImage.imageRect.offset = {0, 0};
-	projectionViews[0].subImage.imageRect.extent = {static_cast<int32_t>(width), static_cast<int32_t>(height)};
-	projectionViews[1].subImage.swapchain = exp->xr_owned.swapchain;
-	projectionViews[1].pose = views[1].pose; // TODO use poses from server
-	projectionViews[1].fov = views[1].fov;
-	projectionViews[1].subImage.imageRect.offset = {static_cast<int32_t>(width), 0};
-	projectionViews[1].subImage.imageRect.extent = {static_cast<int32_t>(width), static_cast<int32_t>(height)};
+	for (uint32_t eye = 0; eye < 2; eye++) {
+		projectionViews[eye].subImage.swapchain = exp->xr_owned.swapchain;
+		// The frame gets reprojected to where the views are now.
+		projectionViews[eye].pose = views[eye].pose;
+		projectionViews[eye].fov = views[eye].fov;
+		// One layer per eye.
+		projectionViews[eye].subImage.imageArrayIndex = eye;
+		projectionViews[eye].subImage.imageRect.offset = {0, 0};
+		projectionViews[eye].subImage.imageRect.extent = {static_cast<int32_t>(width),
+		                                                  static_cast<int32_t>(height)};
+	}
+
+	// Without new frames coming in, what is waiting still has to go out at some point.
+	if (em_frame_report_batch_due(&exp->frameReports, timespec_to_ns(beginFrameTime))) {
+		send_frame_reports(exp);
+	}
 
 	struct timespec decodeEndTime;
-	struct em_sample *sample = em_stream_client_try_pull_sample(exp->stream_client, &decodeEndTime);
+	struct em_sample *sample =
+	    em_stream_client_try_pull_sample(exp->stream_client, predictedDisplayTime, &decodeEndTime);
 
 	if (sample == nullptr) {
 		if (exp->prev_sample) {
+			// The head kept moving, so the old frame needs reprojecting again. Without reprojection the swapchain
+			// still holds it as it was drawn.
+			if (exp->reprojectionMode != EM_REPROJECTION_NONE && exp->prev_sample->has_render_pose) {
+				render_sample(exp, exp->prev_sample, views);
+			}
 			return EM_POLL_RENDER_RESULT_REUSED_SAMPLE;
 		}
 		return EM_POLL_RENDER_RESULT_NO_SAMPLE_AVAILABLE;
 	}
 
-	uint32_t imageIndex;
-	result = xrAcquireSwapchainImage(exp->xr_owned.swapchain, NULL, &imageIndex);
-
-	if (XR_FAILED(result)) {
-		ALOGE("Failed to acquire swapchain image (%d)", result);
-		std::abort();
-	}
-
-	XrSwapchainImageWaitInfo waitInfo = {.type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO,
-	                                     .timeout = XR_INFINITE_DURATION};
-
-	result = xrWaitSwapchainImage(exp->xr_owned.swapchain, &waitInfo);
-
-	if (XR_FAILED(result)) {
-		ALOGE("Failed to wait for swapchain image (%d)", result);
-		std::abort();
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER, exp->swapchainBuffers.framebufferNameAtSwapchainIndex(imageIndex));
-
-	glViewport(0, 0, width * 2, height);
-	glClearColor(0.0f, 1.0f, 0.0f, 1.0f);
-
-	// for (uint32_t eye = 0; eye < 2; eye++) {
-	// 	glViewport(eye * width, 0, width, height);
-	exp->renderer->draw(sample->frame_texture_id, sample->frame_texture_target);
-	// }
-
-	// Release
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	xrReleaseSwapchainImage(exp->xr_owned.swapchain, NULL);
+	render_sample(exp, sample, views);
 
 	// TODO check here to see if we already overshot the predicted display time, maybe?
 
@@ -526,8 +1139,13 @@ em_remote_experience_inner_poll_and_render_frame(EmRemoteExperience *exp,
 	}
 	exp->prev_sample = sample;
 
+	// How far past the display time of the pose it was rendered from this frame gets shown.
+	os_mutex_lock(&exp->tracking.horizonMutex);
+	em_pose_horizon_record_shown(&exp->tracking.horizon, sample->tracking_sequence_idx, predictedDisplayTime);
+	os_mutex_unlock(&exp->tracking.horizonMutex);
+
 	// Send frame report
-	report_frame_timing(exp, beginFrameTime, &decodeEndTime, predictedDisplayTime);
+	report_frame_timing(exp, sample->frame_sequence_id, beginFrameTime, &decodeEndTime, predictedDisplayTime);
 
 	return EM_POLL_RENDER_RESULT_NEW_SAMPLE;
 }
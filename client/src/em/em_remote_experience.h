@@ -12,6 +12,7 @@
 #pragma once
 
 #include "em_connection.h"
+#include "em_reprojection.h"
 #include "em_stream_client.h"
 #include <openxr/openxr.h>
 
@@ -92,6 +93,50 @@ em_remote_experience_new(EmConnection *connection,
 void
 em_remote_experience_destroy(EmRemoteExperience **ptr_exp);
 
+/*!
+ * Choose how frames are reprojected to the current head pose, @ref EM_REPROJECTION_ORIENTATION by default.
+ *
+ * Call from the thread rendering frames.
+ */
+void
+em_remote_experience_set_reprojection_mode(EmRemoteExperience *exp, EmReprojectionMode mode);
+
+/*!
+ * Render as late in each frame as the measured render cost allows, off by default.
+ *
+ * A sample that finishes decoding just after xrBeginFrame then still makes it into that frame, and the views are
+ * located closer to when they are shown. The render cost is measured with GPU timer queries, read back a frame or two
+ * later without waiting. Without GL_EXT_disjoint_timer_query it stays at the initial estimate.
+ *
+ * Call from the thread rendering frames.
+ */
+void
+em_remote_experience_set_late_latch(EmRemoteExperience *exp, bool enabled);
+
+/*!
+ * Draw both eyes in one pass with GL_OVR_multiview2, off by default: each eye is drawn into its own layer of the
+ * swapchain in turn.
+ *
+ * Call from the thread rendering frames.
+ *
+ * @return whether multiview is on now, false if the GL context lacks it.
+ */
+bool
+em_remote_experience_set_multiview(EmRemoteExperience *exp, bool enabled);
+
+/*!
+ * Send the head pose @p hz times a second from a thread of our own, instead of once per frame from the frame loop.
+ * 0, the default, goes back to once per frame.
+ *
+ * Keeps the poses coming evenly when the frame loop hitches, and gives the server denser samples to predict from.
+ * Poses are stamped with the sample time plus how far ahead the frame loop last predicted display, so this needs
+ * @ref em_remote_experience_poll_and_render_frame to drive the frame loop.
+ *
+ * Call from the thread rendering frames.
+ */
+void
+em_remote_experience_set_tracking_rate(EmRemoteExperience *exp, uint32_t hz);
+
 /*!
  * Check for a delivered frame, rendering it if available.
  *
@@ -124,7 +169,8 @@ em_remote_experience_inner_poll_and_render_frame(EmRemoteExperience *exp,
 /*!
  * Set message ID, then serialize and send the upstream message given.
  *
- * Message ID is incremented atomically.
+ * Message ID is incremented atomically. Sends right away on the calling thread, which may allocate, so the frame loop
+ * does not use this.
  *
  * @param exp Self
  * @param upMessage The upstream message, fully populated except for up_message_id.
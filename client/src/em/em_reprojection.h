@@ -0,0 +1,167 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Math for reprojecting a streamed frame from the head orientation it was rendered with to the current one
+ * @ingroup em_client
+ */
+#pragma once
+
+#include <openxr/openxr.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * How much of the difference between the pose a frame was rendered from and the current one gets corrected.
+ */
+typedef enum EmReprojectionMode
+{
+	//! Show the frame as it came in.
+	EM_REPROJECTION_NONE = 0,
+
+	//! Rotate the frame to the current head orientation, which is most of what the user notices.
+	EM_REPROJECTION_ORIENTATION,
+} EmReprojectionMode;
+
+/*!
+ * Where an eye's view sits in the stream's frame, in texture coordinates with 0,0 at the top left.
+ */
+struct em_eye_rect
+{
+	float x;
+	float y;
+	float width;
+	float height;
+};
+
+/*!
+ * Everything the reprojection shader needs for one eye.
+ *
+ * The stream doesn't carry depth, so translation is left alone.
+ */
+struct em_reprojection
+{
+	//! Column major, takes a ray in the current eye space to the eye space the frame was rendered in.
+	float rotation[9];
+
+	//! Tangents of the field of view, assumed to be the same on the server as here.
+	float tan_left;
+	float tan_right;
+	float tan_down;
+	float tan_up;
+
+	//! Where to find this eye in the stream.
+	struct em_eye_rect rect;
+};
+
+//! Where @p eye is when the server didn't say, side by side with the left eye first.
+static inline struct em_eye_rect
+em_eye_rect_side_by_side(uint32_t eye)
+{
+	struct em_eye_rect ret = {eye == 0 ? 0.0f : 0.5f, 0.0f, 0.5f, 1.0f};
+	return ret;
+}
+
+static inline XrQuaternionf
+em_reprojection_quat_mul(const XrQuaternionf *a, const XrQuaternionf *b)
+{
+	XrQuaternionf ret;
+	ret.w = a->w * b->w - a->x * b->x - a->y * b->y - a->z * b->z;
+	ret.x = a->w * b->x + a->x * b->w + a->y * b->z - a->z * b->y;
+	ret.y = a->w * b->y - a->x * b->z + a->y * b->w + a->z * b->x;
+	ret.z = a->w * b->z + a->x * b->y - a->y * b->x + a->z * b->w;
+	return ret;
+}
+
+//! Column major rotation matrix of the unit quaternion @p q.
+static inline void
+em_reprojection_quat_to_mat3(const XrQuaternionf *q, float out[9])
+{
+	float xx = q->x * q->x, yy = q->y * q->y, zz = q->z * q->z;
+	float xy = q->x * q->y, xz = q->x * q->z, yz = q->y * q->z;
+	float wx = q->w * q->x, wy = q->w * q->y, wz = q->w * q->z;
+
+	out[0] = 1.0f - 2.0f * (yy + zz);
+	out[1] = 2.0f * (xy + wz);
+	out[2] = 2.0f * (xz - wy);
+
+	out[3] = 2.0f * (xy - wz);
+	out[4] = 1.0f - 2.0f * (xx + zz);
+	out[5] = 2.0f * (yz + wx);
+
+	out[6] = 2.0f * (xz + wy);
+	out[7] = 2.0f * (yz - wx);
+	out[8] = 1.0f - 2.0f * (xx + yy);
+}
+
+/*!
+ * Set up the reprojection of the eye at @p rect in the stream from @p render_orientation, the head orientation the
+ * server rendered the frame with, to @p current_orientation, where that eye looks now. Both in the same space. Pass the
+ * same orientation twice to show the frame as is.
+ */
+static inline void
+em_reprojection_compute(const XrQuaternionf *render_orientation,
+                        const XrQuaternionf *current_orientation,
+                        const XrFovf *fov,
+                        const struct em_eye_rect *rect,
+                        struct em_reprojection *out)
+{
+	XrQuaternionf render_inverse = {-render_orientation->x, -render_orientation->y, -render_orientation->z,
+	                                render_orientation->w};
+	XrQuaternionf delta = em_reprojection_quat_mul(&render_inverse, current_orientation);
+	em_reprojection_quat_to_mat3(&delta, out->rotation);
+
+	out->tan_left = tanf(fov->angleLeft);
+	out->tan_right = tanf(fov->angleRight);
+	out->tan_down = tanf(fov->angleDown);
+	out->tan_up = tanf(fov->angleUp);
+	out->rect = *rect;
+}
+
+/*!
+ * Where the stream has to be sampled for a point of the current eye's view, what the shader does per fragment.
+ *
+ * @param x01 From the left edge of the eye's view, 0 to 1.
+ * @param y01 From the bottom edge of the eye's view, 0 to 1.
+ *
+ * @return false if that point was outside of what the server rendered.
+ */
+static inline bool
+em_reprojection_apply(const struct em_reprojection *r, float x01, float y01, float *out_u, float *out_v)
+{
+	float cx = r->tan_left + (r->tan_right - r->tan_left) * x01;
+	float cy = r->tan_down + (r->tan_up - r->tan_down) * y01;
+	float cz = -1.0f;
+
+	const float *m = r->rotation;
+	float rx = m[0] * cx + m[3] * cy + m[6] * cz;
+	float ry = m[1] * cx + m[4] * cy + m[7] * cz;
+	float rz = m[2] * cx + m[5] * cy + m[8] * cz;
+	if (rz >= 0.0f) {
+		// Behind the rendered eye.
+		return false;
+	}
+
+	float sx = ((rx / -rz) - r->tan_left) / (r->tan_right - r->tan_left);
+	float sy = ((ry / -rz) - r->tan_down) / (r->tan_up - r->tan_down);
+	if (sx < 0.0f || sx > 1.0f || sy < 0.0f || sy > 1.0f) {
+		return false;
+	}
+
+	// The stream's rows go top to bottom.
+	*out_u = r->rect.x + sx * r->rect.width;
+	*out_v = r->rect.y + (1.0f - sy) * r->rect.height;
+	return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,201 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Small queue of decoded samples, picking the one meant for the display time at hand
+ * @ingroup em_client
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! How many decoded samples wait for the renderer at most, the oldest is pushed out beyond that.
+#define EM_SAMPLE_QUEUE_SIZE 4
+
+/*!
+ * How @ref em_sample_queue_take picks a sample.
+ */
+enum em_sample_select_policy
+{
+	//! The sample the server rendered for the display time closest to ours, holding on to early ones.
+	EM_SAMPLE_SELECT_DISPLAY_TIME = 0,
+
+	//! Always the newest sample, dropping the rest.
+	EM_SAMPLE_SELECT_LATEST,
+};
+
+struct em_sample_queue_entry
+{
+	//! Owned by whoever pushed it, the queue never looks at it.
+	void *sample;
+
+	//! Fence behind the GPU work that produced the sample, NULL if none. Owned like sample.
+	void *gpu_fence;
+
+	struct timespec decode_end;
+
+	//! The server's frame id, 0 if unknown.
+	int64_t frame_id;
+
+	//! The display time the server rendered this frame for, in XrTime, 0 if unknown.
+	int64_t display_time;
+};
+
+/*!
+ * Decoded samples in decode order, which is also display time order. Zero initialize it.
+ *
+ * Not thread safe, guard it with the mutex that protects the samples.
+ */
+struct em_sample_queue
+{
+	struct em_sample_queue_entry entries[EM_SAMPLE_QUEUE_SIZE];
+
+	//! Index of the oldest entry.
+	uint32_t head;
+	uint32_t count;
+
+	//! Display time of the entry taken last, which the renderer is showing, 0 if unknown.
+	int64_t last_display_time;
+};
+
+static inline struct em_sample_queue_entry *
+em_sample_queue_at(struct em_sample_queue *q, uint32_t i)
+{
+	return &q->entries[(q->head + i) % EM_SAMPLE_QUEUE_SIZE];
+}
+
+//! Remove the oldest entry into @p out.
+static inline void
+em_sample_queue_pop(struct em_sample_queue *q, struct em_sample_queue_entry *out)
+{
+	*out = q->entries[q->head];
+	q->head = (q->head + 1) % EM_SAMPLE_QUEUE_SIZE;
+	q->count--;
+}
+
+/*!
+ * Add a freshly decoded sample.
+ *
+ * @return true if the queue was full, the oldest entry is then moved to @p out_evicted for the caller to release.
+ */
+static inline bool
+em_sample_queue_push(struct em_sample_queue *q,
+                     const struct em_sample_queue_entry *entry,
+                     struct em_sample_queue_entry *out_evicted)
+{
+	bool evicted = q->count == EM_SAMPLE_QUEUE_SIZE;
+	if (evicted) {
+		em_sample_queue_pop(q, out_evicted);
+	}
+
+	q->count++;
+	*em_sample_queue_at(q, q->count - 1) = *entry;
+
+	return evicted;
+}
+
+static inline int64_t
+em_sample_queue_distance(int64_t a, int64_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+/*!
+ * Take the sample to show at @p display_time, if there is one better than what is shown already.
+ *
+ * Entries older than the taken one can never be shown anymore, they are moved to @p out_dropped, room for
+ * EM_SAMPLE_QUEUE_SIZE of them, for the caller to release. Entries newer than it stay queued.
+ *
+ * With @ref EM_SAMPLE_SELECT_DISPLAY_TIME a sample rendered for a later display time than ours waits in the queue
+ * as long as the shown one is the closer match, so a burst of frames after a network hiccup is spread back out
+ * instead of skipped through. Without display times it works like @ref EM_SAMPLE_SELECT_LATEST.
+ *
+ * @return true if @p out_taken was filled in.
+ */
+static inline bool
+em_sample_queue_take(struct em_sample_queue *q,
+                     enum em_sample_select_policy policy,
+                     int64_t display_time,
+                     struct em_sample_queue_entry *out_taken,
+                     struct em_sample_queue_entry *out_dropped,
+                     uint32_t *out_dropped_count)
+{
+	*out_dropped_count = 0;
+	if (q->count == 0) {
+		return false;
+	}
+
+	bool by_display_time = policy == EM_SAMPLE_SELECT_DISPLAY_TIME && display_time != 0;
+	for (uint32_t i = 0; i < q->count; i++) {
+		by_display_time = by_display_time && em_sample_queue_at(q, i)->display_time != 0;
+	}
+
+	uint32_t best = q->count - 1;
+	if (by_display_time) {
+		// Entries for display times we have already passed, stale once something newer was shown.
+		uint32_t first = 0;
+		while (first < q->count && q->last_display_time != 0 &&
+		       em_sample_queue_at(q, first)->display_time <= q->last_display_time) {
+			first++;
+		}
+		if (first == q->count) {
+			// Only stale ones, none of them worth showing.
+			while (q->count > 0) {
+				em_sample_queue_pop(q, &out_dropped[(*out_dropped_count)++]);
+			}
+			return false;
+		}
+
+		best = first;
+		for (uint32_t i = first + 1; i < q->count; i++) {
+			// Ties go to the newer one.
+			if (em_sample_queue_distance(em_sample_queue_at(q, i)->display_time, display_time) <=
+			    em_sample_queue_distance(em_sample_queue_at(q, best)->display_time, display_time)) {
+				best = i;
+			}
+		}
+
+		int64_t best_distance = em_sample_queue_distance(em_sample_queue_at(q, best)->display_time, display_time);
+		if (q->last_display_time != 0 &&
+		    em_sample_queue_distance(q->last_display_time, display_time) < best_distance) {
+			// Too early, keep showing the current one.
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < best; i++) {
+		em_sample_queue_pop(q, &out_dropped[(*out_dropped_count)++]);
+	}
+	em_sample_queue_pop(q, out_taken);
+	q->last_display_time = out_taken->display_time;
+
+	return true;
+}
+
+/*!
+ * Empty the queue, e.g. when the pipeline goes away.
+ *
+ * @return the number of entries moved to @p out_entries, room for EM_SAMPLE_QUEUE_SIZE of them.
+ */
+static inline uint32_t
+em_sample_queue_clear(struct em_sample_queue *q, struct em_sample_queue_entry *out_entries)
+{
+	uint32_t count = 0;
+	while (q->count > 0) {
+		em_sample_queue_pop(q, &out_entries[count++]);
+	}
+	q->last_display_time = 0;
+	return count;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,215 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Fixed pool of send buffers for upstream messages
+ * @ingroup em_client
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace em {
+
+/*!
+ * A fixed set of byte buffers handed out for encoding outgoing messages.
+ *
+ * A buffer stays acquired until release() is called on it, which may happen on any thread: it is shaped to be used
+ * as the free function of a GBytes wrapping the buffer, so the buffer comes back once the data channel is done with
+ * it. Neither acquiring nor releasing allocates. The GBytes wrapping a buffer still does, as does handing it to the
+ * data channel, so threads that must not allocate encode into a buffer and leave the sending to another thread through
+ * a SendQueue.
+ *
+ * The pool is reference counted: the owner holds one reference through the Ptr from create(), and every buffer in
+ * flight holds one more. Whatever still sits in a send queue when the owner lets go keeps the pool alive until it is
+ * released.
+ *
+ * @tparam BufferSize size of each buffer, in bytes
+ * @tparam Count number of buffers, i.e. how many messages may be in flight at once
+ */
+template <std::size_t BufferSize, std::size_t Count> class SendBufferPool
+{
+public:
+	static_assert(Count > 0, "need at least one buffer");
+
+	//! Drops the owner's reference instead of deleting.
+	struct Unref
+	{
+		void
+		operator()(SendBufferPool *pool) const
+		{
+			pool->unref();
+		}
+	};
+
+	using Ptr = std::unique_ptr<SendBufferPool, Unref>;
+
+	static Ptr
+	create()
+	{
+		return Ptr(new SendBufferPool());
+	}
+
+	SendBufferPool(const SendBufferPool &) = delete;
+	SendBufferPool &
+	operator=(const SendBufferPool &) = delete;
+
+	class Buffer
+	{
+	public:
+		std::uint8_t *
+		data()
+		{
+			return data_.data();
+		}
+
+		static constexpr std::size_t
+		size()
+		{
+			return BufferSize;
+		}
+
+	private:
+		friend class SendBufferPool;
+		SendBufferPool *pool_ = nullptr;
+		std::atomic_bool inUse_{false};
+		std::array<std::uint8_t, BufferSize> data_;
+	};
+
+	/*!
+	 * Get a free buffer, or nullptr if they are all in flight.
+	 *
+	 * Safe to call from several threads, though it is meant for a single sender.
+	 */
+	Buffer *
+	acquire()
+	{
+		std::size_t start = next_.load(std::memory_order_relaxed);
+		for (std::size_t i = 0; i < Count; ++i) {
+			Buffer &buffer = buffers_[(start + i) % Count];
+			if (!buffer.inUse_.exchange(true, std::memory_order_acquire)) {
+				next_.store((start + i + 1) % Count, std::memory_order_relaxed);
+				refs_.fetch_add(1, std::memory_order_relaxed);
+				return &buffer;
+			}
+		}
+		exhausted_.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	/*!
+	 * Return a buffer to the pool.
+	 *
+	 * Takes a void pointer so it can be passed directly as a GDestroyNotify with the buffer as user data. Frees the
+	 * pool if its owner already let go and this was the last buffer out.
+	 */
+	static void
+	release(void *buffer)
+	{
+		Buffer *b = static_cast<Buffer *>(buffer);
+		SendBufferPool *pool = b->pool_;
+		b->inUse_.store(false, std::memory_order_release);
+		pool->unref();
+	}
+
+	//! Number of buffers currently handed out.
+	std::size_t
+	inFlight() const
+	{
+		std::size_t count = 0;
+		for (const Buffer &buffer : buffers_) {
+			if (buffer.inUse_.load(std::memory_order_relaxed)) {
+				count++;
+			}
+		}
+		return count;
+	}
+
+	//! How often acquire() came back empty handed.
+	std::uint64_t
+	exhaustedCount() const
+	{
+		return exhausted_.load(std::memory_order_relaxed);
+	}
+
+private:
+	SendBufferPool()
+	{
+		for (Buffer &buffer : buffers_) {
+			buffer.pool_ = this;
+		}
+	}
+
+	void
+	unref()
+	{
+		if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			delete this;
+		}
+	}
+
+	std::array<Buffer, Count> buffers_;
+	std::atomic_size_t next_{0};
+	std::atomic_uint64_t exhausted_{0};
+	//! The owner's plus one per buffer in flight.
+	std::atomic_size_t refs_{1};
+};
+
+/*!
+ * Fixed size first in, first out queue of encoded messages, for handing them from the threads that encode them to the
+ * one that sends them without allocating.
+ *
+ * Not synchronized, the caller locks around it.
+ *
+ * @tparam Entry what is queued, copied in and out
+ * @tparam Capacity at most this many entries, sized to match a SendBufferPool so there is room for every buffer
+ */
+template <typename Entry, std::size_t Capacity> class SendQueue
+{
+public:
+	static_assert(Capacity > 0, "need room for at least one entry");
+
+	//! Add to the back, returns false if full.
+	bool
+	push(const Entry &entry)
+	{
+		if (size_ == Capacity) {
+			return false;
+		}
+		entries_[(front_ + size_) % Capacity] = entry;
+		size_++;
+		return true;
+	}
+
+	//! Take from the front, returns false if empty.
+	bool
+	pop(Entry &outEntry)
+	{
+		if (size_ == 0) {
+			return false;
+		}
+		outEntry = entries_[front_];
+		front_ = (front_ + 1) % Capacity;
+		size_--;
+		return true;
+	}
+
+	std::size_t
+	size() const
+	{
+		return size_;
+	}
+
+private:
+	std::array<Entry, Capacity> entries_{};
+	std::size_t front_ = 0;
+	std::size_t size_ = 0;
+};
+
+} // namespace em
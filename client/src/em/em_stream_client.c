@@ -11,14 +11,22 @@
 #include "em_stream_client.h"
 #include "em_app_log.h"
 #include "em_connection.h"
+#include "em_sample_queue.h"
 #include "gst_common.h" // for em_sample
 #include "em/em_egl.h"
 
+#include "electricmaple.pb.h"
+#include "em_frame_data_extension.h"
+#include "pb_decode.h"
+
 #include "os/os_threading.h"
 
 #include <gst/app/gstappsink.h>
 #include <gst/gl/gl.h>
 #include <gst/gl/gstglsyncmeta.h>
+#ifndef __ANDROID__
+#include <gst/gl/egl/gstgldisplay_egl.h>
+#endif
 #include <gst/gst.h>
 #include <gst/gstbus.h>
 #include <gst/gstelement.h>
@@ -26,17 +34,32 @@
 #include <gst/gstmessage.h>
 #include <gst/gstsample.h>
 #include <gst/gstutils.h>
+#include <gst/rtp/gstrtpbuffer.h>
 #include <gst/video/video-frame.h>
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2ext.h>
 
-#include <linux/time.h>
 #include <time.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+//! How many frames we remember the ids of, between the depayloader and the decoder output.
+#define FRAME_ID_COUNT 16
+
+#define DEPAYLOADER_NAME "depay"
+
+#ifdef __ANDROID__
+//! The Quest's hardware decoder, decodes straight into an external OES texture.
+#define DECODER_ELEMENT "amcviddec-omxqcomvideodecoderavc"
+#else
+//! Software decoder for desktop builds, glsinkbin uploads its output into a 2D texture.
+#define DECODER_ELEMENT "avdec_h264"
+#endif
+
 void
 em_gst_message_debug(const char *function, GstMessage *msg);
 
@@ -83,8 +106,25 @@ struct _EmStreamClient
 		EGLContext android_main_context;
 		// 16x16 pbuffer surface
 		EGLSurface surface;
+
+		//! Shared with the android_main context, only ever current on the stream client thread.
+		EGLContext worker_context;
+		EGLSurface worker_surface;
+
+		//! From EGL_KHR_fence_sync and EGL_KHR_wait_sync, NULL unless the display has both.
+		PFNEGLCREATESYNCKHRPROC create_sync;
+		PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+		PFNEGLWAITSYNCKHRPROC wait_sync;
 	} egl;
 
+	//! Time the render thread spends on the decoder's GPU work when taking a sample, only touched by that thread.
+	struct
+	{
+		uint64_t count;
+		uint64_t ns_total;
+		uint64_t ns_max;
+	} decoder_wait;
+
 	bool own_egl_mutex;
 	EmEglMutexIface *egl_mutex;
 
@@ -94,8 +134,31 @@ struct _EmStreamClient
 	bool received_first_frame;
 
 	GMutex sample_mutex;
-	GstSample *sample;
-	struct timespec sample_decode_end_ts;
+
+	//! Decoded samples waiting for the renderer, protected by sample_mutex.
+	struct em_sample_queue samples;
+	enum em_sample_select_policy select_policy;
+
+	//! Frame data the server sent along with the video, by buffer pts, protected by sample_mutex.
+	struct
+	{
+		struct
+		{
+			GstClockTime pts;
+			int64_t frame_id;
+			int64_t display_time;
+
+			//! The head pose the server rendered the frame from, in our local space.
+			XrPosef render_pose;
+			bool has_render_pose;
+
+			struct em_eye_rect eye_rects[2];
+
+			//! Which of our tracking messages the render pose came from, 0 if the server didn't say.
+			int64_t tracking_sequence_idx;
+		} entries[FRAME_ID_COUNT];
+		uint32_t next;
+	} frame_ids;
 };
 
 #if 0
@@ -163,6 +226,18 @@ em_stream_client_set_connection(EmStreamClient *sc, EmConnection *connection);
 static void
 em_stream_client_free_egl_mutex(EmStreamClient *sc);
 
+static void
+destroy_worker_context(EmStreamClient *sc);
+
+static void
+release_queued_samples(EmStreamClient *sc);
+
+static EGLSyncKHR
+create_decoder_fence(EmStreamClient *sc);
+
+static void
+release_entry(EmStreamClient *sc, struct em_sample_queue_entry *entry);
+
 /* GObject method implementations */
 
 #if 0
@@ -213,7 +288,7 @@ em_stream_client_dispose(EmStreamClient *self)
 	em_stream_client_stop(self);
 	g_clear_object(&self->loop);
 	g_clear_object(&self->connection);
-	gst_clear_object(&self->sample);
+	release_queued_samples(self);
 	gst_clear_object(&self->pipeline);
 	gst_clear_object(&self->gst_gl_display);
 	gst_clear_object(&self->gst_gl_context);
@@ -229,6 +304,13 @@ em_stream_client_finalize(EmStreamClient *self)
 	// only called once, after dispose
 	// EmStreamClient *self = EM_STREAM_CLIENT(object);
 	os_thread_helper_destroy(&self->play_thread);
+	if (self->decoder_wait.count > 0) {
+		ALOGI("%s: Waited on the decoder's GPU work %" PRIu64 " times, avg %.3f max %.3f ms", __FUNCTION__,
+		      self->decoder_wait.count,
+		      (double)self->decoder_wait.ns_total / (double)self->decoder_wait.count / 1e6,
+		      (double)self->decoder_wait.ns_max / 1e6);
+	}
+	destroy_worker_context(self);
 	em_stream_client_free_egl_mutex(self);
 }
 
@@ -332,34 +414,199 @@ gst_bus_cb(GstBus *bus, GstMessage *message, gpointer data)
 	return TRUE;
 }
 
+//! Remember the frame id if @p buffer is the RTP packet that carries it, the first one of each frame.
+static void
+read_frame_id(EmStreamClient *sc, GstBuffer *buffer)
+{
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+	if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp)) {
+		return;
+	}
+
+	guint8 appbits = 0;
+	gpointer data = NULL;
+	guint size = 0;
+	em_proto_DownMessage message = em_proto_DownMessage_init_default;
+	bool found = gst_rtp_buffer_get_extension_twobytes_header(&rtp, &appbits, EM_FRAME_DATA_EXTENSION_ID, 0, &data,
+	                                                          &size);
+	if (found) {
+		pb_istream_t is = pb_istream_from_buffer((const pb_byte_t *)data, size);
+		found = pb_decode(&is, &em_proto_DownMessage_msg, &message) && message.has_frame_data;
+	}
+	gst_rtp_buffer_unmap(&rtp);
+
+	if (!found) {
+		return;
+	}
+
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sc->sample_mutex);
+	uint32_t i = sc->frame_ids.next;
+	sc->frame_ids.entries[i].pts = GST_BUFFER_PTS(buffer);
+	sc->frame_ids.entries[i].frame_id = message.frame_data.frame_sequence_id;
+	sc->frame_ids.entries[i].display_time = message.frame_data.display_time;
+	sc->frame_ids.entries[i].has_render_pose = message.frame_data.has_P_localSpace_viewSpace &&
+	                                           message.frame_data.P_localSpace_viewSpace.has_orientation;
+	if (sc->frame_ids.entries[i].has_render_pose) {
+		const em_proto_Pose *pose = &message.frame_data.P_localSpace_viewSpace;
+		sc->frame_ids.entries[i].render_pose.orientation =
+		    (XrQuaternionf){pose->orientation.x, pose->orientation.y, pose->orientation.z, pose->orientation.w};
+		sc->frame_ids.entries[i].render_pose.position =
+		    (XrVector3f){pose->position.x, pose->position.y, pose->position.z};
+	}
+	const bool has_eye_rect[2] = {message.frame_data.has_left_eye_rect, message.frame_data.has_right_eye_rect};
+	const em_proto_EyeRect *eye_rect[2] = {&message.frame_data.left_eye_rect, &message.frame_data.right_eye_rect};
+	for (uint32_t eye = 0; eye < 2; eye++) {
+		sc->frame_ids.entries[i].eye_rects[eye] =
+		    has_eye_rect[eye] ? (struct em_eye_rect){eye_rect[eye]->x, eye_rect[eye]->y, eye_rect[eye]->width,
+		                                             eye_rect[eye]->height}
+		                      : em_eye_rect_side_by_side(eye);
+	}
+	sc->frame_ids.entries[i].tracking_sequence_idx = message.frame_data.tracking_sequence_idx;
+	sc->frame_ids.next = (i + 1) % FRAME_ID_COUNT;
+}
+
+static gboolean
+read_frame_id_list_cb(GstBuffer **buffer, guint idx, gpointer user_data)
+{
+	read_frame_id((EmStreamClient *)user_data, *buffer);
+	return TRUE;
+}
+
+static GstPadProbeReturn
+depayloader_sink_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	EmStreamClient *sc = (EmStreamClient *)user_data;
+
+	if ((info->type & GST_PAD_PROBE_TYPE_BUFFER) != 0) {
+		read_frame_id(sc, GST_PAD_PROBE_INFO_BUFFER(info));
+	} else {
+		gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST(info), read_frame_id_list_cb, sc);
+	}
+
+	return GST_PAD_PROBE_OK;
+}
+
+//! The depayloader and decoder keep the pts, so it tells which frame a decoded buffer is. Call with sample_mutex.
+static void
+find_frame_data_locked(EmStreamClient *sc, GstClockTime pts, struct em_sample_queue_entry *entry)
+{
+	for (uint32_t i = 0; i < FRAME_ID_COUNT; i++) {
+		if (sc->frame_ids.entries[i].pts == pts) {
+			entry->frame_id = sc->frame_ids.entries[i].frame_id;
+			entry->display_time = sc->frame_ids.entries[i].display_time;
+			return;
+		}
+	}
+}
+
+/*!
+ * The decoded frame may have sat in the sample queue for a while, so look its pose, eye rects and tracking sequence
+ * index up by frame id when it's taken. @p out_eye_rects and @p out_tracking_sequence_idx are left alone if the frame
+ * isn't known.
+ */
+static bool
+find_render_pose_locked(EmStreamClient *sc,
+                        int64_t frame_id,
+                        XrPosef *out_pose,
+                        struct em_eye_rect out_eye_rects[2],
+                        int64_t *out_tracking_sequence_idx)
+{
+	if (frame_id == 0) {
+		return false;
+	}
+	for (uint32_t i = 0; i < FRAME_ID_COUNT; i++) {
+		if (sc->frame_ids.entries[i].frame_id == frame_id) {
+			out_eye_rects[0] = sc->frame_ids.entries[i].eye_rects[0];
+			out_eye_rects[1] = sc->frame_ids.entries[i].eye_rects[1];
+			*out_tracking_sequence_idx = sc->frame_ids.entries[i].tracking_sequence_idx;
+			if (sc->frame_ids.entries[i].has_render_pose) {
+				*out_pose = sc->frame_ids.entries[i].render_pose;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
 static GstFlowReturn
 on_new_sample_cb(GstAppSink *appsink, gpointer user_data)
 {
 	EmStreamClient *sc = (EmStreamClient *)user_data;
-	// TODO record the frame ID, get frame pose
+	// TODO get frame pose
 	struct timespec ts;
 	int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
 	if (ret != 0) {
 		ALOGE("%s: clock_gettime failed, which is very bizarre.", __FUNCTION__);
 		return GST_FLOW_ERROR;
 	}
-	GstSample *prevSample = NULL;
 	GstSample *sample = gst_app_sink_pull_sample(appsink);
 	g_assert_nonnull(sample);
+
+	if (sc->context == NULL) {
+		ALOGI("%s: Retrieving the GStreamer EGL context", __FUNCTION__);
+		/* Get GStreamer's gl context. */
+		gst_gl_query_local_gl_context(sc->appsink, GST_PAD_SINK, &sc->context);
+
+		/* Check if we have 2D or OES textures */
+		GstStructure *s = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+		const gchar *texture_target_str = gst_structure_get_string(s, "texture-target");
+		if (g_str_equal(texture_target_str, GST_GL_TEXTURE_TARGET_EXTERNAL_OES_STR)) {
+			sc->frame_texture_target = GL_TEXTURE_EXTERNAL_OES;
+		} else if (g_str_equal(texture_target_str, GST_GL_TEXTURE_TARGET_2D_STR)) {
+			sc->frame_texture_target = GL_TEXTURE_2D;
+#ifdef __ANDROID__
+			ALOGE("RYLIE: Got GL_TEXTURE_2D instead of expected GL_TEXTURE_EXTERNAL_OES");
+#endif
+		} else {
+			g_assert_not_reached();
+		}
+	}
+
+	struct em_sample_queue_entry entry = {
+	    .sample = sample,
+	    .gpu_fence = create_decoder_fence(sc),
+	    .decode_end = ts,
+	};
+	struct em_sample_queue_entry evicted = {0};
+	bool full = false;
 	{
 		g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sc->sample_mutex);
-		prevSample = sc->sample;
-		sc->sample = sample;
-		sc->sample_decode_end_ts = ts;
+		find_frame_data_locked(sc, GST_BUFFER_PTS(gst_sample_get_buffer(sample)), &entry);
+		full = em_sample_queue_push(&sc->samples, &entry, &evicted);
 		sc->received_first_frame = true;
 	}
-	if (prevSample) {
-		ALOGI("Discarding unused, replaced sample");
-		gst_sample_unref(prevSample);
+	if (full) {
+		ALOGI("Discarding unused sample, the queue is full");
+		release_entry(sc, &evicted);
 	}
 	return GST_FLOW_OK;
 }
 
+/*!
+ * Make the worker context current on the stream client thread, so it never has to take the render thread's context
+ * and its mutex. Falls back to those if there is no worker context.
+ */
+static bool
+worker_egl_begin(EmStreamClient *sc, EmEglState *out_saved)
+{
+	if (sc->egl.worker_context == EGL_NO_CONTEXT) {
+		return em_stream_client_egl_begin_pbuffer(sc);
+	}
+	em_egl_state_save(out_saved);
+	return eglMakeCurrent(sc->egl.display, sc->egl.worker_surface, sc->egl.worker_surface,
+	                      sc->egl.worker_context) == EGL_TRUE;
+}
+
+static void
+worker_egl_end(EmStreamClient *sc, const EmEglState *saved)
+{
+	if (sc->egl.worker_context == EGL_NO_CONTEXT) {
+		em_stream_client_egl_end(sc);
+		return;
+	}
+	em_egl_state_restore(saved, sc->egl.display);
+}
+
 static void
 on_need_pipeline_cb(EmConnection *emconn, EmStreamClient *sc)
 {
@@ -375,17 +622,18 @@ on_need_pipeline_cb(EmConnection *emconn, EmStreamClient *sc)
 	uint32_t height = 1024;
 
 	// We'll need an active egl context below before setting up gstgl (as explained previously)
-	if (!em_stream_client_egl_begin_pbuffer(sc)) {
+	EmEglState saved_egl_state;
+	if (!worker_egl_begin(sc, &saved_egl_state)) {
 		ALOGE("%s: Failed to make EGL context current, cannot create pipeline!", __FUNCTION__);
 		return;
 	}
 
 	gchar *pipeline_string = g_strdup_printf(
 	    "webrtcbin name=webrtc bundle-policy=max-bundle latency=0 ! "
-	    "rtph264depay ! "
+	    "rtph264depay name=" DEPAYLOADER_NAME " ! "
 	    "h264parse ! "
 	    "video/x-h264,stream-format=(string)byte-stream, alignment=(string)au,parsed=(boolean)true !"
-	    "amcviddec-omxqcomvideodecoderavc ! "
+	    DECODER_ELEMENT " ! "
 	    "glsinkbin name=glsink");
 
 	sc->pipeline = gst_object_ref_sink(gst_parse_launch(pipeline_string, &error));
@@ -395,7 +643,7 @@ on_need_pipeline_cb(EmConnection *emconn, EmStreamClient *sc)
 	}
 
 	// Un-current the EGL context
-	em_stream_client_egl_end(sc);
+	worker_egl_end(sc, &saved_egl_state);
 
 	// We convert the string SINK_CAPS above into a GstCaps that elements below can understand.
 	// the "video/x-raw(" GST_CAPS_FEATURE_MEMORY_GL_MEMORY ")," part of the caps is read :
@@ -429,6 +677,14 @@ on_need_pipeline_cb(EmConnection *emconn, EmStreamClient *sc)
 	g_autoptr(GstElement) glsinkbin = gst_bin_get_by_name(GST_BIN(sc->pipeline), "glsink");
 	g_object_set(glsinkbin, "sink", sc->appsink, NULL);
 
+	// The server puts its frame ids in an RTP header extension, which is gone after depayloading.
+	{
+		g_autoptr(GstElement) depay = gst_bin_get_by_name(GST_BIN(sc->pipeline), DEPAYLOADER_NAME);
+		g_autoptr(GstPad) pad = gst_element_get_static_pad(depay, "sink");
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, depayloader_sink_probe_cb,
+		                  sc, NULL);
+	}
+
 	g_autoptr(GstBus) bus = gst_element_get_bus(sc->pipeline);
 	// We set this up to inject the EGL context
 	gst_bus_set_sync_handler(bus, (GstBusSyncHandler)bus_sync_handler_cb, sc, NULL);
@@ -452,6 +708,7 @@ on_drop_pipeline_cb(EmConnection *emconn, EmStreamClient *sc)
 	}
 	gst_clear_object(&sc->pipeline);
 	gst_clear_object(&sc->appsink);
+	release_queued_samples(sc);
 }
 
 static void *
@@ -505,12 +762,98 @@ em_stream_client_destroy(EmStreamClient **ptr_sc)
 	*ptr_sc = NULL;
 }
 
+static bool
+has_egl_extension(const char *extensions, const char *name)
+{
+	size_t len = strlen(name);
+	for (const char *p = extensions; p != NULL && (p = strstr(p, name)) != NULL; p += len) {
+		if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+load_egl_sync_functions(EmStreamClient *sc)
+{
+	sc->egl.create_sync = NULL;
+	sc->egl.destroy_sync = NULL;
+	sc->egl.wait_sync = NULL;
+
+	const char *extensions = eglQueryString(sc->egl.display, EGL_EXTENSIONS);
+	if (!has_egl_extension(extensions, "EGL_KHR_fence_sync") || !has_egl_extension(extensions, "EGL_KHR_wait_sync")) {
+		ALOGW("%s: No EGL_KHR_fence_sync and EGL_KHR_wait_sync, new frames will stall the render thread",
+		      __FUNCTION__);
+		return;
+	}
+	sc->egl.create_sync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+	sc->egl.destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+	sc->egl.wait_sync = (PFNEGLWAITSYNCKHRPROC)eglGetProcAddress("eglWaitSyncKHR");
+	if (sc->egl.create_sync == NULL || sc->egl.destroy_sync == NULL || sc->egl.wait_sync == NULL) {
+		sc->egl.create_sync = NULL;
+		sc->egl.destroy_sync = NULL;
+		sc->egl.wait_sync = NULL;
+	}
+}
+
+/*!
+ * Create the stream client thread's own context, in the android_main context's share group, so textures and syncs
+ * are visible to both. Call with the android_main context current.
+ */
+static void
+create_worker_context(EmStreamClient *sc)
+{
+	EGLint config_id = 0;
+	EGLConfig config = NULL;
+	EGLint num_configs = 0;
+	eglQueryContext(sc->egl.display, sc->egl.android_main_context, EGL_CONFIG_ID, &config_id);
+	const EGLint config_attributes[] = {EGL_CONFIG_ID, config_id, EGL_NONE};
+	if (eglChooseConfig(sc->egl.display, config_attributes, &config, 1, &num_configs) == EGL_FALSE ||
+	    num_configs < 1) {
+		ALOGW("%s: Could not find the main context's config, sharing its context instead", __FUNCTION__);
+		return;
+	}
+
+	const EGLint context_attributes[] = {EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE};
+	sc->egl.worker_context =
+	    eglCreateContext(sc->egl.display, config, sc->egl.android_main_context, context_attributes);
+	if (sc->egl.worker_context == EGL_NO_CONTEXT) {
+		ALOGW("%s: Could not create a shared context (0x%x), sharing the main context instead", __FUNCTION__,
+		      eglGetError());
+		return;
+	}
+
+	const EGLint pbuffer_attributes[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+	sc->egl.worker_surface = eglCreatePbufferSurface(sc->egl.display, config, pbuffer_attributes);
+	if (sc->egl.worker_surface == EGL_NO_SURFACE) {
+		ALOGW("%s: Could not create a pbuffer (0x%x), sharing the main context instead", __FUNCTION__,
+		      eglGetError());
+		eglDestroyContext(sc->egl.display, sc->egl.worker_context);
+		sc->egl.worker_context = EGL_NO_CONTEXT;
+	}
+}
+
+static void
+destroy_worker_context(EmStreamClient *sc)
+{
+	if (sc->egl.worker_surface != EGL_NO_SURFACE) {
+		eglDestroySurface(sc->egl.display, sc->egl.worker_surface);
+		sc->egl.worker_surface = EGL_NO_SURFACE;
+	}
+	if (sc->egl.worker_context != EGL_NO_CONTEXT) {
+		eglDestroyContext(sc->egl.display, sc->egl.worker_context);
+		sc->egl.worker_context = EGL_NO_CONTEXT;
+	}
+}
+
 void
 em_stream_client_set_egl_context(EmStreamClient *sc,
                                  EmEglMutexIface *egl_mutex,
                                  bool adopt_mutex_interface,
                                  EGLSurface pbuffer_surface)
 {
+	destroy_worker_context(sc);
 	em_stream_client_free_egl_mutex(sc);
 	sc->own_egl_mutex = adopt_mutex_interface;
 	sc->egl_mutex = egl_mutex;
@@ -524,11 +867,19 @@ em_stream_client_set_egl_context(EmStreamClient *sc,
 	sc->egl.display = egl_mutex->display;
 	sc->egl.android_main_context = egl_mutex->context;
 	sc->egl.surface = pbuffer_surface;
+	load_egl_sync_functions(sc);
+	create_worker_context(sc);
 
 	const GstGLPlatform egl_platform = GST_GL_PLATFORM_EGL;
 	guintptr android_main_egl_context_handle = gst_gl_context_get_current_gl_context(egl_platform);
 	GstGLAPI gl_api = gst_gl_context_get_current_gl_api(egl_platform, NULL, NULL);
+#ifdef __ANDROID__
 	sc->gst_gl_display = g_object_ref_sink(gst_gl_display_new());
+#else
+	// Might be a surfaceless display, don't let GStreamer go looking for a window system one of its own.
+	sc->gst_gl_display =
+	    g_object_ref_sink(GST_GL_DISPLAY(gst_gl_display_egl_new_with_egl_display((gpointer)sc->egl.display)));
+#endif
 	sc->android_main_context = g_object_ref_sink(
 	    gst_gl_context_new_wrapped(sc->gst_gl_display, android_main_egl_context_handle, egl_platform, gl_api));
 
@@ -555,6 +906,12 @@ em_stream_client_egl_end(EmStreamClient *sc)
 	em_egl_mutex_end(sc->egl_mutex);
 }
 
+bool
+em_stream_client_has_own_egl_context(EmStreamClient *sc)
+{
+	return sc->egl.worker_context != EGL_NO_CONTEXT;
+}
+
 void
 em_stream_client_spawn_thread(EmStreamClient *sc, EmConnection *connection)
 {
@@ -584,8 +941,82 @@ em_stream_client_stop(EmStreamClient *sc)
 	sc->pipeline_is_running = false;
 }
 
+void
+em_stream_client_set_sample_select_policy(EmStreamClient *sc, enum em_sample_select_policy policy)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sc->sample_mutex);
+	sc->select_policy = policy;
+}
+
+struct decoder_fence
+{
+	EmStreamClient *sc;
+	EGLSyncKHR sync;
+};
+
+//! Runs on GStreamer's GL thread, behind everything it did to produce the frame.
+static void
+create_decoder_fence_cb(GstGLContext *context, gpointer user_data)
+{
+	struct decoder_fence *fence = (struct decoder_fence *)user_data;
+	fence->sync = fence->sc->egl.create_sync(fence->sc->egl.display, EGL_SYNC_FENCE_KHR, NULL);
+
+	// Another context can only wait for it once it got to the GPU.
+	context->gl_vtable->Flush();
+}
+
+/*!
+ * Fence the GL work GStreamer did to produce the sample just pulled, so the render thread can have its GPU wait for
+ * it instead of waiting itself. Call from the appsink callback, which blocks the streaming thread, not the renderer.
+ *
+ * @return EGL_NO_SYNC_KHR if the sample has to be waited on some other way.
+ */
+static EGLSyncKHR
+create_decoder_fence(EmStreamClient *sc)
+{
+	// The Android decoder latches the SurfaceTexture in its sync meta's wait, which picks the image the one external
+	// texture shows, so that has to wait until the renderer takes the sample.
+	if (sc->egl.create_sync == NULL || sc->context == NULL || sc->frame_texture_target != GL_TEXTURE_2D) {
+		return EGL_NO_SYNC_KHR;
+	}
+	struct decoder_fence fence = {.sc = sc, .sync = EGL_NO_SYNC_KHR};
+	gst_gl_context_thread_add(sc->context, create_decoder_fence_cb, &fence);
+	return fence.sync;
+}
+
+//! Drop a queue entry that will not be rendered.
+static void
+release_entry(EmStreamClient *sc, struct em_sample_queue_entry *entry)
+{
+	if (entry->gpu_fence != NULL) {
+		sc->egl.destroy_sync(sc->egl.display, (EGLSyncKHR)entry->gpu_fence);
+		entry->gpu_fence = NULL;
+	}
+	gst_sample_unref((GstSample *)entry->sample);
+	entry->sample = NULL;
+}
+
+/*!
+ * Make the render context's GPU wait for GStreamer's GL work on the frame, without blocking the render thread on it.
+ * Call with the render context current. Takes ownership of @p fence.
+ *
+ * @return false if there is no fence or waiting on it failed, the caller has to wait some other way.
+ */
+static bool
+wait_for_decoder_gpu(EmStreamClient *sc, EGLSyncKHR fence)
+{
+	if (fence == EGL_NO_SYNC_KHR) {
+		return false;
+	}
+
+	// Server side, the render thread goes on submitting while the GPU orders the reads after the decoder's writes.
+	EGLBoolean waited = sc->egl.wait_sync(sc->egl.display, fence, 0);
+	sc->egl.destroy_sync(sc->egl.display, fence);
+	return waited == EGL_TRUE;
+}
+
 struct em_sample *
-em_stream_client_try_pull_sample(EmStreamClient *sc, struct timespec *out_decode_end)
+em_stream_client_try_pull_sample(EmStreamClient *sc, int64_t predicted_display_time, struct timespec *out_decode_end)
 {
 	if (!sc->appsink) {
 		// not setup yet.
@@ -594,15 +1025,30 @@ em_stream_client_try_pull_sample(EmStreamClient *sc, struct timespec *out_decode
 
 	// We actually pull the sample in the new-sample signal handler, so here we're just receiving the sample already
 	// pulled.
-	GstSample *sample = NULL;
-	struct timespec decode_end;
+	struct em_sample_queue_entry taken = {0};
+	struct em_sample_queue_entry dropped[EM_SAMPLE_QUEUE_SIZE];
+	uint32_t dropped_count = 0;
+	XrPosef render_pose = {{0.0f, 0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 0.0f}};
+	bool has_render_pose = false;
+	struct em_eye_rect eye_rects[2] = {em_eye_rect_side_by_side(0), em_eye_rect_side_by_side(1)};
+	int64_t tracking_sequence_idx = 0;
 	{
 		g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sc->sample_mutex);
-		sample = sc->sample;
-		sc->sample = NULL;
-		decode_end = sc->sample_decode_end_ts;
+		if (em_sample_queue_take(&sc->samples, sc->select_policy, predicted_display_time, &taken, dropped,
+		                         &dropped_count)) {
+			has_render_pose =
+			    find_render_pose_locked(sc, taken.frame_id, &render_pose, eye_rects, &tracking_sequence_idx);
+		}
+	}
+	for (uint32_t i = 0; i < dropped_count; i++) {
+		ALOGI("Discarding unused sample %" PRId64 ", a later one is a better match", dropped[i].frame_id);
+		release_entry(sc, &dropped[i]);
 	}
 
+	GstSample *sample = (GstSample *)taken.sample;
+	struct timespec decode_end = taken.decode_end;
+	int64_t frame_id = taken.frame_id;
+
 	if (sample == NULL) {
 		if (gst_app_sink_is_eos(GST_APP_SINK(sc->appsink))) {
 			ALOGW("%s: EOS", __FUNCTION__);
@@ -637,31 +1083,31 @@ em_stream_client_try_pull_sample(EmStreamClient *sc, struct timespec *out_decode
 	gst_video_frame_map(&frame, &info, buffer, flags);
 	ret->base.frame_texture_id = *(GLuint *)frame.data[0];
 
-	if (sc->context == NULL) {
-		ALOGI("%s: Retrieving the GStreamer EGL context", __FUNCTION__);
-		/* Get GStreamer's gl context. */
-		gst_gl_query_local_gl_context(sc->appsink, GST_PAD_SINK, &sc->context);
-
-		/* Check if we have 2D or OES textures */
-		GstStructure *s = gst_caps_get_structure(caps, 0);
-		const gchar *texture_target_str = gst_structure_get_string(s, "texture-target");
-		if (g_str_equal(texture_target_str, GST_GL_TEXTURE_TARGET_EXTERNAL_OES_STR)) {
-			sc->frame_texture_target = GL_TEXTURE_EXTERNAL_OES;
-		} else if (g_str_equal(texture_target_str, GST_GL_TEXTURE_TARGET_2D_STR)) {
-			sc->frame_texture_target = GL_TEXTURE_2D;
-			ALOGE("RYLIE: Got GL_TEXTURE_2D instead of expected GL_TEXTURE_EXTERNAL_OES");
-		} else {
-			g_assert_not_reached();
-		}
-	}
 	ret->base.frame_texture_target = sc->frame_texture_target;
-
+	ret->base.frame_sequence_id = frame_id;
+	ret->base.render_pose = render_pose;
+	ret->base.has_render_pose = has_render_pose;
+	ret->base.eye_rects[0] = eye_rects[0];
+	ret->base.eye_rects[1] = eye_rects[1];
+	ret->base.tracking_sequence_idx = tracking_sequence_idx;
+
+	struct timespec wait_start;
+	clock_gettime(CLOCK_MONOTONIC, &wait_start);
 	GstGLSyncMeta *sync_meta = gst_buffer_get_gl_sync_meta(buffer);
-	if (sync_meta) {
+	if (!wait_for_decoder_gpu(sc, (EGLSyncKHR)taken.gpu_fence) && sync_meta) {
 		/* MOSHI: the set_sync() seems to be needed for resizing */
 		gst_gl_sync_meta_set_sync_point(sync_meta, sc->context);
 		gst_gl_sync_meta_wait(sync_meta, sc->context);
 	}
+	struct timespec wait_end;
+	clock_gettime(CLOCK_MONOTONIC, &wait_end);
+	uint64_t wait_ns = (uint64_t)((wait_end.tv_sec - wait_start.tv_sec) * 1000000000LL +
+	                              (wait_end.tv_nsec - wait_start.tv_nsec));
+	sc->decoder_wait.count++;
+	sc->decoder_wait.ns_total += wait_ns;
+	if (wait_ns > sc->decoder_wait.ns_max) {
+		sc->decoder_wait.ns_max = wait_ns;
+	}
 
 	gst_video_frame_unmap(&frame);
 	// move sample ownership into the return value
@@ -699,9 +1145,31 @@ em_stream_client_set_connection(EmStreamClient *sc, EmConnection *connection)
 static void
 em_stream_client_free_egl_mutex(EmStreamClient *sc)
 {
+	EmEglMutexStats stats;
+	if (sc->egl_mutex != NULL && em_egl_mutex_get_stats(sc->egl_mutex, &stats) && stats.lock_count > 0) {
+		ALOGI("%s: EGL mutex locked %" PRIu64 " times, %" PRIu64 " contended, wait avg %.3f max %.3f ms, "
+		      "hold avg %.3f max %.3f ms",
+		      __FUNCTION__, stats.lock_count, stats.contended_count,
+		      (double)stats.wait_ns_total / (double)stats.lock_count / 1e6, (double)stats.wait_ns_max / 1e6,
+		      (double)stats.hold_ns_total / (double)stats.lock_count / 1e6, (double)stats.hold_ns_max / 1e6);
+	}
 
 	if (sc->own_egl_mutex) {
 		em_egl_mutex_destroy(&sc->egl_mutex);
 	}
 	sc->egl_mutex = NULL;
 }
+
+static void
+release_queued_samples(EmStreamClient *sc)
+{
+	struct em_sample_queue_entry entries[EM_SAMPLE_QUEUE_SIZE];
+	uint32_t count = 0;
+	{
+		g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sc->sample_mutex);
+		count = em_sample_queue_clear(&sc->samples, entries);
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		release_entry(sc, &entries[i]);
+	}
+}
@@ -11,11 +11,13 @@
 #pragma once
 
 #include "em_connection.h"
+#include "em_sample_queue.h"
 
 #include <EGL/egl.h>
 #include <glib-object.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,6 +57,8 @@ em_stream_client_destroy(EmStreamClient **ptr_sc);
  * After calling this method, **do not** manually make this context active again: instead use
  * @ref em_stream_client_egl_begin and @ref em_stream_client_egl_end
  *
+ * The stream client thread does its own GL setup in a context shared with this one, so it does not hold up rendering.
+ *
  * @param sc self
  * @param egl_mutex An implementation of the EGL mutex interface, which carries an EGLDisplay and EGLContext
  * @param adopt_mutex_interface True if the stream client takes ownership of the EGL mutex interface.
@@ -96,6 +100,16 @@ em_stream_client_egl_begin_pbuffer(EmStreamClient *sc);
 void
 em_stream_client_egl_end(EmStreamClient *sc);
 
+/*!
+ * Whether the stream client thread got a context of its own, shared with the "main" one, so it never needs the main
+ * context.
+ *
+ * If so, the render thread is its only user and may keep it current between frames, instead of beginning and ending
+ * every frame.
+ */
+bool
+em_stream_client_has_own_egl_context(EmStreamClient *sc);
+
 /*!
  * Start the GMainLoop embedded in this object in a new thread
  *
@@ -111,15 +125,25 @@ void
 em_stream_client_stop(EmStreamClient *sc);
 
 /*!
- * Attempt to retrieve a sample, if one has been decoded.
+ * Choose how @ref em_stream_client_try_pull_sample picks among the decoded samples waiting.
+ *
+ * Defaults to @ref EM_SAMPLE_SELECT_DISPLAY_TIME.
+ */
+void
+em_stream_client_set_sample_select_policy(EmStreamClient *sc, enum em_sample_select_policy policy);
+
+/*!
+ * Attempt to retrieve a sample, if one has been decoded that is a better match for @p predicted_display_time than
+ * the one retrieved last.
  *
  * Non-null return values need to be released with @ref em_stream_client_release_sample.
 
 * @param sc self
+* @param predicted_display_time the XrTime the sample will be shown at, from xrWaitFrame.
 * @param[out] out_decode_end struct to populate with decode-end time.
  */
 struct em_sample *
-em_stream_client_try_pull_sample(EmStreamClient *sc, struct timespec *out_decode_end);
+em_stream_client_try_pull_sample(EmStreamClient *sc, int64_t predicted_display_time, struct timespec *out_decode_end);
 
 /*!
  * Release a sample returned from @ref em_stream_client_try_pull_sample
@@ -31,9 +31,25 @@
 
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "em_reprojection.h"
 
 struct em_sample
 {
 	GLuint frame_texture_id;
 	GLenum frame_texture_target;
+
+	//! The server's id for this frame, 0 if it didn't tell us.
+	int64_t frame_sequence_id;
+
+	//! The head pose the server rendered this frame from, in our local space, valid if has_render_pose is set.
+	XrPosef render_pose;
+	bool has_render_pose;
+
+	//! Where the left and right eye are in the frame.
+	struct em_eye_rect eye_rects[2];
+
+	//! sequence_idx of the tracking message the server rendered this frame from, 0 if it didn't tell us.
+	int64_t tracking_sequence_idx;
 };
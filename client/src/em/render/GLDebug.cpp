@@ -15,7 +15,10 @@
 
 #include "GLES3/gl3.h"
 #include <GLES3/gl32.h>
+
+#ifdef __ANDROID__
 #include <android/log.h>
+#endif
 
 namespace {
 
@@ -57,6 +60,7 @@ glDebugTypeToString(GLenum e)
 }
 #undef MAKE_CASE
 
+#ifdef __ANDROID__
 android_LogPriority
 glDebugSeverityToAndroidLogPriority(GLenum e)
 {
@@ -69,6 +73,7 @@ glDebugSeverityToAndroidLogPriority(GLenum e)
 	default: return ANDROID_LOG_VERBOSE;
 	}
 }
+#endif
 
 void KHRONOS_APIENTRY
 gl_debug_callback(GLenum source,
@@ -79,8 +84,16 @@ gl_debug_callback(GLenum source,
                   const GLchar *message,
                   const void *userParam)
 {
+#ifdef __ANDROID__
 	__android_log_print(glDebugSeverityToAndroidLogPriority(severity), LOG_TAG, "GL: %s: %s (id %d): %s",
 	                    glDebugSourceToString(source), glDebugTypeToString(type), id, message);
+#else
+	if (severity == GL_DEBUG_SEVERITY_HIGH || severity == GL_DEBUG_SEVERITY_MEDIUM) {
+		ALOGW("GL: %s: %s (id %d): %s", glDebugSourceToString(source), glDebugTypeToString(type), id, message);
+	} else {
+		ALOGD("GL: %s: %s (id %d): %s", glDebugSourceToString(source), glDebugTypeToString(type), id, message);
+	}
+#endif
 }
 
 } // namespace
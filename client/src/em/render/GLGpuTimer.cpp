@@ -0,0 +1,145 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Measures GPU time of GL work without waiting for it
+ * @ingroup em_utils
+ */
+
+#include "GLGpuTimer.h"
+#include "../em_app_log.h"
+#include <EGL/egl.h>
+
+#include <cstring>
+
+
+static bool
+hasGlExtension(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char *extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+		if (extension != nullptr && strcmp(extension, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename T>
+static bool
+getProc(T &out, const char *name)
+{
+	out = reinterpret_cast<T>(eglGetProcAddress(name));
+	return out != nullptr;
+}
+
+GLGpuTimer::~GLGpuTimer()
+{
+	reset();
+}
+
+bool
+GLGpuTimer::init()
+{
+	if (!hasGlExtension("GL_EXT_disjoint_timer_query")) {
+		ALOGW("%s: No GL_EXT_disjoint_timer_query, GPU time will not be measured", __FUNCTION__);
+		return false;
+	}
+	PFNGLBEGINQUERYEXTPROC beginQuery = nullptr;
+	if (!getProc(genQueries_, "glGenQueriesEXT") || !getProc(deleteQueries_, "glDeleteQueriesEXT") ||
+	    !getProc(beginQuery, "glBeginQueryEXT") || !getProc(endQuery_, "glEndQueryEXT") ||
+	    !getProc(getQueryObjectuiv_, "glGetQueryObjectuivEXT") ||
+	    !getProc(getQueryObjectui64v_, "glGetQueryObjectui64vEXT")) {
+		ALOGE("%s: GL_EXT_disjoint_timer_query advertised but its functions are missing", __FUNCTION__);
+		return false;
+	}
+	genQueries_(kQueryCount, queries_);
+	// Set last, it is what isSupported() looks at.
+	beginQuery_ = beginQuery;
+
+	// Reading the flag clears it, so nothing from before counts against the first results.
+	GLint disjoint = 0;
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	return true;
+}
+
+void
+GLGpuTimer::begin()
+{
+	if (!isSupported() || running_ || inFlight_ == kQueryCount) {
+		return;
+	}
+	beginQuery_(GL_TIME_ELAPSED_EXT, queries_[(oldest_ + inFlight_) % kQueryCount]);
+	running_ = true;
+}
+
+void
+GLGpuTimer::end(int64_t tag)
+{
+	if (!running_) {
+		return;
+	}
+	endQuery_(GL_TIME_ELAPSED_EXT);
+	tags_[(oldest_ + inFlight_) % kQueryCount] = tag;
+	inFlight_++;
+	running_ = false;
+}
+
+bool
+GLGpuTimer::poll(int64_t &outGpuNs, int64_t &outTag)
+{
+	if (!isSupported()) {
+		return false;
+	}
+	// Reading the flag clears it. Any query that had started by now may span the disjoint operation.
+	GLint disjoint = 0;
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	if (disjoint != 0) {
+		discard_ = inFlight_ + (running_ ? 1 : 0);
+	}
+
+	while (inFlight_ > 0) {
+		GLuint query = queries_[oldest_];
+		GLuint available = GL_FALSE;
+		getQueryObjectuiv_(query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+		if (available == GL_FALSE) {
+			return false;
+		}
+
+		GLuint64 elapsed = 0;
+		getQueryObjectui64v_(query, GL_QUERY_RESULT_EXT, &elapsed);
+		int64_t tag = tags_[oldest_];
+		oldest_ = (oldest_ + 1) % kQueryCount;
+		inFlight_--;
+
+		if (discard_ > 0) {
+			discard_--;
+			continue;
+		}
+		outGpuNs = static_cast<int64_t>(elapsed);
+		outTag = tag;
+		return true;
+	}
+	return false;
+}
+
+void
+GLGpuTimer::reset()
+{
+	if (!isSupported()) {
+		return;
+	}
+	if (running_) {
+		endQuery_(GL_TIME_ELAPSED_EXT);
+		running_ = false;
+	}
+	deleteQueries_(kQueryCount, queries_);
+	inFlight_ = 0;
+	oldest_ = 0;
+	discard_ = 0;
+	beginQuery_ = nullptr;
+}
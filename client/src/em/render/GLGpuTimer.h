@@ -0,0 +1,83 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Measures GPU time of GL work without waiting for it
+ * @ingroup em_utils
+ */
+
+#pragma once
+
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Times stretches of GL commands on the GPU with GL_EXT_disjoint_timer_query.
+ *
+ * Results come back a frame or two later and are picked up with poll(), which never blocks. Results spanning a
+ * disjoint operation (the GPU changing clocks, say) are thrown away. Without the extension, isSupported() is false
+ * and everything else does nothing.
+ *
+ * Every call must be made with the same GL context current.
+ */
+class GLGpuTimer
+{
+public:
+	GLGpuTimer() = default;
+	// non-copyable
+	GLGpuTimer(const GLGpuTimer &) = delete;
+	GLGpuTimer &
+	operator=(const GLGpuTimer &) = delete;
+
+	// destructor calls reset
+	~GLGpuTimer();
+
+	/// Look up the extension and generate the query names.
+	bool
+	init();
+
+	bool
+	isSupported() const noexcept
+	{
+		return beginQuery_ != nullptr;
+	}
+
+	/// Start timing. Skipped if every query is still waiting for its result.
+	void
+	begin();
+
+	/// Stop timing what begin() started. @p tag is handed back by poll() along with the result.
+	void
+	end(int64_t tag);
+
+	/// Get the oldest finished measurement in nanoseconds, without waiting. Returns false if none is ready.
+	bool
+	poll(int64_t &outGpuNs, int64_t &outTag);
+
+	/// Delete the query names.
+	void
+	reset();
+
+private:
+	static constexpr size_t kQueryCount = 4;
+
+	GLuint queries_[kQueryCount] = {};
+	int64_t tags_[kQueryCount] = {};
+	size_t oldest_ = 0;
+	size_t inFlight_ = 0;
+	/// How many of the oldest in flight results to throw away, because of a disjoint operation.
+	size_t discard_ = 0;
+	bool running_ = false;
+
+	PFNGLGENQUERIESEXTPROC genQueries_ = nullptr;
+	PFNGLDELETEQUERIESEXTPROC deleteQueries_ = nullptr;
+	PFNGLBEGINQUERYEXTPROC beginQuery_ = nullptr;
+	PFNGLENDQUERYEXTPROC endQuery_ = nullptr;
+	PFNGLGETQUERYOBJECTUIVEXTPROC getQueryObjectuiv_ = nullptr;
+	PFNGLGETQUERYOBJECTUI64VEXTPROC getQueryObjectui64v_ = nullptr;
+};
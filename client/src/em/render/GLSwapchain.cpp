@@ -11,7 +11,9 @@
 
 #include "GLSwapchain.h"
 #include "../em_app_log.h"
+#include <EGL/egl.h>
 #include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
 #include <openxr/openxr.h>
 
 #include <cassert>
@@ -22,11 +24,35 @@ GLSwapchain::~GLSwapchain()
 	reset();
 }
 
+/// Check that we can actually render to the framebuffer bound.
+static bool
+checkFramebuffer(const char *what, GLsizei i)
+{
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		ALOGE("%s: Index %d: Failed to create %s framebuffer (%d)\n", __FUNCTION__, i, what, status);
+		return false;
+	}
+	return true;
+}
+
 bool
-GLSwapchain::enumerateAndGenerateFramebuffers(XrSwapchain swapchain)
+GLSwapchain::enumerateAndGenerateFramebuffers(XrSwapchain swapchain, uint32_t arraySize, bool multiview)
 {
 	assert(swapchainImages_.empty());
 	assert(framebuffers_.empty());
+	assert(multiviewFramebuffers_.empty());
+	assert(arraySize > 0);
+
+	PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC framebufferTextureMultiview = nullptr;
+	if (multiview) {
+		framebufferTextureMultiview = reinterpret_cast<PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC>(
+		    eglGetProcAddress("glFramebufferTextureMultiviewOVR"));
+		if (framebufferTextureMultiview == nullptr) {
+			ALOGE("%s: No glFramebufferTextureMultiviewOVR for a multiview swapchain", __FUNCTION__);
+			return false;
+		}
+	}
 	uint32_t countOutput = 0;
 	if (!XR_UNQUALIFIED_SUCCESS(xrEnumerateSwapchainImages(swapchain, 0, &countOutput, nullptr))) {
 		ALOGE("%s: Failed initial call to xrEnumerateSwapchainImages", __FUNCTION__);
@@ -45,27 +71,39 @@ GLSwapchain::enumerateAndGenerateFramebuffers(XrSwapchain swapchain)
 	swapchainImages_.resize(countOutput);
 
 	const GLsizei n = static_cast<GLsizei>(countOutput);
+	const GLsizei layers = static_cast<GLsizei>(arraySize);
+	arraySize_ = arraySize;
 
 	ALOGI("%s: Generating framebuffers", __FUNCTION__);
-	framebuffers_.resize(n);
-	glGenFramebuffers(n, framebuffers_.data());
+	framebuffers_.resize(n * layers);
+	glGenFramebuffers(n * layers, framebuffers_.data());
+	if (multiview) {
+		multiviewFramebuffers_.resize(n);
+		glGenFramebuffers(n, multiviewFramebuffers_.data());
+	}
 
 	bool success = true;
-	for (GLsizei i = 0; i < n; ++i) {
-		ALOGI("%s: Index %d: Binding framebuffer name %d to texture ID %d", __FUNCTION__, i, framebuffers_[i],
-		      swapchainImages_[i].image);
-		// bind this name as the active framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers_[i]);
-		// associate a swapchain image as the texture object/image for this framebuffer
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, swapchainImages_[i].image,
-		                       0);
-		// check to make sure we can actually render to this.
-		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-
-		if (status != GL_FRAMEBUFFER_COMPLETE) {
-			ALOGE("%s: Index %d: Failed to create framebuffer (%d)\n", __FUNCTION__, i, status);
-			success = false;
-			break;
+	for (GLsizei i = 0; i < n && success; ++i) {
+		ALOGI("%s: Index %d: Binding framebuffer name %d to texture ID %d", __FUNCTION__, i,
+		      framebuffers_[i * layers], swapchainImages_[i].image);
+		for (GLsizei layer = 0; layer < layers && success; ++layer) {
+			// bind this name as the active framebuffer
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffers_[i * layers + layer]);
+			// associate a swapchain image (layer) as the texture object/image for this framebuffer
+			if (arraySize > 1) {
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, swapchainImages_[i].image, 0,
+				                          layer);
+			} else {
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+				                       swapchainImages_[i].image, 0);
+			}
+			success = checkFramebuffer("layer", i);
+		}
+		if (success && multiview) {
+			glBindFramebuffer(GL_FRAMEBUFFER, multiviewFramebuffers_[i]);
+			framebufferTextureMultiview(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, swapchainImages_[i].image, 0, 0,
+			                            layers);
+			success = checkFramebuffer("multiview", i);
 		}
 	}
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -85,5 +123,10 @@ GLSwapchain::reset()
 	}
 	glDeleteFramebuffers(static_cast<GLsizei>(framebuffers_.size()), framebuffers_.data());
 	framebuffers_.clear();
+	if (!multiviewFramebuffers_.empty()) {
+		glDeleteFramebuffers(static_cast<GLsizei>(multiviewFramebuffers_.size()), multiviewFramebuffers_.data());
+		multiviewFramebuffers_.clear();
+	}
+	arraySize_ = 1;
 	swapchainImages_.clear();
 }
@@ -16,7 +16,7 @@
 #include <openxr/openxr_platform.h>
 #include <vector>
 
-#ifdef __ANDROID__
+#ifdef XR_USE_GRAPHICS_API_OPENGL_ES
 using XrSwapchainImageForGL = XrSwapchainImageOpenGLESKHR;
 static constexpr XrStructureType kGLSwapchainImageType = XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_ES_KHR;
 #else
@@ -40,9 +40,12 @@ public:
 	// destructor calls reset
 	~GLSwapchain();
 
-	/// Enumerate the swapchain images and generate/associate framebuffer object names with each
+	/// Enumerate the swapchain images and generate/associate framebuffer object names with each.
+	///
+	/// With an @p arraySize of more than 1, each layer of each image gets its own framebuffer. With @p multiview,
+	/// each image also gets one with all its layers as a GL_OVR_multiview2 attachment, one view per layer.
 	bool
-	enumerateAndGenerateFramebuffers(XrSwapchain swapchain);
+	enumerateAndGenerateFramebuffers(XrSwapchain swapchain, uint32_t arraySize = 1, bool multiview = false);
 
 	/// Get the number of images in the swapchain
 	uint32_t
@@ -56,15 +59,32 @@ public:
 	void
 	reset();
 
-	/// Access the GL framebuffer object name associated with swapchain image @p i
+	/// Access the GL framebuffer object name associated with layer @p layer of swapchain image @p i
 	GLuint
-	framebufferNameAtSwapchainIndex(uint32_t i) const
+	framebufferNameAtSwapchainIndex(uint32_t i, uint32_t layer = 0) const
 	{
-		return framebuffers_.at(i);
+		return framebuffers_.at(i * arraySize_ + layer);
+	}
+
+	/// Whether there are multiview framebuffers, see @ref multiviewFramebufferNameAtSwapchainIndex
+	bool
+	hasMultiview() const noexcept
+	{
+		return !multiviewFramebuffers_.empty();
+	}
+
+	/// Access the GL framebuffer object name with all layers of swapchain image @p i as multiview attachment
+	GLuint
+	multiviewFramebufferNameAtSwapchainIndex(uint32_t i) const
+	{
+		return multiviewFramebuffers_.at(i);
 	}
 
 private:
 	static constexpr XrStructureType kSwapchainImageType = XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_ES_KHR;
 	std::vector<XrSwapchainImageOpenGLESKHR> swapchainImages_;
+	uint32_t arraySize_ = 1;
+	/// One per layer of each image, arraySize_ at a time.
 	std::vector<GLuint> framebuffers_;
+	std::vector<GLuint> multiviewFramebuffers_;
 };
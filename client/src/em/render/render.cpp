@@ -19,19 +19,73 @@
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <openxr/openxr.h>
 #include <stdexcept>
 
-// Vertex shader source code
-static constexpr const GLchar *vertexShaderSource = R"(
+// Vertex shader header for drawing one eye at a time, picked by a uniform
+static constexpr const GLchar *vertexShaderSingleViewSource = R"(
     #version 300 es
+    uniform int viewIndex;
+    #define VIEW_INDEX viewIndex
+)";
+
+// Vertex shader header for drawing both eyes in one pass into the layers of an array texture
+static constexpr const GLchar *vertexShaderMultiviewSource = R"(
+    #version 300 es
+    #extension GL_OVR_multiview2 : require
+    layout(num_views = 2) in;
+    #define VIEW_INDEX int(gl_ViewID_OVR)
+)";
+
+// Shared by the vertex shaders after their header, turns the eye's view into rays rotated into the eye the frame was
+// rendered for. The rays are linear in screen position, so interpolating them is exact. Keep in sync with
+// em_reprojection_apply.
+static constexpr const GLchar *vertexShaderMainSource = R"(
     in vec3 position;
     in vec2 uv;
-    out vec2 frag_uv;
+    out vec3 ray;
+    flat out vec4 eyeTanAngles;
+    flat out vec4 eyeRectInStream;
+
+    uniform mat3 reprojection[2];
+    // left, right, down, up
+    uniform vec4 tanAngles[2];
+    // x, y, width, height in texture coordinates
+    uniform vec4 eyeRect[2];
 
     void main() {
         gl_Position = vec4(position, 1.0);
-        frag_uv = uv;
+        vec2 screen = position.xy * 0.5 + 0.5;
+        vec4 tangents = tanAngles[VIEW_INDEX];
+        vec2 tangent = mix(tangents.xz, tangents.yw, screen);
+        ray = reprojection[VIEW_INDEX] * vec3(tangent, -1.0);
+        eyeTanAngles = tangents;
+        eyeRectInStream = eyeRect[VIEW_INDEX];
+    }
+)";
+
+// Shared by the fragment shaders after their sampler declaration, where the ray hits the stream, black if outside of
+// what the server rendered.
+static constexpr const GLchar *fragmentShaderMainSource = R"(
+    in vec3 ray;
+    flat in vec4 eyeTanAngles;
+    flat in vec4 eyeRectInStream;
+    out vec4 frag_color;
+
+    void main() {
+        if (ray.z >= 0.0) {
+            frag_color = vec4(0.0, 0.0, 0.0, 1.0);
+            return;
+        }
+        vec2 s = (ray.xy / -ray.z - eyeTanAngles.xz) / (eyeTanAngles.yw - eyeTanAngles.xz);
+        if (any(lessThan(s, vec2(0.0))) || any(greaterThan(s, vec2(1.0)))) {
+            frag_color = vec4(0.0, 0.0, 0.0, 1.0);
+            return;
+        }
+        // The stream's rows go top to bottom.
+        vec2 uv = eyeRectInStream.xy + vec2(s.x, 1.0 - s.y) * eyeRectInStream.zw;
+        frag_color = texture(textureSampler, uv);
     }
 )";
 
@@ -40,15 +94,17 @@ static constexpr const GLchar *fragmentShaderSource = R"(
     #version 300 es
     #extension GL_OES_EGL_image_external : require
     #extension GL_OES_EGL_image_external_essl3 : require
-    precision mediump float;
+    precision highp float;
 
-    in vec2 frag_uv;
-    out vec4 frag_color;
     uniform samplerExternalOES textureSampler;
+)";
 
-    void main() {
-        frag_color = texture(textureSampler, frag_uv);
-    }
+// Fragment shader source code for plain 2D textures, which software decoders upload into
+static constexpr const GLchar *fragmentShader2DSource = R"(
+    #version 300 es
+    precision highp float;
+
+    uniform sampler2D textureSampler;
 )";
 
 // Function to check shader compilation errors
@@ -77,23 +133,26 @@ checkProgramLinking(GLuint program)
 	}
 }
 
-void
-Renderer::setupShaders()
+// Compile and link the given vertex and fragment shader headers, each followed by their shared main
+static GLuint
+buildProgram(const GLchar *vertexHeaderSource, const GLchar *fragmentHeaderSource)
 {
 	// Compile the vertex shader
 	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
+	const GLchar *vertexSources[] = {vertexHeaderSource, vertexShaderMainSource};
+	glShaderSource(vertexShader, 2, vertexSources, NULL);
 	glCompileShader(vertexShader);
 	checkShaderCompilation(vertexShader);
 
 	// Compile the fragment shader
 	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
+	const GLchar *fragmentSources[] = {fragmentHeaderSource, fragmentShaderMainSource};
+	glShaderSource(fragmentShader, 2, fragmentSources, NULL);
 	glCompileShader(fragmentShader);
 	checkShaderCompilation(fragmentShader);
 
 	// Create and link the shader program
-	program = glCreateProgram();
+	GLuint program = glCreateProgram();
 	glAttachShader(program, vertexShader);
 	glAttachShader(program, fragmentShader);
 	glLinkProgram(program);
@@ -103,7 +162,49 @@ Renderer::setupShaders()
 	glDeleteShader(vertexShader);
 	glDeleteShader(fragmentShader);
 
-	textureSamplerLocation_ = glGetUniformLocation(program, "textureSampler");
+	return program;
+}
+
+// Whether the current context lists the extension @p name
+static bool
+hasGlExtension(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char *extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+		if (extension != nullptr && strcmp(extension, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+Renderer::Program
+Renderer::setupProgram(const GLchar *vertexHeaderSource, const GLchar *fragmentHeaderSource)
+{
+	Program ret;
+	ret.program = buildProgram(vertexHeaderSource, fragmentHeaderSource);
+	ret.textureSamplerLocation = glGetUniformLocation(ret.program, "textureSampler");
+	ret.reprojectionLocation = glGetUniformLocation(ret.program, "reprojection");
+	ret.tanAnglesLocation = glGetUniformLocation(ret.program, "tanAngles");
+	ret.eyeRectLocation = glGetUniformLocation(ret.program, "eyeRect");
+	ret.viewIndexLocation = glGetUniformLocation(ret.program, "viewIndex");
+	return ret;
+}
+
+void
+Renderer::setupShaders()
+{
+	programOES = setupProgram(vertexShaderSingleViewSource, fragmentShaderSource);
+	program2D = setupProgram(vertexShaderSingleViewSource, fragmentShader2DSource);
+
+	// Software GL like llvmpipe may not have it, drawing each eye on its own works everywhere.
+	if (hasGlExtension("GL_OVR_multiview2")) {
+		ALOGI("%s: GL_OVR_multiview2 available, drawing both eyes in one pass", __FUNCTION__);
+		programOESMultiview = setupProgram(vertexShaderMultiviewSource, fragmentShaderSource);
+		program2DMultiview = setupProgram(vertexShaderMultiviewSource, fragmentShader2DSource);
+	}
 }
 
 struct TextureCoord
@@ -167,9 +268,21 @@ Renderer::setupRender()
 void
 Renderer::reset()
 {
-	if (program != 0) {
-		glDeleteProgram(program);
-		program = 0;
+	if (programOES.program != 0) {
+		glDeleteProgram(programOES.program);
+		programOES.program = 0;
+	}
+	if (program2D.program != 0) {
+		glDeleteProgram(program2D.program);
+		program2D.program = 0;
+	}
+	if (programOESMultiview.program != 0) {
+		glDeleteProgram(programOESMultiview.program);
+		programOESMultiview.program = 0;
+	}
+	if (program2DMultiview.program != 0) {
+		glDeleteProgram(program2DMultiview.program);
+		program2DMultiview.program = 0;
 	}
 	if (quadVAO != 0) {
 		glDeleteVertexArrays(1, &quadVAO);
@@ -181,19 +294,57 @@ Renderer::reset()
 	}
 }
 
+bool
+Renderer::supportsMultiview() const
+{
+	return programOESMultiview.program != 0 && program2DMultiview.program != 0;
+}
+
 void
-Renderer::draw(GLuint texture, GLenum texture_target) const
+Renderer::draw(GLuint texture, GLenum texture_target, const struct em_reprojection eyes[2], uint32_t eye) const
 {
-	//    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	// Use the shader program matching the texture target
+	const Program &p = texture_target == GL_TEXTURE_2D ? program2D : programOES;
+	glUseProgram(p.program);
+	glUniform1i(p.viewIndexLocation, static_cast<GLint>(eye));
+	drawQuad(p, texture, texture_target, eyes);
+}
 
-	// Use the shader program
-	glUseProgram(program);
+void
+Renderer::drawMultiview(GLuint texture, GLenum texture_target, const struct em_reprojection eyes[2]) const
+{
+	const Program &p = texture_target == GL_TEXTURE_2D ? program2DMultiview : programOESMultiview;
+	glUseProgram(p.program);
+	drawQuad(p, texture, texture_target, eyes);
+}
 
+void
+Renderer::drawQuad(const Program &p, GLuint texture, GLenum texture_target, const struct em_reprojection eyes[2]) const
+{
 	// Bind the texture
 	glActiveTexture(GL_TEXTURE0);
-	// glBindTexture(GL_TEXTURE_2D, texture);
 	glBindTexture(texture_target, texture);
-	glUniform1i(textureSamplerLocation_, 0);
+	glUniform1i(p.textureSamplerLocation, 0);
+
+	GLfloat rotations[2 * 9];
+	GLfloat tanAngles[2 * 4];
+	GLfloat eyeRects[2 * 4];
+	for (uint32_t eye = 0; eye < 2; eye++) {
+		memcpy(&rotations[eye * 9], eyes[eye].rotation, sizeof(eyes[eye].rotation));
+
+		tanAngles[eye * 4 + 0] = eyes[eye].tan_left;
+		tanAngles[eye * 4 + 1] = eyes[eye].tan_right;
+		tanAngles[eye * 4 + 2] = eyes[eye].tan_down;
+		tanAngles[eye * 4 + 3] = eyes[eye].tan_up;
+
+		eyeRects[eye * 4 + 0] = eyes[eye].rect.x;
+		eyeRects[eye * 4 + 1] = eyes[eye].rect.y;
+		eyeRects[eye * 4 + 2] = eyes[eye].rect.width;
+		eyeRects[eye * 4 + 3] = eyes[eye].rect.height;
+	}
+	glUniformMatrix3fv(p.reprojectionLocation, 2, GL_FALSE, rotations);
+	glUniform4fv(p.tanAnglesLocation, 2, tanAngles);
+	glUniform4fv(p.eyeRectLocation, 2, eyeRects);
 
 	// Draw the quad
 	glBindVertexArray(quadVAO);
@@ -11,6 +11,8 @@
 
 #pragma once
 
+#include "../em_reprojection.h"
+
 #include <EGL/egl.h>
 #include <GLES3/gl3.h>
 #include <memory>
@@ -37,20 +39,46 @@ public:
 	void
 	reset();
 
-	/// Draw texture to framebuffer. Must call with EGL Context current.
+	/// Whether @ref drawMultiview can be used, needs GL_OVR_multiview2. Must call after setupRender.
+	bool
+	supportsMultiview() const;
+
+	/// Draw @p eye of the stream's texture to the current viewport, reprojected. Must call with EGL Context current.
+	void
+	draw(GLuint texture, GLenum texture_target, const struct em_reprojection eyes[2], uint32_t eye) const;
+
+	/// Draw both eyes of the stream's texture in one pass, into the two layers of the current framebuffer's multiview
+	/// attachment, reprojected. Only if supportsMultiview(). Must call with EGL Context current.
 	void
-	draw(GLuint texture, GLenum texture_target) const;
+	drawMultiview(GLuint texture, GLenum texture_target, const struct em_reprojection eyes[2]) const;
 
 
 private:
+	struct Program
+	{
+		GLuint program = 0;
+		GLint textureSamplerLocation = 0;
+		GLint reprojectionLocation = 0;
+		GLint tanAnglesLocation = 0;
+		GLint eyeRectLocation = 0;
+		//! -1 in the multiview programs, which get the eye from gl_ViewID_OVR.
+		GLint viewIndexLocation = -1;
+	};
+
+	static Program
+	setupProgram(const GLchar *vertexHeaderSource, const GLchar *fragmentHeaderSource);
+	void
+	drawQuad(const Program &p, GLuint texture, GLenum texture_target, const struct em_reprojection eyes[2]) const;
 	void
 	setupShaders();
 	void
 	setupQuadVertexData();
 
-	GLuint program = 0;
+	Program programOES;
+	Program program2D;
+	//! Only set up if GL_OVR_multiview2 is there.
+	Program programOESMultiview;
+	Program program2DMultiview;
 	GLuint quadVAO = 0;
 	GLuint quadVBO = 0;
-
-	GLint textureSamplerLocation_ = 0;
 };
@@ -11,9 +11,10 @@
 
 #ifdef __ANDROID__
 #include <jni.h>
-#include <EGL/egl.h>
 #endif
 
+#include <EGL/egl.h>
+
 #include <GLES3/gl3.h>
 
 
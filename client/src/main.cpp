@@ -8,6 +8,7 @@
  * @author Moshi Turner <moses@collabora.com>
  * @author Rylie Pavlik <rpavlik@collabora.com>
  */
+#include "ClientCommon.hpp"
 #include "EglData.hpp"
 #include "em/em_egl.h"
 #include "em/em_remote_experience.h"
@@ -52,25 +53,8 @@
 #include <ctime>
 
 
-#define XR_LOAD(fn) xrGetInstanceProcAddr(state.instance, #fn, (PFN_xrVoidFunction *)&fn);
-
 namespace {
 
-struct em_state
-{
-	bool connected;
-
-	XrInstance instance;
-	XrSystemId system;
-	XrSession session;
-	XrSessionState sessionState;
-
-	uint32_t width;
-	uint32_t height;
-
-	EmConnection *connection;
-};
-
 em_state state = {};
 
 void
@@ -125,65 +109,7 @@ poll_events(struct android_app *app, struct em_state &state)
 		}
 	}
 
-	// Poll OpenXR events
-	XrResult result = XR_SUCCESS;
-	XrEventDataBuffer buffer;
-	buffer.type = XR_TYPE_EVENT_DATA_BUFFER;
-	buffer.next = NULL;
-
-	while (xrPollEvent(state.instance, &buffer) == XR_SUCCESS) {
-		if (buffer.type == XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED) {
-			XrEventDataSessionStateChanged *event = (XrEventDataSessionStateChanged *)&buffer;
-
-			switch (event->state) {
-			case XR_SESSION_STATE_IDLE: ALOGI("OpenXR session is now IDLE"); break;
-			case XR_SESSION_STATE_READY: {
-				ALOGI("OpenXR session is now READY, beginning session");
-				XrSessionBeginInfo beginInfo = {};
-				beginInfo.type = XR_TYPE_SESSION_BEGIN_INFO;
-				beginInfo.primaryViewConfigurationType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO;
-
-				result = xrBeginSession(state.session, &beginInfo);
-
-				if (XR_FAILED(result)) {
-					ALOGI("Failed to begin OpenXR session (%d)", result);
-				}
-			} break;
-			case XR_SESSION_STATE_SYNCHRONIZED: ALOGI("OpenXR session is now SYNCHRONIZED"); break;
-			case XR_SESSION_STATE_VISIBLE: ALOGI("OpenXR session is now VISIBLE"); break;
-			case XR_SESSION_STATE_FOCUSED: ALOGI("OpenXR session is now FOCUSED"); break;
-			case XR_SESSION_STATE_STOPPING:
-				ALOGI("OpenXR session is now STOPPING");
-				xrEndSession(state.session);
-				break;
-			case XR_SESSION_STATE_LOSS_PENDING: ALOGI("OpenXR session is now LOSS_PENDING"); break;
-			case XR_SESSION_STATE_EXITING: ALOGI("OpenXR session is now EXITING"); break;
-			default: break;
-			}
-
-			state.sessionState = event->state;
-		}
-
-		buffer.type = XR_TYPE_EVENT_DATA_BUFFER;
-	}
-
-	// If session isn't ready, return. We'll be called again and will poll events again.
-	if (state.sessionState < XR_SESSION_STATE_READY) {
-		ALOGI("Waiting for session ready state!");
-		using namespace std::chrono_literals;
-		std::this_thread::sleep_for(100ms);
-		return false;
-	}
-
-	return true;
-}
-
-void
-connected_cb(EmConnection *connection, struct em_state *state)
-{
-	ALOGI("%s: Got signal that we are connected!", __FUNCTION__);
-
-	state->connected = true;
+	return poll_xr_events(state);
 }
 
 } // namespace
@@ -324,8 +250,6 @@ android_main(struct android_app *app)
 		return;
 	}
 
-	EmEglMutexIface *egl_mutex = em_egl_mutex_create(initialEglData->display, initialEglData->context);
-
 	//
 	// End of normal OpenXR app startup
 	//
@@ -337,32 +261,12 @@ android_main(struct android_app *app)
 	// Set up gstreamer
 	gst_init(0, NULL);
 
-	// Set up our own objects
-	ALOGI("%s: creating stream client object", __FUNCTION__);
-	EmStreamClient *stream_client = em_stream_client_new();
-
-	ALOGI("%s: telling stream client about EGL", __FUNCTION__);
-	// retaining ownership
-	em_stream_client_set_egl_context(stream_client, egl_mutex, false, initialEglData->surface);
-
-	ALOGI("%s: creating connection object", __FUNCTION__);
-	state.connection = g_object_ref_sink(em_connection_new_localhost());
-
-	g_signal_connect(state.connection, "connected", G_CALLBACK(connected_cb), &state);
-
-	ALOGI("%s: starting connection", __FUNCTION__);
-	em_connection_connect(state.connection);
-
-	XrExtent2Di eye_extents{static_cast<int32_t>(state.width), static_cast<int32_t>(state.height)};
-	EmRemoteExperience *remote_experience =
-	    em_remote_experience_new(state.connection, stream_client, state.instance, state.session, &eye_extents);
-	if (!remote_experience) {
-		ALOGE("%s: Failed during remote experience init.", __FUNCTION__);
+	em_remote_client remote_client = {};
+	if (!remote_client_start(state, *initialEglData, remote_client)) {
 		return;
 	}
-
-	ALOGI("%s: starting stream client mainloop thread", __FUNCTION__);
-	em_stream_client_spawn_thread(stream_client, state.connection);
+	// A few poses per displayed frame, independent of how the frame loop keeps up.
+	em_remote_experience_set_tracking_rate(remote_client.experience, 250);
 
 	//
 	// End of remote-rendering-specific setup, into main loop
@@ -372,7 +276,7 @@ android_main(struct android_app *app)
 	ALOGI("DEBUG: Starting main loop.\n");
 	while (!app->destroyRequested) {
 		if (poll_events(app, state)) {
-			em_remote_experience_poll_and_render_frame(remote_experience);
+			em_remote_experience_poll_and_render_frame(remote_client.experience);
 		}
 	}
 
@@ -381,13 +285,7 @@ android_main(struct android_app *app)
 	// Clean up RR structures
 	//
 
-	g_clear_object(&state.connection);
-	// without gobject for stream client, the EmRemoteExperience takes ownership
-	// g_clear_object(&stream_client);
-
-	em_remote_experience_destroy(&remote_experience);
-
-	em_egl_mutex_destroy(&egl_mutex);
+	remote_client_stop(state, remote_client);
 
 	//
 	// End RR cleanup
@@ -0,0 +1,257 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief Main file for the desktop Linux build of the WebRTC client, for headless testing.
+ *
+ * Runs the same connection, decode and render loop as the Android app, but on a surfaceless EGL display (llvmpipe
+ * works) and against any OpenXR runtime supporting XR_MNDX_egl_enable, such as Monado with the null compositor.
+ */
+#include "ClientCommon.hpp"
+#include "EglData.hpp"
+#include "em/em_egl.h"
+#include "em/em_remote_experience.h"
+#include "em/render/xr_platform_deps.h"
+
+
+#include "em/em_app_log.h"
+#include "em/em_connection.h"
+#include "em/em_stream_client.h"
+#include "em/gst_common.h"
+
+#include <EGL/egl.h>
+
+#include <gst/gst.h>
+
+#include <memory>
+#include <openxr/openxr.h>
+#include <openxr/openxr_platform.h>
+
+#include <signal.h>
+#include <stdbool.h>
+#include <thread>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace {
+
+em_state state = {};
+
+volatile sig_atomic_t quit_requested = 0;
+
+void
+on_signal(int /* signum */)
+{
+	quit_requested = 1;
+}
+
+void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	        "Usage: %s [--frames N] [--late-latch] [--tracking-hz N] [--multiview]\n"
+	        "\n"
+	        "  --frames N       Quit after rendering N new frames from the server, 0 (default) runs until\n"
+	        "                   interrupted.\n"
+	        "  --late-latch     Render as late in each frame as the measured render cost allows.\n"
+	        "  --tracking-hz N  Send the head pose N times a second from its own thread, 0 (default) sends it once\n"
+	        "                   per frame.\n"
+	        "  --multiview      Draw both eyes in one pass with GL_OVR_multiview2, if there is one.\n",
+	        argv0);
+}
+
+} // namespace
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t frame_limit = 0;
+	bool late_latch = false;
+	uint32_t tracking_hz = 0;
+	bool multiview = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			frame_limit = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--late-latch") == 0) {
+			late_latch = true;
+		} else if (strcmp(argv[i], "--tracking-hz") == 0 && i + 1 < argc) {
+			tracking_hz = (uint32_t)strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--multiview") == 0) {
+			multiview = true;
+		} else {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Same default as the Android app, but leave it alone if the caller set one.
+	setenv("GST_DEBUG", "*:2,webrtc*:9,sctp*:9,dtls*:9", 0);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	auto initialEglData = std::make_unique<EglData>();
+	if (!initialEglData->isReady()) {
+		ALOGE("Failed to set up EGL");
+		return EXIT_FAILURE;
+	}
+
+	//
+	// Normal OpenXR app startup
+	//
+
+	// Create OpenXR instance
+
+	const char *extensions[] = {XR_MNDX_EGL_ENABLE_EXTENSION_NAME, XR_KHR_OPENGL_ES_ENABLE_EXTENSION_NAME,
+	                            XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME};
+
+	XrInstanceCreateInfo instanceInfo = {};
+	instanceInfo.type = XR_TYPE_INSTANCE_CREATE_INFO;
+
+	strncpy(instanceInfo.applicationInfo.engineName, "N/A", XR_MAX_APPLICATION_NAME_SIZE - 1);
+	instanceInfo.applicationInfo.engineName[XR_MAX_APPLICATION_NAME_SIZE - 1] = '\0';
+
+	strncpy(instanceInfo.applicationInfo.applicationName, "ElectricMaple desktop client",
+	        XR_MAX_APPLICATION_NAME_SIZE - 1);
+	instanceInfo.applicationInfo.applicationName[XR_MAX_APPLICATION_NAME_SIZE - 1] = '\0';
+
+	instanceInfo.applicationInfo.apiVersion = XR_CURRENT_API_VERSION;
+	instanceInfo.enabledExtensionCount = sizeof(extensions) / sizeof(extensions[0]);
+	instanceInfo.enabledExtensionNames = extensions;
+
+	XrResult result = xrCreateInstance(&instanceInfo, &state.instance);
+
+	if (XR_FAILED(result)) {
+		ALOGE("Failed to initialize OpenXR instance (%d), does the runtime support %s?", result,
+		      XR_MNDX_EGL_ENABLE_EXTENSION_NAME);
+		return EXIT_FAILURE;
+	}
+
+	// OpenXR system
+
+	XrSystemGetInfo systemInfo = {.type = XR_TYPE_SYSTEM_GET_INFO,
+	                              .formFactor = XR_FORM_FACTOR_HEAD_MOUNTED_DISPLAY};
+
+	result = xrGetSystem(state.instance, &systemInfo, &state.system);
+
+	if (XR_FAILED(result)) {
+		ALOGE("Failed to get OpenXR system (%d)", result);
+		return EXIT_FAILURE;
+	}
+
+	XrViewConfigurationView viewInfo[2] = {};
+	viewInfo[0].type = XR_TYPE_VIEW_CONFIGURATION_VIEW;
+	viewInfo[1].type = XR_TYPE_VIEW_CONFIGURATION_VIEW;
+
+	uint32_t viewCount = 0;
+	result = xrEnumerateViewConfigurationViews(state.instance, state.system,
+	                                           XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO, 2, &viewCount, viewInfo);
+
+	if (XR_FAILED(result) || viewCount != 2) {
+		ALOGE("Failed to enumerate view configuration views");
+		return EXIT_FAILURE;
+	}
+
+	state.width = viewInfo[0].recommendedImageRectWidth;
+	state.height = viewInfo[0].recommendedImageRectHeight;
+
+	// OpenXR session
+	ALOGI("Creating OpenXR session...");
+	PFN_xrGetOpenGLESGraphicsRequirementsKHR xrGetOpenGLESGraphicsRequirementsKHR = NULL;
+	XR_LOAD(xrGetOpenGLESGraphicsRequirementsKHR);
+	XrGraphicsRequirementsOpenGLESKHR graphicsRequirements = {.type = XR_TYPE_GRAPHICS_REQUIREMENTS_OPENGL_ES_KHR};
+	xrGetOpenGLESGraphicsRequirementsKHR(state.instance, state.system, &graphicsRequirements);
+
+	XrGraphicsBindingEGLMNDX graphicsBinding = {
+	    .type = XR_TYPE_GRAPHICS_BINDING_EGL_MNDX,
+	    .getProcAddress = eglGetProcAddress,
+	    .display = initialEglData->display,
+	    .config = initialEglData->config,
+	    .context = initialEglData->context,
+	};
+
+	XrSessionCreateInfo sessionInfo = {
+	    .type = XR_TYPE_SESSION_CREATE_INFO, .next = &graphicsBinding, .systemId = state.system};
+
+	result = xrCreateSession(state.instance, &sessionInfo, &state.session);
+
+	if (XR_FAILED(result)) {
+		ALOGE("ERROR: Failed to create OpenXR session (%d)", result);
+		return EXIT_FAILURE;
+	}
+
+	//
+	// End of normal OpenXR app startup
+	//
+
+	//
+	// Start of remote-rendering-specific code
+	//
+
+	// Set up gstreamer
+	gst_init(&argc, &argv);
+
+	em_remote_client remote_client = {};
+	if (!remote_client_start(state, *initialEglData, remote_client)) {
+		return EXIT_FAILURE;
+	}
+	em_remote_experience_set_late_latch(remote_client.experience, late_latch);
+	em_remote_experience_set_tracking_rate(remote_client.experience, tracking_hz);
+	em_remote_experience_set_multiview(remote_client.experience, multiview);
+
+	//
+	// End of remote-rendering-specific setup, into main loop
+	//
+
+	// Main rendering loop.
+	ALOGI("DEBUG: Starting main loop.");
+	uint64_t new_frames = 0;
+	int exit_code = EXIT_SUCCESS;
+	while (!quit_requested) {
+		bool ready = poll_xr_events(state);
+		if (state.sessionState == XR_SESSION_STATE_EXITING || state.sessionState == XR_SESSION_STATE_LOSS_PENDING) {
+			ALOGI("%s: OpenXR session is ending, quitting", __FUNCTION__);
+			break;
+		}
+		if (!ready || quit_requested) {
+			continue;
+		}
+
+		EmPollRenderResult res = em_remote_experience_poll_and_render_frame(remote_client.experience);
+		if (em_poll_render_result_is_error(res)) {
+			ALOGE("%s: Render loop failed: %s", __FUNCTION__, em_poll_render_result_to_string(res));
+			exit_code = EXIT_FAILURE;
+			break;
+		}
+		if (res == EM_POLL_RENDER_RESULT_NEW_SAMPLE) {
+			new_frames++;
+			if (frame_limit != 0 && new_frames >= frame_limit) {
+				ALOGI("%s: Rendered %llu frames, quitting", __FUNCTION__, (unsigned long long)new_frames);
+				break;
+			}
+		}
+	}
+
+	ALOGI("DEBUG: Exited main loop, cleaning up.");
+	//
+	// Clean up RR structures
+	//
+
+	remote_client_stop(state, remote_client);
+
+	//
+	// End RR cleanup
+	//
+
+	xrDestroySession(state.session);
+	xrDestroyInstance(state.instance);
+
+	initialEglData = nullptr;
+
+	return exit_code;
+}
@@ -0,0 +1,325 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Tests and benchmarks for the compact tracking encoding
+ */
+
+#include "em_compact_tracking.h"
+
+#include <pb_encode.h>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_approx.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <cmath>
+#include <random>
+#include <utility>
+
+namespace {
+
+constexpr float kPositionTolerance = 0.5f / EM_COMPACT_TRACKING_POSITION_SCALE + 1e-6f;
+
+em_proto_Quaternion
+random_orientation(std::mt19937 &rng)
+{
+	std::normal_distribution<float> dist;
+	em_proto_Quaternion q{dist(rng), dist(rng), dist(rng), dist(rng)};
+	float len = std::sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+	q.w /= len;
+	q.x /= len;
+	q.y /= len;
+	q.z /= len;
+	return q;
+}
+
+em_proto_Pose
+random_pose(std::mt19937 &rng)
+{
+	std::uniform_real_distribution<float> dist(-2.f, 2.f);
+	em_proto_Pose pose = em_proto_Pose_init_default;
+	pose.has_position = true;
+	pose.position = {dist(rng), dist(rng), dist(rng)};
+	pose.has_orientation = true;
+	pose.orientation = random_orientation(rng);
+	return pose;
+}
+
+em_proto_TrackingMessage
+make_tracking(std::mt19937 &rng, int64_t sequence_idx, bool controllers)
+{
+	em_proto_TrackingMessage msg = em_proto_TrackingMessage_init_default;
+	msg.has_P_localSpace_viewSpace = true;
+	msg.P_localSpace_viewSpace = random_pose(rng);
+	msg.has_P_viewSpace_view0 = true;
+	msg.P_viewSpace_view0 = random_pose(rng);
+	msg.has_P_viewSpace_view1 = true;
+	msg.P_viewSpace_view1 = random_pose(rng);
+	if (controllers) {
+		msg.has_P_local_controller_grip_left = true;
+		msg.P_local_controller_grip_left = random_pose(rng);
+		msg.has_controller_aim_left = true;
+		msg.controller_aim_left = random_pose(rng);
+		msg.has_controller_grip_right = true;
+		msg.controller_grip_right = random_pose(rng);
+		msg.has_controller_aim_right = true;
+		msg.controller_aim_right = random_pose(rng);
+	}
+	msg.timestamp = sequence_idx * 11111111;
+	msg.sequence_idx = sequence_idx;
+	return msg;
+}
+
+//! Angle in radians between two unit quaternions.
+double
+angle_between(const em_proto_Quaternion &a, const em_proto_Quaternion &b)
+{
+	// acos of the dot product can't resolve angles this small, so use the half-angle form.
+	double dot = double(a.w) * b.w + double(a.x) * b.x + double(a.y) * b.y + double(a.z) * b.z;
+	double sign = dot < 0. ? -1. : 1.;
+	double diff = 0.;
+	double sum = 0.;
+	for (auto [x, y] : {std::pair<double, double>{a.w, b.w}, {a.x, b.x}, {a.y, b.y}, {a.z, b.z}}) {
+		diff += (x - sign * y) * (x - sign * y);
+		sum += (x + sign * y) * (x + sign * y);
+	}
+	return 4. * std::atan2(std::sqrt(diff), std::sqrt(sum));
+}
+
+//! 16 bit components are good for well below a hundredth of a degree.
+constexpr double kAngleTolerance = 0.01 * M_PI / 180.;
+
+void
+check_pose(const em_proto_Pose &expected, const em_proto_Pose &actual)
+{
+	REQUIRE(actual.has_position);
+	REQUIRE(actual.has_orientation);
+	CHECK(actual.position.x == Catch::Approx(expected.position.x).margin(kPositionTolerance));
+	CHECK(actual.position.y == Catch::Approx(expected.position.y).margin(kPositionTolerance));
+	CHECK(actual.position.z == Catch::Approx(expected.position.z).margin(kPositionTolerance));
+	CHECK(angle_between(expected.orientation, actual.orientation) < kAngleTolerance);
+}
+
+void
+check_tracking(const em_proto_TrackingMessage &expected, const em_proto_TrackingMessage &actual)
+{
+	CHECK(actual.sequence_idx == expected.sequence_idx);
+	CHECK(actual.timestamp == expected.timestamp);
+	REQUIRE(actual.has_P_localSpace_viewSpace == expected.has_P_localSpace_viewSpace);
+	check_pose(expected.P_localSpace_viewSpace, actual.P_localSpace_viewSpace);
+	check_pose(expected.P_viewSpace_view0, actual.P_viewSpace_view0);
+	check_pose(expected.P_viewSpace_view1, actual.P_viewSpace_view1);
+	REQUIRE(actual.has_controller_aim_right == expected.has_controller_aim_right);
+	if (expected.has_controller_aim_right) {
+		check_pose(expected.controller_aim_right, actual.controller_aim_right);
+	}
+}
+
+} // namespace
+
+TEST_CASE("compact_orientation")
+{
+	std::mt19937 rng(1234);
+
+	SECTION("identity")
+	{
+		em_proto_Quaternion identity{1.f, 0.f, 0.f, 0.f};
+		em_proto_Quaternion out{};
+		em_compact_tracking_unpack_orientation(em_compact_tracking_pack_orientation(&identity), &out);
+		CHECK(angle_between(identity, out) < kAngleTolerance);
+	}
+
+	SECTION("random")
+	{
+		for (int i = 0; i < 10000; i++) {
+			em_proto_Quaternion q = random_orientation(rng);
+			em_proto_Quaternion out{};
+			em_compact_tracking_unpack_orientation(em_compact_tracking_pack_orientation(&q), &out);
+			CHECK(angle_between(q, out) < kAngleTolerance);
+		}
+	}
+}
+
+TEST_CASE("compact_tracking")
+{
+	std::mt19937 rng(42);
+	em_compact_tracking_encoder enc;
+	em_compact_tracking_decoder dec;
+	em_compact_tracking_encoder_init(&enc, 4);
+	em_compact_tracking_decoder_init(&dec);
+
+	em_proto_CompactTrackingMessage compact = em_proto_CompactTrackingMessage_init_default;
+	em_proto_TrackingMessage decoded = em_proto_TrackingMessage_init_default;
+
+	SECTION("round trip across keyframes")
+	{
+		for (int64_t seq = 1; seq <= 20; seq++) {
+			em_proto_TrackingMessage msg = make_tracking(rng, seq, seq > 6);
+			em_compact_tracking_encode(&enc, &msg, &compact);
+
+			// Start of stream, keyframe interval, and the controllers appearing all force keyframes.
+			bool keyframe = compact.keyframe_sequence_idx == compact.sequence_idx;
+			if (seq == 1 || seq == 6 || seq == 7) {
+				CHECK(keyframe);
+			}
+
+			REQUIRE(em_compact_tracking_decode(&dec, &compact, &decoded) == EM_COMPACT_TRACKING_OK);
+			check_tracking(msg, decoded);
+		}
+	}
+
+	SECTION("lost keyframe is detected")
+	{
+		em_proto_TrackingMessage msg = make_tracking(rng, 1, false);
+		em_compact_tracking_encode(&enc, &msg, &compact); // keyframe, "lost"
+
+		msg = make_tracking(rng, 2, false);
+		em_compact_tracking_encode(&enc, &msg, &compact);
+		CHECK(em_compact_tracking_decode(&dec, &compact, &decoded) == EM_COMPACT_TRACKING_MISSING_KEYFRAME);
+
+		em_compact_tracking_encoder_force_keyframe(&enc);
+		msg = make_tracking(rng, 3, false);
+		em_compact_tracking_encode(&enc, &msg, &compact);
+		REQUIRE(em_compact_tracking_decode(&dec, &compact, &decoded) == EM_COMPACT_TRACKING_OK);
+		check_tracking(msg, decoded);
+	}
+
+	SECTION("late keyframe does not replace a newer one")
+	{
+		em_proto_TrackingMessage first = make_tracking(rng, 1, false);
+		em_proto_CompactTrackingMessage late_keyframe;
+		em_compact_tracking_encode(&enc, &first, &late_keyframe);
+
+		em_compact_tracking_encoder_force_keyframe(&enc);
+		em_proto_TrackingMessage second = make_tracking(rng, 2, false);
+		em_compact_tracking_encode(&enc, &second, &compact);
+		REQUIRE(em_compact_tracking_decode(&dec, &compact, &decoded) == EM_COMPACT_TRACKING_OK);
+
+		// Arrives out of order, decodes on its own.
+		REQUIRE(em_compact_tracking_decode(&dec, &late_keyframe, &decoded) == EM_COMPACT_TRACKING_OK);
+		check_tracking(first, decoded);
+
+		// Deltas against the newer keyframe still work.
+		em_proto_TrackingMessage third = make_tracking(rng, 3, false);
+		em_compact_tracking_encode(&enc, &third, &compact);
+		CHECK(compact.keyframe_sequence_idx == 2);
+		REQUIRE(em_compact_tracking_decode(&dec, &compact, &decoded) == EM_COMPACT_TRACKING_OK);
+		check_tracking(third, decoded);
+	}
+
+	SECTION("pipelined pose needs version 2")
+	{
+		em_proto_TrackingMessage msg = make_tracking(rng, 1, false);
+		em_compact_tracking_encode(&enc, &msg, &compact);
+		CHECK(compact.version == 1);
+
+		msg = make_tracking(rng, 2, false);
+		msg.has_P_localSpace_viewSpace_pipelined = true;
+		msg.P_localSpace_viewSpace_pipelined = random_pose(rng);
+		msg.pipelined_timestamp = msg.timestamp + 60000000;
+		em_compact_tracking_encode(&enc, &msg, &compact);
+		CHECK(compact.version == 2);
+		CHECK(compact.keyframe_sequence_idx == 2);
+		REQUIRE(em_compact_tracking_decode(&dec, &compact, &decoded) == EM_COMPACT_TRACKING_OK);
+		check_tracking(msg, decoded);
+		REQUIRE(decoded.has_P_localSpace_viewSpace_pipelined);
+		check_pose(msg.P_localSpace_viewSpace_pipelined, decoded.P_localSpace_viewSpace_pipelined);
+		CHECK(decoded.pipelined_timestamp == msg.pipelined_timestamp);
+
+		// A version 1 message can't claim the eighth pose.
+		em_proto_CompactTrackingMessage bad = compact;
+		bad.version = 1;
+		CHECK(em_compact_tracking_decode(&dec, &bad, &decoded) == EM_COMPACT_TRACKING_MALFORMED);
+	}
+
+	SECTION("missing parts stay missing")
+	{
+		em_proto_TrackingMessage msg = make_tracking(rng, 1, true);
+		msg.P_viewSpace_view0.has_position = false;
+		msg.controller_aim_right.has_orientation = false;
+		em_compact_tracking_encode(&enc, &msg, &compact);
+		REQUIRE(em_compact_tracking_decode(&dec, &compact, &decoded) == EM_COMPACT_TRACKING_OK);
+
+		CHECK_FALSE(decoded.P_viewSpace_view0.has_position);
+		CHECK(decoded.P_viewSpace_view0.has_orientation);
+		CHECK(decoded.controller_aim_right.has_position);
+		CHECK_FALSE(decoded.controller_aim_right.has_orientation);
+		CHECK(decoded.P_localSpace_viewSpace.has_position);
+		CHECK(decoded.P_localSpace_viewSpace.has_orientation);
+	}
+
+	SECTION("bad input")
+	{
+		em_proto_TrackingMessage msg = make_tracking(rng, 1, false);
+		em_compact_tracking_encode(&enc, &msg, &compact);
+
+		em_proto_CompactTrackingMessage bad = compact;
+		bad.version = EM_COMPACT_TRACKING_VERSION + 1;
+		CHECK(em_compact_tracking_decode(&dec, &bad, &decoded) == EM_COMPACT_TRACKING_UNSUPPORTED_VERSION);
+
+		bad = compact;
+		bad.poses_count--;
+		CHECK(em_compact_tracking_decode(&dec, &bad, &decoded) == EM_COMPACT_TRACKING_MALFORMED);
+	}
+
+	SECTION("smaller on the wire")
+	{
+		em_compact_tracking_encoder_init(&enc, EM_COMPACT_TRACKING_DEFAULT_KEYFRAME_INTERVAL);
+
+		// Head and hands move around a millimeter per frame.
+		std::uniform_real_distribution<float> step(-0.001f, 0.001f);
+		em_proto_TrackingMessage msg = make_tracking(rng, 1, true);
+
+		size_t full_size = 0;
+		size_t compact_size = 0;
+		for (int64_t seq = 1; seq <= 90; seq++) {
+			for (em_proto_Pose *pose : {&msg.P_localSpace_viewSpace, &msg.P_viewSpace_view0, &msg.P_viewSpace_view1,
+			                            &msg.P_local_controller_grip_left, &msg.controller_aim_left,
+			                            &msg.controller_grip_right, &msg.controller_aim_right}) {
+				pose->position.x += step(rng);
+				pose->position.y += step(rng);
+				pose->position.z += step(rng);
+			}
+			msg.timestamp = seq * 11111111;
+			msg.sequence_idx = seq;
+			em_compact_tracking_encode(&enc, &msg, &compact);
+
+			size_t size = 0;
+			REQUIRE(pb_get_encoded_size(&size, em_proto_TrackingMessage_fields, &msg));
+			full_size += size;
+			REQUIRE(pb_get_encoded_size(&size, em_proto_CompactTrackingMessage_fields, &compact));
+			compact_size += size;
+		}
+		// Roughly 45%, the orientations dominate.
+		CHECK(compact_size * 10 < full_size * 6);
+	}
+}
+
+TEST_CASE("compact_tracking throughput", "[!benchmark]")
+{
+	std::mt19937 rng(7);
+	em_compact_tracking_encoder enc;
+	em_compact_tracking_decoder dec;
+	em_compact_tracking_encoder_init(&enc, EM_COMPACT_TRACKING_DEFAULT_KEYFRAME_INTERVAL);
+	em_compact_tracking_decoder_init(&dec);
+
+	em_proto_TrackingMessage msg = make_tracking(rng, 1, true);
+	em_proto_CompactTrackingMessage compact = em_proto_CompactTrackingMessage_init_default;
+	em_proto_TrackingMessage decoded = em_proto_TrackingMessage_init_default;
+
+	BENCHMARK("encode")
+	{
+		msg.sequence_idx++;
+		em_compact_tracking_encode(&enc, &msg, &compact);
+		return compact.poses_count;
+	};
+
+	BENCHMARK("encode + decode")
+	{
+		msg.sequence_idx++;
+		em_compact_tracking_encode(&enc, &msg, &compact);
+		return em_compact_tracking_decode(&dec, &compact, &decoded);
+	};
+}
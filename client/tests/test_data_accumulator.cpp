@@ -4,6 +4,7 @@
  * @file
  */
 
+#include "catch2/benchmark/catch_benchmark.hpp"
 #include "catch2/catch_message.hpp"
 #include "catch2/catch_test_macros.hpp"
 #include "catch2/matchers/catch_matchers_quantifiers.hpp"
@@ -14,6 +15,7 @@
 #include <cstdint>
 #include <initializer_list>
 #include <iterator>
+#include <memory>
 #include <vector>
 
 static constexpr std::size_t MaxElts = 3;
@@ -32,13 +34,36 @@ constexpr IdType kOldId = 5;
 static_assert(kOldId < kGoodId[0],
               "the old ID must be less than the smallest good ID");
 
-std::vector<IdType>
-visitIds(em::IdDataAccumulator<MyData, MaxElts> const &accum) {
+template <typename Accum> std::vector<IdType> visitIds(Accum const &accum) {
   std::vector<IdType> ids;
   accum.constVisitAll([&](IdType id, MyData const &) { ids.emplace_back(id); });
   return ids;
 }
 
+/// What FrameDataAccumulator does for each frame: add it, fill in an earlier
+/// one, and emit and drop what's complete.
+template <typename Accum, IdType Lag> IdType simulateFrame(Accum &accum, IdType &nextId) {
+  IdType id = nextId++;
+  accum.addDataFor(id, MyData{true, false});
+  accum.updateDataFor(id - Lag, [](MyData &data) { data.b = true; });
+  IdType emitted = 0;
+  accum.visitAll([&](IdType visitedId, MyData &data) {
+    if (data.a && data.b) {
+      emitted = visitedId;
+      return em::id_data_accum::Command::Drop;
+    }
+    return em::id_data_accum::Command::Keep;
+  });
+  return emitted;
+}
+
+template <typename Accum> void benchmarkFrames(const char *name) {
+  // The big ones don't fit on the stack comfortably.
+  auto accum = std::make_unique<Accum>();
+  IdType nextId = 1;
+  BENCHMARK(name) { return simulateFrame<Accum, 2>(*accum, nextId); };
+}
+
 } // namespace
 
 TEST_CASE("IdData") {
@@ -269,3 +294,112 @@ TEST_CASE("IdData") {
     }
   }
 }
+
+TEST_CASE("RingIdData") {
+  em::RingIdDataAccumulator<MyData, MaxElts> accum{};
+
+  CHECK(accum.size() == 0);
+  CHECK(accum.addDataFor(kGoodId[0], {}));
+  CHECK(accum.addDataFor(kGoodId[1], {}));
+  CHECK(accum.addDataFor(kGoodId[2], {}));
+  CHECK(accum.size() == 3);
+  CHECK(accum.getConstForId(kGoodId[0]));
+  CHECK(accum.getConstForId(kGoodId[1]));
+  CHECK(accum.getConstForId(kGoodId[2]));
+  CHECK_FALSE(accum.getConstForId(kGoodId[3]));
+  CHECK_FALSE(accum.getConstForId(kOldId));
+
+  SECTION("Reject duplicate IDs") {
+    CHECK_THROWS(accum.addDataFor(kGoodId[1], {}));
+  }
+
+  SECTION("Reject sentinel ID") {
+    CHECK_THROWS(accum.addDataFor(em::id_data_accum::kSentinel, {}));
+    CHECK_FALSE(accum.getConstForId(em::id_data_accum::kSentinel));
+  }
+
+  SECTION("Reject older than what is in its slot") {
+    const IdType sharesSlot = kGoodId[0] - static_cast<IdType>(MaxElts);
+    INFO(sharesSlot << " shares a slot with " << kGoodId[0]);
+    CHECK_FALSE(accum.addDataFor(sharesSlot, {}));
+    CHECK(accum.size() == 3);
+    CHECK(accum.getConstForId(kGoodId[0]));
+  }
+
+  SECTION("Newer additional value replaces the one in its slot") {
+    CHECK(accum.addDataFor(kGoodId[3], {}));
+    CHECK(accum.size() == 3);
+    CHECK(nullptr == accum.getConstForId(kGoodId[0]));
+    CHECK(accum.getConstForId(kGoodId[3]));
+    CHECK_THAT(visitIds(accum),
+               Catch::Matchers::UnorderedRangeEquals(
+                   std::initializer_list<IdType>{kGoodId[1], kGoodId[2],
+                                                 kGoodId[3]}));
+  }
+
+  SECTION("Modify values") {
+    accum.getForId(kGoodId[1])->a = true;
+    CHECK(accum.updateDataFor(kGoodId[2], [](MyData &data) { data.b = true; }));
+    CHECK_FALSE(accum.updateDataFor(kGoodId[3], [](MyData &data) { data.b = true; }));
+    CHECK(accum.getConstForId(kGoodId[1])->a);
+    CHECK_FALSE(accum.getConstForId(kGoodId[1])->b);
+    CHECK(accum.getConstForId(kGoodId[2])->b);
+    CHECK_FALSE(accum.getConstForId(kGoodId[0])->a);
+  }
+
+  SECTION("Visited oldest first") {
+    CHECK_THAT(visitIds(accum),
+               Catch::Matchers::RangeEquals(std::initializer_list<IdType>{
+                   kGoodId[0], kGoodId[1], kGoodId[2]}));
+  }
+
+  SECTION("Drop values") {
+    bool anyLeft = accum.visitAll([](IdType id, MyData &) {
+      if (id == kGoodId[1]) {
+        return em::id_data_accum::Command::Drop;
+      }
+      return em::id_data_accum::Command::Keep;
+    });
+    CHECK(anyLeft);
+    CHECK(accum.size() == 2);
+    CHECK_FALSE(accum.getConstForId(kGoodId[1]));
+
+    anyLeft = accum.visitAll(
+        [](IdType, MyData &) { return em::id_data_accum::Command::Drop; });
+    CHECK_FALSE(anyLeft);
+    CHECK(accum.size() == 0);
+    CHECK(visitIds(accum).empty());
+  }
+
+  SECTION("Skipped IDs") {
+    const IdType farAhead = kGoodId[2] + 10 * static_cast<IdType>(MaxElts);
+    CHECK(accum.addDataFor(farAhead, {}));
+    CHECK(accum.size() == 3);
+    CHECK(accum.getConstForId(farAhead));
+    CHECK_THAT(visitIds(accum),
+               Catch::Matchers::UnorderedRangeEquals(
+                   std::initializer_list<IdType>{kGoodId[0], kGoodId[1],
+                                                 farAhead}));
+  }
+
+  SECTION("Keeps up with a long run of frames") {
+    em::RingIdDataAccumulator<MyData, 64> big{};
+    IdType nextId = 1;
+    for (int i = 0; i < 1000; i++) {
+      IdType emitted = simulateFrame<decltype(big), 2>(big, nextId);
+      if (i >= 2) {
+        CHECK(emitted == nextId - 3);
+      }
+    }
+    CHECK(big.size() == 2);
+  }
+}
+
+TEST_CASE("IdData vs RingIdData", "[!benchmark]") {
+  benchmarkFrames<em::IdDataAccumulator<MyData, 5>>("linear, 5");
+  benchmarkFrames<em::RingIdDataAccumulator<MyData, 5>>("ring, 5");
+  benchmarkFrames<em::IdDataAccumulator<MyData, 64>>("linear, 64");
+  benchmarkFrames<em::RingIdDataAccumulator<MyData, 64>>("ring, 64");
+  benchmarkFrames<em::IdDataAccumulator<MyData, 512>>("linear, 512");
+  benchmarkFrames<em::RingIdDataAccumulator<MyData, 512>>("ring, 512");
+}
@@ -0,0 +1,115 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Tests for batching frame timing reports
+ */
+
+#include "em/em_frame_report_batch.h"
+
+#include <pb_decode.h>
+#include <pb_encode.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+
+namespace {
+
+constexpr int64_t kMs = 1000 * 1000;
+
+em_proto_UpFrameMessage
+make_frame(int64_t frame_id)
+{
+	em_proto_UpFrameMessage frame = em_proto_UpFrameMessage_init_default;
+	frame.frame_sequence_id = frame_id;
+	frame.decode_complete_time = frame_id * 11 * kMs;
+	frame.display_time = frame_id * 11 * kMs + 5 * kMs;
+	return frame;
+}
+
+} // namespace
+
+TEST_CASE("frame_report_batch")
+{
+	em_frame_report_batch b;
+	em_frame_report_batch_init(&b, 3, 50 * kMs);
+
+	SECTION("nothing to send when empty")
+	{
+		em_proto_UpMessage message = em_proto_UpMessage_init_default;
+		CHECK_FALSE(em_frame_report_batch_due(&b, 1000 * kMs));
+		CHECK_FALSE(em_frame_report_batch_take(&b, &message));
+	}
+
+	SECTION("due once enough frames are waiting")
+	{
+		for (int64_t id = 1; id <= 2; id++) {
+			em_proto_UpFrameMessage frame = make_frame(id);
+			REQUIRE(em_frame_report_batch_add(&b, &frame, id * kMs));
+			CHECK_FALSE(em_frame_report_batch_due(&b, id * kMs));
+		}
+		em_proto_UpFrameMessage frame = make_frame(3);
+		REQUIRE(em_frame_report_batch_add(&b, &frame, 3 * kMs));
+		CHECK(em_frame_report_batch_due(&b, 3 * kMs));
+
+		em_proto_UpMessage message = em_proto_UpMessage_init_default;
+		REQUIRE(em_frame_report_batch_take(&b, &message));
+		REQUIRE(message.frames_count == 3);
+		CHECK(message.frames[0].frame_sequence_id == 1);
+		CHECK(message.frames[2].frame_sequence_id == 3);
+		CHECK(b.count == 0);
+		CHECK_FALSE(em_frame_report_batch_due(&b, 3 * kMs));
+	}
+
+	SECTION("due once the oldest waited long enough")
+	{
+		em_proto_UpFrameMessage frame = make_frame(1);
+		REQUIRE(em_frame_report_batch_add(&b, &frame, 10 * kMs));
+		CHECK_FALSE(em_frame_report_batch_due(&b, 59 * kMs));
+		CHECK(em_frame_report_batch_due(&b, 60 * kMs));
+	}
+
+	SECTION("the frame count is limited to what a message carries")
+	{
+		em_frame_report_batch_init(&b, 1000, 50 * kMs);
+		CHECK(b.max_frames == EM_FRAME_REPORT_BATCH_CAPACITY);
+
+		for (int64_t id = 1; id <= (int64_t)EM_FRAME_REPORT_BATCH_CAPACITY; id++) {
+			em_proto_UpFrameMessage frame = make_frame(id);
+			REQUIRE(em_frame_report_batch_add(&b, &frame, 0));
+		}
+		em_proto_UpFrameMessage frame = make_frame(99);
+		CHECK_FALSE(em_frame_report_batch_add(&b, &frame, 0));
+		CHECK(em_frame_report_batch_due(&b, 0));
+	}
+
+	SECTION("a full batch survives the wire")
+	{
+		em_frame_report_batch_init(&b, EM_FRAME_REPORT_BATCH_CAPACITY, 50 * kMs);
+		for (int64_t id = 1; id <= (int64_t)EM_FRAME_REPORT_BATCH_CAPACITY; id++) {
+			em_proto_UpFrameMessage frame = make_frame(id);
+			REQUIRE(em_frame_report_batch_add(&b, &frame, 0));
+		}
+
+		em_proto_UpMessage sent = em_proto_UpMessage_init_default;
+		REQUIRE(em_frame_report_batch_take(&b, &sent));
+
+		uint8_t buffer[em_proto_UpMessage_size];
+		pb_ostream_t os = pb_ostream_from_buffer(buffer, sizeof(buffer));
+		REQUIRE(pb_encode(&os, &em_proto_UpMessage_msg, &sent));
+
+		em_proto_UpMessage received = em_proto_UpMessage_init_default;
+		pb_istream_t is = pb_istream_from_buffer(buffer, os.bytes_written);
+		REQUIRE(pb_decode(&is, &em_proto_UpMessage_msg, &received));
+
+		CHECK_FALSE(received.has_frame);
+		REQUIRE(received.frames_count == EM_FRAME_REPORT_BATCH_CAPACITY);
+		for (uint32_t i = 0; i < received.frames_count; i++) {
+			CHECK(received.frames[i].frame_sequence_id == sent.frames[i].frame_sequence_id);
+			CHECK(received.frames[i].decode_complete_time == sent.frames[i].decode_complete_time);
+			CHECK(received.frames[i].display_time == sent.frames[i].display_time);
+		}
+	}
+}
@@ -0,0 +1,53 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Tests for the late latch render scheduling
+ */
+
+#include "em/em_late_latch.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+
+namespace {
+
+constexpr int64_t kMs = 1000 * 1000;
+constexpr int64_t kPeriod = 11'111'111; // 90 Hz
+
+} // namespace
+
+TEST_CASE("late_latch")
+{
+	em_late_latch ll{};
+	em_late_latch_init(&ll, 1 * kMs);
+
+	SECTION("starts late enough for the render cost and margin")
+	{
+		for (int i = 0; i < 400; i++) {
+			em_late_latch_record(&ll, 3 * kMs);
+		}
+		CHECK(em_late_latch_start_time(&ll, 100 * kMs, kPeriod) == 100 * kMs + kPeriod - 4 * kMs);
+	}
+
+	SECTION("a costlier frame is taken into account right away")
+	{
+		em_late_latch_record(&ll, 7 * kMs);
+		CHECK(ll.cost_ns == 7 * kMs);
+	}
+
+	SECTION("a single cheap frame barely moves the estimate")
+	{
+		em_late_latch_record(&ll, 8 * kMs);
+		em_late_latch_record(&ll, 0);
+		CHECK(ll.cost_ns == 8 * kMs - kMs / 2);
+	}
+
+	SECTION("never starts before the frame does")
+	{
+		em_late_latch_record(&ll, 20 * kMs);
+		CHECK(em_late_latch_start_time(&ll, 100 * kMs, kPeriod) == 100 * kMs);
+	}
+}
@@ -0,0 +1,226 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Tests and benchmarks for the latency histogram
+ */
+
+#include "em_latency_histogram.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int64_t kUs = 1000;
+
+std::unique_ptr<em_latency_histogram>
+make_histogram()
+{
+	return std::make_unique<em_latency_histogram>(em_latency_histogram{});
+}
+
+//! Within the bucket precision of @p expected_us.
+bool
+close_enough(uint64_t actual_us, uint64_t expected_us)
+{
+	uint64_t diff = actual_us > expected_us ? actual_us - expected_us : expected_us - actual_us;
+	return diff * (1u << EM_LATENCY_HISTOGRAM_SUB_BITS) <= expected_us;
+}
+
+} // namespace
+
+TEST_CASE("latency_histogram buckets")
+{
+	SECTION("small values are exact")
+	{
+		for (uint64_t us = 0; us < (1u << EM_LATENCY_HISTOGRAM_SUB_BITS); us++) {
+			uint32_t i = em_latency_histogram_bucket_for(us);
+			CHECK(em_latency_histogram_bucket_lower_us(i) == us);
+			CHECK(em_latency_histogram_bucket_width_us(i) == 1);
+		}
+	}
+
+	SECTION("buckets tile the range without gaps")
+	{
+		for (uint32_t i = 0; i + 1 < EM_LATENCY_HISTOGRAM_BUCKET_COUNT; i++) {
+			uint64_t lower = em_latency_histogram_bucket_lower_us(i);
+			uint64_t width = em_latency_histogram_bucket_width_us(i);
+
+			CHECK(em_latency_histogram_bucket_for(lower) == i);
+			CHECK(em_latency_histogram_bucket_for(lower + width - 1) == i);
+			CHECK(em_latency_histogram_bucket_lower_us(i + 1) == lower + width);
+
+			// Relative precision holds everywhere.
+			CHECK(width * (1u << EM_LATENCY_HISTOGRAM_SUB_BITS) <= lower + (1u << EM_LATENCY_HISTOGRAM_SUB_BITS));
+		}
+	}
+
+	SECTION("huge values land in the last bucket")
+	{
+		CHECK(em_latency_histogram_bucket_for(UINT64_MAX) == EM_LATENCY_HISTOGRAM_BUCKET_COUNT - 1);
+		CHECK(em_latency_histogram_bucket_for(uint64_t(1) << EM_LATENCY_HISTOGRAM_MAX_BITS) ==
+		      EM_LATENCY_HISTOGRAM_BUCKET_COUNT - 1);
+	}
+}
+
+TEST_CASE("latency_histogram")
+{
+	auto h = make_histogram();
+
+	SECTION("empty")
+	{
+		CHECK(em_latency_histogram_quantile_us(h.get(), 0.5) == 0);
+		CHECK(em_latency_histogram_mean_us(h.get()) == 0.0);
+	}
+
+	SECTION("quantiles of a uniform spread")
+	{
+		for (int64_t us = 1; us <= 10000; us++) {
+			em_latency_histogram_record_ns(h.get(), us * kUs);
+		}
+
+		CHECK(h->total == 10000);
+		CHECK(h->max_us == 10000);
+		CHECK(em_latency_histogram_mean_us(h.get()) == 5000.5);
+		CHECK(close_enough(em_latency_histogram_quantile_us(h.get(), 0.5), 5000));
+		CHECK(close_enough(em_latency_histogram_quantile_us(h.get(), 0.9), 9000));
+		CHECK(close_enough(em_latency_histogram_quantile_us(h.get(), 0.99), 9900));
+		CHECK(em_latency_histogram_quantile_us(h.get(), 1.0) == 10000);
+		CHECK(em_latency_histogram_quantile_us(h.get(), 0.0) == 1);
+	}
+
+	SECTION("a single value is reported as itself")
+	{
+		em_latency_histogram_record_ns(h.get(), 11111 * kUs);
+		CHECK(em_latency_histogram_quantile_us(h.get(), 0.5) == 11111);
+	}
+
+	SECTION("negative values count as zero")
+	{
+		em_latency_histogram_record_ns(h.get(), -5 * kUs);
+		CHECK(h->counts[0] == 1);
+		CHECK(h->sum_us == 0);
+	}
+
+	SECTION("drain moves everything and leaves the recorder empty")
+	{
+		for (int64_t ms = 1; ms <= 20; ms++) {
+			em_latency_histogram_record_ns(h.get(), ms * 1000 * kUs);
+		}
+
+		auto snapshot = make_histogram();
+		em_latency_histogram_drain(h.get(), snapshot.get());
+
+		CHECK(snapshot->total == 20);
+		CHECK(snapshot->max_us == 20000);
+		CHECK(snapshot->sum_us == 210000);
+		CHECK(h->total == 0);
+		CHECK(h->sum_us == 0);
+		CHECK(h->max_us == 0);
+		for (uint32_t i = 0; i < EM_LATENCY_HISTOGRAM_BUCKET_COUNT; i++) {
+			CHECK(h->counts[i] == 0);
+		}
+
+		// A second drain adds to what is already there.
+		em_latency_histogram_record_ns(h.get(), 30 * 1000 * kUs);
+		em_latency_histogram_drain(h.get(), snapshot.get());
+		CHECK(snapshot->total == 21);
+		CHECK(snapshot->max_us == 30000);
+	}
+
+	SECTION("per thread recorders merge into one snapshot")
+	{
+		constexpr int kThreads = 4;
+		constexpr int kPerThread = 10000;
+
+		std::vector<std::unique_ptr<em_latency_histogram>> recorders;
+		for (int t = 0; t < kThreads; t++) {
+			recorders.push_back(make_histogram());
+		}
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < kThreads; t++) {
+			threads.emplace_back([&, t] {
+				for (int i = 0; i < kPerThread; i++) {
+					em_latency_histogram_record_ns(recorders[t].get(), (t + 1) * 1000 * kUs);
+				}
+			});
+		}
+		for (auto &thread : threads) {
+			thread.join();
+		}
+
+		auto snapshot = make_histogram();
+		for (auto &recorder : recorders) {
+			em_latency_histogram_merge(snapshot.get(), recorder.get());
+		}
+
+		CHECK(snapshot->total == kThreads * kPerThread);
+		CHECK(snapshot->max_us == kThreads * 1000);
+		CHECK(close_enough(em_latency_histogram_quantile_us(snapshot.get(), 0.5), 2000));
+	}
+
+	SECTION("nothing is lost draining while another thread records")
+	{
+		constexpr int kValues = 200000;
+
+		std::thread recorder([&] {
+			for (int i = 0; i < kValues; i++) {
+				em_latency_histogram_record_ns(h.get(), (i % 5000) * kUs);
+			}
+		});
+
+		auto snapshot = make_histogram();
+		while (snapshot->total < kValues) {
+			em_latency_histogram_drain(h.get(), snapshot.get());
+		}
+		recorder.join();
+		em_latency_histogram_drain(h.get(), snapshot.get());
+
+		uint64_t bucket_total = 0;
+		for (uint32_t i = 0; i < EM_LATENCY_HISTOGRAM_BUCKET_COUNT; i++) {
+			bucket_total += snapshot->counts[i];
+		}
+		CHECK(snapshot->total == kValues);
+		CHECK(bucket_total == kValues);
+	}
+}
+
+TEST_CASE("latency_histogram throughput", "[!benchmark]")
+{
+	auto h = make_histogram();
+	auto snapshot = make_histogram();
+
+	std::mt19937 rng(7);
+	std::lognormal_distribution<double> dist(9.0, 0.5);
+	std::vector<int64_t> values;
+	for (int i = 0; i < 1024; i++) {
+		values.push_back((int64_t)dist(rng) * kUs);
+	}
+	size_t next = 0;
+
+	BENCHMARK("record")
+	{
+		em_latency_histogram_record_ns(h.get(), values[next++ % values.size()]);
+		return h->total;
+	};
+
+	BENCHMARK("drain")
+	{
+		em_latency_histogram_drain(h.get(), snapshot.get());
+		return snapshot->total;
+	};
+
+	BENCHMARK("p99 of a snapshot")
+	{
+		return em_latency_histogram_quantile_us(snapshot.get(), 0.99);
+	};
+}
@@ -0,0 +1,162 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Tests that drawing each eye into its own layer, one at a time or with multiview, matches side by side
+ *
+ * Runs on a surfaceless EGL display, and skips where there is none. The multiview part skips without
+ * GL_OVR_multiview2.
+ */
+
+#include "EglData.hpp"
+#include "em/em_reprojection.h"
+#include "em/render/render.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <EGL/egl.h>
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <vector>
+
+namespace {
+
+constexpr GLsizei kEyeWidth = 32;
+constexpr GLsizei kEyeHeight = 32;
+
+const XrFovf kFov = {-0.8f, 0.8f, -0.8f, 0.8f};
+const XrQuaternionf kIdentity = {0.0f, 0.0f, 0.0f, 1.0f};
+
+/// Side by side stream frame: red and green ramps across each eye, blue tells the eyes apart.
+GLuint
+makeStreamTexture()
+{
+	std::vector<uint8_t> pixels(2 * kEyeWidth * kEyeHeight * 4);
+	for (GLsizei y = 0; y < kEyeHeight; y++) {
+		for (GLsizei x = 0; x < 2 * kEyeWidth; x++) {
+			uint8_t *p = &pixels[(y * 2 * kEyeWidth + x) * 4];
+			p[0] = static_cast<uint8_t>((x % kEyeWidth) * 255 / (kEyeWidth - 1));
+			p[1] = static_cast<uint8_t>(y * 255 / (kEyeHeight - 1));
+			p[2] = x < kEyeWidth ? 0 : 255;
+			p[3] = 255;
+		}
+	}
+	GLuint texture = 0;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2 * kEyeWidth, kEyeHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+std::vector<uint8_t>
+readPixels(GLint x, GLsizei width)
+{
+	std::vector<uint8_t> pixels(width * kEyeHeight * 4);
+	glReadPixels(x, 0, width, kEyeHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	return pixels;
+}
+
+} // namespace
+
+TEST_CASE("multiview")
+{
+	std::unique_ptr<EglData> egl;
+	try {
+		egl = std::make_unique<EglData>();
+	} catch (std::exception const &) {
+	}
+	if (!egl || !egl->isReady()) {
+		SKIP("No EGL display to render with");
+	}
+	egl->makeCurrent();
+
+	Renderer renderer;
+	renderer.setupRender();
+	GLuint stream = makeStreamTexture();
+
+	struct em_reprojection eyes[2];
+	for (uint32_t eye = 0; eye < 2; eye++) {
+		struct em_eye_rect rect = em_eye_rect_side_by_side(eye);
+		em_reprojection_compute(&kIdentity, &kIdentity, &kFov, &rect, &eyes[eye]);
+	}
+
+	// What the frame loop draws without multiview: both eyes side by side into one wide image.
+	GLuint wide = 0;
+	glGenTextures(1, &wide);
+	glBindTexture(GL_TEXTURE_2D, wide);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 2 * kEyeWidth, kEyeHeight);
+	GLuint framebuffer = 0;
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, wide, 0);
+	REQUIRE(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	for (uint32_t eye = 0; eye < 2; eye++) {
+		glViewport(eye * kEyeWidth, 0, kEyeWidth, kEyeHeight);
+		renderer.draw(stream, GL_TEXTURE_2D, eyes, eye);
+	}
+	std::vector<uint8_t> expected[2] = {readPixels(0, kEyeWidth), readPixels(kEyeWidth, kEyeWidth)};
+	REQUIRE(glGetError() == GL_NO_ERROR);
+
+	// Each eye shows its own half of the stream.
+	size_t center = ((kEyeHeight / 2) * kEyeWidth + kEyeWidth / 2) * 4;
+	CHECK(expected[0][center + 2] == 0);
+	CHECK(expected[1][center + 2] == 255);
+
+	// What it draws by default: each eye into its own layer of an array image, one after the other.
+	GLuint layers = 0;
+	glGenTextures(1, &layers);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, layers);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, kEyeWidth, kEyeHeight, 2);
+	glViewport(0, 0, kEyeWidth, kEyeHeight);
+	for (GLint eye = 0; eye < 2; eye++) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layers, 0, eye);
+		REQUIRE(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+		renderer.draw(stream, GL_TEXTURE_2D, eyes, eye);
+	}
+	REQUIRE(glGetError() == GL_NO_ERROR);
+
+	for (GLint eye = 0; eye < 2; eye++) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layers, 0, eye);
+		CHECK(readPixels(0, kEyeWidth) == expected[eye]);
+	}
+
+	if (!renderer.supportsMultiview()) {
+		SKIP("No GL_OVR_multiview2");
+	}
+	auto framebufferTextureMultiview = reinterpret_cast<PFNGLFRAMEBUFFERTEXTUREMULTIVIEWOVRPROC>(
+	    eglGetProcAddress("glFramebufferTextureMultiviewOVR"));
+	REQUIRE(framebufferTextureMultiview != nullptr);
+
+	// What it draws with multiview: one pass into both layers, cleared so nothing drawn above is left to compare.
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	for (GLint eye = 0; eye < 2; eye++) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layers, 0, eye);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	framebufferTextureMultiview(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layers, 0, 0, 2);
+	REQUIRE(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	glViewport(0, 0, kEyeWidth, kEyeHeight);
+	renderer.drawMultiview(stream, GL_TEXTURE_2D, eyes);
+	REQUIRE(glGetError() == GL_NO_ERROR);
+
+	for (GLint eye = 0; eye < 2; eye++) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, layers, 0, eye);
+		REQUIRE(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+		CHECK(readPixels(0, kEyeWidth) == expected[eye]);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	GLuint textures[] = {stream, wide, layers};
+	glDeleteTextures(3, textures);
+	renderer.reset();
+	egl->makeNotCurrent();
+}
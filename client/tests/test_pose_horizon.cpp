@@ -0,0 +1,91 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Tests for estimating how late sent poses get shown
+ */
+
+#include "em/em_pose_horizon.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+
+namespace {
+
+constexpr int64_t kMs = 1000 * 1000;
+constexpr int64_t kPeriod = 11'111'111; // 90 Hz
+
+} // namespace
+
+TEST_CASE("pose_horizon")
+{
+	em_pose_horizon h;
+	em_pose_horizon_init(&h);
+	int64_t horizon_ns = -1;
+
+	SECTION("nothing known before a frame comes back")
+	{
+		em_pose_horizon_record_sent(&h, 1, 100 * kMs);
+		CHECK_FALSE(em_pose_horizon_get(&h, &horizon_ns));
+		CHECK(horizon_ns == -1);
+	}
+
+	SECTION("the first measurement is taken as is")
+	{
+		em_pose_horizon_record_sent(&h, 1, 100 * kMs);
+		REQUIRE(em_pose_horizon_record_shown(&h, 1, 160 * kMs));
+		REQUIRE(em_pose_horizon_get(&h, &horizon_ns));
+		CHECK(horizon_ns == 60 * kMs);
+	}
+
+	SECTION("converges on a steady pipeline")
+	{
+		// Every frame is rendered from the pose sent six frames earlier.
+		for (int64_t seq = 1; seq <= 200; seq++) {
+			em_pose_horizon_record_sent(&h, seq, seq * kPeriod);
+			if (seq > 6) {
+				REQUIRE(em_pose_horizon_record_shown(&h, seq - 6, seq * kPeriod));
+			}
+		}
+		REQUIRE(em_pose_horizon_get(&h, &horizon_ns));
+		CHECK(horizon_ns == 6 * kPeriod);
+	}
+
+	SECTION("a single slow frame only nudges the estimate")
+	{
+		em_pose_horizon_record_sent(&h, 1, 100 * kMs);
+		em_pose_horizon_record_shown(&h, 1, 150 * kMs);
+		em_pose_horizon_record_sent(&h, 2, 200 * kMs);
+		em_pose_horizon_record_shown(&h, 2, 330 * kMs);
+		REQUIRE(em_pose_horizon_get(&h, &horizon_ns));
+		CHECK(horizon_ns == 50 * kMs + (130 - 50) * kMs / EM_POSE_HORIZON_SMOOTHING);
+	}
+
+	SECTION("measurements are clamped")
+	{
+		em_pose_horizon_record_sent(&h, 1, 100 * kMs);
+		em_pose_horizon_record_shown(&h, 1, 90 * kMs);
+		REQUIRE(em_pose_horizon_get(&h, &horizon_ns));
+		CHECK(horizon_ns == 0);
+
+		em_pose_horizon_init(&h);
+		em_pose_horizon_record_sent(&h, 1, 100 * kMs);
+		em_pose_horizon_record_shown(&h, 1, 100 * kMs + 10 * EM_POSE_HORIZON_MAX_NS);
+		REQUIRE(em_pose_horizon_get(&h, &horizon_ns));
+		CHECK(horizon_ns == EM_POSE_HORIZON_MAX_NS);
+	}
+
+	SECTION("unknown and forgotten poses are ignored")
+	{
+		CHECK_FALSE(em_pose_horizon_record_shown(&h, 0, 100 * kMs));
+		CHECK_FALSE(em_pose_horizon_record_shown(&h, 5, 100 * kMs));
+
+		for (int64_t seq = 1; seq <= 1 + EM_POSE_HORIZON_HISTORY; seq++) {
+			em_pose_horizon_record_sent(&h, seq, seq * kPeriod);
+		}
+		CHECK_FALSE(em_pose_horizon_record_shown(&h, 1, 1000 * kMs));
+		CHECK(em_pose_horizon_record_shown(&h, 2, 1000 * kMs));
+	}
+}
@@ -0,0 +1,113 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Tests for the reprojection math the client's shaders mirror
+ */
+
+#include "em/em_reprojection.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cmath>
+
+namespace {
+
+constexpr float kEpsilon = 1e-4f;
+
+const XrFovf kFov = {-0.8f, 0.7f, 0.75f, -0.85f};
+const XrQuaternionf kIdentity = {0.0f, 0.0f, 0.0f, 1.0f};
+
+XrQuaternionf
+yaw(float radians)
+{
+	return XrQuaternionf{0.0f, std::sin(radians / 2.0f), 0.0f, std::cos(radians / 2.0f)};
+}
+
+bool
+near(float a, float b)
+{
+	return std::fabs(a - b) < kEpsilon;
+}
+
+} // namespace
+
+TEST_CASE("reprojection")
+{
+	em_reprojection r{};
+	float u = 0.0f;
+	float v = 0.0f;
+
+	SECTION("the same orientation shows the frame as is")
+	{
+		XrQuaternionf head = yaw(0.3f);
+		em_eye_rect rect = em_eye_rect_side_by_side(1);
+		em_reprojection_compute(&head, &head, &kFov, &rect, &r);
+
+		for (float x : {0.0f, 0.25f, 0.5f, 1.0f}) {
+			for (float y : {0.0f, 0.4f, 1.0f}) {
+				REQUIRE(em_reprojection_apply(&r, x, y, &u, &v));
+				CHECK(near(u, 0.5f + x * 0.5f));
+				CHECK(near(v, 1.0f - y));
+			}
+		}
+	}
+
+	SECTION("eyes sample their own half of the stream")
+	{
+		em_eye_rect rect = em_eye_rect_side_by_side(0);
+		em_reprojection_compute(&kIdentity, &kIdentity, &kFov, &rect, &r);
+		REQUIRE(em_reprojection_apply(&r, 1.0f, 0.5f, &u, &v));
+		CHECK(near(u, 0.5f));
+	}
+
+	SECTION("eyes can be packed any way the server likes")
+	{
+		// Right eye on the bottom, at a lower resolution than the left one above it.
+		em_eye_rect rect = {0.0f, 0.6f, 0.75f, 0.4f};
+		em_reprojection_compute(&kIdentity, &kIdentity, &kFov, &rect, &r);
+
+		REQUIRE(em_reprojection_apply(&r, 0.0f, 1.0f, &u, &v));
+		CHECK(near(u, 0.0f));
+		CHECK(near(v, 0.6f));
+
+		REQUIRE(em_reprojection_apply(&r, 1.0f, 0.0f, &u, &v));
+		CHECK(near(u, 0.75f));
+		CHECK(near(v, 1.0f));
+	}
+
+	SECTION("turning left moves the frame right")
+	{
+		// Looking a bit to the left of where the frame was rendered, the middle of the view shows what was left of
+		// the frame's middle.
+		XrQuaternionf current = yaw(0.1f);
+		em_eye_rect rect = em_eye_rect_side_by_side(0);
+		em_reprojection_compute(&kIdentity, &current, &kFov, &rect, &r);
+
+		float x_center = -std::tan(kFov.angleLeft) / (std::tan(kFov.angleRight) - std::tan(kFov.angleLeft));
+		float y_center = -std::tan(kFov.angleDown) / (std::tan(kFov.angleUp) - std::tan(kFov.angleDown));
+		REQUIRE(em_reprojection_apply(&r, x_center, y_center, &u, &v));
+
+		float expected = (-std::tan(0.1f) - std::tan(kFov.angleLeft)) /
+		                 (std::tan(kFov.angleRight) - std::tan(kFov.angleLeft)) * 0.5f;
+		CHECK(near(u, expected));
+		CHECK(near(v, 1.0f - y_center));
+	}
+
+	SECTION("what the server didn't render is left out")
+	{
+		XrQuaternionf current = yaw(0.5f);
+		em_eye_rect rect = em_eye_rect_side_by_side(0);
+		em_reprojection_compute(&kIdentity, &current, &kFov, &rect, &r);
+		CHECK_FALSE(em_reprojection_apply(&r, 0.0f, 0.5f, &u, &v));
+	}
+
+	SECTION("looking away entirely shows nothing")
+	{
+		XrQuaternionf current = yaw(3.0f);
+		em_eye_rect rect = em_eye_rect_side_by_side(0);
+		em_reprojection_compute(&kIdentity, &current, &kFov, &rect, &r);
+		CHECK_FALSE(em_reprojection_apply(&r, 0.5f, 0.5f, &u, &v));
+	}
+}
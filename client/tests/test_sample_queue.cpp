@@ -0,0 +1,168 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Tests for the decoded sample queue
+ */
+
+#include "em/em_sample_queue.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+
+namespace {
+
+constexpr int64_t kPeriod = 11'111'111; // 90 Hz
+
+em_sample_queue_entry
+make_entry(int64_t frame_id, int64_t display_time)
+{
+	em_sample_queue_entry entry{};
+	entry.sample = reinterpret_cast<void *>(static_cast<intptr_t>(frame_id));
+	entry.frame_id = frame_id;
+	entry.display_time = display_time;
+	return entry;
+}
+
+void
+push(em_sample_queue &q, int64_t frame_id, int64_t display_time)
+{
+	em_sample_queue_entry entry = make_entry(frame_id, display_time);
+	em_sample_queue_entry evicted{};
+	REQUIRE_FALSE(em_sample_queue_push(&q, &entry, &evicted));
+}
+
+struct Taken
+{
+	bool took = false;
+	int64_t frame_id = 0;
+	uint32_t dropped = 0;
+};
+
+Taken
+take(em_sample_queue &q, em_sample_select_policy policy, int64_t display_time)
+{
+	em_sample_queue_entry taken{};
+	em_sample_queue_entry dropped[EM_SAMPLE_QUEUE_SIZE];
+	Taken ret;
+	ret.took = em_sample_queue_take(&q, policy, display_time, &taken, dropped, &ret.dropped);
+	ret.frame_id = taken.frame_id;
+	return ret;
+}
+
+} // namespace
+
+TEST_CASE("sample_queue")
+{
+	em_sample_queue q{};
+
+	SECTION("empty")
+	{
+		CHECK_FALSE(take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, kPeriod).took);
+		CHECK_FALSE(take(q, EM_SAMPLE_SELECT_LATEST, kPeriod).took);
+	}
+
+	SECTION("the oldest is pushed out when full")
+	{
+		for (int64_t id = 1; id <= EM_SAMPLE_QUEUE_SIZE; id++) {
+			push(q, id, id * kPeriod);
+		}
+
+		em_sample_queue_entry entry = make_entry(99, 99 * kPeriod);
+		em_sample_queue_entry evicted{};
+		CHECK(em_sample_queue_push(&q, &entry, &evicted));
+		CHECK(evicted.frame_id == 1);
+		CHECK(q.count == EM_SAMPLE_QUEUE_SIZE);
+
+		em_sample_queue_entry cleared[EM_SAMPLE_QUEUE_SIZE];
+		REQUIRE(em_sample_queue_clear(&q, cleared) == EM_SAMPLE_QUEUE_SIZE);
+		CHECK(cleared[0].frame_id == 2);
+		CHECK(cleared[EM_SAMPLE_QUEUE_SIZE - 1].frame_id == 99);
+		CHECK(q.count == 0);
+	}
+
+	SECTION("latest wins drops everything older")
+	{
+		push(q, 1, 1 * kPeriod);
+		push(q, 2, 2 * kPeriod);
+		push(q, 3, 3 * kPeriod);
+
+		Taken t = take(q, EM_SAMPLE_SELECT_LATEST, 1 * kPeriod);
+		CHECK(t.took);
+		CHECK(t.frame_id == 3);
+		CHECK(t.dropped == 2);
+		CHECK(q.count == 0);
+	}
+
+	SECTION("a burst is spread back out over the display times it was meant for")
+	{
+		// Three frames arriving at once after a hiccup.
+		push(q, 1, 1 * kPeriod);
+		push(q, 2, 2 * kPeriod);
+		push(q, 3, 3 * kPeriod);
+
+		Taken t = take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, 1 * kPeriod);
+		CHECK(t.took);
+		CHECK(t.frame_id == 1);
+		CHECK(t.dropped == 0);
+		CHECK(q.count == 2);
+
+		t = take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, 2 * kPeriod);
+		CHECK(t.frame_id == 2);
+
+		t = take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, 3 * kPeriod);
+		CHECK(t.frame_id == 3);
+		CHECK(q.count == 0);
+	}
+
+	SECTION("late frames are skipped through to the best match")
+	{
+		push(q, 1, 1 * kPeriod);
+		push(q, 2, 2 * kPeriod);
+		push(q, 3, 3 * kPeriod);
+		push(q, 4, 4 * kPeriod);
+
+		Taken t = take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, 3 * kPeriod + kPeriod / 4);
+		CHECK(t.frame_id == 3);
+		CHECK(t.dropped == 2);
+		CHECK(q.count == 1);
+	}
+
+	SECTION("an early frame waits while the shown one is the better match")
+	{
+		push(q, 1, 1 * kPeriod);
+		CHECK(take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, 1 * kPeriod).frame_id == 1);
+
+		push(q, 2, 3 * kPeriod);
+		CHECK_FALSE(take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, 1 * kPeriod + kPeriod / 2).took);
+		CHECK(q.count == 1);
+
+		Taken t = take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, 3 * kPeriod);
+		CHECK(t.took);
+		CHECK(t.frame_id == 2);
+	}
+
+	SECTION("frames for display times already shown are dropped")
+	{
+		push(q, 2, 2 * kPeriod);
+		CHECK(take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, 2 * kPeriod).frame_id == 2);
+
+		push(q, 1, 1 * kPeriod);
+		Taken t = take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, 3 * kPeriod);
+		CHECK_FALSE(t.took);
+		CHECK(t.dropped == 1);
+		CHECK(q.count == 0);
+	}
+
+	SECTION("without display times it is latest wins")
+	{
+		push(q, 1, 0);
+		push(q, 2, 0);
+
+		Taken t = take(q, EM_SAMPLE_SELECT_DISPLAY_TIME, 1 * kPeriod);
+		CHECK(t.frame_id == 2);
+		CHECK(t.dropped == 1);
+	}
+}
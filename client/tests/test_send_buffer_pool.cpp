@@ -0,0 +1,247 @@
+// Copyright 2023, Pluto VR, Inc.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief Tests for the pooled upstream send buffers
+ */
+
+#include "catch2/catch_test_macros.hpp"
+
+#include "em/em_send_buffer_pool.hpp"
+
+#include "electricmaple.pb.h"
+#include "pb_encode.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace {
+
+//! Last pointer handed to operator delete.
+void *volatile lastDeleted = nullptr;
+
+//! Count heap allocations while set.
+volatile bool countAllocations = false;
+volatile std::size_t allocations = 0;
+
+void
+countAllocation()
+{
+	if (countAllocations) {
+		allocations = allocations + 1;
+	}
+}
+
+constexpr std::size_t kBufferSize = em_proto_UpMessage_size + 10;
+constexpr std::size_t kCount = 4;
+
+using Pool = em::SendBufferPool<kBufferSize, kCount>;
+
+struct Encoded
+{
+	Pool::Buffer *buffer;
+	std::size_t length;
+};
+
+using Queue = em::SendQueue<Encoded, kCount>;
+
+em_proto_UpMessage
+makeTrackingMessage(int64_t id)
+{
+	em_proto_UpMessage msg = em_proto_UpMessage_init_default;
+	msg.up_message_id = id;
+	msg.has_tracking = true;
+	msg.tracking.has_P_localSpace_viewSpace = true;
+	msg.tracking.P_localSpace_viewSpace.has_position = true;
+	msg.tracking.P_localSpace_viewSpace.position = {0.1f, 1.6f, -0.2f};
+	msg.tracking.P_localSpace_viewSpace.has_orientation = true;
+	msg.tracking.P_localSpace_viewSpace.orientation = {1.f, 0.f, 0.f, 0.f};
+	msg.tracking.sequence_idx = id;
+	msg.tracking.timestamp = id * 11111111;
+	return msg;
+}
+
+} // namespace
+
+#ifdef __GLIBC__
+// Catch C allocations too, forwarding to glibc's own.
+extern "C" {
+void *
+__libc_malloc(std::size_t size);
+void *
+__libc_calloc(std::size_t count, std::size_t size);
+void *
+__libc_realloc(void *p, std::size_t size);
+
+void *
+malloc(std::size_t size)
+{
+	countAllocation();
+	return __libc_malloc(size);
+}
+
+void *
+calloc(std::size_t count, std::size_t size)
+{
+	countAllocation();
+	return __libc_calloc(count, size);
+}
+
+void *
+realloc(void *p, std::size_t size)
+{
+	countAllocation();
+	return __libc_realloc(p, size);
+}
+}
+#endif
+
+// Count what gets allocated, and remember what gets deleted, to see when the pool goes.
+void *
+operator new(std::size_t size)
+{
+	countAllocation();
+	if (void *p = std::malloc(size == 0 ? 1 : size)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void
+operator delete(void *p) noexcept
+{
+	lastDeleted = p;
+	std::free(p);
+}
+
+void
+operator delete(void *p, std::size_t) noexcept
+{
+	lastDeleted = p;
+	std::free(p);
+}
+
+TEST_CASE("SendBufferPool")
+{
+	Pool::Ptr pool = Pool::create();
+
+	SECTION("hands out distinct buffers until exhausted")
+	{
+		std::vector<Pool::Buffer *> held;
+		for (std::size_t i = 0; i < kCount; ++i) {
+			Pool::Buffer *buffer = pool->acquire();
+			REQUIRE(buffer != nullptr);
+			for (Pool::Buffer *other : held) {
+				CHECK(other != buffer);
+			}
+			held.push_back(buffer);
+		}
+		CHECK(pool->inFlight() == kCount);
+		CHECK(pool->acquire() == nullptr);
+		CHECK(pool->exhaustedCount() == 1);
+
+		Pool::release(held[2]);
+		CHECK(pool->acquire() == held[2]);
+
+		for (Pool::Buffer *buffer : held) {
+			Pool::release(buffer);
+		}
+		CHECK(pool->inFlight() == 0);
+	}
+
+	SECTION("steady state encoding does not allocate")
+	{
+		// What the frame loop does per message: encode into a pooled buffer and queue it for the sender thread.
+		// The sender keeps a couple in flight, like the data channel would.
+		Queue queue;
+		bool encoded = true;
+		bool queued = true;
+
+		allocations = 0;
+		countAllocations = true;
+		for (int64_t id = 1; id <= 1000; ++id) {
+			Pool::Buffer *buffer = pool->acquire();
+			if (buffer == nullptr) {
+				encoded = false;
+				break;
+			}
+
+			em_proto_UpMessage msg = makeTrackingMessage(id);
+			pb_ostream_t os = pb_ostream_from_buffer(buffer->data(), buffer->size());
+			encoded = encoded && pb_encode(&os, &em_proto_UpMessage_msg, &msg) && os.bytes_written > 0;
+			queued = queued && queue.push({buffer, os.bytes_written});
+
+			Encoded sent;
+			if (queue.size() == 2 && queue.pop(sent)) {
+				Pool::release(sent.buffer);
+			}
+		}
+		countAllocations = false;
+
+		CHECK(encoded);
+		CHECK(queued);
+		REQUIRE(allocations == 0);
+		CHECK(pool->exhaustedCount() == 0);
+
+		Encoded left;
+		while (queue.pop(left)) {
+			Pool::release(left.buffer);
+		}
+		CHECK(pool->inFlight() == 0);
+	}
+
+	SECTION("buffers in flight keep the pool alive")
+	{
+		Pool::Buffer *first = pool->acquire();
+		Pool::Buffer *second = pool->acquire();
+		REQUIRE(first != nullptr);
+		REQUIRE(second != nullptr);
+
+		Pool *raw = pool.get();
+		lastDeleted = nullptr;
+		pool = nullptr;
+		CHECK(lastDeleted != raw);
+
+		// Still writable, like a send queue finishing with it would.
+		first->data()[0] = 42;
+		Pool::release(first);
+		CHECK(lastDeleted != raw);
+
+		Pool::release(second);
+		CHECK(lastDeleted == raw);
+	}
+
+	SECTION("an idle pool goes with its owner")
+	{
+		Pool *raw = pool.get();
+		lastDeleted = nullptr;
+		pool = nullptr;
+		CHECK(lastDeleted == raw);
+	}
+}
+
+TEST_CASE("SendQueue")
+{
+	Queue queue;
+	Pool::Buffer *fake = nullptr;
+	Encoded out{};
+	CHECK_FALSE(queue.pop(out));
+
+	// Wraps around a few times, in order.
+	std::size_t next = 0;
+	for (std::size_t i = 0; i < 3 * kCount; ++i) {
+		REQUIRE(queue.push({fake, i}));
+		if (queue.size() == kCount) {
+			CHECK_FALSE(queue.push({fake, 99}));
+			while (queue.pop(out)) {
+				CHECK(out.length == next);
+				next++;
+			}
+		}
+	}
+	CHECK(next == 3 * kCount);
+	CHECK(queue.size() == 0);
+}
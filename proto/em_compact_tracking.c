@@ -0,0 +1,345 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Compact quantized encoding of em_proto_TrackingMessage.
+ */
+
+#include "em_compact_tracking.h"
+
+#include <math.h>
+#include <string.h>
+
+#define ORIENTATION_BITS 16
+#define ORIENTATION_MAX ((1u << ORIENTATION_BITS) - 1u)
+
+// The three smallest components of a unit quaternion are within +-1/sqrt(2).
+#define ORIENTATION_RANGE 0.70710678f
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+static em_proto_Pose *
+pose_at(em_proto_TrackingMessage *msg, uint32_t i, bool **out_has)
+{
+	switch (i) {
+	case 0: *out_has = &msg->has_P_localSpace_viewSpace; return &msg->P_localSpace_viewSpace;
+	case 1: *out_has = &msg->has_P_viewSpace_view0; return &msg->P_viewSpace_view0;
+	case 2: *out_has = &msg->has_P_viewSpace_view1; return &msg->P_viewSpace_view1;
+	case 3: *out_has = &msg->has_P_local_controller_grip_left; return &msg->P_local_controller_grip_left;
+	case 4: *out_has = &msg->has_controller_aim_left; return &msg->controller_aim_left;
+	case 5: *out_has = &msg->has_controller_grip_right; return &msg->controller_grip_right;
+	case 6: *out_has = &msg->has_controller_aim_right; return &msg->controller_aim_right;
+	case 7: *out_has = &msg->has_P_localSpace_viewSpace_pipelined; return &msg->P_localSpace_viewSpace_pipelined;
+	default: *out_has = NULL; return NULL;
+	}
+}
+
+static const em_proto_Pose *
+const_pose_at(const em_proto_TrackingMessage *msg, uint32_t i)
+{
+	bool *has = NULL;
+	const em_proto_Pose *pose = pose_at((em_proto_TrackingMessage *)msg, i, &has);
+	return *has ? pose : NULL;
+}
+
+static uint32_t
+count_bits(uint32_t v)
+{
+	uint32_t count = 0;
+	for (; v != 0; v &= v - 1) {
+		count++;
+	}
+	return count;
+}
+
+static int32_t
+quantize_position(float v)
+{
+	float scaled = v * EM_COMPACT_TRACKING_POSITION_SCALE;
+	if (scaled >= (float)INT32_MAX) {
+		return INT32_MAX;
+	}
+	if (scaled <= (float)INT32_MIN) {
+		return INT32_MIN;
+	}
+	return (int32_t)lroundf(scaled);
+}
+
+static int32_t
+clamp_delta(int64_t delta)
+{
+	if (delta > INT32_MAX) {
+		return INT32_MAX;
+	}
+	if (delta < INT32_MIN) {
+		return INT32_MIN;
+	}
+	return (int32_t)delta;
+}
+
+static uint32_t
+quantize_component(float v)
+{
+	float normalized = (v / ORIENTATION_RANGE) * 0.5f + 0.5f;
+	if (normalized <= 0.f) {
+		return 0;
+	}
+	if (normalized >= 1.f) {
+		return ORIENTATION_MAX;
+	}
+	return (uint32_t)lroundf(normalized * (float)ORIENTATION_MAX);
+}
+
+static float
+dequantize_component(uint32_t v)
+{
+	return (((float)v / (float)ORIENTATION_MAX) - 0.5f) * 2.f * ORIENTATION_RANGE;
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+uint64_t
+em_compact_tracking_pack_orientation(const em_proto_Quaternion *q)
+{
+	float c[4] = {q->w, q->x, q->y, q->z};
+
+	float len_sq = c[0] * c[0] + c[1] * c[1] + c[2] * c[2] + c[3] * c[3];
+	if (len_sq <= 0.f) {
+		// Not a rotation, send identity.
+		c[0] = 1.f;
+		c[1] = c[2] = c[3] = 0.f;
+		len_sq = 1.f;
+	}
+
+	uint32_t largest = 0;
+	for (uint32_t i = 1; i < 4; i++) {
+		if (fabsf(c[i]) > fabsf(c[largest])) {
+			largest = i;
+		}
+	}
+
+	// q and -q are the same rotation, make the dropped component positive.
+	float scale = 1.f / sqrtf(len_sq);
+	if (c[largest] < 0.f) {
+		scale = -scale;
+	}
+
+	uint64_t packed = largest;
+	for (uint32_t i = 0; i < 4; i++) {
+		if (i == largest) {
+			continue;
+		}
+		packed = (packed << ORIENTATION_BITS) | quantize_component(c[i] * scale);
+	}
+
+	return packed;
+}
+
+void
+em_compact_tracking_unpack_orientation(uint64_t packed, em_proto_Quaternion *out_q)
+{
+	uint32_t largest = (uint32_t)(packed >> (3 * ORIENTATION_BITS)) & 0x3u;
+	float c[4];
+	float sum_sq = 0.f;
+
+	int shift = 2 * ORIENTATION_BITS;
+	for (uint32_t i = 0; i < 4; i++) {
+		if (i == largest) {
+			continue;
+		}
+		c[i] = dequantize_component((uint32_t)(packed >> shift) & ORIENTATION_MAX);
+		sum_sq += c[i] * c[i];
+		shift -= ORIENTATION_BITS;
+	}
+
+	c[largest] = sum_sq < 1.f ? sqrtf(1.f - sum_sq) : 0.f;
+
+	// Renormalize to take out the quantization error on the reconstructed component.
+	float len = sqrtf(c[0] * c[0] + c[1] * c[1] + c[2] * c[2] + c[3] * c[3]);
+	out_q->w = c[0] / len;
+	out_q->x = c[1] / len;
+	out_q->y = c[2] / len;
+	out_q->z = c[3] / len;
+}
+
+void
+em_compact_tracking_encoder_init(struct em_compact_tracking_encoder *enc, uint32_t keyframe_interval)
+{
+	memset(enc, 0, sizeof(*enc));
+	enc->keyframe_interval = keyframe_interval;
+}
+
+void
+em_compact_tracking_encoder_force_keyframe(struct em_compact_tracking_encoder *enc)
+{
+	enc->keyframe.valid = false;
+}
+
+void
+em_compact_tracking_encode(struct em_compact_tracking_encoder *enc,
+                           const em_proto_TrackingMessage *in,
+                           em_proto_CompactTrackingMessage *out)
+{
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < EM_COMPACT_TRACKING_MAX_POSES; i++) {
+		const em_proto_Pose *pose = const_pose_at(in, i);
+		if (pose != NULL && (pose->has_position || pose->has_orientation)) {
+			mask |= 1u << i;
+		}
+	}
+
+	// A pose that the keyframe doesn't have has nothing to be relative to.
+	bool keyframe = !enc->keyframe.valid ||                     //
+	                enc->since_keyframe >= enc->keyframe_interval || //
+	                (mask & ~enc->keyframe.pose_mask) != 0;
+
+	if (keyframe) {
+		enc->keyframe.valid = true;
+		enc->keyframe.sequence_idx = in->sequence_idx;
+		enc->keyframe.pose_mask = mask;
+		enc->since_keyframe = 0;
+	} else {
+		enc->since_keyframe++;
+	}
+
+	memset(out, 0, sizeof(*out));
+	out->version = (mask >> EM_COMPACT_TRACKING_V1_MAX_POSES) != 0 ? EM_COMPACT_TRACKING_VERSION : 1;
+	out->pose_mask = mask;
+	out->keyframe_sequence_idx = enc->keyframe.sequence_idx;
+	out->timestamp = in->timestamp;
+	out->sequence_idx = in->sequence_idx;
+	if ((mask & (1u << EM_COMPACT_TRACKING_V1_MAX_POSES)) != 0) {
+		out->pipelined_timestamp = in->pipelined_timestamp;
+	}
+
+	for (uint32_t i = 0; i < EM_COMPACT_TRACKING_MAX_POSES; i++) {
+		if ((mask & (1u << i)) == 0) {
+			continue;
+		}
+
+		const em_proto_Pose *pose = const_pose_at(in, i);
+		em_proto_QuantizedPose *qp = &out->poses[out->poses_count++];
+
+		if (!pose->has_position) {
+			out->position_absent_mask |= 1u << i;
+		}
+		if (!pose->has_orientation) {
+			out->orientation_absent_mask |= 1u << i;
+		}
+
+		if (pose->has_orientation) {
+			qp->orientation = em_compact_tracking_pack_orientation(&pose->orientation);
+		} else {
+			em_proto_Quaternion identity = {1.f, 0.f, 0.f, 0.f};
+			qp->orientation = em_compact_tracking_pack_orientation(&identity);
+		}
+
+		int32_t position[3] = {0, 0, 0};
+		if (pose->has_position) {
+			position[0] = quantize_position(pose->position.x);
+			position[1] = quantize_position(pose->position.y);
+			position[2] = quantize_position(pose->position.z);
+		}
+
+		if (keyframe) {
+			memcpy(enc->keyframe.positions[i], position, sizeof(position));
+			qp->position_x = position[0];
+			qp->position_y = position[1];
+			qp->position_z = position[2];
+		} else {
+			const int32_t *base = enc->keyframe.positions[i];
+			qp->position_x = clamp_delta((int64_t)position[0] - base[0]);
+			qp->position_y = clamp_delta((int64_t)position[1] - base[1]);
+			qp->position_z = clamp_delta((int64_t)position[2] - base[2]);
+		}
+	}
+}
+
+void
+em_compact_tracking_decoder_init(struct em_compact_tracking_decoder *dec)
+{
+	memset(dec, 0, sizeof(*dec));
+}
+
+enum em_compact_tracking_result
+em_compact_tracking_decode(struct em_compact_tracking_decoder *dec,
+                           const em_proto_CompactTrackingMessage *in,
+                           em_proto_TrackingMessage *out)
+{
+	if (in->version == 0 || in->version > EM_COMPACT_TRACKING_VERSION) {
+		return EM_COMPACT_TRACKING_UNSUPPORTED_VERSION;
+	}
+
+	uint32_t max_poses = in->version == 1 ? EM_COMPACT_TRACKING_V1_MAX_POSES : EM_COMPACT_TRACKING_MAX_POSES;
+	if ((in->pose_mask >> max_poses) != 0 || count_bits(in->pose_mask) != in->poses_count) {
+		return EM_COMPACT_TRACKING_MALFORMED;
+	}
+
+	bool keyframe = in->keyframe_sequence_idx == in->sequence_idx;
+	struct em_compact_tracking_keyframe *kf = &dec->keyframe;
+
+	if (!keyframe && (!kf->valid ||                                       //
+	                  kf->sequence_idx != in->keyframe_sequence_idx ||    //
+	                  (in->pose_mask & ~kf->pose_mask) != 0)) {
+		return EM_COMPACT_TRACKING_MISSING_KEYFRAME;
+	}
+
+	// A late keyframe is still decodable on its own, but must not replace a newer one.
+	bool store_keyframe = keyframe && (!kf->valid || in->sequence_idx > kf->sequence_idx);
+	if (store_keyframe) {
+		kf->valid = true;
+		kf->sequence_idx = in->sequence_idx;
+		kf->pose_mask = in->pose_mask;
+	}
+
+	em_proto_TrackingMessage result = em_proto_TrackingMessage_init_zero;
+	result.timestamp = in->timestamp;
+	result.sequence_idx = in->sequence_idx;
+	result.pipelined_timestamp = in->pipelined_timestamp;
+
+	uint32_t idx = 0;
+	for (uint32_t i = 0; i < EM_COMPACT_TRACKING_MAX_POSES; i++) {
+		if ((in->pose_mask & (1u << i)) == 0) {
+			continue;
+		}
+
+		const em_proto_QuantizedPose *qp = &in->poses[idx++];
+		bool *has = NULL;
+		em_proto_Pose *pose = pose_at(&result, i, &has);
+		*has = true;
+
+		int32_t position[3] = {qp->position_x, qp->position_y, qp->position_z};
+		if (!keyframe) {
+			const int32_t *base = kf->positions[i];
+			position[0] = clamp_delta((int64_t)position[0] + base[0]);
+			position[1] = clamp_delta((int64_t)position[1] + base[1]);
+			position[2] = clamp_delta((int64_t)position[2] + base[2]);
+		} else if (store_keyframe) {
+			memcpy(kf->positions[i], position, sizeof(position));
+		}
+
+		pose->has_position = (in->position_absent_mask & (1u << i)) == 0;
+		pose->position.x = (float)position[0] / EM_COMPACT_TRACKING_POSITION_SCALE;
+		pose->position.y = (float)position[1] / EM_COMPACT_TRACKING_POSITION_SCALE;
+		pose->position.z = (float)position[2] / EM_COMPACT_TRACKING_POSITION_SCALE;
+
+		pose->has_orientation = (in->orientation_absent_mask & (1u << i)) == 0;
+		em_compact_tracking_unpack_orientation(qp->orientation, &pose->orientation);
+	}
+
+	*out = result;
+
+	return EM_COMPACT_TRACKING_OK;
+}
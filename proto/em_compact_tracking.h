@@ -0,0 +1,135 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Compact quantized encoding of em_proto_TrackingMessage.
+ *
+ * Orientations are packed smallest-three style into 50 bits, positions are fixed point (0.1mm) and, except on
+ * keyframes, relative to the positions of the most recent keyframe. Both the client (encoder) and the server
+ * (decoder) keep a little bit of keyframe state per connection.
+ *
+ * The server advertises the highest version it decodes in em_proto_StreamCapabilities, the client only sends
+ * compact tracking once it has seen that.
+ */
+
+#pragma once
+
+#include "electricmaple.pb.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * Current version of the compact tracking format.
+ *
+ * Version 2 added the pipelined head pose as bit 7. The encoder only marks a message as version 2 if it carries that
+ * pose, so a client talking to a version 1 server just has to leave it out.
+ */
+#define EM_COMPACT_TRACKING_VERSION 2
+
+//! Number of poses in em_proto_TrackingMessage.
+#define EM_COMPACT_TRACKING_MAX_POSES 8
+
+//! Number of poses in em_proto_TrackingMessage as of version 1.
+#define EM_COMPACT_TRACKING_V1_MAX_POSES 7
+
+//! Fixed point position units per meter.
+#define EM_COMPACT_TRACKING_POSITION_SCALE 10000.0f
+
+//! Default number of delta messages between keyframes.
+#define EM_COMPACT_TRACKING_DEFAULT_KEYFRAME_INTERVAL 30
+
+/*!
+ * Keyframe state shared by encoder and decoder.
+ */
+struct em_compact_tracking_keyframe
+{
+	bool valid;
+	int64_t sequence_idx;
+	uint32_t pose_mask;
+	int32_t positions[EM_COMPACT_TRACKING_MAX_POSES][3];
+};
+
+/*!
+ * Client side state.
+ *
+ * Deltas only decode against the keyframe they name, so when the server says it is missing one (see
+ * em_proto_DownMessage::tracking_keyframe_request), call em_compact_tracking_encoder_force_keyframe.
+ */
+struct em_compact_tracking_encoder
+{
+	//! Send a keyframe after this many delta messages.
+	uint32_t keyframe_interval;
+	uint32_t since_keyframe;
+	struct em_compact_tracking_keyframe keyframe;
+};
+
+/*!
+ * Server side state.
+ */
+struct em_compact_tracking_decoder
+{
+	struct em_compact_tracking_keyframe keyframe;
+};
+
+enum em_compact_tracking_result
+{
+	EM_COMPACT_TRACKING_OK = 0,
+	//! Newer version than we understand.
+	EM_COMPACT_TRACKING_UNSUPPORTED_VERSION,
+	//! The keyframe this message is relative to was lost or superseded.
+	EM_COMPACT_TRACKING_MISSING_KEYFRAME,
+	//! Pose mask and pose count disagree.
+	EM_COMPACT_TRACKING_MALFORMED,
+};
+
+/*!
+ * Pack a quaternion into the smallest-three representation used on the wire.
+ */
+uint64_t
+em_compact_tracking_pack_orientation(const em_proto_Quaternion *q);
+
+/*!
+ * Unpack a smallest-three quaternion, the result is normalized.
+ */
+void
+em_compact_tracking_unpack_orientation(uint64_t packed, em_proto_Quaternion *out_q);
+
+void
+em_compact_tracking_encoder_init(struct em_compact_tracking_encoder *enc, uint32_t keyframe_interval);
+
+//! Make the next encoded message a keyframe, e.g. after the receiver reported trouble.
+void
+em_compact_tracking_encoder_force_keyframe(struct em_compact_tracking_encoder *enc);
+
+/*!
+ * Encode @p in, which must carry a strictly increasing sequence_idx.
+ *
+ * A pose counts as present if it has a position or an orientation; missing parts are sent as identity and flagged, so
+ * the decoder leaves them out again.
+ */
+void
+em_compact_tracking_encode(struct em_compact_tracking_encoder *enc,
+                           const em_proto_TrackingMessage *in,
+                           em_proto_CompactTrackingMessage *out);
+
+void
+em_compact_tracking_decoder_init(struct em_compact_tracking_decoder *dec);
+
+/*!
+ * Decode @p in into a full tracking message, @p out is only written on success.
+ */
+enum em_compact_tracking_result
+em_compact_tracking_decode(struct em_compact_tracking_decoder *dec,
+                           const em_proto_CompactTrackingMessage *in,
+                           em_proto_TrackingMessage *out);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
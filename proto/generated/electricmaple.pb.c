@@ -21,6 +21,12 @@ PB_BIND(em_proto_Pose, em_proto_Pose, AUTO)
 PB_BIND(em_proto_TrackingMessage, em_proto_TrackingMessage, 2)
 
 
+PB_BIND(em_proto_QuantizedPose, em_proto_QuantizedPose, AUTO)
+
+
+PB_BIND(em_proto_CompactTrackingMessage, em_proto_CompactTrackingMessage, AUTO)
+
+
 PB_BIND(em_proto_InputThumbstick, em_proto_InputThumbstick, AUTO)
 
 
@@ -42,12 +48,24 @@ PB_BIND(em_proto_TouchControllerRight, em_proto_TouchControllerRight, AUTO)
 PB_BIND(em_proto_UpFrameMessage, em_proto_UpFrameMessage, AUTO)
 
 
+PB_BIND(em_proto_ClockSyncPong, em_proto_ClockSyncPong, AUTO)
+
+
 PB_BIND(em_proto_UpMessage, em_proto_UpMessage, 2)
 
 
+PB_BIND(em_proto_EyeRect, em_proto_EyeRect, AUTO)
+
+
 PB_BIND(em_proto_DownFrameDataMessage, em_proto_DownFrameDataMessage, AUTO)
 
 
+PB_BIND(em_proto_StreamCapabilities, em_proto_StreamCapabilities, AUTO)
+
+
+PB_BIND(em_proto_ClockSyncPing, em_proto_ClockSyncPing, AUTO)
+
+
 PB_BIND(em_proto_DownMessage, em_proto_DownMessage, AUTO)
 
 
@@ -59,8 +59,41 @@ typedef struct _em_proto_TrackingMessage {
     em_proto_Pose controller_aim_right;
     int64_t timestamp;
     int64_t sequence_idx;
+    /* Head pose predicted further out, for when a frame the server starts rendering now gets displayed. */
+    bool has_P_localSpace_viewSpace_pipelined;
+    em_proto_Pose P_localSpace_viewSpace_pipelined;
+    int64_t pipelined_timestamp;
 } em_proto_TrackingMessage;
 
+/* A Pose packed by em_compact_tracking. */
+typedef struct _em_proto_QuantizedPose {
+    /* Smallest-three quaternion: 2 bit index of the dropped component, 3 x 16 bit components */
+    uint64_t orientation;
+    /* Fixed point, 0.1mm units, relative to the keyframe position unless this is a keyframe */
+    int32_t position_x;
+    int32_t position_y;
+    int32_t position_z;
+} em_proto_QuantizedPose;
+
+/* Compact encoding of TrackingMessage, see em_compact_tracking.h */
+typedef struct _em_proto_CompactTrackingMessage {
+    uint32_t version;
+    /* Bit i is the i-th Pose field of TrackingMessage in declaration order: bits 0-6 are fields 1-7, bit 7 is
+ field 10 (P_localSpace_viewSpace_pipelined). Set poses are in poses, in bit order. */
+    uint32_t pose_mask;
+    /* Sequence index of the keyframe positions are relative to; equal to sequence_idx for a keyframe. */
+    int64_t keyframe_sequence_idx;
+    pb_size_t poses_count;
+    em_proto_QuantizedPose poses[8];
+    int64_t timestamp;
+    int64_t sequence_idx;
+    /* Since version 2, with bit 7 of pose_mask. */
+    int64_t pipelined_timestamp;
+    /* Bit i set means the pose with bit i in pose_mask had no position, or no orientation; it went out as identity. */
+    uint32_t position_absent_mask;
+    uint32_t orientation_absent_mask;
+} em_proto_CompactTrackingMessage;
+
 typedef struct _em_proto_InputThumbstick {
     bool has_xy;
     em_proto_Vec2 xy;
@@ -117,24 +150,73 @@ typedef struct _em_proto_UpFrameMessage {
     int64_t display_time; /* nanoseconds, in client OpenXR time domain */
 } em_proto_UpFrameMessage;
 
+/* Reply to a ClockSyncPing, sent as soon as the ping is received. */
+typedef struct _em_proto_ClockSyncPong {
+    uint32_t id;
+    int64_t server_send_time; /* nanoseconds, copied from the ping */
+    int64_t client_receive_time; /* nanoseconds, in client OpenXR time domain */
+    int64_t client_send_time; /* nanoseconds, in client OpenXR time domain */
+} em_proto_ClockSyncPong;
+
 typedef struct _em_proto_UpMessage {
     int64_t up_message_id;
     bool has_tracking;
     em_proto_TrackingMessage tracking;
     bool has_frame;
     em_proto_UpFrameMessage frame;
+    bool has_compact_tracking;
+    em_proto_CompactTrackingMessage compact_tracking;
+    bool has_clock_sync_pong;
+    em_proto_ClockSyncPong clock_sync_pong;
+    /* Timing of several frames at once, oldest first, to servers that said they take it. */
+    pb_size_t frames_count;
+    em_proto_UpFrameMessage frames[8];
 } em_proto_UpMessage;
 
+/* Where an eye's view sits in the video frame, in texture coordinates with 0,0 at the top left. */
+typedef struct _em_proto_EyeRect {
+    float x;
+    float y;
+    float width;
+    float height;
+} em_proto_EyeRect;
+
 typedef struct _em_proto_DownFrameDataMessage {
     int64_t frame_sequence_id;
     bool has_P_localSpace_viewSpace;
     em_proto_Pose P_localSpace_viewSpace;
     int64_t display_time; /* TODO fovs here */
+    bool has_left_eye_rect;
+    em_proto_EyeRect left_eye_rect;
+    bool has_right_eye_rect;
+    em_proto_EyeRect right_eye_rect;
+    /* sequence_idx of the TrackingMessage the pose came from, 0 if unknown. */
+    int64_t tracking_sequence_idx;
 } em_proto_DownFrameDataMessage;
 
+/* Sent by the server when the data channel opens. */
+typedef struct _em_proto_StreamCapabilities {
+    /* Highest CompactTrackingMessage version the server decodes, 0 if none. */
+    uint32_t compact_tracking_version;
+    /* Whether the server reads UpMessage.frames, the client sends one frame per UpMessage otherwise. */
+    bool batched_frame_reports;
+} em_proto_StreamCapabilities;
+
+/* Sent periodically by the server to estimate the client clock offset. */
+typedef struct _em_proto_ClockSyncPing {
+    uint32_t id;
+    int64_t server_send_time; /* nanoseconds, in server monotonic time domain */
+} em_proto_ClockSyncPing;
+
 typedef struct _em_proto_DownMessage {
     bool has_frame_data;
     em_proto_DownFrameDataMessage frame_data;
+    bool has_capabilities;
+    em_proto_StreamCapabilities capabilities;
+    bool has_clock_sync_ping;
+    em_proto_ClockSyncPing clock_sync_ping;
+    /* Compact tracking relative to a keyframe we never got came in, send a keyframe next. */
+    bool tracking_keyframe_request;
 } em_proto_DownMessage;
 
 
@@ -163,12 +245,17 @@ extern "C" {
 
 
 
+
+
+
 /* Initializer values for message structs */
 #define em_proto_Quaternion_init_default         {0, 0, 0, 0}
 #define em_proto_Vec3_init_default               {0, 0, 0}
 #define em_proto_Vec2_init_default               {0, 0}
 #define em_proto_Pose_init_default               {false, em_proto_Vec3_init_default, false, em_proto_Quaternion_init_default}
-#define em_proto_TrackingMessage_init_default    {false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, 0, 0}
+#define em_proto_TrackingMessage_init_default    {false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, false, em_proto_Pose_init_default, 0, 0, false, em_proto_Pose_init_default, 0}
+#define em_proto_QuantizedPose_init_default      {0, 0, 0, 0}
+#define em_proto_CompactTrackingMessage_init_default {0, 0, 0, 0, {em_proto_QuantizedPose_init_default, em_proto_QuantizedPose_init_default, em_proto_QuantizedPose_init_default, em_proto_QuantizedPose_init_default, em_proto_QuantizedPose_init_default, em_proto_QuantizedPose_init_default, em_proto_QuantizedPose_init_default, em_proto_QuantizedPose_init_default}, 0, 0, 0, 0, 0}
 #define em_proto_InputThumbstick_init_default    {false, em_proto_Vec2_init_default, 0, 0}
 #define em_proto_InputValueTouch_init_default    {0, 0}
 #define em_proto_InputClickTouch_init_default    {0, 0}
@@ -176,14 +263,20 @@ extern "C" {
 #define em_proto_TouchControllerLeft_init_default {false, em_proto_InputClickTouch_init_default, false, em_proto_InputClickTouch_init_default, false, em_proto_InputClickTouch_init_default, false, em_proto_TouchControllerCommon_init_default}
 #define em_proto_TouchControllerRight_init_default {false, em_proto_InputClickTouch_init_default, false, em_proto_InputClickTouch_init_default, false, em_proto_InputClickTouch_init_default, false, em_proto_TouchControllerCommon_init_default}
 #define em_proto_UpFrameMessage_init_default     {0, 0, 0, 0}
-#define em_proto_UpMessage_init_default          {0, false, em_proto_TrackingMessage_init_default, false, em_proto_UpFrameMessage_init_default}
-#define em_proto_DownFrameDataMessage_init_default {0, false, em_proto_Pose_init_default, 0}
-#define em_proto_DownMessage_init_default        {false, em_proto_DownFrameDataMessage_init_default}
+#define em_proto_ClockSyncPong_init_default      {0, 0, 0, 0}
+#define em_proto_UpMessage_init_default          {0, false, em_proto_TrackingMessage_init_default, false, em_proto_UpFrameMessage_init_default, false, em_proto_CompactTrackingMessage_init_default, false, em_proto_ClockSyncPong_init_default, 0, {em_proto_UpFrameMessage_init_default, em_proto_UpFrameMessage_init_default, em_proto_UpFrameMessage_init_default, em_proto_UpFrameMessage_init_default, em_proto_UpFrameMessage_init_default, em_proto_UpFrameMessage_init_default, em_proto_UpFrameMessage_init_default, em_proto_UpFrameMessage_init_default}}
+#define em_proto_EyeRect_init_default            {0, 0, 0, 0}
+#define em_proto_DownFrameDataMessage_init_default {0, false, em_proto_Pose_init_default, 0, false, em_proto_EyeRect_init_default, false, em_proto_EyeRect_init_default, 0}
+#define em_proto_StreamCapabilities_init_default {0, 0}
+#define em_proto_ClockSyncPing_init_default      {0, 0}
+#define em_proto_DownMessage_init_default        {false, em_proto_DownFrameDataMessage_init_default, false, em_proto_StreamCapabilities_init_default, false, em_proto_ClockSyncPing_init_default, 0}
 #define em_proto_Quaternion_init_zero            {0, 0, 0, 0}
 #define em_proto_Vec3_init_zero                  {0, 0, 0}
 #define em_proto_Vec2_init_zero                  {0, 0}
 #define em_proto_Pose_init_zero                  {false, em_proto_Vec3_init_zero, false, em_proto_Quaternion_init_zero}
-#define em_proto_TrackingMessage_init_zero       {false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, 0, 0}
+#define em_proto_TrackingMessage_init_zero       {false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, false, em_proto_Pose_init_zero, 0, 0, false, em_proto_Pose_init_zero, 0}
+#define em_proto_QuantizedPose_init_zero         {0, 0, 0, 0}
+#define em_proto_CompactTrackingMessage_init_zero {0, 0, 0, 0, {em_proto_QuantizedPose_init_zero, em_proto_QuantizedPose_init_zero, em_proto_QuantizedPose_init_zero, em_proto_QuantizedPose_init_zero, em_proto_QuantizedPose_init_zero, em_proto_QuantizedPose_init_zero, em_proto_QuantizedPose_init_zero, em_proto_QuantizedPose_init_zero}, 0, 0, 0, 0, 0}
 #define em_proto_InputThumbstick_init_zero       {false, em_proto_Vec2_init_zero, 0, 0}
 #define em_proto_InputValueTouch_init_zero       {0, 0}
 #define em_proto_InputClickTouch_init_zero       {0, 0}
@@ -191,9 +284,13 @@ extern "C" {
 #define em_proto_TouchControllerLeft_init_zero   {false, em_proto_InputClickTouch_init_zero, false, em_proto_InputClickTouch_init_zero, false, em_proto_InputClickTouch_init_zero, false, em_proto_TouchControllerCommon_init_zero}
 #define em_proto_TouchControllerRight_init_zero  {false, em_proto_InputClickTouch_init_zero, false, em_proto_InputClickTouch_init_zero, false, em_proto_InputClickTouch_init_zero, false, em_proto_TouchControllerCommon_init_zero}
 #define em_proto_UpFrameMessage_init_zero        {0, 0, 0, 0}
-#define em_proto_UpMessage_init_zero             {0, false, em_proto_TrackingMessage_init_zero, false, em_proto_UpFrameMessage_init_zero}
-#define em_proto_DownFrameDataMessage_init_zero  {0, false, em_proto_Pose_init_zero, 0}
-#define em_proto_DownMessage_init_zero           {false, em_proto_DownFrameDataMessage_init_zero}
+#define em_proto_ClockSyncPong_init_zero         {0, 0, 0, 0}
+#define em_proto_UpMessage_init_zero             {0, false, em_proto_TrackingMessage_init_zero, false, em_proto_UpFrameMessage_init_zero, false, em_proto_CompactTrackingMessage_init_zero, false, em_proto_ClockSyncPong_init_zero, 0, {em_proto_UpFrameMessage_init_zero, em_proto_UpFrameMessage_init_zero, em_proto_UpFrameMessage_init_zero, em_proto_UpFrameMessage_init_zero, em_proto_UpFrameMessage_init_zero, em_proto_UpFrameMessage_init_zero, em_proto_UpFrameMessage_init_zero, em_proto_UpFrameMessage_init_zero}}
+#define em_proto_EyeRect_init_zero               {0, 0, 0, 0}
+#define em_proto_DownFrameDataMessage_init_zero  {0, false, em_proto_Pose_init_zero, 0, false, em_proto_EyeRect_init_zero, false, em_proto_EyeRect_init_zero, 0}
+#define em_proto_StreamCapabilities_init_zero    {0, 0}
+#define em_proto_ClockSyncPing_init_zero         {0, 0}
+#define em_proto_DownMessage_init_zero           {false, em_proto_DownFrameDataMessage_init_zero, false, em_proto_StreamCapabilities_init_zero, false, em_proto_ClockSyncPing_init_zero, 0}
 
 /* Field tags (for use in manual encoding/decoding) */
 #define em_proto_Quaternion_w_tag                1
@@ -216,6 +313,21 @@ extern "C" {
 #define em_proto_TrackingMessage_controller_aim_right_tag 7
 #define em_proto_TrackingMessage_timestamp_tag   8
 #define em_proto_TrackingMessage_sequence_idx_tag 9
+#define em_proto_TrackingMessage_P_localSpace_viewSpace_pipelined_tag 10
+#define em_proto_TrackingMessage_pipelined_timestamp_tag 11
+#define em_proto_QuantizedPose_orientation_tag   1
+#define em_proto_QuantizedPose_position_x_tag    2
+#define em_proto_QuantizedPose_position_y_tag    3
+#define em_proto_QuantizedPose_position_z_tag    4
+#define em_proto_CompactTrackingMessage_version_tag 1
+#define em_proto_CompactTrackingMessage_pose_mask_tag 2
+#define em_proto_CompactTrackingMessage_keyframe_sequence_idx_tag 3
+#define em_proto_CompactTrackingMessage_poses_tag 4
+#define em_proto_CompactTrackingMessage_timestamp_tag 5
+#define em_proto_CompactTrackingMessage_sequence_idx_tag 6
+#define em_proto_CompactTrackingMessage_pipelined_timestamp_tag 7
+#define em_proto_CompactTrackingMessage_position_absent_mask_tag 8
+#define em_proto_CompactTrackingMessage_orientation_absent_mask_tag 9
 #define em_proto_InputThumbstick_xy_tag          1
 #define em_proto_InputThumbstick_click_tag       2
 #define em_proto_InputThumbstick_touch_tag       3
@@ -239,13 +351,34 @@ extern "C" {
 #define em_proto_UpFrameMessage_decode_complete_time_tag 2
 #define em_proto_UpFrameMessage_begin_frame_time_tag 3
 #define em_proto_UpFrameMessage_display_time_tag 4
+#define em_proto_ClockSyncPong_id_tag            1
+#define em_proto_ClockSyncPong_server_send_time_tag 2
+#define em_proto_ClockSyncPong_client_receive_time_tag 3
+#define em_proto_ClockSyncPong_client_send_time_tag 4
 #define em_proto_UpMessage_up_message_id_tag     1
 #define em_proto_UpMessage_tracking_tag          2
 #define em_proto_UpMessage_frame_tag             3
+#define em_proto_UpMessage_compact_tracking_tag  4
+#define em_proto_UpMessage_clock_sync_pong_tag   5
+#define em_proto_UpMessage_frames_tag            6
+#define em_proto_EyeRect_x_tag                   1
+#define em_proto_EyeRect_y_tag                   2
+#define em_proto_EyeRect_width_tag               3
+#define em_proto_EyeRect_height_tag              4
 #define em_proto_DownFrameDataMessage_frame_sequence_id_tag 1
 #define em_proto_DownFrameDataMessage_P_localSpace_viewSpace_tag 2
 #define em_proto_DownFrameDataMessage_display_time_tag 3
+#define em_proto_DownFrameDataMessage_left_eye_rect_tag 4
+#define em_proto_DownFrameDataMessage_right_eye_rect_tag 5
+#define em_proto_DownFrameDataMessage_tracking_sequence_idx_tag 6
+#define em_proto_StreamCapabilities_compact_tracking_version_tag 1
+#define em_proto_StreamCapabilities_batched_frame_reports_tag 2
+#define em_proto_ClockSyncPing_id_tag            1
+#define em_proto_ClockSyncPing_server_send_time_tag 2
 #define em_proto_DownMessage_frame_data_tag      1
+#define em_proto_DownMessage_capabilities_tag    2
+#define em_proto_DownMessage_clock_sync_ping_tag 3
+#define em_proto_DownMessage_tracking_keyframe_request_tag 4
 
 /* Struct field encoding specification for nanopb */
 #define em_proto_Quaternion_FIELDLIST(X, a) \
@@ -286,7 +419,9 @@ X(a, STATIC,   OPTIONAL, MESSAGE,  controller_aim_left,   5) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  controller_grip_right,   6) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  controller_aim_right,   7) \
 X(a, STATIC,   SINGULAR, INT64,    timestamp,         8) \
-X(a, STATIC,   SINGULAR, INT64,    sequence_idx,      9)
+X(a, STATIC,   SINGULAR, INT64,    sequence_idx,      9) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  P_localSpace_viewSpace_pipelined,  10) \
+X(a, STATIC,   SINGULAR, INT64,    pipelined_timestamp,  11)
 #define em_proto_TrackingMessage_CALLBACK NULL
 #define em_proto_TrackingMessage_DEFAULT NULL
 #define em_proto_TrackingMessage_P_localSpace_viewSpace_MSGTYPE em_proto_Pose
@@ -296,6 +431,29 @@ X(a, STATIC,   SINGULAR, INT64,    sequence_idx,      9)
 #define em_proto_TrackingMessage_controller_aim_left_MSGTYPE em_proto_Pose
 #define em_proto_TrackingMessage_controller_grip_right_MSGTYPE em_proto_Pose
 #define em_proto_TrackingMessage_controller_aim_right_MSGTYPE em_proto_Pose
+#define em_proto_TrackingMessage_P_localSpace_viewSpace_pipelined_MSGTYPE em_proto_Pose
+
+#define em_proto_QuantizedPose_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, FIXED64,  orientation,       1) \
+X(a, STATIC,   SINGULAR, SINT32,   position_x,        2) \
+X(a, STATIC,   SINGULAR, SINT32,   position_y,        3) \
+X(a, STATIC,   SINGULAR, SINT32,   position_z,        4)
+#define em_proto_QuantizedPose_CALLBACK NULL
+#define em_proto_QuantizedPose_DEFAULT NULL
+
+#define em_proto_CompactTrackingMessage_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT32,   version,           1) \
+X(a, STATIC,   SINGULAR, UINT32,   pose_mask,         2) \
+X(a, STATIC,   SINGULAR, INT64,    keyframe_sequence_idx,   3) \
+X(a, STATIC,   REPEATED, MESSAGE,  poses,             4) \
+X(a, STATIC,   SINGULAR, INT64,    timestamp,         5) \
+X(a, STATIC,   SINGULAR, INT64,    sequence_idx,      6) \
+X(a, STATIC,   SINGULAR, INT64,    pipelined_timestamp,   7) \
+X(a, STATIC,   SINGULAR, UINT32,   position_absent_mask,   8) \
+X(a, STATIC,   SINGULAR, UINT32,   orientation_absent_mask,   9)
+#define em_proto_CompactTrackingMessage_CALLBACK NULL
+#define em_proto_CompactTrackingMessage_DEFAULT NULL
+#define em_proto_CompactTrackingMessage_poses_MSGTYPE em_proto_QuantizedPose
 
 #define em_proto_InputThumbstick_FIELDLIST(X, a) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  xy,                1) \
@@ -360,34 +518,80 @@ X(a, STATIC,   SINGULAR, INT64,    display_time,      4)
 #define em_proto_UpFrameMessage_CALLBACK NULL
 #define em_proto_UpFrameMessage_DEFAULT NULL
 
+#define em_proto_ClockSyncPong_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT32,   id,                1) \
+X(a, STATIC,   SINGULAR, INT64,    server_send_time,   2) \
+X(a, STATIC,   SINGULAR, INT64,    client_receive_time,   3) \
+X(a, STATIC,   SINGULAR, INT64,    client_send_time,   4)
+#define em_proto_ClockSyncPong_CALLBACK NULL
+#define em_proto_ClockSyncPong_DEFAULT NULL
+
 #define em_proto_UpMessage_FIELDLIST(X, a) \
 X(a, STATIC,   SINGULAR, INT64,    up_message_id,     1) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  tracking,          2) \
-X(a, STATIC,   OPTIONAL, MESSAGE,  frame,             3)
+X(a, STATIC,   OPTIONAL, MESSAGE,  frame,             3) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  compact_tracking,   4) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  clock_sync_pong,   5) \
+X(a, STATIC,   REPEATED, MESSAGE,  frames,            6)
 #define em_proto_UpMessage_CALLBACK NULL
 #define em_proto_UpMessage_DEFAULT NULL
 #define em_proto_UpMessage_tracking_MSGTYPE em_proto_TrackingMessage
 #define em_proto_UpMessage_frame_MSGTYPE em_proto_UpFrameMessage
+#define em_proto_UpMessage_compact_tracking_MSGTYPE em_proto_CompactTrackingMessage
+#define em_proto_UpMessage_clock_sync_pong_MSGTYPE em_proto_ClockSyncPong
+#define em_proto_UpMessage_frames_MSGTYPE em_proto_UpFrameMessage
+
+#define em_proto_EyeRect_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, FLOAT,    x,                 1) \
+X(a, STATIC,   SINGULAR, FLOAT,    y,                 2) \
+X(a, STATIC,   SINGULAR, FLOAT,    width,             3) \
+X(a, STATIC,   SINGULAR, FLOAT,    height,            4)
+#define em_proto_EyeRect_CALLBACK NULL
+#define em_proto_EyeRect_DEFAULT NULL
 
 #define em_proto_DownFrameDataMessage_FIELDLIST(X, a) \
 X(a, STATIC,   SINGULAR, INT64,    frame_sequence_id,   1) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  P_localSpace_viewSpace,   2) \
-X(a, STATIC,   SINGULAR, INT64,    display_time,      3)
+X(a, STATIC,   SINGULAR, INT64,    display_time,      3) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  left_eye_rect,     4) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  right_eye_rect,    5) \
+X(a, STATIC,   SINGULAR, INT64,    tracking_sequence_idx,   6)
 #define em_proto_DownFrameDataMessage_CALLBACK NULL
 #define em_proto_DownFrameDataMessage_DEFAULT NULL
 #define em_proto_DownFrameDataMessage_P_localSpace_viewSpace_MSGTYPE em_proto_Pose
+#define em_proto_DownFrameDataMessage_left_eye_rect_MSGTYPE em_proto_EyeRect
+#define em_proto_DownFrameDataMessage_right_eye_rect_MSGTYPE em_proto_EyeRect
+
+#define em_proto_StreamCapabilities_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT32,   compact_tracking_version,   1) \
+X(a, STATIC,   SINGULAR, BOOL,     batched_frame_reports,   2)
+#define em_proto_StreamCapabilities_CALLBACK NULL
+#define em_proto_StreamCapabilities_DEFAULT NULL
+
+#define em_proto_ClockSyncPing_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT32,   id,                1) \
+X(a, STATIC,   SINGULAR, INT64,    server_send_time,   2)
+#define em_proto_ClockSyncPing_CALLBACK NULL
+#define em_proto_ClockSyncPing_DEFAULT NULL
 
 #define em_proto_DownMessage_FIELDLIST(X, a) \
-X(a, STATIC,   OPTIONAL, MESSAGE,  frame_data,        1)
+X(a, STATIC,   OPTIONAL, MESSAGE,  frame_data,        1) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  capabilities,      2) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  clock_sync_ping,   3) \
+X(a, STATIC,   SINGULAR, BOOL,     tracking_keyframe_request,   4)
 #define em_proto_DownMessage_CALLBACK NULL
 #define em_proto_DownMessage_DEFAULT NULL
 #define em_proto_DownMessage_frame_data_MSGTYPE em_proto_DownFrameDataMessage
+#define em_proto_DownMessage_capabilities_MSGTYPE em_proto_StreamCapabilities
+#define em_proto_DownMessage_clock_sync_ping_MSGTYPE em_proto_ClockSyncPing
 
 extern const pb_msgdesc_t em_proto_Quaternion_msg;
 extern const pb_msgdesc_t em_proto_Vec3_msg;
 extern const pb_msgdesc_t em_proto_Vec2_msg;
 extern const pb_msgdesc_t em_proto_Pose_msg;
 extern const pb_msgdesc_t em_proto_TrackingMessage_msg;
+extern const pb_msgdesc_t em_proto_QuantizedPose_msg;
+extern const pb_msgdesc_t em_proto_CompactTrackingMessage_msg;
 extern const pb_msgdesc_t em_proto_InputThumbstick_msg;
 extern const pb_msgdesc_t em_proto_InputValueTouch_msg;
 extern const pb_msgdesc_t em_proto_InputClickTouch_msg;
@@ -395,8 +599,12 @@ extern const pb_msgdesc_t em_proto_TouchControllerCommon_msg;
 extern const pb_msgdesc_t em_proto_TouchControllerLeft_msg;
 extern const pb_msgdesc_t em_proto_TouchControllerRight_msg;
 extern const pb_msgdesc_t em_proto_UpFrameMessage_msg;
+extern const pb_msgdesc_t em_proto_ClockSyncPong_msg;
 extern const pb_msgdesc_t em_proto_UpMessage_msg;
+extern const pb_msgdesc_t em_proto_EyeRect_msg;
 extern const pb_msgdesc_t em_proto_DownFrameDataMessage_msg;
+extern const pb_msgdesc_t em_proto_StreamCapabilities_msg;
+extern const pb_msgdesc_t em_proto_ClockSyncPing_msg;
 extern const pb_msgdesc_t em_proto_DownMessage_msg;
 
 /* Defines for backwards compatibility with code written before nanopb-0.4.0 */
@@ -405,6 +613,8 @@ extern const pb_msgdesc_t em_proto_DownMessage_msg;
 #define em_proto_Vec2_fields &em_proto_Vec2_msg
 #define em_proto_Pose_fields &em_proto_Pose_msg
 #define em_proto_TrackingMessage_fields &em_proto_TrackingMessage_msg
+#define em_proto_QuantizedPose_fields &em_proto_QuantizedPose_msg
+#define em_proto_CompactTrackingMessage_fields &em_proto_CompactTrackingMessage_msg
 #define em_proto_InputThumbstick_fields &em_proto_InputThumbstick_msg
 #define em_proto_InputValueTouch_fields &em_proto_InputValueTouch_msg
 #define em_proto_InputClickTouch_fields &em_proto_InputClickTouch_msg
@@ -412,24 +622,34 @@ extern const pb_msgdesc_t em_proto_DownMessage_msg;
 #define em_proto_TouchControllerLeft_fields &em_proto_TouchControllerLeft_msg
 #define em_proto_TouchControllerRight_fields &em_proto_TouchControllerRight_msg
 #define em_proto_UpFrameMessage_fields &em_proto_UpFrameMessage_msg
+#define em_proto_ClockSyncPong_fields &em_proto_ClockSyncPong_msg
 #define em_proto_UpMessage_fields &em_proto_UpMessage_msg
+#define em_proto_EyeRect_fields &em_proto_EyeRect_msg
 #define em_proto_DownFrameDataMessage_fields &em_proto_DownFrameDataMessage_msg
+#define em_proto_StreamCapabilities_fields &em_proto_StreamCapabilities_msg
+#define em_proto_ClockSyncPing_fields &em_proto_ClockSyncPing_msg
 #define em_proto_DownMessage_fields &em_proto_DownMessage_msg
 
 /* Maximum encoded size of messages (where known) */
-#define em_proto_DownFrameDataMessage_size       63
-#define em_proto_DownMessage_size                65
+#define em_proto_ClockSyncPing_size              17
+#define em_proto_ClockSyncPong_size              39
+#define em_proto_CompactTrackingMessage_size     300
+#define em_proto_DownFrameDataMessage_size       118
+#define em_proto_DownMessage_size                151
+#define em_proto_EyeRect_size                    20
 #define em_proto_InputClickTouch_size            4
 #define em_proto_InputThumbstick_size            16
 #define em_proto_InputValueTouch_size            7
 #define em_proto_Pose_size                       39
+#define em_proto_QuantizedPose_size              27
 #define em_proto_Quaternion_size                 20
+#define em_proto_StreamCapabilities_size         8
 #define em_proto_TouchControllerCommon_size      38
 #define em_proto_TouchControllerLeft_size        58
 #define em_proto_TouchControllerRight_size       58
-#define em_proto_TrackingMessage_size            309
+#define em_proto_TrackingMessage_size            361
 #define em_proto_UpFrameMessage_size             44
-#define em_proto_UpMessage_size                  369
+#define em_proto_UpMessage_size                  1133
 #define em_proto_Vec2_size                       10
 #define em_proto_Vec3_size                       15
 
@@ -0,0 +1,77 @@
+#!/bin/sh
+
+# Copyright 2023, Pluto VR, Inc.
+#
+# SPDX-License-Identifier: BSL-1.0
+
+# Measure how stale the server's head pose gets when tracking crosses a lossy link, with tracking sent over the
+# reliable, ordered channel (how clients used to send it) and over the unordered, unreliable "tracking" channel.
+#
+# Start the server and an OpenXR app on it first, see run_server.sh and run_openxr_app.sh. This then adds netem loss
+# and delay on loopback (needs sudo), connects the test client for each mode in turn, and prints what the server
+# scraped: how old the newest applied pose got before the next replaced it, and how many tracking messages arrived
+# stale.
+#
+# Everything can be overridden from the environment, e.g. LOSS=5% DURATION=120 ./tracking_loss_harness.sh
+set -e
+EM_ROOT=$(cd "$(dirname "$0")" && cd .. && pwd)
+
+LOSS=${LOSS:-1%}
+# Each way, so twice this round trip.
+DELAY=${DELAY:-10ms}
+RATE=${RATE:-90}
+DURATION=${DURATION:-60}
+DEV=${DEV:-lo}
+WEBRTC_CLIENT=${WEBRTC_CLIENT:-"$EM_ROOT/server/build/src/test/webrtc_client"}
+METRICS_URL=${METRICS_URL:-http://127.0.0.1:8081/metrics}
+
+cleanup() {
+	sudo tc qdisc del dev "$DEV" root netem 2>/dev/null || true
+}
+trap cleanup EXIT INT TERM
+
+# Print the value of one sample from a scrape, or 0.
+metric() {
+	awk -v name="$2" '$1 == name { print $2; found = 1 } END { if (!found) print 0 }' "$1"
+}
+
+run() {
+	mode=$1
+	shift
+
+	# Scraping drains the quantiles, so the next scrape only covers this run.
+	before=$(mktemp)
+	after=$(mktemp)
+	curl -sf "$METRICS_URL" >"$before"
+
+	timeout -s INT "$DURATION" "$WEBRTC_CLIENT" --tracking-rate "$RATE" "$@" >/dev/null 2>&1 || true
+	# Let the server notice the client is gone.
+	sleep 2
+
+	curl -sf "$METRICS_URL" >"$after"
+
+	count=$(($(metric "$after" ems_tracking_gap_ms_count) - $(metric "$before" ems_tracking_gap_ms_count)))
+	sum=$(awk -v a="$(metric "$after" ems_tracking_gap_ms_sum)" -v b="$(metric "$before" ems_tracking_gap_ms_sum)" \
+		'BEGIN { print a - b }')
+	received=$(($(metric "$after" 'ems_tracking_messages_total{result="received"}') -
+		$(metric "$before" 'ems_tracking_messages_total{result="received"}')))
+	stale=$(($(metric "$after" 'ems_tracking_messages_total{result="stale"}') -
+		$(metric "$before" 'ems_tracking_messages_total{result="stale"}')))
+
+	printf '%-10s %8s %8s %8s %8s %10s %8s\n' "$mode" \
+		"$(awk -v s="$sum" -v c="$count" 'BEGIN { printf "%.1f", c > 0 ? s / c : 0 }')" \
+		"$(metric "$after" 'ems_tracking_gap_ms{quantile="0.5"}')" \
+		"$(metric "$after" 'ems_tracking_gap_ms{quantile="0.9"}')" \
+		"$(metric "$after" 'ems_tracking_gap_ms{quantile="0.99"}')" \
+		"$received" "$stale"
+
+	rm -f "$before" "$after"
+}
+
+sudo tc qdisc add dev "$DEV" root netem delay "$DELAY" loss "$LOSS"
+
+echo "netem on $DEV: delay $DELAY each way, loss $LOSS; tracking at $RATE Hz for $DURATION s per mode"
+echo "Pose age in ms, from when it was applied to when the next one replaced it:"
+printf '%-10s %8s %8s %8s %8s %10s %8s\n' mode mean p50 p90 p99 received stale
+run reliable --tracking-reliable
+run tracking
@@ -10,40 +10,479 @@
  */
 
 #include "ems_callbacks.h"
-#include <cstddef>
-#include <type_traits>
 
-#include "util/u_generic_callbacks.hpp"
+#include "electricmaple.pb.h"
 
+#include "os/os_threading.h"
+#include "util/u_logging.h"
+#include "util/u_time.h"
+
+#include <array>
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
 #include <stdint.h>
 
+namespace {
+
+struct CallbackEntry
+{
+	ems_callbacks_func_t func;
+	uint32_t event_mask;
+	void *userdata;
+};
+
+/*!
+ * An immutable snapshot of the registered callbacks.
+ *
+ * Dispatch only ever reads a published snapshot, writers build a new one and swap it in.
+ */
+using CallbackList = std::vector<CallbackEntry>;
+
+/*!
+ * Bounded queue of decoded messages with drop-oldest semantics, for one producer and one consumer.
+ *
+ * Each slot carries a sequence number (as in Vyukov's bounded queue): a slot is writable when its sequence equals
+ * the producer position, and readable when it equals the consumer position plus one. When the queue is full the
+ * producer claims the oldest message through the same compare-exchange the consumer uses, so it never writes a slot
+ * that is being read.
+ */
+class UpMessageQueue
+{
+public:
+	explicit UpMessageQueue(uint32_t capacity) : slots_(capacity), capacity_(capacity)
+	{
+		for (uint64_t i = 0; i < capacity_; i++) {
+			slots_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	//! Producer side, returns true if the oldest message had to be dropped.
+	bool
+	push(enum ems_callbacks_event event, const em_proto_UpMessage &message)
+	{
+		bool dropped = false;
+		uint64_t pos = head_;
+		Slot &slot = slots_[pos % capacity_];
+
+		while (true) {
+			uint64_t seq = slot.sequence.load(std::memory_order_acquire);
+			if (seq == pos) {
+				break;
+			}
+
+			// Full: the slot still holds message (pos - capacity), try to take it away from the consumer.
+			uint64_t oldest = pos - capacity_;
+			if (seq == oldest + 1 && tail_.compare_exchange_strong(oldest, oldest + 1, std::memory_order_acq_rel)) {
+				dropped = true;
+				break;
+			}
+
+			// The consumer is copying that message out, it will hand the slot back shortly.
+			std::this_thread::yield();
+		}
+
+		slot.event = event;
+		slot.message = message;
+		slot.sequence.store(pos + 1, std::memory_order_release);
+		head_ = pos + 1;
+
+		return dropped;
+	}
+
+	//! Consumer side, returns false if the queue is empty.
+	bool
+	pop(enum ems_callbacks_event &out_event, em_proto_UpMessage &out_message)
+	{
+		uint64_t pos = tail_.load(std::memory_order_acquire);
+
+		while (true) {
+			Slot &slot = slots_[pos % capacity_];
+			uint64_t seq = slot.sequence.load(std::memory_order_acquire);
+			int64_t diff = (int64_t)(seq - (pos + 1));
+
+			if (diff < 0) {
+				// Nothing published at this position yet.
+				return false;
+			}
+
+			if (diff > 0) {
+				// The producer dropped this one and reused the slot, catch up.
+				pos = tail_.load(std::memory_order_acquire);
+				continue;
+			}
+
+			if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_acq_rel)) {
+				out_event = slot.event;
+				out_message = slot.message;
+				slot.sequence.store(pos + capacity_, std::memory_order_release);
+				return true;
+			}
+			// pos now holds the current tail, retry.
+		}
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t> sequence{0};
+		enum ems_callbacks_event event;
+		em_proto_UpMessage message;
+	};
+
+	std::vector<Slot> slots_;
+	const uint64_t capacity_;
+
+	//! Only touched by the producer. A new producer thread may take over once the old one is done, see Participant.
+	uint64_t head_ = 0;
+
+	//! Advanced by the consumer, and by the producer when dropping.
+	std::atomic<uint64_t> tail_{0};
+};
+
+/*!
+ * What one thread needs to call one ems_callbacks: its hazard slot, and its own queue to the dispatch thread.
+ *
+ * Created the first time a thread calls, and handed to another thread once this one exits. Never freed while the
+ * ems_callbacks lives, so writers and the dispatch thread can look at all of them without a lock.
+ */
+struct Participant
+{
+	//! The snapshot this thread is walking, or nullptr. Writers don't free a snapshot while it is in here.
+	std::atomic<const CallbackList *> hazard{nullptr};
+
+	//! This thread's messages to the dispatch thread, set up before the dispatch thread is announced.
+	std::unique_ptr<UpMessageQueue> queue;
+
+	//! The thread using it exited, the next new one may take it over.
+	std::atomic<bool> retired{false};
+
+	//! The ems_callbacks is gone, threads holding on to it should let go.
+	std::atomic<bool> orphaned{false};
+};
+
+//! Past this many threads calling at once, the rest take the writer lock instead.
+constexpr size_t kMaxParticipants = 32;
+
+} // namespace
+
 struct ems_callbacks
 {
-	std::mutex mutex;
-	xrt::auxiliary::util::GenericCallbacks<ems_callbacks_func_t, enum ems_callbacks_event> callbacks_collection;
+	//! Tells ems_callbacks apart in each thread's list of participants, addresses get reused.
+	const uint64_t id;
+
+	//! Serializes writers (add/reset/mode changes), never taken while dispatching.
+	std::mutex writer_mutex;
+
+	//! The currently published snapshot, never null.
+	std::atomic<const CallbackList *> current{new CallbackList};
+
+	struct
+	{
+		//! Taken when a thread calls for the first time, and when another one exits.
+		std::mutex mutex;
+
+		//! Keeps them alive, protected by mutex.
+		std::vector<std::shared_ptr<Participant>> owned;
+
+		//! The first count of these are set, for going through them without the mutex.
+		std::array<std::atomic<Participant *>, kMaxParticipants> slots{};
+		std::atomic<size_t> count{0};
+	} participants;
+
+	struct
+	{
+		//! Capacity of each participant's queue, set once the dispatch thread starts.
+		uint32_t queue_capacity = 0;
+
+		//! For threads that found no participant free, protected by writer_mutex.
+		std::unique_ptr<UpMessageQueue> overflow_queue;
+
+		//! Set once the queues are ready to be used by producers.
+		std::atomic<bool> active{false};
+
+		//! The snapshot the dispatch thread is walking, like Participant::hazard.
+		std::atomic<const CallbackList *> hazard{nullptr};
+
+		std::thread thread;
+		std::atomic<bool> running{false};
+		struct os_semaphore sem;
+
+		std::atomic<uint64_t> dropped{0};
+	} dispatch;
+
+	explicit ems_callbacks(uint64_t id) : id(id) {}
+};
+
+namespace {
+
+std::atomic<uint64_t> next_callbacks_id{1};
+
+/*!
+ * A thread's hold on its participant of one ems_callbacks, hands it back when the thread exits.
+ */
+struct ThreadParticipation
+{
+	uint64_t callbacks_id;
+	std::shared_ptr<Participant> participant;
+
+	ThreadParticipation(uint64_t callbacks_id, std::shared_ptr<Participant> participant)
+	    : callbacks_id(callbacks_id), participant(std::move(participant))
+	{}
+
+	ThreadParticipation(ThreadParticipation &&) = default;
+	ThreadParticipation &
+	operator=(ThreadParticipation &&) = default;
+
+	~ThreadParticipation()
+	{
+		if (participant) {
+			participant->retired.store(true, std::memory_order_release);
+		}
+	}
 };
 
+thread_local std::vector<ThreadParticipation> thread_participations;
+
+/*!
+ * Get this thread's participant, taking one over or making one the first time. Returns nullptr if there are
+ * kMaxParticipants threads in already.
+ */
+Participant *
+get_participant(struct ems_callbacks *callbacks)
+{
+	for (const ThreadParticipation &tp : thread_participations) {
+		if (tp.callbacks_id == callbacks->id) {
+			return tp.participant.get();
+		}
+	}
+
+	// First call on this thread, forget ems_callbacks that are gone while at it.
+	for (auto it = thread_participations.begin(); it != thread_participations.end();) {
+		if (it->participant->orphaned.load(std::memory_order_relaxed)) {
+			it = thread_participations.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(callbacks->participants.mutex);
+
+	std::shared_ptr<Participant> participant;
+	for (const std::shared_ptr<Participant> &p : callbacks->participants.owned) {
+		// Whatever the old thread queued is still delivered, we carry on after it.
+		if (p->retired.load(std::memory_order_acquire)) {
+			p->retired.store(false, std::memory_order_relaxed);
+			participant = p;
+			break;
+		}
+	}
+
+	if (!participant) {
+		size_t count = callbacks->participants.count.load(std::memory_order_relaxed);
+		if (count == kMaxParticipants) {
+			return nullptr;
+		}
+		participant = std::make_shared<Participant>();
+		{
+			// The dispatch thread may be starting up right now, it sets up the queues with this held.
+			std::unique_lock<std::mutex> writer_lock(callbacks->writer_mutex);
+			if (callbacks->dispatch.queue_capacity != 0) {
+				participant->queue = std::make_unique<UpMessageQueue>(callbacks->dispatch.queue_capacity);
+			}
+		}
+		callbacks->participants.owned.push_back(participant);
+		callbacks->participants.slots[count].store(participant.get(), std::memory_order_release);
+		callbacks->participants.count.store(count + 1, std::memory_order_release);
+	}
+
+	thread_participations.emplace_back(callbacks->id, participant);
+	return participant.get();
+}
+
+/*!
+ * Publish the snapshot this thread is about to walk in @p hazard, and return it. Once this returns, writers won't
+ * free it until the hazard is cleared.
+ */
+const CallbackList *
+protect_snapshot(struct ems_callbacks *callbacks, std::atomic<const CallbackList *> &hazard)
+{
+	const CallbackList *list = callbacks->current.load(std::memory_order_acquire);
+	while (true) {
+		hazard.store(list, std::memory_order_seq_cst);
+		// A writer that swapped it out before seeing our hazard may be freeing it, go again with the new one.
+		const CallbackList *now = callbacks->current.load(std::memory_order_seq_cst);
+		if (now == list) {
+			return list;
+		}
+		list = now;
+	}
+}
+
+void
+invoke_list(const CallbackList *list, enum ems_callbacks_event event, const em_proto_UpMessage *message)
+{
+	for (const CallbackEntry &entry : *list) {
+		if ((entry.event_mask & (uint32_t)event) != 0) {
+			entry.func(event, message, entry.userdata);
+		}
+	}
+}
+
+void
+invoke_protected(struct ems_callbacks *callbacks,
+                 std::atomic<const CallbackList *> &hazard,
+                 enum ems_callbacks_event event,
+                 const em_proto_UpMessage *message)
+{
+	// Called from inside a callback: the outer call already protects a snapshot, stay on it.
+	const CallbackList *outer = hazard.load(std::memory_order_relaxed);
+	if (outer != nullptr) {
+		invoke_list(outer, event, message);
+		return;
+	}
+
+	invoke_list(protect_snapshot(callbacks, hazard), event, message);
+	hazard.store(nullptr, std::memory_order_release);
+}
+
+//! Whether any thread has @p list in its hazard slot.
+bool
+snapshot_in_use(struct ems_callbacks *callbacks, const CallbackList *list)
+{
+	if (callbacks->dispatch.hazard.load(std::memory_order_seq_cst) == list) {
+		return true;
+	}
+	size_t count = callbacks->participants.count.load(std::memory_order_acquire);
+	for (size_t i = 0; i < count; i++) {
+		Participant *p = callbacks->participants.slots[i].load(std::memory_order_acquire);
+		if (p->hazard.load(std::memory_order_seq_cst) == list) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*!
+ * Swap in a new snapshot and free the old one once no dispatcher can still be looking at it.
+ *
+ * Must not be called from inside a callback.
+ */
+void
+publish_snapshot_locked(struct ems_callbacks *callbacks, const CallbackList *list)
+{
+	const CallbackList *old = callbacks->current.exchange(list, std::memory_order_seq_cst);
+
+	// Anybody who got the old one published it in their hazard slot before checking it was still current.
+	while (snapshot_in_use(callbacks, old)) {
+		std::this_thread::yield();
+	}
+
+	delete old;
+}
+
+/*!
+ * Take one message from each queue in turn and deliver it, until all are empty. Messages from one thread stay in
+ * order, a thread sending a lot does not hold up the others.
+ */
+void
+drain_queues(struct ems_callbacks *callbacks, enum ems_callbacks_event &event, em_proto_UpMessage &message)
+{
+	bool any = true;
+	while (any) {
+		any = false;
+		size_t count = callbacks->participants.count.load(std::memory_order_acquire);
+		for (size_t i = 0; i < count; i++) {
+			Participant *p = callbacks->participants.slots[i].load(std::memory_order_acquire);
+			if (p->queue && p->queue->pop(event, message)) {
+				invoke_protected(callbacks, callbacks->dispatch.hazard, event, &message);
+				any = true;
+			}
+		}
+		if (callbacks->dispatch.overflow_queue->pop(event, message)) {
+			invoke_protected(callbacks, callbacks->dispatch.hazard, event, &message);
+			any = true;
+		}
+	}
+}
+
+void
+dispatch_thread_func(struct ems_callbacks *callbacks)
+{
+	enum ems_callbacks_event event;
+	std::unique_ptr<em_proto_UpMessage> message = std::make_unique<em_proto_UpMessage>();
+
+	while (callbacks->dispatch.running.load(std::memory_order_acquire)) {
+		// Time out now and then so we notice being stopped.
+		os_semaphore_wait(&callbacks->dispatch.sem, 100 * U_TIME_1MS_IN_NS);
+
+		drain_queues(callbacks, event, *message);
+	}
+}
+
+void
+stop_dispatch_thread(struct ems_callbacks *callbacks)
+{
+	if (!callbacks->dispatch.thread.joinable()) {
+		return;
+	}
+
+	{
+		// Threads without a participant push under this.
+		std::unique_lock<std::mutex> lock(callbacks->writer_mutex);
+		callbacks->dispatch.active.store(false, std::memory_order_seq_cst);
+	}
+
+	// Wait out producers that saw it still active. They publish their hazard before looking, see
+	// ems_callbacks_call, so any that did not publish one yet will see it inactive.
+	size_t count = callbacks->participants.count.load(std::memory_order_acquire);
+	for (size_t i = 0; i < count; i++) {
+		Participant *p = callbacks->participants.slots[i].load(std::memory_order_acquire);
+		while (p->hazard.load(std::memory_order_seq_cst) != nullptr) {
+			std::this_thread::yield();
+		}
+	}
+
+	callbacks->dispatch.running.store(false, std::memory_order_release);
+	os_semaphore_release(&callbacks->dispatch.sem);
+	callbacks->dispatch.thread.join();
+
+	os_semaphore_destroy(&callbacks->dispatch.sem);
+}
+
+} // namespace
+
 struct ems_callbacks *
 ems_callbacks_create()
 {
-	// auto ret = std::make_unique<ems_callbacks>();
-
-	// return ret.release();
-	return new ems_callbacks;
+	return new ems_callbacks(next_callbacks_id.fetch_add(1, std::memory_order_relaxed));
 }
 
 void
 ems_callbacks_destroy(struct ems_callbacks **ptr_callbacks)
 {
-	if (!ptr_callbacks) {
+	if (!ptr_callbacks || !*ptr_callbacks) {
 		return;
 	}
 	std::unique_ptr<ems_callbacks> callbacks(*ptr_callbacks);
-	// take the lock to wait for anybody else who might be in the lock.
-	std::unique_lock<std::mutex> lock(callbacks->mutex);
-	lock.unlock();
+
+	stop_dispatch_thread(callbacks.get());
+
+	{
+		// Waits for anybody still dispatching on the current snapshot.
+		std::unique_lock<std::mutex> lock(callbacks->writer_mutex);
+		publish_snapshot_locked(callbacks.get(), nullptr);
+	}
+
+	{
+		// Threads that called us keep their participant until they exit or call another ems_callbacks.
+		std::unique_lock<std::mutex> lock(callbacks->participants.mutex);
+		for (const std::shared_ptr<Participant> &p : callbacks->participants.owned) {
+			p->orphaned.store(true, std::memory_order_relaxed);
+		}
+	}
 
 	*ptr_callbacks = nullptr;
 	callbacks.reset();
@@ -52,24 +491,87 @@ ems_callbacks_destroy(struct ems_callbacks **ptr_callbacks)
 void
 ems_callbacks_add(struct ems_callbacks *callbacks, uint32_t event_mask, ems_callbacks_func_t func, void *userdata)
 {
-	std::unique_lock<std::mutex> lock(callbacks->mutex);
-	callbacks->callbacks_collection.addCallback(func, event_mask, userdata);
+	std::unique_lock<std::mutex> lock(callbacks->writer_mutex);
+
+	auto *list = new CallbackList(*callbacks->current.load(std::memory_order_acquire));
+	list->push_back(CallbackEntry{func, event_mask, userdata});
+
+	publish_snapshot_locked(callbacks, list);
 }
 
 void
 ems_callbacks_reset(struct ems_callbacks *callbacks)
 {
-	std::unique_lock<std::mutex> lock(callbacks->mutex);
-	callbacks->callbacks_collection = {};
+	std::unique_lock<std::mutex> lock(callbacks->writer_mutex);
+	publish_snapshot_locked(callbacks, new CallbackList);
+}
+
+bool
+ems_callbacks_start_dispatch_thread(struct ems_callbacks *callbacks, uint32_t queue_capacity)
+{
+	// Participants made from here on get a queue with this held, the ones already there get one below.
+	std::unique_lock<std::mutex> participants_lock(callbacks->participants.mutex);
+	std::unique_lock<std::mutex> lock(callbacks->writer_mutex);
+
+	if (queue_capacity == 0 || callbacks->dispatch.thread.joinable()) {
+		return false;
+	}
+
+	if (os_semaphore_init(&callbacks->dispatch.sem, 0) != 0) {
+		U_LOG_E("Failed to init dispatch semaphore");
+		return false;
+	}
+
+	callbacks->dispatch.queue_capacity = queue_capacity;
+	callbacks->dispatch.overflow_queue = std::make_unique<UpMessageQueue>(queue_capacity);
+	for (const std::shared_ptr<Participant> &p : callbacks->participants.owned) {
+		p->queue = std::make_unique<UpMessageQueue>(queue_capacity);
+	}
+
+	callbacks->dispatch.running.store(true, std::memory_order_release);
+	callbacks->dispatch.thread = std::thread(dispatch_thread_func, callbacks);
+	callbacks->dispatch.active.store(true, std::memory_order_seq_cst);
+
+	return true;
+}
+
+uint64_t
+ems_callbacks_get_dropped_count(struct ems_callbacks *callbacks)
+{
+	return callbacks->dispatch.dropped.load(std::memory_order_relaxed);
 }
 
 void
 ems_callbacks_call(struct ems_callbacks *callbacks, enum ems_callbacks_event event, const em_proto_UpMessage *message)
 {
-	std::unique_lock<std::mutex> lock(callbacks->mutex);
-	auto invoker = [=](enum ems_callbacks_event ev, ems_callbacks_func_t callback, void *userdata) {
-		callback(ev, message, userdata);
-		return false; // do not remove
-	};
-	callbacks->callbacks_collection.invokeCallbacks(event, invoker);
+	Participant *p = get_participant(callbacks);
+	if (p == nullptr) {
+		// Too many threads at once. Rare enough to take the lock, which keeps writers from freeing anything.
+		std::unique_lock<std::mutex> lock(callbacks->writer_mutex);
+		if (callbacks->dispatch.active.load(std::memory_order_relaxed)) {
+			if (callbacks->dispatch.overflow_queue->push(event, *message)) {
+				callbacks->dispatch.dropped.fetch_add(1, std::memory_order_relaxed);
+			}
+			os_semaphore_release(&callbacks->dispatch.sem);
+		} else {
+			invoke_list(callbacks->current.load(std::memory_order_relaxed), event, message);
+		}
+		return;
+	}
+
+	// Publishing the hazard first also tells stop_dispatch_thread we might be using the queue.
+	if (p->hazard.load(std::memory_order_relaxed) == nullptr) {
+		protect_snapshot(callbacks, p->hazard);
+		if (callbacks->dispatch.active.load(std::memory_order_seq_cst)) {
+			if (p->queue->push(event, *message)) {
+				callbacks->dispatch.dropped.fetch_add(1, std::memory_order_relaxed);
+			}
+			os_semaphore_release(&callbacks->dispatch.sem);
+			p->hazard.store(nullptr, std::memory_order_release);
+			return;
+		}
+		p->hazard.store(nullptr, std::memory_order_release);
+	}
+
+	invoke_protected(callbacks, p->hazard, event, message);
 }
@@ -9,6 +9,7 @@
  * @ingroup aux_util
  */
 #pragma once
+#include <stdbool.h>
 #include <stdint.h>
 #include <glib.h>
 
@@ -60,17 +61,46 @@ ems_callbacks_add(struct ems_callbacks *callbacks, uint32_t event_mask, ems_call
 
 /// Call all callbacks that are interested in @p event
 ///
+/// Never takes a lock: callbacks are stored as an immutable snapshot that add/reset replace wholesale. Only the
+/// first call from each thread does, and calls from threads beyond the first 32 calling at once.
+///
+/// If a dispatch thread was started, the message is copied into its queue and this returns right away,
+/// otherwise the callbacks run on the calling thread.
+///
 /// @param callbacks self
 /// @param event The enum @ref ems_callbacks_event describing this event
-/// @param message The decoded message. We pass yours, we do not copy it!
+/// @param message The decoded message. Without a dispatch thread we pass yours, we do not copy it!
 ///
 /// @public @memberof ems_callbacks
 void
 ems_callbacks_call(struct ems_callbacks *callbacks, enum ems_callbacks_event event, const em_proto_UpMessage *message);
 
+/// Start delivering messages on a dedicated thread instead of the thread calling @ref ems_callbacks_call.
+///
+/// Each calling thread gets its own bounded queue, which the dispatch thread takes from in turn: messages from one
+/// thread arrive in order, and when the dispatch thread falls behind the oldest queued message is dropped, so a slow
+/// consumer can never stall the caller. Call this before any messages start flowing.
+///
+/// @param callbacks self
+/// @param queue_capacity Maximum number of queued messages, must be non-zero.
+///
+/// @return false if the thread was already started or could not be started.
+///
+/// @public @memberof ems_callbacks
+bool
+ems_callbacks_start_dispatch_thread(struct ems_callbacks *callbacks, uint32_t queue_capacity);
+
+/// Number of messages dropped because a dispatch thread queue was full.
+///
+/// @public @memberof ems_callbacks
+uint64_t
+ems_callbacks_get_dropped_count(struct ems_callbacks *callbacks);
+
 /// Clear all callbacks.
 ///
 /// For use prior to starting to destroy things that may have registered callbacks.
+/// Returns only once no thread is still running one of the removed callbacks,
+/// so it (like @ref ems_callbacks_add) must not be called from inside a callback.
 ///
 /// @param callbacks self
 ///
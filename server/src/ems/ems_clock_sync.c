@@ -0,0 +1,297 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Estimate of the client's clock relative to ours, from ping/pong exchanges over the data channel
+ * @ingroup aux_util
+ */
+
+#include "ems_clock_sync.h"
+
+#include "os/os_threading.h"
+#include "util/u_misc.h"
+#include "util/u_time.h"
+#include "util/u_var.h"
+
+#include <math.h>
+
+
+//! Round trips up to twice the best one, plus this, are considered clean.
+#define RTT_SLACK_NS (250 * U_TIME_1MS_IN_NS / 1000)
+
+//! Drift is only fitted over enough exchanges spread over enough time, anything less is noise.
+#define DRIFT_MIN_SAMPLES 8
+#define DRIFT_MIN_SPAN_NS ((int64_t)5 * U_TIME_1S_IN_NS)
+
+//! No real clock is this far off, a fit saying otherwise is noise as well.
+#define DRIFT_MAX 1e-3
+
+struct sample
+{
+	//! Midpoint of our send and receive.
+	int64_t server_ns;
+	int64_t offset_ns;
+	int64_t rtt_ns;
+};
+
+struct ems_clock_sync
+{
+	struct os_mutex lock;
+
+	struct sample samples[EMS_CLOCK_SYNC_SAMPLE_COUNT];
+	uint32_t next;
+	uint32_t count;
+
+	/*!
+	 * The fitted offset at server time t is base_offset_ns + fit_offset_ns + drift * (t - ref_server_ns), the
+	 * integer part keeps the double math small when the clocks are far apart.
+	 */
+	bool valid;
+	int64_t ref_server_ns;
+	int64_t base_offset_ns;
+	double fit_offset_ns;
+	double drift;
+
+	int64_t rtt_ns;
+	int64_t min_rtt_ns;
+	uint64_t accepted;
+	uint64_t rejected;
+
+	//! Mirrors for the debug UI.
+	struct
+	{
+		float offset_ms;
+		float drift_ppm;
+		float rtt_ms;
+		float min_rtt_ms;
+	} ui;
+};
+
+static void
+refit_locked(struct ems_clock_sync *cs, const struct sample *newest)
+{
+	int64_t min_rtt = INT64_MAX;
+	for (uint32_t i = 0; i < cs->count; i++) {
+		if (cs->samples[i].rtt_ns < min_rtt) {
+			min_rtt = cs->samples[i].rtt_ns;
+		}
+	}
+
+	int64_t max_rtt = 2 * min_rtt + RTT_SLACK_NS;
+
+	cs->rtt_ns = newest->rtt_ns;
+	cs->min_rtt_ns = min_rtt;
+	if (newest->rtt_ns <= max_rtt) {
+		cs->accepted++;
+	} else {
+		cs->rejected++;
+	}
+
+	// Everything relative to the newest exchange, which is also where the estimate matters most.
+	int64_t ref = newest->server_ns;
+	int64_t base = newest->offset_ns;
+
+	double sum_x = 0.0;
+	double sum_y = 0.0;
+	double sum_xx = 0.0;
+	double sum_xy = 0.0;
+	int64_t first_ns = INT64_MAX;
+	int64_t last_ns = INT64_MIN;
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < cs->count; i++) {
+		const struct sample *s = &cs->samples[i];
+		if (s->rtt_ns > max_rtt) {
+			continue;
+		}
+
+		double x = (double)(s->server_ns - ref);
+		double y = (double)(s->offset_ns - base);
+		sum_x += x;
+		sum_y += y;
+		sum_xx += x * x;
+		sum_xy += x * y;
+		if (s->server_ns < first_ns) {
+			first_ns = s->server_ns;
+		}
+		if (s->server_ns > last_ns) {
+			last_ns = s->server_ns;
+		}
+		n++;
+	}
+
+	// The exchange with the smallest round trip always passes, so n is at least one.
+	double mean_x = sum_x / n;
+	double mean_y = sum_y / n;
+	double drift = 0.0;
+
+	if (n >= DRIFT_MIN_SAMPLES && last_ns - first_ns >= DRIFT_MIN_SPAN_NS) {
+		double var_x = sum_xx - sum_x * mean_x;
+		if (var_x > 0.0) {
+			drift = (sum_xy - sum_x * mean_y) / var_x;
+		}
+		if (fabs(drift) > DRIFT_MAX) {
+			drift = 0.0;
+		}
+	}
+
+	cs->valid = true;
+	cs->ref_server_ns = ref;
+	cs->base_offset_ns = base;
+	cs->drift = drift;
+	cs->fit_offset_ns = mean_y - drift * mean_x;
+
+	cs->ui.offset_ms = (float)time_ns_to_ms_f((time_duration_ns)(base + llround(cs->fit_offset_ns)));
+	cs->ui.drift_ppm = (float)(drift * 1e6);
+	cs->ui.rtt_ms = (float)time_ns_to_ms_f(cs->rtt_ns);
+	cs->ui.min_rtt_ms = (float)time_ns_to_ms_f(cs->min_rtt_ns);
+}
+
+//! Client minus server at @p server_ns, relative to base_offset_ns.
+static double
+fit_offset_at_locked(const struct ems_clock_sync *cs, int64_t server_ns)
+{
+	return cs->fit_offset_ns + cs->drift * (double)(server_ns - cs->ref_server_ns);
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+struct ems_clock_sync *
+ems_clock_sync_create(void)
+{
+	struct ems_clock_sync *cs = U_TYPED_CALLOC(struct ems_clock_sync);
+	os_mutex_init(&cs->lock);
+
+	u_var_add_root(cs, "Electric Maple Server clock sync", false);
+	u_var_add_ro_f32(cs, &cs->ui.offset_ms, "Offset, client minus server (ms)");
+	u_var_add_ro_f32(cs, &cs->ui.drift_ppm, "Drift (ppm)");
+	u_var_add_ro_f32(cs, &cs->ui.rtt_ms, "Round trip (ms)");
+	u_var_add_ro_f32(cs, &cs->ui.min_rtt_ms, "Best round trip (ms)");
+	u_var_add_ro_u64(cs, &cs->accepted, "Exchanges accepted");
+	u_var_add_ro_u64(cs, &cs->rejected, "Exchanges rejected");
+
+	return cs;
+}
+
+void
+ems_clock_sync_destroy(struct ems_clock_sync **ptr_clock_sync)
+{
+	if (ptr_clock_sync == NULL || *ptr_clock_sync == NULL) {
+		return;
+	}
+
+	struct ems_clock_sync *cs = *ptr_clock_sync;
+
+	u_var_remove_root(cs);
+	os_mutex_destroy(&cs->lock);
+	free(cs);
+
+	*ptr_clock_sync = NULL;
+}
+
+void
+ems_clock_sync_reset(struct ems_clock_sync *clock_sync)
+{
+	struct ems_clock_sync *cs = clock_sync;
+
+	os_mutex_lock(&cs->lock);
+	cs->next = 0;
+	cs->count = 0;
+	cs->valid = false;
+	cs->drift = 0.0;
+	cs->fit_offset_ns = 0.0;
+	cs->rtt_ns = 0;
+	cs->min_rtt_ns = 0;
+	U_ZERO(&cs->ui);
+	os_mutex_unlock(&cs->lock);
+}
+
+bool
+ems_clock_sync_add_sample(struct ems_clock_sync *clock_sync,
+                          int64_t server_send_ns,
+                          int64_t client_receive_ns,
+                          int64_t client_send_ns,
+                          int64_t server_receive_ns)
+{
+	struct ems_clock_sync *cs = clock_sync;
+
+	int64_t round_trip_ns = server_receive_ns - server_send_ns;
+	int64_t client_hold_ns = client_send_ns - client_receive_ns;
+
+	// A pong from before its ping, or one the client held longer than the whole round trip.
+	if (round_trip_ns < 0 || client_hold_ns < 0 || client_hold_ns > round_trip_ns) {
+		return false;
+	}
+
+	struct sample s;
+	s.server_ns = server_send_ns + round_trip_ns / 2;
+	s.rtt_ns = round_trip_ns - client_hold_ns;
+	// ((t2 - t1) + (t3 - t4)) / 2, rearranged so that a large offset doesn't overflow.
+	s.offset_ns = (client_receive_ns - server_send_ns) - (round_trip_ns - client_hold_ns) / 2;
+
+	os_mutex_lock(&cs->lock);
+	cs->samples[cs->next] = s;
+	cs->next = (cs->next + 1) % EMS_CLOCK_SYNC_SAMPLE_COUNT;
+	if (cs->count < EMS_CLOCK_SYNC_SAMPLE_COUNT) {
+		cs->count++;
+	}
+	refit_locked(cs, &s);
+	os_mutex_unlock(&cs->lock);
+
+	return true;
+}
+
+bool
+ems_clock_sync_client_to_server(struct ems_clock_sync *clock_sync, int64_t client_ns, int64_t *out_server_ns)
+{
+	struct ems_clock_sync *cs = clock_sync;
+
+	os_mutex_lock(&cs->lock);
+	bool valid = cs->valid;
+	if (valid) {
+		// client = server + offset(server), solved for server.
+		double d = (double)(client_ns - cs->base_offset_ns - cs->ref_server_ns) - cs->fit_offset_ns;
+		*out_server_ns = cs->ref_server_ns + llround(d / (1.0 + cs->drift));
+	}
+	os_mutex_unlock(&cs->lock);
+
+	return valid;
+}
+
+bool
+ems_clock_sync_server_to_client(struct ems_clock_sync *clock_sync, int64_t server_ns, int64_t *out_client_ns)
+{
+	struct ems_clock_sync *cs = clock_sync;
+
+	os_mutex_lock(&cs->lock);
+	bool valid = cs->valid;
+	if (valid) {
+		*out_client_ns = server_ns + cs->base_offset_ns + llround(fit_offset_at_locked(cs, server_ns));
+	}
+	os_mutex_unlock(&cs->lock);
+
+	return valid;
+}
+
+void
+ems_clock_sync_get_stats(struct ems_clock_sync *clock_sync, struct ems_clock_sync_stats *out_stats)
+{
+	struct ems_clock_sync *cs = clock_sync;
+
+	os_mutex_lock(&cs->lock);
+	out_stats->valid = cs->valid;
+	out_stats->offset_ns = cs->valid ? cs->base_offset_ns + llround(cs->fit_offset_ns) : 0;
+	out_stats->drift_ppm = cs->drift * 1e6;
+	out_stats->rtt_ns = cs->rtt_ns;
+	out_stats->min_rtt_ns = cs->min_rtt_ns;
+	out_stats->accepted = cs->accepted;
+	out_stats->rejected = cs->rejected;
+	os_mutex_unlock(&cs->lock);
+}
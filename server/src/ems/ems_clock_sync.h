@@ -0,0 +1,114 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Estimate of the client's clock relative to ours, from ping/pong exchanges over the data channel
+ * @ingroup aux_util
+ */
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// How many exchanges the estimate is fitted over.
+/// @relates ems_clock_sync
+#define EMS_CLOCK_SYNC_SAMPLE_COUNT 32
+
+/// Snapshot of the current estimate, for debug UI and metrics.
+/// @relates ems_clock_sync
+struct ems_clock_sync_stats
+{
+	//! False until the first usable exchange.
+	bool valid;
+
+	//! Client clock minus server clock, right now.
+	int64_t offset_ns;
+
+	//! How fast the client clock runs relative to ours, in parts per million.
+	double drift_ppm;
+
+	//! Round trip of the newest exchange, and the smallest one in the window.
+	int64_t rtt_ns;
+	int64_t min_rtt_ns;
+
+	//! Exchanges used in the fit, and those thrown out for a round trip well above the best one.
+	uint64_t accepted;
+	uint64_t rejected;
+};
+
+/// Client clock offset and drift, fitted over the most recent ping/pong exchanges.
+///
+/// Each exchange gives the classic NTP estimate: the offset assuming the network delay was the same both ways, and the
+/// round trip, which bounds how wrong that assumption can be. Exchanges whose round trip is far above the best one in
+/// the window were most likely queued somewhere on one leg and are left out, the rest are fitted with a line against
+/// our clock so a slowly drifting client clock doesn't leave us a few milliseconds off between exchanges.
+///
+/// Thread safe, all functions may be called from any thread.
+struct ems_clock_sync;
+
+/// Allocate an estimator, with no estimate.
+/// @public @memberof ems_clock_sync
+struct ems_clock_sync *
+ems_clock_sync_create(void);
+
+/// Destroy an estimator and clear the pointer.
+///
+/// Does all the null checks for you.
+///
+/// @public @memberof ems_clock_sync
+void
+ems_clock_sync_destroy(struct ems_clock_sync **ptr_clock_sync);
+
+/// Forget everything, for when a different client (and so a different clock) takes over.
+/// @public @memberof ems_clock_sync
+void
+ems_clock_sync_reset(struct ems_clock_sync *clock_sync);
+
+/// Add one ping/pong exchange.
+///
+/// @param clock_sync self
+/// @param server_send_ns When we sent the ping, in our monotonic clock.
+/// @param client_receive_ns When the client received the ping, in its clock.
+/// @param client_send_ns When the client sent the pong, in its clock.
+/// @param server_receive_ns When we received the pong, in our monotonic clock.
+///
+/// @return false if the timestamps are inconsistent and the exchange was ignored.
+///
+/// @public @memberof ems_clock_sync
+bool
+ems_clock_sync_add_sample(struct ems_clock_sync *clock_sync,
+                          int64_t server_send_ns,
+                          int64_t client_receive_ns,
+                          int64_t client_send_ns,
+                          int64_t server_receive_ns);
+
+/// Convert a client timestamp into our monotonic clock.
+///
+/// @return false, leaving @p out_server_ns alone, while there is no estimate yet.
+///
+/// @public @memberof ems_clock_sync
+bool
+ems_clock_sync_client_to_server(struct ems_clock_sync *clock_sync, int64_t client_ns, int64_t *out_server_ns);
+
+/// Convert one of our monotonic timestamps into the client's clock.
+///
+/// @return false, leaving @p out_client_ns alone, while there is no estimate yet.
+///
+/// @public @memberof ems_clock_sync
+bool
+ems_clock_sync_server_to_client(struct ems_clock_sync *clock_sync, int64_t server_ns, int64_t *out_client_ns);
+
+/// Get a snapshot of the current estimate.
+/// @public @memberof ems_clock_sync
+void
+ems_clock_sync_get_stats(struct ems_clock_sync *clock_sync, struct ems_clock_sync_stats *out_stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,6 +16,11 @@
  */
 
 #include "ems_compositor.h"
+#include "ems_callbacks.h"
+#include "ems_clock_sync.h"
+#include "ems_frame_ledger.h"
+
+#include "electricmaple.pb.h"
 
 #include "gstreamer/gst_internal.h"
 #include "os/os_time.h"
@@ -37,6 +42,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <algorithm>
 
 // native quest resolution
 // #define APP_VIEW_W (1832)
@@ -56,6 +62,13 @@
 
 
 DEBUG_GET_ONCE_LOG_OPTION(log, "XRT_COMPOSITOR_LOG", U_LOGGING_INFO)
+DEBUG_GET_ONCE_NUM_OPTION(signaling_port, "EMS_SIGNALING_PORT", 8080)
+
+/*!
+ * How much of the measured client vsync phase is taken into the correction per frame report. Low, so a report that
+ * came in late moves our display times only a little and they keep going forward.
+ */
+static constexpr double kClientPhaseGain = 0.1;
 
 
 /*
@@ -340,13 +353,74 @@ compositor_init_sys_info(struct ems_compositor *c, struct xrt_device *xdev)
  *
  */
 
+/*!
+ * Open the frame's ledger entry, with the display time the app rendered it for, which the client uses to pick the
+ * frame to show, and the pose it was most likely rendered with: the newest one the app had been handed by the time it
+ * committed. The client learns its pipeline latency from which tracking message that was. When the client sampled
+ * that pose is estimated from when it got here, minus half of the best round trip the clock sync has seen.
+ */
+static void
+mark_committed(struct ems_compositor *c, int64_t frame_id, int64_t now_ns)
+{
+	struct ems_frame_ledger *ledger = c->instance->frame_ledger;
+
+	ems_frame_ledger_mark(ledger, frame_id, EMS_FRAME_POINT_COMMITTED, now_ns);
+	ems_frame_ledger_set_target_display_time(ledger, frame_id, (int64_t)c->base.slot.data.display_time_ns);
+	ems_frame_ledger_set_tracking_sequence_idx(ledger, frame_id,
+	                                           ems_hmd_get_handed_out_sequence_idx(c->instance->head));
+
+	int64_t arrival_ns = ems_hmd_get_handed_out_arrival_ns(c->instance->head);
+	if (arrival_ns == 0) {
+		return;
+	}
+
+	struct ems_clock_sync_stats clock;
+	ems_clock_sync_get_stats(c->instance->clock_sync, &clock);
+	ems_frame_ledger_mark(ledger, frame_id, EMS_FRAME_POINT_POSE, arrival_ns - clock.min_rtt_ns / 2);
+}
+
+/*!
+ * Remember the head pose the app rendered the frame from, so the client can reproject it to where the head is when the
+ * frame is finally shown. The views share the head's orientation, the head sits between the eyes.
+ */
+static void
+mark_render_pose(struct ems_compositor *c,
+                 int64_t frame_id,
+                 const struct xrt_layer_projection_view_data *lvd,
+                 const struct xrt_layer_projection_view_data *rvd)
+{
+	struct xrt_pose pose;
+	pose.orientation = lvd->pose.orientation;
+	pose.position.x = (lvd->pose.position.x + rvd->pose.position.x) * 0.5f;
+	pose.position.y = (lvd->pose.position.y + rvd->pose.position.y) * 0.5f;
+	pose.position.z = (lvd->pose.position.z + rvd->pose.position.z) * 0.5f;
+
+	ems_frame_ledger_set_render_pose(c->instance->frame_ledger, frame_id, &pose);
+}
+
 void
 pack_blit_and_encode(struct ems_compositor *c,
+                     int64_t frame_id,
                      const struct xrt_layer_projection_view_data *lvd,
                      const struct xrt_layer_projection_view_data *rvd,
                      struct comp_swapchain *lsc,
                      struct comp_swapchain *rsc)
 {
+	if (!c->pipeline_playing) {
+		ems_gstreamer_pipeline_play(c->gstreamer_pipeline);
+		c->pipeline_playing = true;
+	}
+
+	// The encoder isn't running without clients, so don't bother with the blit and readback either.
+	if (!ems_gstreamer_pipeline_has_clients(c->gstreamer_pipeline)) {
+		os_mutex_lock(&c->metrics.lock);
+		c->idle_frames_skipped = ++c->metrics.frames_skipped;
+		os_mutex_unlock(&c->metrics.lock);
+		return;
+	}
+
+	mark_render_pose(c, frame_id, lvd, rvd);
+
 	if (c->offset_ns == 0) {
 		uint64_t now = os_monotonic_get_ns();
 		c->offset_ns = now;
@@ -356,10 +430,14 @@ pack_blit_and_encode(struct ems_compositor *c,
 
 	struct vk_image_readback_to_xf *wrap = NULL;
 	struct vk_bundle *vk = &c->base.vk;
+	uint64_t readback_start_ns = os_monotonic_get_ns();
 
 	// Getting frame
 	if (!vk_image_readback_to_xf_pool_get_unused_frame(vk, c->pool, &wrap)) {
 		EMS_COMP_ERROR(c, "vk_image_readback_to_xf_pool_get_unused_frame: Failed!");
+		os_mutex_lock(&c->metrics.lock);
+		c->metrics.pool_exhausted++;
+		os_mutex_unlock(&c->metrics.lock);
 		return;
 	}
 
@@ -499,10 +577,19 @@ pack_blit_and_encode(struct ems_compositor *c,
 	// Do checking here.
 	if (ret != VK_SUCCESS) {
 		EMS_COMP_ERROR(c, "vk_cmd_pool_end_submit_wait_and_free_cmd_buffer_locked: %s", vk_result_string(ret));
+		os_mutex_lock(&c->metrics.lock);
+		c->metrics.readback_failed++;
+		os_mutex_unlock(&c->metrics.lock);
 		xrt_frame_reference(&frame, NULL);
 		return;
 	}
 
+	os_mutex_lock(&c->metrics.lock);
+	c->metrics.frames_read_back++;
+	ems_latency_window_add(&c->metrics.readback,
+	                       (float)time_ns_to_ms_f((time_duration_ns)(os_monotonic_get_ns() - readback_start_ns)));
+	os_mutex_unlock(&c->metrics.lock);
+
 	// HACK
 	wrap->base_frame.timestamp = os_monotonic_get_ns();
 	wrap->base_frame.source_timestamp = wrap->base_frame.timestamp;
@@ -510,10 +597,10 @@ pack_blit_and_encode(struct ems_compositor *c,
 	wrap->base_frame.source_id = 0;
 	wrap = NULL;
 
-	if (!c->pipeline_playing) {
-		ems_gstreamer_pipeline_play(c->gstreamer_pipeline);
-		c->pipeline_playing = true;
-	}
+	// The sink stamps the buffer with this, which is how the pipeline tells which frame it is looking at.
+	uint64_t pts = frame->timestamp - c->offset_ns;
+	ems_frame_ledger_set_pts(c->instance->frame_ledger, frame_id, pts);
+	ems_frame_ledger_mark(c->instance->frame_ledger, frame_id, EMS_FRAME_POINT_PUSHED, (int64_t)frame->timestamp);
 
 	u_sink_debug_push_frame(&c->debug_sink, frame);
 
@@ -527,6 +614,33 @@ pack_blit_and_encode(struct ems_compositor *c,
 }
 
 
+static void
+ems_compositor_write_metrics(GString *out, void *user_data)
+{
+	struct ems_compositor *c = (struct ems_compositor *)user_data;
+
+	os_mutex_lock(&c->metrics.lock);
+	ems_metrics_describe(out, "ems_readback_frames_total", "counter", "Frames read back for encoding.");
+	ems_metrics_counter(out, "ems_readback_frames_total", NULL, c->metrics.frames_read_back);
+	ems_metrics_describe(out, "ems_readback_pool_exhausted_total", "counter",
+	                     "Frames dropped because every readback buffer was still held by the pipeline.");
+	ems_metrics_counter(out, "ems_readback_pool_exhausted_total", NULL, c->metrics.pool_exhausted);
+	ems_metrics_describe(out, "ems_readback_failed_total", "counter", "Readback command buffers that failed.");
+	ems_metrics_counter(out, "ems_readback_failed_total", NULL, c->metrics.readback_failed);
+	ems_metrics_describe(out, "ems_readback_skipped_total", "counter", "Frames not read back, nobody connected.");
+	ems_metrics_counter(out, "ems_readback_skipped_total", NULL, c->metrics.frames_skipped);
+	ems_metrics_describe(out, "ems_readback_ms", "summary", "Blit, copy and GPU wait per read back frame.");
+	ems_metrics_summary(out, "ems_readback_ms", NULL, &c->metrics.readback);
+	ems_metrics_describe(out, "ems_client_vsync_phase_ms", "gauge",
+	                     "Client display time minus our predicted one, within half a frame.");
+	ems_metrics_value(out, "ems_client_vsync_phase_ms", NULL, c->client_display.phase_ms);
+	ems_metrics_describe(out, "ems_client_vsync_correction_ms", "gauge",
+	                     "How far our display and wake times are shifted to line up with the client's vsync.");
+	ems_metrics_value(out, "ems_client_vsync_correction_ms", NULL, c->client_display.correction_ms);
+	os_mutex_unlock(&c->metrics.lock);
+}
+
+
 /*
  *
  * Member functions.
@@ -580,6 +694,17 @@ ems_compositor_predict_frame(struct xrt_compositor *xc,
 	    out_predicted_display_period_ns, // out_predicted_display_period_ns
 	    &null_min_display_period_ns);    // out_min_display_period_ns
 
+	// Our pacing just counts frame intervals from whenever we started. Shift it to where the client actually shows
+	// frames, so the app renders for display times the client will display at.
+	os_mutex_lock(&c->metrics.lock);
+	int64_t correction_ns = c->client_display.correction_ns;
+	*out_predicted_display_time_ns = (uint64_t)((int64_t)*out_predicted_display_time_ns + correction_ns);
+	c->client_display.predicted_ns = (int64_t)*out_predicted_display_time_ns;
+	os_mutex_unlock(&c->metrics.lock);
+
+	int64_t wake_ns = (int64_t)*out_wake_time_ns + correction_ns;
+	*out_wake_time_ns = wake_ns > (int64_t)now_ns ? (uint64_t)wake_ns : now_ns;
+
 	return XRT_SUCCESS;
 }
 
@@ -645,6 +770,7 @@ ems_compositor_layer_commit(struct xrt_compositor *xc, xrt_graphics_sync_handle_
 	{
 		uint64_t now_ns = os_monotonic_get_ns();
 		u_pc_mark_point(c->upc, U_TIMING_POINT_BEGIN, frame_id, now_ns);
+		mark_committed(c, frame_id, (int64_t)now_ns);
 	}
 
 	// We want to render here. comp_base filled c->base.slot.layers for us.
@@ -660,7 +786,7 @@ ems_compositor_layer_commit(struct xrt_compositor *xc, xrt_graphics_sync_handle_
 			struct comp_swapchain *left = layer.sc_array[0];
 			struct comp_swapchain *right = layer.sc_array[1];
 
-			pack_blit_and_encode(c, lvd, rvd, left, right);
+			pack_blit_and_encode(c, frame_id, lvd, rvd, left, right);
 		} break;
 		case XRT_LAYER_STEREO_PROJECTION: {
 			const struct xrt_layer_stereo_projection_data *stereo = &layer.data.stereo;
@@ -670,7 +796,7 @@ ems_compositor_layer_commit(struct xrt_compositor *xc, xrt_graphics_sync_handle_
 			struct comp_swapchain *left = layer.sc_array[0];
 			struct comp_swapchain *right = layer.sc_array[1];
 
-			pack_blit_and_encode(c, lvd, rvd, left, right);
+			pack_blit_and_encode(c, frame_id, lvd, rvd, left, right);
 		} break;
 		default: U_LOG_E("Unhandled layer type %d", layer.data.type); break;
 		}
@@ -757,6 +883,7 @@ ems_compositor_destroy(struct xrt_compositor *xc)
 	comp_swapchain_shared_destroy(&c->base.cscs, vk);
 
 	vk_image_readback_to_xf_pool_destroy(vk, &c->pool);
+	os_mutex_destroy(&c->metrics.lock);
 
 	vk_cmd_pool_destroy(vk, &c->cmd_pool);
 
@@ -787,6 +914,58 @@ ems_compositor_destroy(struct xrt_compositor *xc)
 }
 
 
+/*!
+ * Frame timing from the client, its display time mapped into our clock shows how far our made up display times are
+ * from its actual vsync. A bit of that goes into the correction ems_compositor_predict_frame applies, which phase
+ * locks our display times to the client's vsync.
+ */
+static void
+ems_compositor_handle_frame(enum ems_callbacks_event event, const em_proto_UpMessage *message, void *userdata)
+{
+	struct ems_compositor *c = (struct ems_compositor *)userdata;
+
+	// Only the newest frame of a batch matters here.
+	const em_proto_UpFrameMessage *frame = nullptr;
+	if (message->has_frame) {
+		frame = &message->frame;
+	} else if (message->frames_count > 0) {
+		frame = &message->frames[message->frames_count - 1];
+	}
+	if (frame == nullptr || frame->display_time == 0) {
+		return;
+	}
+
+	int64_t display_ns = 0;
+	if (!ems_clock_sync_client_to_server(c->instance->clock_sync, frame->display_time, &display_ns)) {
+		return;
+	}
+
+	os_mutex_lock(&c->metrics.lock);
+	c->client_display.display_ns = display_ns;
+	if (c->client_display.predicted_ns != 0) {
+		// Folded into half a frame either way, which of our frames it lines up with doesn't matter here.
+		int64_t interval_ns = (int64_t)c->settings.frame_interval_ns;
+		int64_t phase_ns = (display_ns - c->client_display.predicted_ns) % interval_ns;
+		if (phase_ns < 0) {
+			phase_ns += interval_ns;
+		}
+		if (phase_ns > interval_ns / 2) {
+			phase_ns -= interval_ns;
+		}
+		c->client_display.phase_ms = (float)time_ns_to_ms_f(phase_ns);
+
+		// Held within half a frame either way instead of wrapping, which would make the display times jump. If the
+		// client's vsync drifts further, the phase folds over to the other side and the correction follows it there
+		// a bit at a time. Never more than half a frame later also leaves the app the rest of the frame to render.
+		int64_t correction_ns = c->client_display.correction_ns + (int64_t)((double)phase_ns * kClientPhaseGain);
+		correction_ns = std::clamp(correction_ns, -interval_ns / 2, interval_ns / 2);
+		c->client_display.correction_ns = correction_ns;
+		c->client_display.correction_ms = (float)time_ns_to_ms_f(correction_ns);
+	}
+	os_mutex_unlock(&c->metrics.lock);
+}
+
+
 /*
  *
  * 'Exported' functions.
@@ -824,6 +1003,7 @@ ems_compositor_create_system(ems_instance &emsi, struct xrt_system_compositor **
 
 	c->settings.frame_interval_ns = xdev->hmd->screens[0].nominal_frame_interval_ns;
 	c->xdev = xdev;
+	c->instance = &emsi;
 
 	EMS_COMP_INFO(c, "Starting Electric Maple Server remote compositor!");
 
@@ -855,10 +1035,17 @@ ems_compositor_create_system(ems_instance &emsi, struct xrt_system_compositor **
 
 	u_var_add_root(c, "Electric Maple Server compositor", 0);
 	u_var_add_sink_debug(c, &c->debug_sink, "Debug Sink");
+	u_var_add_ro_u64(c, &c->idle_frames_skipped, "Frames skipped, no clients");
+	u_var_add_ro_f32(c, &c->client_display.phase_ms, "Client vsync minus ours (ms)");
+	u_var_add_ro_f32(c, &c->client_display.correction_ms, "Our vsync shifted by (ms)");
 
 #define EMS_APPSRC_NAME "EMS_source"
 
-	ems_gstreamer_pipeline_create(&c->xfctx, EMS_APPSRC_NAME, emsi.callbacks, &c->gstreamer_pipeline);
+	ems_gstreamer_pipeline_create(&c->xfctx, EMS_APPSRC_NAME, (uint16_t)debug_get_num_option_signaling_port(),
+	                              emsi.callbacks, emsi.clock_sync, emsi.frame_ledger, &c->gstreamer_pipeline);
+	os_mutex_init(&c->metrics.lock);
+	ems_gstreamer_pipeline_add_metrics(c->gstreamer_pipeline, ems_compositor_write_metrics, c);
+	ems_callbacks_add(emsi.callbacks, EMS_CALLBACKS_EVENT_TRACKING, ems_compositor_handle_frame, c);
 	gstreamer_sink_create_with_pipeline( //
 	    c->gstreamer_pipeline,           //
 	    READBACK_W,                      //
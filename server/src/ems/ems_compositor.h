@@ -21,6 +21,7 @@
 #include "xrt/xrt_instance.h"
 
 #include "os/os_time.h"
+#include "os/os_threading.h"
 
 #include "util/u_threading.h"
 #include "util/u_logging.h"
@@ -143,6 +144,42 @@ struct ems_compositor
 	struct xrt_frame_sink *frame_sink;
 
 	uint64_t offset_ns;
+
+	//! Copy of metrics.frames_skipped for u_var, only written by the compositor thread.
+	uint64_t idle_frames_skipped;
+
+	//! Served by the pipeline's /metrics, which reads these from its own thread.
+	struct
+	{
+		struct os_mutex lock;
+
+		uint64_t frames_read_back;
+		uint64_t pool_exhausted;
+		uint64_t readback_failed;
+
+		//! Frames not read back because nobody was connected to stream them to.
+		uint64_t frames_skipped;
+
+		//! Blit, copy and waiting for the GPU, per frame.
+		struct ems_latency_window readback;
+	} metrics;
+
+	//! Where the client's vsync falls relative to our pacing, protected by the metrics lock.
+	struct
+	{
+		//! Our newest predicted display time.
+		int64_t predicted_ns;
+
+		//! The client's newest reported display time, in our clock.
+		int64_t display_ns;
+
+		//! Where the client's vsync is relative to ours, what is left of it after the correction.
+		float phase_ms;
+
+		//! Added to the display and wake times the pacing helper predicts, to line them up with the client's vsync.
+		int64_t correction_ns;
+		float correction_ms;
+	} client_display;
 };
 
 
@@ -0,0 +1,216 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Per frame timestamps from the compositor, the pipeline and the client, joined by frame id
+ * @ingroup aux_util
+ */
+
+#include "ems_frame_ledger.h"
+
+#include "os/os_threading.h"
+#include "util/u_misc.h"
+
+
+struct slot
+{
+	bool used;
+	struct ems_frame_ledger_entry entry;
+};
+
+struct ems_frame_ledger
+{
+	struct os_mutex lock;
+
+	//! Indexed by frame id modulo the size, ids only go up so a slot's previous frame is always the older one.
+	struct slot slots[EMS_FRAME_LEDGER_SIZE];
+
+	struct ems_frame_ledger_stats stats;
+};
+
+static struct slot *
+slot_for(struct ems_frame_ledger *ledger, int64_t frame_id)
+{
+	int64_t i = frame_id % EMS_FRAME_LEDGER_SIZE;
+	if (i < 0) {
+		i += EMS_FRAME_LEDGER_SIZE;
+	}
+	return &ledger->slots[i];
+}
+
+//! The slot holding @p frame_id, or a fresh one for it, NULL if a newer frame already took its place.
+static struct slot *
+open_locked(struct ems_frame_ledger *ledger, int64_t frame_id)
+{
+	struct slot *s = slot_for(ledger, frame_id);
+
+	if (s->used && s->entry.frame_id == frame_id) {
+		return s;
+	}
+	if (s->used && s->entry.frame_id > frame_id) {
+		return NULL;
+	}
+	if (s->used) {
+		ledger->stats.evicted++;
+	}
+
+	U_ZERO(s);
+	s->used = true;
+	s->entry.frame_id = frame_id;
+
+	return s;
+}
+
+static struct slot *
+find_pts_locked(struct ems_frame_ledger *ledger, uint64_t pts)
+{
+	for (uint32_t i = 0; i < EMS_FRAME_LEDGER_SIZE; i++) {
+		struct slot *s = &ledger->slots[i];
+		if (s->used && s->entry.has_pts && s->entry.pts == pts) {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+
+/*
+ *
+ * 'Exported' functions.
+ *
+ */
+
+struct ems_frame_ledger *
+ems_frame_ledger_create(void)
+{
+	struct ems_frame_ledger *ledger = U_TYPED_CALLOC(struct ems_frame_ledger);
+	os_mutex_init(&ledger->lock);
+
+	return ledger;
+}
+
+void
+ems_frame_ledger_destroy(struct ems_frame_ledger **ptr_ledger)
+{
+	if (ptr_ledger == NULL || *ptr_ledger == NULL) {
+		return;
+	}
+
+	struct ems_frame_ledger *ledger = *ptr_ledger;
+
+	os_mutex_destroy(&ledger->lock);
+	free(ledger);
+
+	*ptr_ledger = NULL;
+}
+
+void
+ems_frame_ledger_mark(struct ems_frame_ledger *ledger, int64_t frame_id, enum ems_frame_point point, int64_t ns)
+{
+	os_mutex_lock(&ledger->lock);
+	struct slot *s = open_locked(ledger, frame_id);
+	if (s != NULL) {
+		s->entry.ns[point] = ns;
+	}
+	os_mutex_unlock(&ledger->lock);
+}
+
+void
+ems_frame_ledger_set_pts(struct ems_frame_ledger *ledger, int64_t frame_id, uint64_t pts)
+{
+	os_mutex_lock(&ledger->lock);
+	struct slot *s = open_locked(ledger, frame_id);
+	if (s != NULL) {
+		s->entry.pts = pts;
+		s->entry.has_pts = true;
+	}
+	os_mutex_unlock(&ledger->lock);
+}
+
+void
+ems_frame_ledger_set_target_display_time(struct ems_frame_ledger *ledger, int64_t frame_id, int64_t display_ns)
+{
+	os_mutex_lock(&ledger->lock);
+	struct slot *s = open_locked(ledger, frame_id);
+	if (s != NULL) {
+		s->entry.target_display_ns = display_ns;
+	}
+	os_mutex_unlock(&ledger->lock);
+}
+
+void
+ems_frame_ledger_set_render_pose(struct ems_frame_ledger *ledger, int64_t frame_id, const struct xrt_pose *pose)
+{
+	os_mutex_lock(&ledger->lock);
+	struct slot *s = open_locked(ledger, frame_id);
+	if (s != NULL) {
+		s->entry.render_pose = *pose;
+		s->entry.has_render_pose = true;
+	}
+	os_mutex_unlock(&ledger->lock);
+}
+
+void
+ems_frame_ledger_set_tracking_sequence_idx(struct ems_frame_ledger *ledger, int64_t frame_id, int64_t sequence_idx)
+{
+	os_mutex_lock(&ledger->lock);
+	struct slot *s = open_locked(ledger, frame_id);
+	if (s != NULL) {
+		s->entry.tracking_sequence_idx = sequence_idx;
+	}
+	os_mutex_unlock(&ledger->lock);
+}
+
+bool
+ems_frame_ledger_mark_pts(struct ems_frame_ledger *ledger, uint64_t pts, enum ems_frame_point point, int64_t ns)
+{
+	os_mutex_lock(&ledger->lock);
+	struct slot *s = find_pts_locked(ledger, pts);
+	if (s != NULL) {
+		s->entry.ns[point] = ns;
+	}
+	os_mutex_unlock(&ledger->lock);
+
+	return s != NULL;
+}
+
+bool
+ems_frame_ledger_find_pts(struct ems_frame_ledger *ledger, uint64_t pts, struct ems_frame_ledger_entry *out_entry)
+{
+	os_mutex_lock(&ledger->lock);
+	struct slot *s = find_pts_locked(ledger, pts);
+	if (s != NULL) {
+		*out_entry = s->entry;
+	}
+	os_mutex_unlock(&ledger->lock);
+
+	return s != NULL;
+}
+
+bool
+ems_frame_ledger_take(struct ems_frame_ledger *ledger, int64_t frame_id, struct ems_frame_ledger_entry *out_entry)
+{
+	os_mutex_lock(&ledger->lock);
+	struct slot *s = slot_for(ledger, frame_id);
+	bool found = s->used && s->entry.frame_id == frame_id;
+	if (found) {
+		*out_entry = s->entry;
+		s->used = false;
+		ledger->stats.joined++;
+	} else {
+		ledger->stats.unmatched++;
+	}
+	os_mutex_unlock(&ledger->lock);
+
+	return found;
+}
+
+void
+ems_frame_ledger_get_stats(struct ems_frame_ledger *ledger, struct ems_frame_ledger_stats *out_stats)
+{
+	os_mutex_lock(&ledger->lock);
+	*out_stats = ledger->stats;
+	os_mutex_unlock(&ledger->lock);
+}
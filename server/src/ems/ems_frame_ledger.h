@@ -0,0 +1,166 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Per frame timestamps from the compositor, the pipeline and the client, joined by frame id
+ * @ingroup aux_util
+ */
+#pragma once
+#include "xrt/xrt_defines.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// How many frames the ledger keeps, frames that go this many ids without a client report are dropped.
+/// @relates ems_frame_ledger
+#define EMS_FRAME_LEDGER_SIZE 64
+
+/// The points in a frame's life, in the order they happen. All in our monotonic clock.
+/// @relates ems_frame_ledger
+enum ems_frame_point
+{
+	//! When the client sampled the pose the frame was rendered with, estimated.
+	EMS_FRAME_POINT_POSE = 0,
+	//! The app committed the frame's layers.
+	EMS_FRAME_POINT_COMMITTED,
+	//! Read back and pushed into the pipeline.
+	EMS_FRAME_POINT_PUSHED,
+	//! Into the encoder.
+	EMS_FRAME_POINT_ENCODE_BEGIN,
+	//! Out of the encoder.
+	EMS_FRAME_POINT_ENCODE_END,
+	//! Decoded on the client.
+	EMS_FRAME_POINT_DECODED,
+	//! Displayed on the client.
+	EMS_FRAME_POINT_DISPLAYED,
+
+	EMS_FRAME_POINT_COUNT,
+};
+
+/// Everything known about one frame.
+/// @relates ems_frame_ledger
+struct ems_frame_ledger_entry
+{
+	int64_t frame_id;
+
+	//! The buffer timestamp in the pipeline, valid once has_pts is set.
+	uint64_t pts;
+	bool has_pts;
+
+	//! When the app rendered the frame to be displayed, in our clock, 0 if not known.
+	int64_t target_display_ns;
+
+	//! The head pose the app rendered the frame from, valid once has_render_pose is set.
+	struct xrt_pose render_pose;
+	bool has_render_pose;
+
+	//! The client's sequence_idx of the tracking message the render pose came from, 0 if not known.
+	int64_t tracking_sequence_idx;
+
+	//! Indexed by enum ems_frame_point, 0 for points not seen.
+	int64_t ns[EMS_FRAME_POINT_COUNT];
+};
+
+/// Counters, for debug UI and metrics.
+/// @relates ems_frame_ledger
+struct ems_frame_ledger_stats
+{
+	//! Frames taken out with a client report.
+	uint64_t joined;
+
+	//! Client reports for frames we no longer, or never, had.
+	uint64_t unmatched;
+
+	//! Frames pushed out by newer ones before the client reported them.
+	uint64_t evicted;
+};
+
+/// Where each frame is along the way from the compositor to the client's display.
+///
+/// The compositor opens an entry when a frame is committed and tells the ledger which pipeline timestamp it pushed
+/// the frame with, the pipeline's probes then mark the frame by that, and the client's report on the frame id closes
+/// it. The caller converts client timestamps into our clock before marking them.
+///
+/// Thread safe, all functions may be called from any thread.
+struct ems_frame_ledger;
+
+/// Allocate an empty ledger.
+/// @public @memberof ems_frame_ledger
+struct ems_frame_ledger *
+ems_frame_ledger_create(void);
+
+/// Destroy a ledger and clear the pointer.
+///
+/// Does all the null checks for you.
+///
+/// @public @memberof ems_frame_ledger
+void
+ems_frame_ledger_destroy(struct ems_frame_ledger **ptr_ledger);
+
+/// Record @p point for @p frame_id, opening an entry for it if needed.
+///
+/// Ignored for frames that have already been pushed out by newer ones.
+///
+/// @public @memberof ems_frame_ledger
+void
+ems_frame_ledger_mark(struct ems_frame_ledger *ledger, int64_t frame_id, enum ems_frame_point point, int64_t ns);
+
+/// Remember that @p frame_id went into the pipeline with the buffer timestamp @p pts.
+/// @public @memberof ems_frame_ledger
+void
+ems_frame_ledger_set_pts(struct ems_frame_ledger *ledger, int64_t frame_id, uint64_t pts);
+
+/// Remember the display time the app rendered @p frame_id for.
+/// @public @memberof ems_frame_ledger
+void
+ems_frame_ledger_set_target_display_time(struct ems_frame_ledger *ledger, int64_t frame_id, int64_t display_ns);
+
+/// Remember the head pose the app rendered @p frame_id from.
+/// @public @memberof ems_frame_ledger
+void
+ems_frame_ledger_set_render_pose(struct ems_frame_ledger *ledger, int64_t frame_id, const struct xrt_pose *pose);
+
+/// Remember which of the client's tracking messages the pose @p frame_id was rendered from came in.
+/// @public @memberof ems_frame_ledger
+void
+ems_frame_ledger_set_tracking_sequence_idx(struct ems_frame_ledger *ledger, int64_t frame_id, int64_t sequence_idx);
+
+/// Record @p point for the frame pushed with @p pts.
+///
+/// @return false if no frame in the ledger has that timestamp.
+///
+/// @public @memberof ems_frame_ledger
+bool
+ems_frame_ledger_mark_pts(struct ems_frame_ledger *ledger, uint64_t pts, enum ems_frame_point point, int64_t ns);
+
+/// Look up the frame pushed with @p pts, copying what is known about it so far, it stays in the ledger.
+///
+/// @return false, leaving @p out_entry alone, if no frame in the ledger has that timestamp.
+///
+/// @public @memberof ems_frame_ledger
+bool
+ems_frame_ledger_find_pts(struct ems_frame_ledger *ledger, uint64_t pts, struct ems_frame_ledger_entry *out_entry);
+
+/// Take the entry for @p frame_id out of the ledger, once the client has reported on it.
+///
+/// @return false if the frame isn't in the ledger, which counts as unmatched.
+///
+/// @public @memberof ems_frame_ledger
+bool
+ems_frame_ledger_take(struct ems_frame_ledger *ledger, int64_t frame_id, struct ems_frame_ledger_entry *out_entry);
+
+/// Get a snapshot of the counters.
+/// @public @memberof ems_frame_ledger
+void
+ems_frame_ledger_get_stats(struct ems_frame_ledger *ledger, struct ems_frame_ledger_stats *out_stats);
+
+#ifdef __cplusplus
+}
+#endif
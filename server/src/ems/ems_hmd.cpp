@@ -14,8 +14,10 @@
  */
 
 #include "ems_callbacks.h"
+#include "ems_clock_sync.h"
 #include "xrt/xrt_defines.h"
 #include <memory>
+#include <cstdlib>
 #undef CLAMP
 
 #include "xrt/xrt_device.h"
@@ -88,6 +90,36 @@ ems_hmd_destroy(struct xrt_device *xdev)
 	u_device_free(&eh->base);
 }
 
+static struct xrt_pose
+pose_from_proto(const em_proto_Pose *in)
+{
+	struct xrt_pose pose = {};
+	pose.position = {in->position.x, in->position.y, in->position.z};
+
+	pose.orientation.w = in->orientation.w;
+	pose.orientation.x = in->orientation.x;
+	pose.orientation.y = in->orientation.y;
+	pose.orientation.z = in->orientation.z;
+	return pose;
+}
+
+/*!
+ * Whether the pipelined pose fits @p at_timestamp_ns better than the plain one. Without synchronized clocks there is
+ * nothing to compare, but the pipelined pose was predicted for when frames we render now get shown, which is what
+ * the app asks for.
+ */
+static bool
+prefer_pipelined_pose(const struct ems_hmd *eh, int64_t at_timestamp_ns)
+{
+	if (!eh->has_pipelined_pose) {
+		return false;
+	}
+	if (eh->pose_timestamp_ns == 0 || eh->pipelined_pose_timestamp_ns == 0) {
+		return true;
+	}
+	return llabs(at_timestamp_ns - eh->pipelined_pose_timestamp_ns) < llabs(at_timestamp_ns - eh->pose_timestamp_ns);
+}
+
 static void
 ems_hmd_update_inputs(struct xrt_device *xdev)
 {
@@ -110,11 +142,29 @@ ems_hmd_get_tracked_pose(struct xrt_device *xdev,
 	if (eh->received->updated) {
 		std::lock_guard<std::mutex> lock(eh->received->mutex);
 		eh->pose = eh->received->pose;
+		eh->pose_timestamp_ns = eh->received->timestamp_ns;
+		eh->pipelined_pose = eh->received->pipelined_pose;
+		eh->pipelined_pose_timestamp_ns = eh->received->pipelined_timestamp_ns;
+		eh->has_pipelined_pose = eh->received->has_pipelined_pose;
+		eh->received->handed_out_arrival_ns = eh->received->arrival_ns;
+		eh->received->handed_out_sequence_idx = eh->received->sequence_idx;
 		math_quat_normalize(&eh->pose.orientation);
+		math_quat_normalize(&eh->pipelined_pose.orientation);
 		eh->received->updated = false;
 	}
+
+	// The client sends the pose for its own next display time and, once it knows its latency, another one predicted
+	// for when a frame we render now will be shown. Take whichever is closer to what is asked for.
+	eh->used_pipelined_pose = prefer_pipelined_pose(eh, (int64_t)at_timestamp_ns);
+	const struct xrt_pose *pose = eh->used_pipelined_pose ? &eh->pipelined_pose : &eh->pose;
+	int64_t pose_timestamp_ns = eh->used_pipelined_pose ? eh->pipelined_pose_timestamp_ns : eh->pose_timestamp_ns;
+
+	if (pose_timestamp_ns != 0) {
+		eh->pose_prediction_gap_ms = (float)time_ns_to_ms_f((int64_t)at_timestamp_ns - pose_timestamp_ns);
+	}
+
 	// TODO Estimate pose at timestamp at_timestamp_ns!
-	out_relation->pose = eh->pose;
+	out_relation->pose = *pose;
 	out_relation->relation_flags = (enum xrt_space_relation_flags)(XRT_SPACE_RELATION_ORIENTATION_VALID_BIT |
 	                                                               XRT_SPACE_RELATION_POSITION_VALID_BIT |
 	                                                               XRT_SPACE_RELATION_ORIENTATION_TRACKED_BIT);
@@ -141,25 +191,50 @@ ems_hmd_handle_data(enum ems_callbacks_event event, const em_proto_UpMessage *me
 	if (!message->has_tracking) {
 		return;
 	}
-	struct xrt_pose pose = {};
-	pose.position = {message->tracking.P_localSpace_viewSpace.position.x,
-	                 message->tracking.P_localSpace_viewSpace.position.y,
-	                 message->tracking.P_localSpace_viewSpace.position.z};
+	const em_proto_TrackingMessage *tracking = &message->tracking;
+	struct xrt_pose pose = pose_from_proto(&tracking->P_localSpace_viewSpace);
 
-	pose.orientation.w = message->tracking.P_localSpace_viewSpace.orientation.w;
-	pose.orientation.x = message->tracking.P_localSpace_viewSpace.orientation.x;
-	pose.orientation.y = message->tracking.P_localSpace_viewSpace.orientation.y;
-	pose.orientation.z = message->tracking.P_localSpace_viewSpace.orientation.z;
+	// The client stamps the pose with the display time it predicted it for, in its own clock.
+	int64_t timestamp_ns = 0;
+	if (tracking->timestamp != 0) {
+		ems_clock_sync_client_to_server(eh->instance->clock_sync, tracking->timestamp, &timestamp_ns);
+	}
 
-	// TODO handle timestamp, etc
+	struct xrt_pose pipelined_pose = {};
+	int64_t pipelined_timestamp_ns = 0;
+	if (tracking->has_P_localSpace_viewSpace_pipelined) {
+		pipelined_pose = pose_from_proto(&tracking->P_localSpace_viewSpace_pipelined);
+		if (tracking->pipelined_timestamp != 0) {
+			ems_clock_sync_client_to_server(eh->instance->clock_sync, tracking->pipelined_timestamp,
+			                                &pipelined_timestamp_ns);
+		}
+	}
 
 	{
 		std::lock_guard<std::mutex> lock(eh->received->mutex);
 		eh->received->pose = pose;
+		eh->received->timestamp_ns = timestamp_ns;
+		eh->received->pipelined_pose = pipelined_pose;
+		eh->received->pipelined_timestamp_ns = pipelined_timestamp_ns;
+		eh->received->has_pipelined_pose = tracking->has_P_localSpace_viewSpace_pipelined;
+		eh->received->sequence_idx = tracking->sequence_idx;
+		eh->received->arrival_ns = (int64_t)os_monotonic_get_ns();
 		eh->received->updated = true;
 	}
 }
 
+int64_t
+ems_hmd_get_handed_out_arrival_ns(struct ems_hmd *eh)
+{
+	return eh->received->handed_out_arrival_ns;
+}
+
+int64_t
+ems_hmd_get_handed_out_sequence_idx(struct ems_hmd *eh)
+{
+	return eh->received->handed_out_sequence_idx;
+}
+
 struct ems_hmd *
 ems_hmd_create(ems_instance &emsi)
 {
@@ -250,6 +325,8 @@ ems_hmd_create(ems_instance &emsi)
 	// Setup variable tracker: Optional but useful for debugging
 	u_var_add_root(eh, "Electric Maple Server HMD", true);
 	u_var_add_pose(eh, &eh->pose, "pose");
+	u_var_add_ro_f32(eh, &eh->pose_prediction_gap_ms, "Time asked for minus pose display time (ms)");
+	u_var_add_bool(eh, &eh->used_pipelined_pose, "Using pipelined pose");
 	u_var_add_log_level(eh, &eh->log_level, "log_level");
 
 	return eh;
@@ -10,11 +10,14 @@
  */
 
 #include "ems_callbacks.h"
+#include "ems_clock_sync.h"
+#include "ems_frame_ledger.h"
 #include "xrt/xrt_system.h"
 #include "xrt/xrt_instance.h"
 #include "xrt/xrt_config_drivers.h"
 
 #include "util/u_misc.h"
+#include "util/u_debug.h"
 #include "util/u_builders.h"
 #include "util/u_trace_marker.h"
 
@@ -25,6 +28,9 @@
 
 #include <assert.h>
 
+DEBUG_GET_ONCE_BOOL_OPTION(dispatch_thread, "EMS_CALLBACKS_DISPATCH_THREAD", false)
+DEBUG_GET_ONCE_NUM_OPTION(dispatch_queue_size, "EMS_CALLBACKS_DISPATCH_QUEUE_SIZE", 16)
+
 namespace {
 inline struct ems_instance *
 from_xinst(struct xrt_instance *xinst)
@@ -118,6 +124,8 @@ ems_instance_destroy(struct xrt_instance *xinst)
 	ems_callbacks_reset(emsi->callbacks);
 
 	ems_callbacks_destroy(&emsi->callbacks);
+	ems_clock_sync_destroy(&emsi->clock_sync);
+	ems_frame_ledger_destroy(&emsi->frame_ledger);
 
 	delete emsi;
 }
@@ -134,6 +142,13 @@ ems_instance_system_devices_init(struct ems_instance *emsi)
 {
 	// needed before creating devices
 	emsi->callbacks = ems_callbacks_create();
+	emsi->clock_sync = ems_clock_sync_create();
+	emsi->frame_ledger = ems_frame_ledger_create();
+
+	// Keeps slow consumers from stalling the data channel receive thread.
+	if (debug_get_bool_option_dispatch_thread()) {
+		ems_callbacks_start_dispatch_thread(emsi->callbacks, (uint32_t)debug_get_num_option_dispatch_queue_size());
+	}
 
 	emsi->xsysd_base.destroy = ems_instance_system_devices_destroy;
 
@@ -34,6 +34,8 @@
 
 
 struct ems_callbacks;
+struct ems_clock_sync;
+struct ems_frame_ledger;
 struct ems_instance;
 struct ems_hmd;
 
@@ -42,6 +44,29 @@ struct ems_hmd_recvbuf
 	std::atomic_bool updated;
 	std::mutex mutex;
 	struct xrt_pose pose;
+
+	//! The display time the client predicted the pose for, not when it sampled it. In our monotonic clock, 0 while
+	//! the clocks aren't synchronized.
+	int64_t timestamp_ns;
+
+	//! The client's guess at the pose for frames we render now, valid if has_pipelined_pose is set.
+	struct xrt_pose pipelined_pose;
+	bool has_pipelined_pose;
+
+	//! When the pipelined pose is predicted for, in our monotonic clock, 0 while the clocks aren't synchronized.
+	int64_t pipelined_timestamp_ns;
+
+	//! The client's sequence_idx of the tracking message.
+	int64_t sequence_idx;
+
+	//! When the pose got to us, in our monotonic clock.
+	int64_t arrival_ns;
+
+	//! Arrival of the pose last handed out, read by the compositor for frames it commits.
+	std::atomic<int64_t> handed_out_arrival_ns{0};
+
+	//! Sequence index of the pose last handed out, read by the compositor for frames it commits.
+	std::atomic<int64_t> handed_out_sequence_idx{0};
 };
 
 struct ems_hmd
@@ -50,6 +75,19 @@ struct ems_hmd
 	struct xrt_device base;
 
 	struct xrt_pose pose;
+	int64_t pose_timestamp_ns;
+
+	//! The pipelined pose from the same message, see ems_hmd_recvbuf.
+	struct xrt_pose pipelined_pose;
+	int64_t pipelined_pose_timestamp_ns;
+	bool has_pipelined_pose;
+
+	//! Whether the pipelined pose was handed out last time, for the debug UI.
+	bool used_pipelined_pose;
+
+	//! How far past the display time the handed out pose was predicted for the time last asked for is, only known
+	//! once the clocks are synchronized. Positive means the pose had to be used for later than it was meant for.
+	float pose_prediction_gap_ms;
 
 	// Should outlive us
 	struct ems_instance *instance;
@@ -93,6 +131,12 @@ struct ems_instance
 
 	//! Callbacks collection
 	struct ems_callbacks *callbacks;
+
+	//! Maps the client's timestamps into our clock, fed by the pipeline.
+	struct ems_clock_sync *clock_sync;
+
+	//! Joins the compositor's, the pipeline's and the client's timestamps for each frame.
+	struct ems_frame_ledger *frame_ledger;
 };
 
 
@@ -113,5 +157,17 @@ ems_compositor_create_system(ems_instance &emsi, struct xrt_system_compositor **
 struct ems_hmd *
 ems_hmd_create(ems_instance &emsi);
 
+/*!
+ * When the pose last handed out by @p eh arrived from the client, in our monotonic clock, 0 if none has.
+ */
+int64_t
+ems_hmd_get_handed_out_arrival_ns(struct ems_hmd *eh);
+
+/*!
+ * The client's sequence_idx of the tracking message the pose last handed out by @p eh came in, 0 if none has.
+ */
+int64_t
+ems_hmd_get_handed_out_sequence_idx(struct ems_hmd *eh);
+
 struct ems_motion_controller *
 ems_motion_controller_create(ems_instance &emsi, enum xrt_device_name device_name, enum xrt_device_type device_type);
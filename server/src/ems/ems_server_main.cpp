@@ -13,9 +13,12 @@
 
 #include "xrt/xrt_config_os.h"
 
+#include "ems_build.h"
+
 #include "util/u_metrics.h"
 #include "util/u_logging.h"
 #include "util/u_trace_marker.h"
+#include "util/u_var.h"
 
 #ifdef XRT_OS_WINDOWS
 #include "util/u_windows.h"
@@ -43,6 +46,11 @@ main(int argc, char *argv[])
 	u_trace_marker_init();
 	u_metrics_init();
 
+#ifdef EMS_HEADLESS
+	// There is no GUI to turn it on, but the variables are still served over HTTP.
+	u_var_force_on();
+#endif
+
 	int ret = ipc_server_main(argc, argv);
 
 	u_metrics_close();
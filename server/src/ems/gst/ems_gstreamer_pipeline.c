@@ -16,34 +16,74 @@
 
 #include "ems_gstreamer_pipeline.h"
 
+#include "ems_build.h"
+
 #include "ems_callbacks.h"
+#include "ems_clock_sync.h"
+#include "ems_frame_ledger.h"
 
 #include "os/os_threading.h"
+#include "os/os_time.h"
 #include "util/u_misc.h"
 #include "util/u_debug.h"
+#include "util/u_time.h"
+#include "util/u_var.h"
 
 #include "pb_decode.h"
+#include "pb_encode.h"
 #include "electricmaple.pb.h"
+#include "em_compact_tracking.h"
+#include "em_frame_data_extension.h"
 
 // Monado includes
 #include "gstreamer/gst_internal.h"
 #include "gstreamer/gst_pipeline.h"
 
+#include "ems_metrics.h"
 #include "ems_signaling_server.h"
+#include "ems_var_dump.h"
 
 #include <glib-unix.h>
 #include <gst/gst.h>
 #include <gst/gststructure.h>
+#include <gst/rtp/gstrtpbuffer.h>
 
 #define GST_USE_UNSTABLE_API
 #include <gst/webrtc/datachannel.h>
+#include <gst/webrtc/webrtc.h>
 #include <gst/webrtc/rtcsessiondescription.h>
 #undef GST_USE_UNSTABLE_API
 
 #include <stdio.h>
 #include <assert.h>
+#include <inttypes.h>
 
 #define WEBRTC_TEE_NAME "webrtctee"
+#define ENCODE_VALVE_NAME "encodevalve"
+#define ENCODER_NAME "encoder"
+#define PAYLOADER_NAME "payloader"
+
+//! How often webrtcbin is asked for RTP stats, also the period fps and bitrate are averaged over.
+#define STATS_INTERVAL_MS 1000
+
+//! Frames that may be inside one stage at once, far more than any queue here holds.
+#define STAGE_PENDING_COUNT 16
+
+#define MAX_METRICS_PROVIDERS 4
+
+//! A quick burst of clock sync pings when a client connects, so there is an estimate right away, then a slow trickle.
+//! The burst goes on past CLOCK_SYNC_BURST_COUNT until the estimate has enough exchanges, but never past
+//! CLOCK_SYNC_MAX_BURST_COUNT in case the client does not answer.
+#define CLOCK_SYNC_BURST_COUNT 8
+#define CLOCK_SYNC_MAX_BURST_COUNT 32
+#define CLOCK_SYNC_BURST_INTERVAL_MS 100
+#define CLOCK_SYNC_INTERVAL_MS 1000
+
+//! Reliable, ordered: frame timing and anything else that must arrive.
+#define DATA_CHANNEL_LABEL "channel"
+
+//! Unordered, no retransmits: tracking, where a late pose is worth less than the next one.
+#define TRACKING_CHANNEL_LABEL "tracking"
 
 #ifdef __aarch64__
 #define DEFAULT_VIDEOSINK " queue max-size-bytes=0 ! kmssink bus-id=a0070000.v_mix"
@@ -52,8 +92,104 @@
 #endif
 
 
+DEBUG_GET_ONCE_NUM_OPTION(webrtcbin_pool_size, "EMS_WEBRTCBIN_POOL_SIZE", 1)
+
+
+struct ems_gstreamer_pipeline;
+
+//! A local ICE candidate gathered before we knew who to send it to.
+struct pending_candidate
+{
+	guint mlineindex;
+	gchar *candidate;
+};
+
+/*!
+ * A webrtcbin with its data channels, transceiver and offer, prepared ahead of time and handed to a client when it
+ * connects. Owned by its webrtcbin, freed along with it.
+ */
+struct ems_webrtc_peer
+{
+	struct ems_gstreamer_pipeline *egp;
+	GstElement *webrtcbin;
+	GObject *data_channel;
+	GObject *tracking_channel;
+
+	//! Protects everything below, the offer and candidates show up on webrtcbin's threads.
+	struct os_mutex lock;
+
+	//! NULL while waiting in the pool.
+	EmsClientId client_id;
+
+	//! Counts up with every client that connects, names the client in /metrics. 0 while waiting in the pool.
+	uint32_t client_number;
+
+	//! Our offer, until there is a client to send it to.
+	gchar *offer_sdp;
+	bool offer_sent;
+
+	//! Queue of struct pending_candidate, until the offer has gone out.
+	GQueue pending_candidates;
+
+	//! Linked to the encoder tee, which happens once the offer is out.
+	bool linked;
+
+	//! peer_flush_cb is on its way, it sends whatever is here by the time it runs.
+	bool flush_scheduled;
+
+	uint64_t client_connected_ns;
+	bool first_frame_seen;
+
+	//! Periodic hello on the data channel while it is open.
+	GSource *hello_source;
+
+	//! Clock sync pings on the data channel, ticks are only touched from the loop thread.
+	GSource *clock_sync_source;
+	uint32_t clock_sync_ticks;
+
+	//! For /metrics, protected by lock.
+	struct
+	{
+		//! Up messages and their bytes, [0] on the reliable channel, [1] on the tracking channel.
+		uint64_t messages[2];
+		uint64_t bytes[2];
+
+		//! Frames the client reported as decoded.
+		uint64_t frames_reported;
+
+		//! Client decode complete to display time, both in the client's clock.
+		struct ems_latency_window decode_to_display;
+
+		//! From the last get-stats reply.
+		uint64_t rtp_bytes_sent;
+		uint64_t rtp_packets_sent;
+		double packets_lost;
+		double fraction_lost;
+		double round_trip_time_s;
+
+		//! Averaged over the last stats interval.
+		float bitrate_kbps;
+		float fps;
+
+		uint64_t last_refresh_ns;
+		uint64_t last_rtp_bytes_sent;
+		uint64_t last_frames_reported;
+	} stats;
+
+	//! This client's tracking stream, protected by the pipeline's tracking lock.
+	struct
+	{
+		//! Keyframe state for compact tracking messages.
+		struct em_compact_tracking_decoder decoder;
+
+		//! Newest sequence_idx handed on, anything not newer than this is dropped.
+		int64_t latest_sequence_idx;
+		uint64_t latest_arrival_ns;
 
-EmsSignalingServer *signaling_server;
+		//! The missing keyframe we last asked the client to replace, so we ask once per lost keyframe.
+		int64_t keyframe_requested_for;
+	} tracking;
+};
 
 
 struct ems_gstreamer_pipeline
@@ -61,11 +197,131 @@ struct ems_gstreamer_pipeline
 	struct gstreamer_pipeline base;
 
 
-	// struct GstElement *pipeline;
-	GstElement *webrtc;
-
-	GObject *data_channel;
-	guint timeout_src_id;
+	//! Signaling, the bus watch and our timers all run here, on loop_thread.
+	GMainContext *context;
+	GMainLoop *loop;
+	GThread *loop_thread;
+
+	EmsSignalingServer *signaling_server;
+
+	//! Only touched from the loop thread.
+	struct
+	{
+		//! Prepared peers, struct ems_webrtc_peer, waiting for a client.
+		GQueue idle;
+
+		//! EmsClientId to struct ems_webrtc_peer, for peers in use.
+		GHashTable *by_client;
+
+		uint32_t pool_size;
+		uint32_t created;
+		guint refill_src_id;
+
+		//! Clients that connected so far.
+		uint32_t connected;
+
+		//! From websocket connect to the client reporting its first decoded frame.
+		float connect_to_first_frame_ms;
+	} peers;
+
+	//! Whether anybody is watching, nothing gets encoded while nobody is.
+	struct
+	{
+		struct os_mutex lock;
+
+		//! Peers linked to the tee.
+		uint32_t linked_peers;
+
+		//! Keyframes requested for newly linked peers.
+		uint32_t keyframes_requested;
+	} encode;
+
+	//! Where time goes between appsrc and the payloader, plus anything others want in /metrics.
+	struct
+	{
+		//! Protects the stages and counters, the probes run on streaming threads.
+		struct os_mutex lock;
+
+		//! [STAGE_CONVERT] valve to encoder input, [STAGE_ENCODE] encoder input to output.
+		struct
+		{
+			struct
+			{
+				GstClockTime pts;
+				uint64_t ns;
+			} pending[STAGE_PENDING_COUNT];
+			uint32_t next;
+
+			struct ems_latency_window window;
+		} stages[2];
+
+		uint64_t frames_encoded;
+		uint64_t bytes_encoded;
+
+		//! Between consecutive points of frames the client reported on, indexed by the earlier point. Recorded into
+		//! without the lock, drained into hops_total by the scrape.
+		struct em_latency_histogram hops[EMS_FRAME_POINT_COUNT - 1];
+		struct em_latency_histogram hops_total[EMS_FRAME_POINT_COUNT - 1];
+
+		//! From the client sampling a pose to it displaying the frame rendered with it, like hops.
+		struct em_latency_histogram motion_to_photon;
+		struct em_latency_histogram motion_to_photon_total;
+		float motion_to_photon_ms;
+
+		guint stats_src_id;
+
+		//! Only changed before play.
+		struct
+		{
+			ems_metrics_func func;
+			void *user_data;
+		} providers[MAX_METRICS_PROVIDERS];
+		uint32_t provider_count;
+	} metrics;
+
+	//! Totals over all clients, the per-client state lives in the peers.
+	struct
+	{
+		//! Both channels can deliver tracking, and they might do so from different threads.
+		struct os_mutex lock;
+
+		uint64_t received;
+		uint64_t stale_dropped;
+		uint64_t undecodable;
+		uint64_t keyframes_requested;
+
+		//! Time between consecutive accepted tracking messages, spikes mean poses are arriving late.
+		float gap_ms;
+		float max_gap_ms;
+		//! The same gaps for /metrics: how old the newest applied pose got before the next one replaced it.
+		struct em_latency_histogram gap;
+		struct em_latency_histogram gap_total;
+	} tracking;
+
+	//! Every frame's timestamps, until the client reports on the frame.
+	struct
+	{
+		struct ems_frame_ledger *ledger;
+
+		//! Only touched from the payloader's streaming thread.
+		GstClockTime last_stamped_pts;
+		bool stamp_failed;
+	} frames;
+
+	//! Estimate of the client clock, there is one HMD so only one client at a time feeds it.
+	struct
+	{
+		struct ems_clock_sync *sync;
+
+		//! Protects peer.
+		struct os_mutex lock;
+
+		//! The client whose pongs are used, the one whose data channel opened last. Never dereferenced.
+		struct ems_webrtc_peer *peer;
+
+		//! Only touched from the loop thread.
+		uint32_t pings_sent;
+	} clock;
 
 
 	struct ems_callbacks *callbacks;
@@ -112,17 +368,37 @@ gst_bus_cb(GstBus *bus, GstMessage *message, gpointer user_data)
 	return TRUE;
 }
 
-static GstElement *
-get_webrtcbin_for_client(GstBin *pipeline, EmsClientId client_id)
+//! Run @p func from the pipeline's loop thread, takes ownership of @p source.
+static guint
+attach_source(struct ems_gstreamer_pipeline *egp, GSource *source, GSourceFunc func, gpointer data)
 {
-	gchar *name;
-	GstElement *webrtcbin;
+	g_source_set_callback(source, func, data, NULL);
+	guint id = g_source_attach(source, egp->context);
+	g_source_unref(source);
+	return id;
+}
 
-	name = g_strdup_printf("webrtcbin_%p", client_id);
-	webrtcbin = gst_bin_get_by_name(pipeline, name);
-	g_free(name);
+//! g_source_remove only looks in the default context.
+static void
+remove_source(struct ems_gstreamer_pipeline *egp, guint *id)
+{
+	if (*id == 0) {
+		return;
+	}
+
+	GSource *source = g_main_context_find_source_by_id(egp->context, *id);
+	if (source != NULL) {
+		g_source_destroy(source);
+	}
+	*id = 0;
+}
+
+static GstElement *
+get_webrtcbin_for_client(struct ems_gstreamer_pipeline *egp, EmsClientId client_id)
+{
+	struct ems_webrtc_peer *peer = g_hash_table_lookup(egp->peers.by_client, client_id);
 
-	return webrtcbin;
+	return peer != NULL ? gst_object_ref(peer->webrtcbin) : NULL;
 }
 
 static void
@@ -148,24 +424,204 @@ connect_webrtc_to_tee(GstElement *webrtcbin)
 	gst_object_unref(pipeline);
 }
 
+/*!
+ * Ask the encoder for an IDR frame, so a new client doesn't sit on a grey screen until the next scheduled keyframe.
+ */
+static void
+request_keyframe(struct ems_gstreamer_pipeline *egp)
+{
+	GstElement *encoder = gst_bin_get_by_name(GST_BIN(egp->base.pipeline), ENCODER_NAME);
+	if (encoder == NULL) {
+		return;
+	}
+
+	// What gst_video_event_new_upstream_force_key_unit builds, without pulling in gstreamer-video for it.
+	GstStructure *s = gst_structure_new("GstForceKeyUnit",                                     //
+	                                    "running-time", GST_TYPE_CLOCK_TIME, GST_CLOCK_TIME_NONE, //
+	                                    "all-headers", G_TYPE_BOOLEAN, TRUE,                      //
+	                                    "count", G_TYPE_UINT, 0,                                  //
+	                                    NULL);
+	GstPad *srcpad = gst_element_get_static_pad(encoder, "src");
+	gst_pad_send_event(srcpad, gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM, s));
+
+	gst_object_unref(srcpad);
+	gst_object_unref(encoder);
+}
+
+//! Open or close the valve in front of the converter and encoder.
 static void
-on_offer_created(GstPromise *promise, GstElement *webrtcbin)
+set_encoding(struct ems_gstreamer_pipeline *egp, bool encode)
+{
+	GstElement *valve = gst_bin_get_by_name(GST_BIN(egp->base.pipeline), ENCODE_VALVE_NAME);
+
+	U_LOG_I("%s encoding", encode ? "Resuming" : "No clients left, pausing");
+	g_object_set(valve, "drop", !encode, NULL);
+	gst_object_unref(valve);
+}
+
+static void
+encode_peer_linked(struct ems_gstreamer_pipeline *egp)
+{
+	os_mutex_lock(&egp->encode.lock);
+	if (egp->encode.linked_peers++ == 0) {
+		set_encoding(egp, true);
+	}
+	egp->encode.keyframes_requested++;
+	request_keyframe(egp);
+	os_mutex_unlock(&egp->encode.lock);
+}
+
+static void
+encode_peer_unlinked(struct ems_gstreamer_pipeline *egp)
+{
+	os_mutex_lock(&egp->encode.lock);
+	if (--egp->encode.linked_peers == 0) {
+		set_encoding(egp, false);
+	}
+	os_mutex_unlock(&egp->encode.lock);
+}
+
+static void
+pending_candidate_free(gpointer data)
+{
+	struct pending_candidate *pc = data;
+
+	g_free(pc->candidate);
+	g_free(pc);
+}
+
+static void
+peer_stop_hello_locked(struct ems_webrtc_peer *peer)
+{
+	if (peer->hello_source != NULL) {
+		g_source_destroy(peer->hello_source);
+		g_clear_pointer(&peer->hello_source, g_source_unref);
+	}
+}
+
+static void
+peer_stop_clock_sync_locked(struct ems_webrtc_peer *peer)
+{
+	if (peer->clock_sync_source != NULL) {
+		g_source_destroy(peer->clock_sync_source);
+		g_clear_pointer(&peer->clock_sync_source, g_source_unref);
+	}
+}
+
+static void
+peer_free(gpointer data)
+{
+	struct ems_webrtc_peer *peer = data;
+
+	peer_stop_hello_locked(peer);
+	peer_stop_clock_sync_locked(peer);
+	g_clear_object(&peer->data_channel);
+	g_clear_object(&peer->tracking_channel);
+	g_free(peer->offer_sdp);
+	g_queue_clear_full(&peer->pending_candidates, pending_candidate_free);
+	os_mutex_destroy(&peer->lock);
+	free(peer);
+}
+
+/*!
+ * Send whatever the client hasn't seen yet, and link to the tee once the offer is out. Runs on the loop thread, which
+ * signaling and the encoder state belong to, and the only one that connects and disconnects clients.
+ */
+static gboolean
+peer_flush_cb(gpointer user_data)
+{
+	struct ems_webrtc_peer *peer = g_object_get_data(G_OBJECT(user_data), "peer");
+	struct ems_gstreamer_pipeline *egp = peer->egp;
+	GQueue candidates = G_QUEUE_INIT;
+	gchar *offer_sdp = NULL;
+	bool link = false;
+
+	os_mutex_lock(&peer->lock);
+	peer->flush_scheduled = false;
+	EmsClientId client_id = peer->client_id;
+	if (client_id != NULL) {
+		offer_sdp = g_steal_pointer(&peer->offer_sdp);
+		peer->offer_sent = peer->offer_sent || offer_sdp != NULL;
+
+		// Candidates only make sense to the client after the offer.
+		if (peer->offer_sent) {
+			link = !peer->linked;
+			peer->linked = true;
+			candidates = peer->pending_candidates;
+			g_queue_init(&peer->pending_candidates);
+		}
+	}
+	uint64_t client_connected_ns = peer->client_connected_ns;
+	os_mutex_unlock(&peer->lock);
+
+	if (offer_sdp != NULL) {
+		ems_signaling_server_send_sdp_offer(egp->signaling_server, client_id, offer_sdp);
+		g_free(offer_sdp);
+
+		U_LOG_I("Client %p: offer sent %.1f ms after connecting", client_id,
+		        time_ns_to_ms_f((time_duration_ns)(os_monotonic_get_ns() - client_connected_ns)));
+	}
+
+	if (link) {
+		connect_webrtc_to_tee(peer->webrtcbin);
+		encode_peer_linked(egp);
+	}
+
+	struct pending_candidate *pc;
+	while ((pc = g_queue_pop_head(&candidates)) != NULL) {
+		ems_signaling_server_send_candidate(egp->signaling_server, client_id, pc->mlineindex, pc->candidate);
+		pending_candidate_free(pc);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/*!
+ * Whether the client has something coming that no peer_flush_cb is on its way for. If so the caller must call
+ * @ref peer_flush once it has dropped the lock.
+ */
+static bool
+peer_want_flush_locked(struct ems_webrtc_peer *peer)
+{
+	if (peer->client_id == NULL || peer->flush_scheduled) {
+		return false;
+	}
+
+	bool want = peer->offer_sdp != NULL ||
+	            (peer->offer_sent && (!peer->linked || !g_queue_is_empty(&peer->pending_candidates)));
+	peer->flush_scheduled = want;
+	return want;
+}
+
+//! Run peer_flush_cb on the loop thread, right away if we are on it. Must not hold the peer lock.
+static void
+peer_flush(struct ems_webrtc_peer *peer)
+{
+	g_main_context_invoke_full(peer->egp->context, G_PRIORITY_DEFAULT, peer_flush_cb,
+	                           gst_object_ref(peer->webrtcbin), gst_object_unref);
+}
+
+static void
+on_offer_created(GstPromise *promise, struct ems_webrtc_peer *peer)
 {
 	GstWebRTCSessionDescription *offer = NULL;
-	gchar *sdp;
 
 	gst_structure_get(gst_promise_get_reply(promise), "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL);
 	gst_promise_unref(promise);
 
-	g_signal_emit_by_name(webrtcbin, "set-local-description", offer, NULL);
+	// Starts ICE gathering, whether or not anybody has connected yet.
+	g_signal_emit_by_name(peer->webrtcbin, "set-local-description", offer, NULL);
 
-	sdp = gst_sdp_message_as_text(offer->sdp);
-	ems_signaling_server_send_sdp_offer(signaling_server, g_object_get_data(G_OBJECT(webrtcbin), "client_id"), sdp);
-	g_free(sdp);
+	os_mutex_lock(&peer->lock);
+	peer->offer_sdp = gst_sdp_message_as_text(offer->sdp);
+	bool flush = peer_want_flush_locked(peer);
+	os_mutex_unlock(&peer->lock);
 
-	gst_webrtc_session_description_free(offer);
+	if (flush) {
+		peer_flush(peer);
+	}
 
-	connect_webrtc_to_tee(webrtcbin);
+	gst_webrtc_session_description_free(offer);
 }
 
 static void
@@ -177,17 +633,27 @@ webrtc_on_data_channel_cb(GstElement *webrtcbin, GObject *data_channel, struct e
 
 
 static void
-webrtc_on_ice_candidate_cb(GstElement *webrtcbin, guint mlineindex, gchar *candidate)
+webrtc_on_ice_candidate_cb(GstElement *webrtcbin, guint mlineindex, gchar *candidate, struct ems_webrtc_peer *peer)
 {
-	ems_signaling_server_send_candidate(signaling_server, g_object_get_data(G_OBJECT(webrtcbin), "client_id"),
-	                                    mlineindex, candidate);
+	struct pending_candidate *pc = g_new0(struct pending_candidate, 1);
+	pc->mlineindex = mlineindex;
+	pc->candidate = g_strdup(candidate);
+
+	os_mutex_lock(&peer->lock);
+	g_queue_push_tail(&peer->pending_candidates, pc);
+	bool flush = peer_want_flush_locked(peer);
+	os_mutex_unlock(&peer->lock);
+
+	if (flush) {
+		peer_flush(peer);
+	}
 }
 
 
 static void
-data_channel_error_cb(GstWebRTCDataChannel *datachannel, struct ems_gstreamer_pipeline *egp)
+data_channel_error_cb(GstWebRTCDataChannel *datachannel, struct ems_webrtc_peer *peer)
 {
-	U_LOG_E("error");
+	U_LOG_E("Client %p: data channel error", peer->client_id);
 }
 
 gboolean
@@ -202,29 +668,323 @@ datachannel_send_message(GstWebRTCDataChannel *datachannel)
 	return G_SOURCE_CONTINUE;
 }
 
+static bool
+data_channel_send_down_message(GstWebRTCDataChannel *datachannel, const em_proto_DownMessage *message)
+{
+	uint8_t buffer[em_proto_DownMessage_size];
+	pb_ostream_t os = pb_ostream_from_buffer(buffer, sizeof(buffer));
+
+	if (!pb_encode(&os, &em_proto_DownMessage_msg, message)) {
+		U_LOG_E("Could not encode down message: %s", PB_GET_ERROR(&os));
+		return false;
+	}
+
+	GBytes *bytes = g_bytes_new(buffer, os.bytes_written);
+	gst_webrtc_data_channel_send_data(datachannel, bytes);
+	g_bytes_unref(bytes);
+
+	return true;
+}
+
+//! Whether @p peer is the client whose clock we are tracking.
+static bool
+is_clock_owner(struct ems_gstreamer_pipeline *egp, struct ems_webrtc_peer *peer)
+{
+	os_mutex_lock(&egp->clock.lock);
+	bool owner = egp->clock.peer == peer;
+	os_mutex_unlock(&egp->clock.lock);
+
+	return owner;
+}
+
+//! Whether the burst of pings can give way to the trickle: the estimate has enough exchanges in it, or nothing uses
+//! this client's clock anyway.
+static bool
+clock_sync_converged(struct ems_gstreamer_pipeline *egp, struct ems_webrtc_peer *peer)
+{
+	if (!is_clock_owner(egp, peer)) {
+		return true;
+	}
+
+	struct ems_clock_sync_stats stats;
+	ems_clock_sync_get_stats(egp->clock.sync, &stats);
+	return stats.valid && stats.accepted >= CLOCK_SYNC_BURST_COUNT / 2;
+}
+
+static void
+peer_start_clock_sync_locked(struct ems_webrtc_peer *peer, guint interval_ms, GSourceFunc func)
+{
+	peer_stop_clock_sync_locked(peer);
+	peer->clock_sync_source = g_timeout_source_new(interval_ms);
+	g_source_set_callback(peer->clock_sync_source, func, peer, NULL);
+	g_source_attach(peer->clock_sync_source, peer->egp->context);
+}
+
+static void
+clock_sync_send_ping(struct ems_webrtc_peer *peer)
+{
+	struct ems_gstreamer_pipeline *egp = peer->egp;
+
+	em_proto_DownMessage message = em_proto_DownMessage_init_default;
+	message.has_clock_sync_ping = true;
+	message.clock_sync_ping.id = ++egp->clock.pings_sent;
+	// Last thing before sending, anything after this counts towards the round trip.
+	message.clock_sync_ping.server_send_time = (int64_t)os_monotonic_get_ns();
+	data_channel_send_down_message(GST_WEBRTC_DATA_CHANNEL(peer->data_channel), &message);
+}
+
+static gboolean
+clock_sync_trickle_cb(gpointer user_data)
+{
+	clock_sync_send_ping(user_data);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+clock_sync_burst_cb(gpointer user_data)
+{
+	struct ems_webrtc_peer *peer = user_data;
+	struct ems_gstreamer_pipeline *egp = peer->egp;
+
+	clock_sync_send_ping(peer);
+
+	os_mutex_lock(&peer->lock);
+	uint32_t ticks = ++peer->clock_sync_ticks;
+	// Still ours, unless the data channel closed or reopened meanwhile.
+	bool current = peer->clock_sync_source == g_main_current_source();
+	os_mutex_unlock(&peer->lock);
+
+	if (!current || ticks < CLOCK_SYNC_BURST_COUNT) {
+		return G_SOURCE_CONTINUE;
+	}
+	if (ticks < CLOCK_SYNC_MAX_BURST_COUNT && !clock_sync_converged(egp, peer)) {
+		return G_SOURCE_CONTINUE;
+	}
+
+	// Swap the fast timer for the slow one, instead of waking up every 100 ms to skip most of them.
+	gboolean ret = G_SOURCE_CONTINUE;
+	os_mutex_lock(&peer->lock);
+	if (peer->clock_sync_source == g_main_current_source()) {
+		peer_start_clock_sync_locked(peer, CLOCK_SYNC_INTERVAL_MS, clock_sync_trickle_cb);
+		ret = G_SOURCE_REMOVE;
+	}
+	os_mutex_unlock(&peer->lock);
+
+	return ret;
+}
+
 static void
-data_channel_open_cb(GstWebRTCDataChannel *datachannel, struct ems_gstreamer_pipeline *egp)
+clock_sync_pong(struct ems_gstreamer_pipeline *egp,
+                struct ems_webrtc_peer *peer,
+                const em_proto_ClockSyncPong *pong,
+                int64_t receive_ns)
 {
-	U_LOG_I("data channel opened");
+	if (!is_clock_owner(egp, peer)) {
+		return;
+	}
+
+	if (!ems_clock_sync_add_sample(egp->clock.sync, pong->server_send_time, pong->client_receive_time,
+	                               pong->client_send_time, receive_ns)) {
+		U_LOG_D("Client %p: ignoring inconsistent clock sync pong %u", peer->client_id, pong->id);
+	}
+}
 
-	egp->timeout_src_id = g_timeout_add_seconds(3, G_SOURCE_FUNC(datachannel_send_message), datachannel);
+static void
+data_channel_open_cb(GstWebRTCDataChannel *datachannel, struct ems_webrtc_peer *peer)
+{
+	struct ems_gstreamer_pipeline *egp = peer->egp;
+
+	U_LOG_I("Client %p: data channel opened", peer->client_id);
+
+	// Tell the client what it may send us, it keeps sending full tracking messages until it hears this.
+	em_proto_DownMessage message = em_proto_DownMessage_init_default;
+	message.has_capabilities = true;
+	message.capabilities.compact_tracking_version = EM_COMPACT_TRACKING_VERSION;
+	message.capabilities.batched_frame_reports = true;
+	data_channel_send_down_message(datachannel, &message);
+
+	// Called on a webrtcbin thread, the timer belongs on the pipeline's loop.
+	os_mutex_lock(&peer->lock);
+	peer_stop_hello_locked(peer);
+	peer->hello_source = g_timeout_source_new_seconds(3);
+	g_source_set_callback(peer->hello_source, G_SOURCE_FUNC(datachannel_send_message), datachannel, NULL);
+	g_source_attach(peer->hello_source, peer->egp->context);
+
+	peer_stop_clock_sync_locked(peer);
+	bool connected = peer->client_id != NULL;
+	if (connected) {
+		peer->clock_sync_ticks = 0;
+		peer_start_clock_sync_locked(peer, CLOCK_SYNC_BURST_INTERVAL_MS, clock_sync_burst_cb);
+	}
+	os_mutex_unlock(&peer->lock);
+
+	// The newest client is the one wearing the headset, its clock is the one that matters from now on.
+	if (connected) {
+		os_mutex_lock(&egp->clock.lock);
+		egp->clock.peer = peer;
+		ems_clock_sync_reset(egp->clock.sync);
+		os_mutex_unlock(&egp->clock.lock);
+	}
 }
 
 static void
-data_channel_close_cb(GstWebRTCDataChannel *datachannel, struct ems_gstreamer_pipeline *egp)
+data_channel_close_cb(GstWebRTCDataChannel *datachannel, struct ems_webrtc_peer *peer)
+{
+	U_LOG_I("Client %p: data channel closed", peer->client_id);
+
+	os_mutex_lock(&peer->lock);
+	peer_stop_hello_locked(peer);
+	peer_stop_clock_sync_locked(peer);
+	os_mutex_unlock(&peer->lock);
+}
+
+/*!
+ * Drop tracking older than what we already passed on, and expand compact tracking.
+ *
+ * Sets @p out_request_keyframe when compact tracking can't be decoded because its keyframe never made it here, the
+ * caller then asks the client for a new one instead of dropping everything until its next scheduled keyframe.
+ *
+ * Returns true if @p message should be dispatched.
+ */
+static bool
+accept_tracking_locked(struct ems_gstreamer_pipeline *egp,
+                       struct ems_webrtc_peer *peer,
+                       em_proto_UpMessage *message,
+                       bool *out_request_keyframe)
 {
-	U_LOG_I("data channel closed");
+	int64_t sequence_idx =
+	    message->has_compact_tracking ? message->compact_tracking.sequence_idx : message->tracking.sequence_idx;
+
+	egp->tracking.received++;
+
+	// Zero means the client doesn't number its tracking, nothing to compare against.
+	if (sequence_idx != 0 && sequence_idx <= peer->tracking.latest_sequence_idx) {
+		egp->tracking.stale_dropped++;
+		return false;
+	}
+
+	if (message->has_compact_tracking) {
+		enum em_compact_tracking_result res =
+		    em_compact_tracking_decode(&peer->tracking.decoder, &message->compact_tracking, &message->tracking);
+		if (res != EM_COMPACT_TRACKING_OK) {
+			U_LOG_D("Dropping compact tracking message %" PRId64 ": %d", sequence_idx, res);
+			egp->tracking.undecodable++;
+
+			int64_t keyframe_idx = message->compact_tracking.keyframe_sequence_idx;
+			if (res == EM_COMPACT_TRACKING_MISSING_KEYFRAME && keyframe_idx != peer->tracking.keyframe_requested_for) {
+				peer->tracking.keyframe_requested_for = keyframe_idx;
+				egp->tracking.keyframes_requested++;
+				*out_request_keyframe = true;
+			}
+			return false;
+		}
+		message->has_compact_tracking = false;
+		message->has_tracking = true;
+	}
+
+	if (sequence_idx != 0) {
+		peer->tracking.latest_sequence_idx = sequence_idx;
+	}
 
-	g_clear_handle_id(&egp->timeout_src_id, g_source_remove);
-	g_clear_object(&egp->data_channel);
+	uint64_t now_ns = os_monotonic_get_ns();
+	if (peer->tracking.latest_arrival_ns != 0) {
+		em_latency_histogram_record_ns(&egp->tracking.gap, (int64_t)(now_ns - peer->tracking.latest_arrival_ns));
+		egp->tracking.gap_ms =
+		    (float)time_ns_to_ms_f((time_duration_ns)(now_ns - peer->tracking.latest_arrival_ns));
+		if (egp->tracking.gap_ms > egp->tracking.max_gap_ms) {
+			egp->tracking.max_gap_ms = egp->tracking.gap_ms;
+		}
+	}
+	peer->tracking.latest_arrival_ns = now_ns;
+
+	return true;
+}
+
+static void
+tracking_channel_close_cb(GstWebRTCDataChannel *datachannel, struct ems_webrtc_peer *peer)
+{
+	U_LOG_I("Client %p: tracking data channel closed", peer->client_id);
 }
 
 static void
-data_channel_message_data_cb(GstWebRTCDataChannel *datachannel, GBytes *data, struct ems_gstreamer_pipeline *egp)
+report_first_frame(struct ems_gstreamer_pipeline *egp, struct ems_webrtc_peer *peer)
 {
+	os_mutex_lock(&peer->lock);
+	bool first = !peer->first_frame_seen && peer->client_id != NULL;
+	peer->first_frame_seen = true;
+	uint64_t connected_ns = peer->client_connected_ns;
+	os_mutex_unlock(&peer->lock);
+
+	if (!first) {
+		return;
+	}
+
+	// The client reports timing once it has decoded and shown a frame, so this is as close as we can see.
+	float ms = (float)time_ns_to_ms_f((time_duration_ns)(os_monotonic_get_ns() - connected_ns));
+	egp->peers.connect_to_first_frame_ms = ms;
+	U_LOG_I("Client %p: %.1f ms from websocket connect to first decoded frame", peer->client_id, ms);
+}
+
+//! A client timestamp in our clock, 0 if it is unset or the clocks aren't synced yet.
+static int64_t
+client_time_to_ns(struct ems_gstreamer_pipeline *egp, int64_t client_ns)
+{
+	int64_t ns = 0;
+	if (client_ns == 0 || !ems_clock_sync_client_to_server(egp->clock.sync, client_ns, &ns)) {
+		return 0;
+	}
+	return ns;
+}
+
+//! Close the frame the client reported on, and account for where its time went.
+static void
+join_frame_report(struct ems_gstreamer_pipeline *egp,
+                  struct ems_webrtc_peer *peer,
+                  const em_proto_UpFrameMessage *frame)
+{
+	// Zero from clients that don't know frame ids, and only one client's clock can be mapped into ours.
+	if (frame->frame_sequence_id == 0 || !is_clock_owner(egp, peer)) {
+		return;
+	}
+
+	// Take before adding the client's points: marking a frame the ledger no longer has would open a new entry for
+	// it, pushing out a frame that is still on its way.
+	struct ems_frame_ledger_entry entry;
+	if (!ems_frame_ledger_take(egp->frames.ledger, frame->frame_sequence_id, &entry)) {
+		return;
+	}
+	entry.ns[EMS_FRAME_POINT_DECODED] = client_time_to_ns(egp, frame->decode_complete_time);
+	entry.ns[EMS_FRAME_POINT_DISPLAYED] = client_time_to_ns(egp, frame->display_time);
+
+	for (uint32_t i = 0; i + 1 < EMS_FRAME_POINT_COUNT; i++) {
+		if (entry.ns[i] == 0 || entry.ns[i + 1] == 0) {
+			continue;
+		}
+		em_latency_histogram_record_ns(&egp->metrics.hops[i], entry.ns[i + 1] - entry.ns[i]);
+	}
+
+	int64_t pose_ns = entry.ns[EMS_FRAME_POINT_POSE];
+	int64_t displayed_ns = entry.ns[EMS_FRAME_POINT_DISPLAYED];
+	if (pose_ns != 0 && displayed_ns != 0) {
+		em_latency_histogram_record_ns(&egp->metrics.motion_to_photon, displayed_ns - pose_ns);
+
+		os_mutex_lock(&egp->metrics.lock);
+		egp->metrics.motion_to_photon_ms = (float)time_ns_to_ms_f(displayed_ns - pose_ns);
+		os_mutex_unlock(&egp->metrics.lock);
+	}
+}
+
+static void
+data_channel_message_data_cb(GstWebRTCDataChannel *datachannel, GBytes *data, struct ems_webrtc_peer *peer)
+{
+	struct ems_gstreamer_pipeline *egp = peer->egp;
 	em_proto_UpMessage message = em_proto_UpMessage_init_default;
 	size_t n = 0;
 
+	// Before decoding, for clock sync pongs.
+	int64_t receive_ns = (int64_t)os_monotonic_get_ns();
+
 	const unsigned char *buf = (const unsigned char *)g_bytes_get_data(data, &n);
 	pb_istream_t our_istream = pb_istream_from_buffer(buf, n);
 
@@ -234,18 +994,68 @@ data_channel_message_data_cb(GstWebRTCDataChannel *datachannel, GBytes *data, st
 		U_LOG_E("Error! %s", PB_GET_ERROR(&our_istream));
 		return;
 	}
+
+	// A single report from older clients, batches from the others.
+	const em_proto_UpFrameMessage *frames = message.has_frame ? &message.frame : message.frames;
+	uint32_t frame_count = message.has_frame ? 1 : message.frames_count;
+
+	os_mutex_lock(&peer->lock);
+	int channel = G_OBJECT(datachannel) == peer->tracking_channel ? 1 : 0;
+	peer->stats.messages[channel]++;
+	peer->stats.bytes[channel] += n;
+	for (uint32_t i = 0; i < frame_count; i++) {
+		peer->stats.frames_reported++;
+		if (frames[i].display_time > frames[i].decode_complete_time && frames[i].decode_complete_time > 0) {
+			ems_latency_window_add(
+			    &peer->stats.decode_to_display,
+			    (float)time_ns_to_ms_f(frames[i].display_time - frames[i].decode_complete_time));
+		}
+	}
+	os_mutex_unlock(&peer->lock);
+
+	if (message.has_clock_sync_pong) {
+		// Pongs travel on their own, nothing in here for the callbacks.
+		clock_sync_pong(egp, peer, &message.clock_sync_pong, receive_ns);
+		return;
+	}
+
+	if (frame_count > 0) {
+		report_first_frame(egp, peer);
+	}
+	for (uint32_t i = 0; i < frame_count; i++) {
+		join_frame_report(egp, peer, &frames[i]);
+	}
+
+	if (message.has_tracking || message.has_compact_tracking) {
+		bool request_keyframe = false;
+		os_mutex_lock(&egp->tracking.lock);
+		bool accepted = accept_tracking_locked(egp, peer, &message, &request_keyframe);
+		os_mutex_unlock(&egp->tracking.lock);
+
+		if (request_keyframe) {
+			// Over the reliable channel, so the request itself can't get lost.
+			em_proto_DownMessage request = em_proto_DownMessage_init_default;
+			request.tracking_keyframe_request = true;
+			data_channel_send_down_message(GST_WEBRTC_DATA_CHANNEL(peer->data_channel), &request);
+		}
+
+		if (!accepted) {
+			return;
+		}
+	}
+
 	ems_callbacks_call(egp->callbacks, EMS_CALLBACKS_EVENT_TRACKING, &message);
 }
 
 static void
-data_channel_message_string_cb(GstWebRTCDataChannel *datachannel, gchar *str, struct ems_gstreamer_pipeline *egp)
+data_channel_message_string_cb(GstWebRTCDataChannel *datachannel, gchar *str, struct ems_webrtc_peer *peer)
 {
-	U_LOG_I("Received data channel message: %s\n", str);
+	U_LOG_I("Client %p: received data channel message: %s\n", peer->client_id, str);
 }
 
 
-static void
-webrtc_client_connected_cb(EmsSignalingServer *server, EmsClientId client_id, struct ems_gstreamer_pipeline *egp)
+static struct ems_webrtc_peer *
+peer_prepare(struct ems_gstreamer_pipeline *egp)
 {
 	GstBin *pipeline = GST_BIN(egp->base.pipeline);
 	gchar *name;
@@ -254,11 +1064,18 @@ webrtc_client_connected_cb(EmsSignalingServer *server, EmsClientId client_id, st
 	GstStateChangeReturn ret;
 	GstWebRTCRTPTransceiver *transceiver;
 
-	name = g_strdup_printf("webrtcbin_%p", client_id);
+	name = g_strdup_printf("webrtcbin_%u", egp->peers.created++);
+
+	struct ems_webrtc_peer *peer = U_TYPED_CALLOC(struct ems_webrtc_peer);
+	peer->egp = egp;
+	os_mutex_init(&peer->lock);
+	g_queue_init(&peer->pending_candidates);
+	em_compact_tracking_decoder_init(&peer->tracking.decoder);
 
 	webrtcbin = gst_element_factory_make("webrtcbin", name);
 	g_object_set(webrtcbin, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, NULL);
-	g_object_set_data(G_OBJECT(webrtcbin), "client_id", client_id);
+	g_object_set_data_full(G_OBJECT(webrtcbin), "peer", peer, peer_free);
+	peer->webrtcbin = webrtcbin;
 	gst_bin_add(pipeline, webrtcbin);
 
 	ret = gst_element_set_state(webrtcbin, GST_STATE_READY);
@@ -270,27 +1087,45 @@ webrtc_client_connected_cb(EmsSignalingServer *server, EmsClientId client_id, st
 
 	// TODO add priority
 	GstStructure *data_channel_options = gst_structure_new_from_string("data-channel-options, ordered=true");
-	g_signal_emit_by_name(webrtcbin, "create-data-channel", "channel", data_channel_options, &egp->data_channel);
+	g_signal_emit_by_name(webrtcbin, "create-data-channel", DATA_CHANNEL_LABEL, data_channel_options,
+	                      &peer->data_channel);
 	gst_clear_structure(&data_channel_options);
 
-	if (!egp->data_channel) {
+	// A lost pose must not hold up the ones behind it.
+	GstStructure *tracking_channel_options =
+	    gst_structure_new_from_string("data-channel-options, ordered=false, max-retransmits=0");
+	g_signal_emit_by_name(webrtcbin, "create-data-channel", TRACKING_CHANNEL_LABEL, tracking_channel_options,
+	                      &peer->tracking_channel);
+	gst_clear_structure(&tracking_channel_options);
+
+	if (!peer->tracking_channel) {
+		// The client falls back to the reliable channel.
+		U_LOG_W("Couldn't make tracking datachannel!");
+	} else {
+		g_signal_connect(peer->tracking_channel, "on-close", G_CALLBACK(tracking_channel_close_cb), peer);
+		g_signal_connect(peer->tracking_channel, "on-error", G_CALLBACK(data_channel_error_cb), peer);
+		g_signal_connect(peer->tracking_channel, "on-message-data", G_CALLBACK(data_channel_message_data_cb),
+		                 peer);
+	}
+
+	if (!peer->data_channel) {
 		U_LOG_E("Couldn't make datachannel!");
 		assert(false);
 	} else {
 		U_LOG_I("Successfully created datachannel!");
 
-		g_signal_connect(egp->data_channel, "on-open", G_CALLBACK(data_channel_open_cb), egp);
-		g_signal_connect(egp->data_channel, "on-close", G_CALLBACK(data_channel_close_cb), egp);
-		g_signal_connect(egp->data_channel, "on-error", G_CALLBACK(data_channel_error_cb), egp);
-		g_signal_connect(egp->data_channel, "on-message-data", G_CALLBACK(data_channel_message_data_cb), egp);
-		g_signal_connect(egp->data_channel, "on-message-string", G_CALLBACK(data_channel_message_string_cb),
-		                 egp);
+		g_signal_connect(peer->data_channel, "on-open", G_CALLBACK(data_channel_open_cb), peer);
+		g_signal_connect(peer->data_channel, "on-close", G_CALLBACK(data_channel_close_cb), peer);
+		g_signal_connect(peer->data_channel, "on-error", G_CALLBACK(data_channel_error_cb), peer);
+		g_signal_connect(peer->data_channel, "on-message-data", G_CALLBACK(data_channel_message_data_cb), peer);
+		g_signal_connect(peer->data_channel, "on-message-string", G_CALLBACK(data_channel_message_string_cb),
+		                 peer);
 	}
 
 	ret = gst_element_set_state(webrtcbin, GST_STATE_PLAYING);
 	g_assert(ret != GST_STATE_CHANGE_FAILURE);
 
-	g_signal_connect(webrtcbin, "on-ice-candidate", G_CALLBACK(webrtc_on_ice_candidate_cb), NULL);
+	g_signal_connect(webrtcbin, "on-ice-candidate", G_CALLBACK(webrtc_on_ice_candidate_cb), peer);
 
 	caps = gst_caps_from_string(
 	    "application/x-rtp, "
@@ -299,16 +1134,87 @@ webrtc_client_connected_cb(EmsSignalingServer *server, EmsClientId client_id, st
 	g_signal_emit_by_name(webrtcbin, "add-transceiver", GST_WEBRTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY, caps,
 	                      &transceiver);
 
-	gst_caps_unref(caps);
-	gst_clear_object(&transceiver);
+	gst_caps_unref(caps);
+	gst_clear_object(&transceiver);
+
+	g_signal_emit_by_name(webrtcbin, "create-offer", NULL,
+	                      gst_promise_new_with_change_func((GstPromiseChangeFunc)on_offer_created, peer, NULL));
+
+	GST_DEBUG_BIN_TO_DOT_FILE(pipeline, GST_DEBUG_GRAPH_SHOW_ALL, "rtcbin");
+
+	g_free(name);
+
+	return peer;
+}
+
+static gboolean
+refill_pool_cb(gpointer user_data)
+{
+	struct ems_gstreamer_pipeline *egp = user_data;
+
+	while (egp->peers.idle.length < egp->peers.pool_size) {
+		g_queue_push_tail(&egp->peers.idle, peer_prepare(egp));
+	}
+
+	egp->peers.refill_src_id = 0;
+	return G_SOURCE_REMOVE;
+}
+
+//! Top the pool of prepared peers up from the loop thread, which owns it.
+static void
+schedule_refill(struct ems_gstreamer_pipeline *egp)
+{
+	if (egp->peers.pool_size > 0 && egp->peers.refill_src_id == 0) {
+		egp->peers.refill_src_id = attach_source(egp, g_idle_source_new(), refill_pool_cb, egp);
+	}
+}
+
+static void
+webrtc_client_connected_cb(EmsSignalingServer *server, EmsClientId client_id, struct ems_gstreamer_pipeline *egp)
+{
+	uint64_t now_ns = os_monotonic_get_ns();
+
+	struct ems_webrtc_peer *peer = g_queue_pop_head(&egp->peers.idle);
+	if (peer == NULL) {
+		// Pool disabled or drained by a burst of clients.
+		peer = peer_prepare(egp);
+	}
+
+	g_hash_table_insert(egp->peers.by_client, client_id, peer);
 
-	g_signal_emit_by_name(
-	    webrtcbin, "create-offer", NULL,
-	    gst_promise_new_with_change_func((GstPromiseChangeFunc)on_offer_created, webrtcbin, NULL));
+	os_mutex_lock(&peer->lock);
+	peer->client_id = client_id;
+	peer->client_number = ++egp->peers.connected;
+	peer->client_connected_ns = now_ns;
+	bool flush = peer_want_flush_locked(peer);
+	os_mutex_unlock(&peer->lock);
 
-	GST_DEBUG_BIN_TO_DOT_FILE(pipeline, GST_DEBUG_GRAPH_SHOW_ALL, "rtcbin");
+	// Sends the offer and candidates right away if the peer was already prepared.
+	if (flush) {
+		peer_flush(peer);
+	}
 
-	g_free(name);
+	// Top up once we're done with this client.
+	schedule_refill(egp);
+}
+
+static void
+on_remote_description_set(GstPromise *promise, gpointer user_data)
+{
+	EmsClientId client_id = user_data;
+	const GstStructure *reply = gst_promise_get_reply(promise);
+
+	if (reply != NULL && gst_structure_has_field(reply, "error")) {
+		GError *error = NULL;
+		gst_structure_get(reply, "error", G_TYPE_ERROR, &error, NULL);
+		U_LOG_E("Client %p: could not set remote description: %s", client_id,
+		        error != NULL ? error->message : "unknown error");
+		g_clear_error(&error);
+	} else {
+		U_LOG_D("Client %p: remote description set", client_id);
+	}
+
+	gst_promise_unref(promise);
 }
 
 static void
@@ -317,7 +1223,6 @@ webrtc_sdp_answer_cb(EmsSignalingServer *server,
                      const gchar *sdp,
                      struct ems_gstreamer_pipeline *egp)
 {
-	GstBin *pipeline = GST_BIN(egp->base.pipeline);
 	GstSDPMessage *sdp_msg = NULL;
 	GstWebRTCSessionDescription *desc = NULL;
 
@@ -331,17 +1236,15 @@ webrtc_sdp_answer_cb(EmsSignalingServer *server,
 		GstElement *webrtcbin;
 		GstPromise *promise;
 
-		webrtcbin = get_webrtcbin_for_client(pipeline, client_id);
+		webrtcbin = get_webrtcbin_for_client(egp, client_id);
 		if (!webrtcbin) {
 			goto out;
 		}
-		promise = gst_promise_new();
+		// Don't wait on this, the main loop is shared by every client's signaling.
+		promise = gst_promise_new_with_change_func(on_remote_description_set, client_id, NULL);
 
 		g_signal_emit_by_name(webrtcbin, "set-remote-description", desc, promise);
 
-		gst_promise_wait(promise);
-		gst_promise_unref(promise);
-
 		gst_object_unref(webrtcbin);
 	} else {
 		gst_sdp_message_free(sdp_msg);
@@ -358,12 +1261,10 @@ webrtc_candidate_cb(EmsSignalingServer *server,
                     const gchar *candidate,
                     struct ems_gstreamer_pipeline *egp)
 {
-	GstBin *pipeline = GST_BIN(egp->base.pipeline);
-
 	if (strlen(candidate)) {
 		GstElement *webrtcbin;
 
-		webrtcbin = get_webrtcbin_for_client(pipeline, client_id);
+		webrtcbin = get_webrtcbin_for_client(egp, client_id);
 		if (webrtcbin) {
 			g_signal_emit_by_name(webrtcbin, "add-ice-candidate", mlineindex, candidate);
 			gst_object_unref(webrtcbin);
@@ -390,17 +1291,43 @@ webrtc_client_disconnected_cb(EmsSignalingServer *server, EmsClientId client_id,
 	GstBin *pipeline = GST_BIN(egp->base.pipeline);
 	GstElement *webrtcbin;
 
-	webrtcbin = get_webrtcbin_for_client(pipeline, client_id);
+	webrtcbin = get_webrtcbin_for_client(egp, client_id);
 
 	if (webrtcbin) {
+		struct ems_webrtc_peer *peer = g_hash_table_lookup(egp->peers.by_client, client_id);
 		GstPad *sinkpad;
 
+		// The websocket is gone, don't send anything more its way.
+		os_mutex_lock(&peer->lock);
+		peer->client_id = NULL;
+		peer_stop_hello_locked(peer);
+		peer_stop_clock_sync_locked(peer);
+		bool was_linked = peer->linked;
+		os_mutex_unlock(&peer->lock);
+		g_hash_table_remove(egp->peers.by_client, client_id);
+
+		// Keep the estimate, the poses this client already sent are still stamped with its clock.
+		os_mutex_lock(&egp->clock.lock);
+		if (egp->clock.peer == peer) {
+			egp->clock.peer = NULL;
+		}
+		os_mutex_unlock(&egp->clock.lock);
+
+		if (was_linked) {
+			encode_peer_unlinked(egp);
+		}
+
 		sinkpad = gst_element_get_static_pad(webrtcbin, "sink_0");
 		if (sinkpad) {
 			gst_pad_add_probe(GST_PAD_PEER(sinkpad), GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
 			                  remove_webrtcbin_probe_cb, webrtcbin, gst_object_unref);
 
 			gst_clear_object(&sinkpad);
+		} else {
+			// Never got as far as being linked, nothing to block.
+			gst_bin_remove(pipeline, webrtcbin);
+			gst_element_set_state(webrtcbin, GST_STATE_NULL);
+			gst_object_unref(webrtcbin);
 		}
 	}
 }
@@ -482,6 +1409,582 @@ print_stats(gpointer user_data)
 }
 
 
+
+/*
+ *
+ * Metrics.
+ *
+ */
+
+enum stage
+{
+	STAGE_CONVERT = 0,
+	STAGE_ENCODE = 1,
+};
+
+static const char *stage_names[] = {"convert", "encode"};
+
+//! Named after where the frame is going, indexed by the point it leaves. Out of the encoder the frame crosses the
+//! network before it is decoded, we only see both together.
+static const char *hop_names[] = {"commit", "readback", "convert", "encode", "network+decode", "display"};
+static_assert(ARRAY_SIZE(hop_names) == EMS_FRAME_POINT_COUNT - 1, "one name per hop");
+
+static void
+stage_begin_locked(struct ems_gstreamer_pipeline *egp, enum stage stage, GstClockTime pts, uint64_t now_ns)
+{
+	uint32_t i = egp->metrics.stages[stage].next;
+	egp->metrics.stages[stage].pending[i].pts = pts;
+	egp->metrics.stages[stage].pending[i].ns = now_ns;
+	egp->metrics.stages[stage].next = (i + 1) % STAGE_PENDING_COUNT;
+}
+
+static void
+stage_end_locked(struct ems_gstreamer_pipeline *egp, enum stage stage, GstClockTime pts, uint64_t now_ns)
+{
+	for (uint32_t i = 0; i < STAGE_PENDING_COUNT; i++) {
+		if (egp->metrics.stages[stage].pending[i].pts != pts || egp->metrics.stages[stage].pending[i].ns == 0) {
+			continue;
+		}
+		uint64_t begin_ns = egp->metrics.stages[stage].pending[i].ns;
+		egp->metrics.stages[stage].pending[i].ns = 0;
+		ems_latency_window_add(&egp->metrics.stages[stage].window,
+		                       (float)time_ns_to_ms_f((time_duration_ns)(now_ns - begin_ns)));
+		return;
+	}
+}
+
+static GstPadProbeReturn
+valve_src_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	struct ems_gstreamer_pipeline *egp = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+	os_mutex_lock(&egp->metrics.lock);
+	stage_begin_locked(egp, STAGE_CONVERT, GST_BUFFER_PTS(buffer), os_monotonic_get_ns());
+	os_mutex_unlock(&egp->metrics.lock);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+encoder_sink_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	struct ems_gstreamer_pipeline *egp = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	uint64_t now_ns = os_monotonic_get_ns();
+
+	os_mutex_lock(&egp->metrics.lock);
+	stage_end_locked(egp, STAGE_CONVERT, GST_BUFFER_PTS(buffer), now_ns);
+	stage_begin_locked(egp, STAGE_ENCODE, GST_BUFFER_PTS(buffer), now_ns);
+	os_mutex_unlock(&egp->metrics.lock);
+
+	ems_frame_ledger_mark_pts(egp->frames.ledger, GST_BUFFER_PTS(buffer), EMS_FRAME_POINT_ENCODE_BEGIN,
+	                          (int64_t)now_ns);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+encoder_src_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	struct ems_gstreamer_pipeline *egp = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	uint64_t now_ns = os_monotonic_get_ns();
+
+	os_mutex_lock(&egp->metrics.lock);
+	stage_end_locked(egp, STAGE_ENCODE, GST_BUFFER_PTS(buffer), now_ns);
+	egp->metrics.frames_encoded++;
+	egp->metrics.bytes_encoded += gst_buffer_get_size(buffer);
+	os_mutex_unlock(&egp->metrics.lock);
+
+	ems_frame_ledger_mark_pts(egp->frames.ledger, GST_BUFFER_PTS(buffer), EMS_FRAME_POINT_ENCODE_END,
+	                          (int64_t)now_ns);
+
+	return GST_PAD_PROBE_OK;
+}
+
+//! Every packet of a frame carries its pts, so a new one means the first packet of the next frame.
+static bool
+starts_frame(struct ems_gstreamer_pipeline *egp, GstBuffer *buffer)
+{
+	return GST_BUFFER_PTS(buffer) != egp->frames.last_stamped_pts;
+}
+
+/*!
+ * Put the frame id into the header extension of @p buffer, which must be writable. Along with the display time the
+ * app rendered it for, in the client's clock so it can line frames up with its own display times.
+ */
+static void
+stamp_frame_data(struct ems_gstreamer_pipeline *egp, GstBuffer *buffer)
+{
+	GstClockTime pts = GST_BUFFER_PTS(buffer);
+	egp->frames.last_stamped_pts = pts;
+
+	struct ems_frame_ledger_entry entry;
+	if (!ems_frame_ledger_find_pts(egp->frames.ledger, pts, &entry)) {
+		return;
+	}
+
+	em_proto_DownMessage message = em_proto_DownMessage_init_default;
+	message.has_frame_data = true;
+	message.frame_data.frame_sequence_id = entry.frame_id;
+	if (entry.target_display_ns != 0) {
+		// Stays 0, unknown, until the clock sync has an estimate.
+		ems_clock_sync_server_to_client(egp->clock.sync, entry.target_display_ns,
+		                                &message.frame_data.display_time);
+	}
+	if (entry.has_render_pose) {
+		em_proto_Pose *pose = &message.frame_data.P_localSpace_viewSpace;
+		message.frame_data.has_P_localSpace_viewSpace = true;
+		pose->has_position = true;
+		pose->position.x = entry.render_pose.position.x;
+		pose->position.y = entry.render_pose.position.y;
+		pose->position.z = entry.render_pose.position.z;
+		pose->has_orientation = true;
+		pose->orientation.w = entry.render_pose.orientation.w;
+		pose->orientation.x = entry.render_pose.orientation.x;
+		pose->orientation.y = entry.render_pose.orientation.y;
+		pose->orientation.z = entry.render_pose.orientation.z;
+	}
+	message.frame_data.tracking_sequence_idx = entry.tracking_sequence_idx;
+
+	// pack_blit_and_encode puts the eyes side by side, left eye first.
+	message.frame_data.has_left_eye_rect = true;
+	message.frame_data.left_eye_rect = (em_proto_EyeRect){0.0f, 0.0f, 0.5f, 1.0f};
+	message.frame_data.has_right_eye_rect = true;
+	message.frame_data.right_eye_rect = (em_proto_EyeRect){0.5f, 0.0f, 0.5f, 1.0f};
+
+	uint8_t data[em_proto_DownMessage_size];
+	pb_ostream_t os = pb_ostream_from_buffer(data, sizeof(data));
+	if (!pb_encode(&os, &em_proto_DownMessage_msg, &message)) {
+		U_LOG_E("Could not encode frame data: %s", PB_GET_ERROR(&os));
+		return;
+	}
+
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+	if (!gst_rtp_buffer_map(buffer, GST_MAP_READWRITE, &rtp)) {
+		return;
+	}
+	bool added = gst_rtp_buffer_add_extension_twobytes_header(&rtp, 0, EM_FRAME_DATA_EXTENSION_ID, data,
+	                                                          (guint)os.bytes_written);
+	gst_rtp_buffer_unmap(&rtp);
+
+	// Happens if something else already put a one-byte header extension on the packet.
+	if (!added && !egp->frames.stamp_failed) {
+		U_LOG_W("Could not add the frame data header extension, clients won't know frame ids");
+		egp->frames.stamp_failed = true;
+	}
+}
+
+static GstPadProbeReturn
+payloader_src_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	struct ems_gstreamer_pipeline *egp = user_data;
+
+	if ((info->type & GST_PAD_PROBE_TYPE_BUFFER) != 0) {
+		GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+		if (starts_frame(egp, buffer)) {
+			buffer = gst_buffer_make_writable(buffer);
+			stamp_frame_data(egp, buffer);
+			GST_PAD_PROBE_INFO_DATA(info) = buffer;
+		}
+		return GST_PAD_PROBE_OK;
+	}
+
+	GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+	guint length = gst_buffer_list_length(list);
+	guint first = 0;
+	while (first < length && !starts_frame(egp, gst_buffer_list_get(list, first))) {
+		first++;
+	}
+	if (first == length) {
+		return GST_PAD_PROBE_OK;
+	}
+
+	list = gst_buffer_list_make_writable(list);
+	GST_PAD_PROBE_INFO_DATA(info) = list;
+	for (guint i = first; i < length; i++) {
+		if (starts_frame(egp, gst_buffer_list_get(list, i))) {
+			stamp_frame_data(egp, gst_buffer_list_get_writable(list, i));
+		}
+	}
+
+	return GST_PAD_PROBE_OK;
+}
+
+static void
+add_probe(GstElement *pipeline,
+          const char *element_name,
+          const char *pad,
+          GstPadProbeType type,
+          GstPadProbeCallback cb,
+          void *egp)
+{
+	GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+	GstPad *static_pad = gst_element_get_static_pad(element, pad);
+
+	gst_pad_add_probe(static_pad, type, cb, egp, NULL);
+
+	gst_object_unref(static_pad);
+	gst_object_unref(element);
+}
+
+struct rtp_stats
+{
+	bool have_outbound;
+	double bytes_sent;
+	double packets_sent;
+
+	bool have_remote_inbound;
+	double packets_lost;
+	double fraction_lost;
+	double round_trip_time_s;
+};
+
+//! Stats fields change integer types between GStreamer versions, go through double.
+static bool
+stats_get_number(const GstStructure *s, const char *field, double *out)
+{
+	const GValue *value = gst_structure_get_value(s, field);
+	if (value == NULL) {
+		return false;
+	}
+
+	GValue d = G_VALUE_INIT;
+	g_value_init(&d, G_TYPE_DOUBLE);
+	bool ok = g_value_transform(value, &d);
+	if (ok) {
+		*out = g_value_get_double(&d);
+	}
+	g_value_unset(&d);
+
+	return ok;
+}
+
+static gboolean
+stats_field_cb(GQuark field_id, const GValue *value, gpointer user_data)
+{
+	struct rtp_stats *rtp = user_data;
+	GstWebRTCStatsType type;
+
+	if (!GST_VALUE_HOLDS_STRUCTURE(value)) {
+		return TRUE;
+	}
+
+	const GstStructure *s = gst_value_get_structure(value);
+	if (!gst_structure_get(s, "type", GST_TYPE_WEBRTC_STATS_TYPE, &type, NULL)) {
+		return TRUE;
+	}
+
+	switch (type) {
+	case GST_WEBRTC_STATS_OUTBOUND_RTP:
+		rtp->have_outbound = stats_get_number(s, "bytes-sent", &rtp->bytes_sent);
+		stats_get_number(s, "packets-sent", &rtp->packets_sent);
+		break;
+	case GST_WEBRTC_STATS_REMOTE_INBOUND_RTP:
+		rtp->have_remote_inbound = true;
+		stats_get_number(s, "packets-lost", &rtp->packets_lost);
+		stats_get_number(s, "fraction-lost", &rtp->fraction_lost);
+		stats_get_number(s, "round-trip-time", &rtp->round_trip_time_s);
+		break;
+	default: break;
+	}
+
+	return TRUE;
+}
+
+static void
+on_stats(GstPromise *promise, gpointer user_data)
+{
+	GstElement *webrtcbin = user_data;
+	struct ems_webrtc_peer *peer = g_object_get_data(G_OBJECT(webrtcbin), "peer");
+	const GstStructure *reply = gst_promise_get_reply(promise);
+	struct rtp_stats rtp = {0};
+
+	if (peer == NULL || reply == NULL) {
+		gst_promise_unref(promise);
+		return;
+	}
+
+	gst_structure_foreach(reply, stats_field_cb, &rtp);
+	gst_promise_unref(promise);
+
+	uint64_t now_ns = os_monotonic_get_ns();
+
+	os_mutex_lock(&peer->lock);
+	if (rtp.have_outbound) {
+		peer->stats.rtp_bytes_sent = (uint64_t)rtp.bytes_sent;
+		peer->stats.rtp_packets_sent = (uint64_t)rtp.packets_sent;
+	}
+	if (rtp.have_remote_inbound) {
+		peer->stats.packets_lost = rtp.packets_lost;
+		peer->stats.fraction_lost = rtp.fraction_lost;
+		peer->stats.round_trip_time_s = rtp.round_trip_time_s;
+	}
+
+	if (peer->stats.last_refresh_ns != 0) {
+		double seconds = time_ns_to_s((time_duration_ns)(now_ns - peer->stats.last_refresh_ns));
+		if (seconds > 0) {
+			uint64_t bytes = peer->stats.rtp_bytes_sent - peer->stats.last_rtp_bytes_sent;
+			uint64_t frames = peer->stats.frames_reported - peer->stats.last_frames_reported;
+			peer->stats.bitrate_kbps = (float)((double)bytes * 8.0 / 1000.0 / seconds);
+			peer->stats.fps = (float)((double)frames / seconds);
+		}
+	}
+	peer->stats.last_refresh_ns = now_ns;
+	peer->stats.last_rtp_bytes_sent = peer->stats.rtp_bytes_sent;
+	peer->stats.last_frames_reported = peer->stats.frames_reported;
+	os_mutex_unlock(&peer->lock);
+}
+
+static gboolean
+refresh_stats_cb(gpointer user_data)
+{
+	struct ems_gstreamer_pipeline *egp = user_data;
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init(&iter, egp->peers.by_client);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct ems_webrtc_peer *peer = value;
+
+		// The reply comes on a webrtcbin thread, keep the bin, and so the peer, alive until then.
+		GstPromise *promise = gst_promise_new_with_change_func(on_stats, gst_object_ref(peer->webrtcbin),
+		                                                       (GDestroyNotify)gst_object_unref);
+		g_signal_emit_by_name(peer->webrtcbin, "get-stats", NULL, promise);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+write_pipeline_metrics(GString *out, struct ems_gstreamer_pipeline *egp)
+{
+	os_mutex_lock(&egp->encode.lock);
+	uint32_t linked = egp->encode.linked_peers;
+	uint32_t keyframes = egp->encode.keyframes_requested;
+	os_mutex_unlock(&egp->encode.lock);
+
+	ems_metrics_describe(out, "ems_clients_linked", "gauge", "Clients receiving video.");
+	ems_metrics_value(out, "ems_clients_linked", NULL, linked);
+	ems_metrics_describe(out, "ems_keyframes_requested_total", "counter", "IDR frames forced for new clients.");
+	ems_metrics_counter(out, "ems_keyframes_requested_total", NULL, keyframes);
+
+	os_mutex_lock(&egp->metrics.lock);
+	ems_metrics_describe(out, "ems_frames_encoded_total", "counter", "Frames out of the encoder.");
+	ems_metrics_counter(out, "ems_frames_encoded_total", NULL, egp->metrics.frames_encoded);
+	ems_metrics_describe(out, "ems_encoded_bytes_total", "counter", "Bytes out of the encoder.");
+	ems_metrics_counter(out, "ems_encoded_bytes_total", NULL, egp->metrics.bytes_encoded);
+	ems_metrics_describe(out, "ems_stage_latency_ms", "summary", "Time a frame spends in each pipeline stage.");
+	for (uint32_t i = 0; i < ARRAY_SIZE(stage_names); i++) {
+		gchar *labels = g_strdup_printf("stage=\"%s\"", stage_names[i]);
+		ems_metrics_summary(out, "ems_stage_latency_ms", labels, &egp->metrics.stages[i].window);
+		g_free(labels);
+	}
+	os_mutex_unlock(&egp->metrics.lock);
+
+	// Scrapes all come from the signaling server's thread, so this is the only one draining. The quantiles cover
+	// the frames since the last scrape.
+	struct em_latency_histogram recent;
+	ems_metrics_describe(out, "ems_frame_hop_latency_ms", "summary",
+	                     "Time between consecutive points of a frame's life, for frames the client reported on.");
+	for (uint32_t i = 0; i < ARRAY_SIZE(hop_names); i++) {
+		em_latency_histogram_reset(&recent);
+		em_latency_histogram_drain(&egp->metrics.hops[i], &recent);
+		em_latency_histogram_merge(&egp->metrics.hops_total[i], &recent);
+
+		gchar *labels = g_strdup_printf("hop=\"%s\"", hop_names[i]);
+		ems_metrics_histogram_summary(out, "ems_frame_hop_latency_ms", labels, &recent,
+		                              &egp->metrics.hops_total[i]);
+		g_free(labels);
+	}
+
+	em_latency_histogram_reset(&recent);
+	em_latency_histogram_drain(&egp->metrics.motion_to_photon, &recent);
+	em_latency_histogram_merge(&egp->metrics.motion_to_photon_total, &recent);
+	ems_metrics_describe(out, "ems_motion_to_photon_ms", "summary",
+	                     "From the client sampling a pose to it displaying the frame rendered with it.");
+	ems_metrics_histogram_summary(out, "ems_motion_to_photon_ms", NULL, &recent, &egp->metrics.motion_to_photon_total);
+
+	struct ems_frame_ledger_stats frames;
+	ems_frame_ledger_get_stats(egp->frames.ledger, &frames);
+	ems_metrics_describe(out, "ems_frame_reports_total", "counter", "Client frame reports by outcome.");
+	ems_metrics_counter(out, "ems_frame_reports_total", "result=\"joined\"", frames.joined);
+	ems_metrics_counter(out, "ems_frame_reports_total", "result=\"unmatched\"", frames.unmatched);
+	ems_metrics_describe(out, "ems_frames_unreported_total", "counter",
+	                     "Frames dropped from the ledger without a client report.");
+	ems_metrics_counter(out, "ems_frames_unreported_total", NULL, frames.evicted);
+
+	os_mutex_lock(&egp->tracking.lock);
+	ems_metrics_describe(out, "ems_tracking_messages_total", "counter", "Tracking messages by outcome.");
+	ems_metrics_counter(out, "ems_tracking_messages_total", "result=\"received\"", egp->tracking.received);
+	ems_metrics_counter(out, "ems_tracking_messages_total", "result=\"stale\"", egp->tracking.stale_dropped);
+	ems_metrics_counter(out, "ems_tracking_messages_total", "result=\"undecodable\"", egp->tracking.undecodable);
+	ems_metrics_describe(out, "ems_tracking_keyframes_requested_total", "counter",
+	                     "Compact tracking keyframes asked for again after one was lost.");
+	ems_metrics_counter(out, "ems_tracking_keyframes_requested_total", NULL, egp->tracking.keyframes_requested);
+	ems_metrics_describe(out, "ems_tracking_gap_max_ms", "gauge",
+	                     "Longest time between two accepted tracking messages so far.");
+	ems_metrics_value(out, "ems_tracking_gap_max_ms", NULL, egp->tracking.max_gap_ms);
+	os_mutex_unlock(&egp->tracking.lock);
+
+	em_latency_histogram_reset(&recent);
+	em_latency_histogram_drain(&egp->tracking.gap, &recent);
+	em_latency_histogram_merge(&egp->tracking.gap_total, &recent);
+	ems_metrics_describe(out, "ems_tracking_gap_ms", "summary",
+	                     "How old the newest applied pose got before the next one replaced it.");
+	ems_metrics_histogram_summary(out, "ems_tracking_gap_ms", NULL, &recent, &egp->tracking.gap_total);
+
+	struct ems_clock_sync_stats clock;
+	ems_clock_sync_get_stats(egp->clock.sync, &clock);
+	ems_metrics_describe(out, "ems_clock_sync_valid", "gauge", "Whether the client clock offset is known.");
+	ems_metrics_value(out, "ems_clock_sync_valid", NULL, clock.valid ? 1 : 0);
+	ems_metrics_describe(out, "ems_clock_offset_ms", "gauge", "Client clock minus server clock.");
+	ems_metrics_value(out, "ems_clock_offset_ms", NULL, time_ns_to_ms_f(clock.offset_ns));
+	ems_metrics_describe(out, "ems_clock_drift_ppm", "gauge", "Client clock rate relative to the server clock.");
+	ems_metrics_value(out, "ems_clock_drift_ppm", NULL, clock.drift_ppm);
+	ems_metrics_describe(out, "ems_clock_sync_rtt_ms", "gauge", "Round trip of the newest clock sync exchange.");
+	ems_metrics_value(out, "ems_clock_sync_rtt_ms", NULL, time_ns_to_ms_f(clock.rtt_ns));
+	ems_metrics_describe(out, "ems_clock_sync_exchanges_total", "counter", "Clock sync exchanges by outcome.");
+	ems_metrics_counter(out, "ems_clock_sync_exchanges_total", "result=\"accepted\"", clock.accepted);
+	ems_metrics_counter(out, "ems_clock_sync_exchanges_total", "result=\"rejected\"", clock.rejected);
+}
+
+static void
+write_client_fps(GString *out, const char *name, const char *labels, const struct ems_webrtc_peer *peer)
+{
+	ems_metrics_value(out, name, labels, peer->stats.fps);
+}
+
+static void
+write_client_bitrate(GString *out, const char *name, const char *labels, const struct ems_webrtc_peer *peer)
+{
+	ems_metrics_value(out, name, labels, peer->stats.bitrate_kbps);
+}
+
+static void
+write_client_rtt(GString *out, const char *name, const char *labels, const struct ems_webrtc_peer *peer)
+{
+	ems_metrics_value(out, name, labels, peer->stats.round_trip_time_s);
+}
+
+static void
+write_client_packets_lost(GString *out, const char *name, const char *labels, const struct ems_webrtc_peer *peer)
+{
+	ems_metrics_value(out, name, labels, peer->stats.packets_lost);
+}
+
+static void
+write_client_fraction_lost(GString *out, const char *name, const char *labels, const struct ems_webrtc_peer *peer)
+{
+	ems_metrics_value(out, name, labels, peer->stats.fraction_lost);
+}
+
+static void
+write_client_rtp_packets_sent(GString *out, const char *name, const char *labels, const struct ems_webrtc_peer *peer)
+{
+	ems_metrics_counter(out, name, labels, peer->stats.rtp_packets_sent);
+}
+
+//! One sample per data channel, of @p per_channel indexed like ems_webrtc_peer::stats::messages.
+static void
+write_client_per_channel(GString *out, const char *name, const char *labels, const uint64_t per_channel[2])
+{
+	for (int channel = 0; channel < 2; channel++) {
+		const char *label = channel == 0 ? DATA_CHANNEL_LABEL : TRACKING_CHANNEL_LABEL;
+		gchar *channel_labels = g_strdup_printf("%s,channel=\"%s\"", labels, label);
+		ems_metrics_counter(out, name, channel_labels, per_channel[channel]);
+		g_free(channel_labels);
+	}
+}
+
+static void
+write_client_messages(GString *out, const char *name, const char *labels, const struct ems_webrtc_peer *peer)
+{
+	write_client_per_channel(out, name, labels, peer->stats.messages);
+}
+
+static void
+write_client_bytes(GString *out, const char *name, const char *labels, const struct ems_webrtc_peer *peer)
+{
+	write_client_per_channel(out, name, labels, peer->stats.bytes);
+}
+
+static void
+write_client_decode_to_display(GString *out, const char *name, const char *labels, const struct ems_webrtc_peer *peer)
+{
+	ems_metrics_summary(out, name, labels, &peer->stats.decode_to_display);
+}
+
+struct client_metric
+{
+	const char *name;
+	const char *type;
+	const char *help;
+	//! Called with the peer's lock held, @p labels names the client.
+	void (*write)(GString *out, const char *name, const char *labels, const struct ems_webrtc_peer *peer);
+};
+
+static const struct client_metric client_metrics[] = {
+    {"ems_client_fps", "gauge", "Frames the client reported decoding per second.", write_client_fps},
+    {"ems_client_bitrate_kbps", "gauge", "RTP bitrate sent to the client.", write_client_bitrate},
+    {"ems_client_rtt_seconds", "gauge", "Round trip time from RTCP receiver reports.", write_client_rtt},
+    {"ems_client_packets_lost", "gauge", "Cumulative RTP packets lost, as reported by the client.",
+     write_client_packets_lost},
+    {"ems_client_fraction_lost", "gauge", "Fraction of RTP packets lost in the last report interval.",
+     write_client_fraction_lost},
+    {"ems_client_rtp_packets_sent_total", "counter", "RTP packets sent to the client.", write_client_rtp_packets_sent},
+    {"ems_client_datachannel_messages_total", "counter", "Data channel messages received from the client.",
+     write_client_messages},
+    {"ems_client_datachannel_bytes_total", "counter", "Data channel bytes received from the client.",
+     write_client_bytes},
+    {"ems_client_decode_to_display_ms", "summary", "Client decode complete to display time.",
+     write_client_decode_to_display},
+};
+
+static void
+write_client_metric(GString *out, const struct client_metric *metric, struct ems_webrtc_peer *peer)
+{
+	// Numbered in the order the clients connected, heap addresses don't belong in a scrape.
+	gchar *labels = g_strdup_printf("client=\"%u\"", peer->client_number);
+	metric->write(out, metric->name, labels, peer);
+	g_free(labels);
+}
+
+//! Runs on the loop thread, like everything else that touches peers.by_client.
+static gchar *
+metrics_text_cb(gpointer user_data)
+{
+	struct ems_gstreamer_pipeline *egp = user_data;
+	GString *out = g_string_new(NULL);
+
+	write_pipeline_metrics(out, egp);
+
+	// Grouped by metric, Prometheus wants all samples of one metric together.
+	for (uint32_t metric = 0; metric < ARRAY_SIZE(client_metrics); metric++) {
+		ems_metrics_describe(out, client_metrics[metric].name, client_metrics[metric].type,
+		                     client_metrics[metric].help);
+
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, egp->peers.by_client);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			struct ems_webrtc_peer *peer = value;
+
+			os_mutex_lock(&peer->lock);
+			write_client_metric(out, &client_metrics[metric], peer);
+			os_mutex_unlock(&peer->lock);
+		}
+	}
+
+	for (uint32_t i = 0; i < egp->metrics.provider_count; i++) {
+		egp->metrics.providers[i].func(out, egp->metrics.providers[i].user_data);
+	}
+
+	return g_string_free(out, FALSE);
+}
+
+
 /*
  *
  * Internal pipeline functions.
@@ -508,21 +2011,44 @@ static void
 destroy(struct xrt_frame_node *node)
 {
 	struct gstreamer_pipeline *gp = container_of(node, struct gstreamer_pipeline, node);
+	struct ems_gstreamer_pipeline *egp = (struct ems_gstreamer_pipeline *)gp;
 
 	/*
 	 * All of the nodes has been broken apart and none of our functions will
 	 * be called, it's now safe to destroy and free ourselves.
 	 */
 
+	if (egp->loop_thread != NULL) {
+		g_main_loop_quit(egp->loop);
+		g_thread_join(egp->loop_thread);
+	}
+
+	g_clear_object(&egp->signaling_server);
+	g_clear_pointer(&egp->loop, g_main_loop_unref);
+
+	u_var_remove_root(egp);
+	os_mutex_destroy(&egp->tracking.lock);
+	os_mutex_destroy(&egp->clock.lock);
+	os_mutex_destroy(&egp->encode.lock);
+	remove_source(egp, &egp->peers.refill_src_id);
+	remove_source(egp, &egp->metrics.stats_src_id);
+	os_mutex_destroy(&egp->metrics.lock);
+	g_queue_clear(&egp->peers.idle);
+	g_clear_pointer(&egp->peers.by_client, g_hash_table_destroy);
+	g_clear_pointer(&egp->context, g_main_context_unref);
+
 	free(gp);
 }
 
-GMainLoop *main_loop;
-
-void *
-loop_thread(void *data)
+static gpointer
+loop_thread(gpointer data)
 {
-	g_main_loop_run(main_loop);
+	struct ems_gstreamer_pipeline *egp = data;
+
+	g_main_context_push_thread_default(egp->context);
+	g_main_loop_run(egp->loop);
+	g_main_context_pop_thread_default(egp->context);
+
 	return NULL;
 }
 
@@ -539,17 +2065,19 @@ ems_gstreamer_pipeline_play(struct gstreamer_pipeline *gp)
 	U_LOG_I("Starting pipeline");
 	struct ems_gstreamer_pipeline *egp = (struct ems_gstreamer_pipeline *)gp;
 
-	main_loop = g_main_loop_new(NULL, FALSE);
-
-
 	GstStateChangeReturn ret = gst_element_set_state(egp->base.pipeline, GST_STATE_PLAYING);
 
 	g_assert(ret != GST_STATE_CHANGE_FAILURE);
 
-	g_signal_connect(signaling_server, "ws-client-connected", G_CALLBACK(webrtc_client_connected_cb), egp);
+	// Get some peers negotiating before anybody shows up, as soon as the loop runs.
+	schedule_refill(egp);
 
-	pthread_t thread;
-	pthread_create(&thread, NULL, loop_thread, NULL);
+	egp->metrics.stats_src_id =
+	    attach_source(egp, g_timeout_source_new(STATS_INTERVAL_MS), refresh_stats_cb, egp);
+
+	g_signal_connect(egp->signaling_server, "ws-client-connected", G_CALLBACK(webrtc_client_connected_cb), egp);
+
+	egp->loop_thread = g_thread_new("ems_pipeline_loop", loop_thread, egp);
 }
 
 void
@@ -577,10 +2105,40 @@ ems_gstreamer_pipeline_stop(struct gstreamer_pipeline *gp)
 
 
 
+void
+ems_gstreamer_pipeline_add_metrics(struct gstreamer_pipeline *gp, ems_metrics_func func, void *user_data)
+{
+	struct ems_gstreamer_pipeline *egp = (struct ems_gstreamer_pipeline *)gp;
+
+	if (egp->metrics.provider_count >= MAX_METRICS_PROVIDERS) {
+		U_LOG_E("Too many metrics providers, increase MAX_METRICS_PROVIDERS");
+		return;
+	}
+
+	egp->metrics.providers[egp->metrics.provider_count].func = func;
+	egp->metrics.providers[egp->metrics.provider_count].user_data = user_data;
+	egp->metrics.provider_count++;
+}
+
+bool
+ems_gstreamer_pipeline_has_clients(struct gstreamer_pipeline *gp)
+{
+	struct ems_gstreamer_pipeline *egp = (struct ems_gstreamer_pipeline *)gp;
+
+	os_mutex_lock(&egp->encode.lock);
+	bool has_clients = egp->encode.linked_peers > 0;
+	os_mutex_unlock(&egp->encode.lock);
+
+	return has_clients;
+}
+
 void
 ems_gstreamer_pipeline_create(struct xrt_frame_context *xfctx,
                               const char *appsrc_name,
+                              uint16_t signaling_port,
                               struct ems_callbacks *callbacks_collection,
+                              struct ems_clock_sync *clock_sync,
+                              struct ems_frame_ledger *frame_ledger,
                               struct gstreamer_pipeline **out_gp)
 {
 	gchar *pipeline_str;
@@ -588,23 +2146,21 @@ ems_gstreamer_pipeline_create(struct xrt_frame_context *xfctx,
 	GError *error = NULL;
 	GstBus *bus;
 
-
-	signaling_server = ems_signaling_server_new();
-
 	pipeline_str = g_strdup_printf(
-	    "appsrc name=%s ! "                //
-	    "queue ! "                         //
-	    "videoconvert ! "                  //
-	    "video/x-raw,format=NV12 ! "       //
-	    "queue !"                          //
-	    "x264enc tune=zerolatency ! "      //
-	    "video/x-h264,profile=baseline ! " //
-	    "queue !"                          //
-	    "h264parse ! "                     //
-	    "rtph264pay config-interval=1 ! "  //
-	    "application/x-rtp,payload=96 ! "  //
+	    "appsrc name=%s ! "                      //
+	    "valve name=%s drop=true ! "             //
+	    "queue ! "                               //
+	    "videoconvert ! "                        //
+	    "video/x-raw,format=NV12 ! "             //
+	    "queue !"                                //
+	    "x264enc name=%s tune=zerolatency ! "    //
+	    "video/x-h264,profile=baseline ! "       //
+	    "queue !"                                //
+	    "h264parse ! "                           //
+	    "rtph264pay name=%s config-interval=1 ! " //
+	    "application/x-rtp,payload=96 ! "         //
 	    "tee name=%s allow-not-linked=true",
-	    appsrc_name, WEBRTC_TEE_NAME);
+	    appsrc_name, ENCODE_VALVE_NAME, ENCODER_NAME, PAYLOADER_NAME, WEBRTC_TEE_NAME);
 
 	// no webrtc bin yet until later!
 
@@ -615,6 +2171,35 @@ ems_gstreamer_pipeline_create(struct xrt_frame_context *xfctx,
 	egp->base.node.destroy = destroy;
 	egp->base.xfctx = xfctx;
 	egp->callbacks = callbacks_collection;
+	egp->clock.sync = clock_sync;
+	egp->frames.ledger = frame_ledger;
+	egp->frames.last_stamped_pts = GST_CLOCK_TIME_NONE;
+	egp->context = g_main_context_new();
+	egp->loop = g_main_loop_new(egp->context, FALSE);
+	os_mutex_init(&egp->tracking.lock);
+	os_mutex_init(&egp->clock.lock);
+	os_mutex_init(&egp->encode.lock);
+	os_mutex_init(&egp->metrics.lock);
+	g_queue_init(&egp->peers.idle);
+	egp->peers.by_client = g_hash_table_new(g_direct_hash, g_direct_equal);
+	egp->peers.pool_size = (uint32_t)debug_get_num_option_webrtcbin_pool_size();
+
+	u_var_add_root(egp, "Electric Maple Server pipeline", false);
+	u_var_add_gui_header(egp, NULL, "Tracking");
+	u_var_add_ro_u64(egp, &egp->tracking.received, "Received");
+	u_var_add_ro_u64(egp, &egp->tracking.stale_dropped, "Dropped, stale");
+	u_var_add_ro_u64(egp, &egp->tracking.undecodable, "Dropped, undecodable");
+	u_var_add_ro_u64(egp, &egp->tracking.keyframes_requested, "Keyframes requested");
+	u_var_add_ro_f32(egp, &egp->tracking.gap_ms, "Gap (ms)");
+	u_var_add_ro_f32(egp, &egp->tracking.max_gap_ms, "Max gap (ms)");
+	u_var_add_gui_header(egp, NULL, "Frames");
+	u_var_add_ro_f32(egp, &egp->metrics.motion_to_photon_ms, "Motion to photon (ms)");
+	u_var_add_gui_header(egp, NULL, "Connections");
+	u_var_add_ro_u32(egp, &egp->peers.pool_size, "Pool size");
+	u_var_add_ro_u32(egp, &egp->peers.created, "Webrtcbins created");
+	u_var_add_ro_u32(egp, &egp->encode.linked_peers, "Linked clients");
+	u_var_add_ro_u32(egp, &egp->encode.keyframes_requested, "Keyframes requested");
+	u_var_add_ro_f32(egp, &egp->peers.connect_to_first_frame_ms, "Connect to first frame (ms)");
 
 
 	gst_init(NULL, NULL);
@@ -623,20 +2208,46 @@ ems_gstreamer_pipeline_create(struct xrt_frame_context *xfctx,
 	g_assert_no_error(error);
 	g_free(pipeline_str);
 
+	add_probe(pipeline, ENCODE_VALVE_NAME, "src", GST_PAD_PROBE_TYPE_BUFFER, valve_src_probe_cb, egp);
+	add_probe(pipeline, ENCODER_NAME, "sink", GST_PAD_PROBE_TYPE_BUFFER, encoder_sink_probe_cb, egp);
+	add_probe(pipeline, ENCODER_NAME, "src", GST_PAD_PROBE_TYPE_BUFFER, encoder_src_probe_cb, egp);
+	add_probe(pipeline, PAYLOADER_NAME, "src", GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+	          payloader_src_probe_cb, egp);
+
 	bus = gst_element_get_bus(pipeline);
-	gst_bus_add_watch(bus, gst_bus_cb, egp);
+	attach_source(egp, gst_bus_create_watch(bus), G_SOURCE_FUNC(gst_bus_cb), egp);
 	gst_object_unref(bus);
 
-	g_signal_connect(signaling_server, "ws-client-disconnected", G_CALLBACK(webrtc_client_disconnected_cb), egp);
-	g_signal_connect(signaling_server, "sdp-answer", G_CALLBACK(webrtc_sdp_answer_cb), egp);
-	g_signal_connect(signaling_server, "candidate", G_CALLBACK(webrtc_candidate_cb), egp);
+	// Soup attaches the listening socket, and so every websocket, to the thread default context.
+	g_main_context_push_thread_default(egp->context);
+	egp->signaling_server = ems_signaling_server_new(signaling_port);
+	// Who is connected and how well the machine keeps up, nothing for the network to see, so loopback only.
+	bool metrics_served = ems_signaling_server_add_local_text_handler(
+	    egp->signaling_server, "/metrics", "text/plain; version=0.0.4", metrics_text_cb, egp);
+#ifdef EMS_HEADLESS
+	// The variables are in the debug GUI otherwise. They say a lot about the machine, so loopback only.
+	bool vars_served = ems_signaling_server_add_local_text_handler(
+	    egp->signaling_server, "/vars", "text/plain; charset=utf-8", ems_var_dump_text, NULL);
+#endif
+	g_main_context_pop_thread_default(egp->context);
 
-	// loop = g_main_loop_new (NULL, FALSE);
-	// g_unix_signal_add (SIGINT, sigint_handler, loop);
+	g_signal_connect(egp->signaling_server, "ws-client-disconnected", G_CALLBACK(webrtc_client_disconnected_cb),
+	                 egp);
+	g_signal_connect(egp->signaling_server, "sdp-answer", G_CALLBACK(webrtc_sdp_answer_cb), egp);
+	g_signal_connect(egp->signaling_server, "candidate", G_CALLBACK(webrtc_candidate_cb), egp);
 
 	g_print(
 	    "Output streams:\n"
-	    "\tWebRTC: http://127.0.0.1:8080\n");
+	    "\tWebRTC: http://127.0.0.1:%u\n",
+	    signaling_port);
+	if (metrics_served) {
+		g_print("\tMetrics: http://127.0.0.1:%u/metrics\n", signaling_port + EMS_SIGNALING_SERVER_LOCAL_PORT_OFFSET);
+	}
+#ifdef EMS_HEADLESS
+	if (vars_served) {
+		g_print("\tVariables: http://127.0.0.1:%u/vars\n", signaling_port + EMS_SIGNALING_SERVER_LOCAL_PORT_OFFSET);
+	}
+#endif
 
 	// Setup pipeline.
 	egp->base.pipeline = pipeline;
@@ -13,6 +13,8 @@
 
 #include "gstreamer/gst_pipeline.h"
 
+#include "ems_metrics.h"
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,6 +22,8 @@ extern "C" {
 struct gstreamer_pipeline;
 
 struct ems_callbacks;
+struct ems_clock_sync;
+struct ems_frame_ledger;
 
 void
 ems_gstreamer_pipeline_play(struct gstreamer_pipeline *gp);
@@ -27,10 +31,26 @@ ems_gstreamer_pipeline_play(struct gstreamer_pipeline *gp);
 void
 ems_gstreamer_pipeline_stop(struct gstreamer_pipeline *gp);
 
+/*!
+ * Have @p func add its own metrics to every scrape of /metrics, must be called before play.
+ */
+void
+ems_gstreamer_pipeline_add_metrics(struct gstreamer_pipeline *gp, ems_metrics_func func, void *user_data);
+
+/*!
+ * Whether any client is linked to the encoder, when this is false the frames pushed to the pipeline are dropped
+ * before they get converted and encoded, so there is no point in reading them back either.
+ */
+bool
+ems_gstreamer_pipeline_has_clients(struct gstreamer_pipeline *gp);
+
 void
 ems_gstreamer_pipeline_create(struct xrt_frame_context *xfctx,
                               const char *appsrc_name,
+                              uint16_t signaling_port,
                               struct ems_callbacks *callbacks_collection,
+                              struct ems_clock_sync *clock_sync,
+                              struct ems_frame_ledger *frame_ledger,
                               struct gstreamer_pipeline **out_gp);
 
 #ifdef __cplusplus
@@ -0,0 +1,133 @@
+// Copyright 2023, Pluto VR, Inc.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Helpers for serving metrics in the Prometheus text format
+ * @ingroup aux_util
+ */
+
+#include "ems_metrics.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static int
+compare_float(const void *a, const void *b)
+{
+	float x = *(const float *)a;
+	float y = *(const float *)b;
+	return (x > y) - (x < y);
+}
+
+void
+ems_latency_window_add(struct ems_latency_window *window, float ms)
+{
+	window->samples_ms[window->next] = ms;
+	window->next = (window->next + 1) % EMS_LATENCY_WINDOW_SIZE;
+	if (window->filled < EMS_LATENCY_WINDOW_SIZE) {
+		window->filled++;
+	}
+
+	window->count++;
+	window->sum_ms += ms;
+}
+
+bool
+ems_latency_window_quantiles(const struct ems_latency_window *window,
+                             const double *quantiles,
+                             uint32_t quantile_count,
+                             float *out_ms)
+{
+	if (window->filled == 0) {
+		return false;
+	}
+
+	// Small enough to sort a copy on every scrape.
+	float sorted[EMS_LATENCY_WINDOW_SIZE];
+	memcpy(sorted, window->samples_ms, window->filled * sizeof(float));
+	qsort(sorted, window->filled, sizeof(float), compare_float);
+
+	for (uint32_t i = 0; i < quantile_count; i++) {
+		uint32_t index = (uint32_t)(quantiles[i] * (double)(window->filled - 1) + 0.5);
+		out_ms[i] = sorted[index];
+	}
+
+	return true;
+}
+
+void
+ems_metrics_describe(GString *out, const char *name, const char *type, const char *help)
+{
+	g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void
+ems_metrics_value(GString *out, const char *name, const char *labels, double value)
+{
+	if (labels != NULL) {
+		g_string_append_printf(out, "%s{%s} %g\n", name, labels, value);
+	} else {
+		g_string_append_printf(out, "%s %g\n", name, value);
+	}
+}
+
+void
+ems_metrics_counter(GString *out, const char *name, const char *labels, uint64_t value)
+{
+	if (labels != NULL) {
+		g_string_append_printf(out, "%s{%s} %" PRIu64 "\n", name, labels, value);
+	} else {
+		g_string_append_printf(out, "%s %" PRIu64 "\n", name, value);
+	}
+}
+
+void
+ems_metrics_summary(GString *out, const char *name, const char *labels, const struct ems_latency_window *window)
+{
+	static const double quantiles[] = {0.5, 0.9, 0.99};
+	float values[G_N_ELEMENTS(quantiles)];
+	const char *prefix = labels != NULL ? labels : "";
+	const char *sep = labels != NULL ? "," : "";
+
+	if (ems_latency_window_quantiles(window, quantiles, G_N_ELEMENTS(quantiles), values)) {
+		for (guint i = 0; i < G_N_ELEMENTS(quantiles); i++) {
+			g_string_append_printf(out, "%s{%s%squantile=\"%g\"} %g\n", name, prefix, sep, quantiles[i],
+			                       (double)values[i]);
+		}
+	}
+
+	gchar *count_name = g_strdup_printf("%s_count", name);
+	gchar *sum_name = g_strdup_printf("%s_sum", name);
+	ems_metrics_counter(out, count_name, labels, window->count);
+	ems_metrics_value(out, sum_name, labels, window->sum_ms);
+	g_free(count_name);
+	g_free(sum_name);
+}
+
+void
+ems_metrics_histogram_summary(GString *out,
+                              const char *name,
+                              const char *labels,
+                              const struct em_latency_histogram *recent,
+                              const struct em_latency_histogram *total)
+{
+	static const double quantiles[] = {0.5, 0.9, 0.99};
+	const char *prefix = labels != NULL ? labels : "";
+	const char *sep = labels != NULL ? "," : "";
+
+	if (recent->total > 0) {
+		for (guint i = 0; i < G_N_ELEMENTS(quantiles); i++) {
+			double ms = (double)em_latency_histogram_quantile_us(recent, quantiles[i]) / 1000.0;
+			g_string_append_printf(out, "%s{%s%squantile=\"%g\"} %g\n", name, prefix, sep, quantiles[i], ms);
+		}
+	}
+
+	gchar *count_name = g_strdup_printf("%s_count", name);
+	gchar *sum_name = g_strdup_printf("%s_sum", name);
+	ems_metrics_counter(out, count_name, labels, total->total);
+	ems_metrics_value(out, sum_name, labels, (double)total->sum_us / 1000.0);
+	g_free(count_name);
+	g_free(sum_name);
+}
@@ -0,0 +1,96 @@
+// Copyright 2023, Pluto VR, Inc.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Helpers for serving metrics in the Prometheus text format
+ * @ingroup aux_util
+ */
+
+#pragma once
+
+#include "em_latency_histogram.h"
+
+#include <glib.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! How many recent samples a latency window keeps for its percentiles.
+#define EMS_LATENCY_WINDOW_SIZE 256
+
+/*!
+ * The most recent latency samples of one stage, percentiles are computed over these when scraped.
+ *
+ * Not thread safe, guard it with whatever lock the samples are produced under.
+ */
+struct ems_latency_window
+{
+	float samples_ms[EMS_LATENCY_WINDOW_SIZE];
+	uint32_t next;
+	uint32_t filled;
+
+	//! Over all samples ever added, for the summary's _count and _sum.
+	uint64_t count;
+	double sum_ms;
+};
+
+void
+ems_latency_window_add(struct ems_latency_window *window, float ms);
+
+/*!
+ * Percentiles @p quantiles (0 to 1) of the samples in @p window, written to @p out_ms.
+ *
+ * Returns false if the window is empty.
+ */
+bool
+ems_latency_window_quantiles(const struct ems_latency_window *window,
+                             const double *quantiles,
+                             uint32_t quantile_count,
+                             float *out_ms);
+
+/*!
+ * Appends metrics to a scrape, called on the signaling server's thread.
+ */
+typedef void (*ems_metrics_func)(GString *out, void *user_data);
+
+//! Write the HELP and TYPE lines that go once before a metric's samples.
+void
+ems_metrics_describe(GString *out, const char *name, const char *type, const char *help);
+
+//! One sample, @p labels is the inside of the braces or NULL.
+void
+ems_metrics_value(GString *out, const char *name, const char *labels, double value);
+
+//! A sample of an integer counter, without going through double.
+void
+ems_metrics_counter(GString *out, const char *name, const char *labels, uint64_t value);
+
+/*!
+ * All samples of a summary: the 0.5, 0.9 and 0.99 quantiles plus _count and _sum.
+ *
+ * Call ems_metrics_describe() with type "summary" first.
+ */
+void
+ems_metrics_summary(GString *out, const char *name, const char *labels, const struct ems_latency_window *window);
+
+/*!
+ * All samples of a summary kept in latency histograms: the 0.5, 0.9 and 0.99 quantiles of @p recent, plus _count and
+ * _sum of @p total, in milliseconds. Both are snapshots, usually what was drained since the last scrape and
+ * everything so far.
+ *
+ * Call ems_metrics_describe() with type "summary" first.
+ */
+void
+ems_metrics_histogram_summary(GString *out,
+                              const char *name,
+                              const char *labels,
+                              const struct em_latency_histogram *recent,
+                              const struct em_latency_histogram *total);
+
+#ifdef __cplusplus
+}
+#endif
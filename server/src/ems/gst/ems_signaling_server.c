@@ -27,11 +27,17 @@
 
 #include "util/u_logging.h"
 
+#include <string.h>
+
 struct _EmsSignalingServer
 {
 	GObject parent;
 
 	SoupServer *soup_server;
+	guint port;
+
+	//! Listens on loopback only, on port + EMS_SIGNALING_SERVER_LOCAL_PORT_OFFSET. NULL until the first local handler.
+	SoupServer *local_server;
 
 	GSList *websocket_connections;
 };
@@ -49,10 +55,19 @@ enum
 
 static guint signals[N_SIGNALS];
 
+enum
+{
+	PROP_0,
+	PROP_PORT,
+	N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES];
+
 EmsSignalingServer *
-ems_signaling_server_new()
+ems_signaling_server_new(guint port)
 {
-	return EMS_SIGNALING_SERVER(g_object_new(EMS_TYPE_SIGNALING_SERVER, NULL));
+	return EMS_SIGNALING_SERVER(g_object_new(EMS_TYPE_SIGNALING_SERVER, "port", port, NULL));
 }
 
 #if !SOUP_CHECK_VERSION(3, 0, 0)
@@ -84,6 +99,110 @@ http_cb(SoupServer *server,     //
 }
 #endif
 
+struct text_handler
+{
+	gchar *content_type;
+	EmsTextHandlerFunc func;
+	gpointer user_data;
+};
+
+static void
+text_handler_free(gpointer data)
+{
+	struct text_handler *handler = data;
+
+	g_free(handler->content_type);
+	g_free(handler);
+}
+
+#if !SOUP_CHECK_VERSION(3, 0, 0)
+static void
+text_cb(SoupServer *server,
+        SoupMessage *msg,
+        const char *path,
+        GHashTable *query,
+        SoupClientContext *client,
+        gpointer user_data)
+{
+	struct text_handler *handler = user_data;
+
+	if (msg->method != SOUP_METHOD_GET) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	gchar *text = handler->func(handler->user_data);
+	soup_message_set_response(msg, handler->content_type, SOUP_MEMORY_TAKE, text, strlen(text));
+	soup_message_set_status(msg, SOUP_STATUS_OK);
+}
+#else
+static void
+text_cb(SoupServer *server,     //
+        SoupServerMessage *msg, //
+        const char *path,       //
+        GHashTable *query,      //
+        gpointer user_data)
+{
+	struct text_handler *handler = user_data;
+
+	if (soup_server_message_get_method(msg) != SOUP_METHOD_GET) {
+		soup_server_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED, NULL);
+		return;
+	}
+
+	gchar *text = handler->func(handler->user_data);
+	soup_server_message_set_response(msg, handler->content_type, SOUP_MEMORY_TAKE, text, strlen(text));
+	soup_server_message_set_status(msg, SOUP_STATUS_OK, NULL);
+}
+#endif
+
+static void
+add_text_handler(
+    SoupServer *soup_server, const char *path, const char *content_type, EmsTextHandlerFunc func, gpointer user_data)
+{
+	struct text_handler *handler = g_new0(struct text_handler, 1);
+	handler->content_type = g_strdup(content_type);
+	handler->func = func;
+	handler->user_data = user_data;
+
+	soup_server_add_handler(soup_server, path, text_cb, handler, text_handler_free);
+}
+
+void
+ems_signaling_server_add_text_handler(EmsSignalingServer *server,
+                                      const char *path,
+                                      const char *content_type,
+                                      EmsTextHandlerFunc func,
+                                      gpointer user_data)
+{
+	add_text_handler(server->soup_server, path, content_type, func, user_data);
+}
+
+bool
+ems_signaling_server_add_local_text_handler(EmsSignalingServer *server,
+                                            const char *path,
+                                            const char *content_type,
+                                            EmsTextHandlerFunc func,
+                                            gpointer user_data)
+{
+	if (server->local_server == NULL) {
+		GError *error = NULL;
+		guint port = server->port + EMS_SIGNALING_SERVER_LOCAL_PORT_OFFSET;
+
+		server->local_server = soup_server_new(NULL, NULL);
+		if (!soup_server_listen_local(server->local_server, port, SOUP_SERVER_LISTEN_IPV4_ONLY, &error)) {
+			U_LOG_E("Could not listen on 127.0.0.1:%u: %s", port, error->message);
+			g_clear_error(&error);
+			g_clear_object(&server->local_server);
+			return false;
+		}
+		soup_server_add_handler(server->local_server, NULL, http_cb, server, NULL);
+	}
+
+	add_text_handler(server->local_server, path, content_type, func, user_data);
+	return true;
+}
+
 static void
 ems_signaling_server_handle_message(EmsSignalingServer *server, SoupWebsocketConnection *connection, GBytes *message)
 {
@@ -197,18 +316,47 @@ websocket_cb(SoupServer *server,
 static void
 ems_signaling_server_init(EmsSignalingServer *server)
 {
-	GError *error = NULL;
-
 	server->soup_server = soup_server_new(NULL, NULL);
-	g_assert_no_error(error);
 
 	soup_server_add_handler(server->soup_server, NULL, http_cb, server, NULL);
 	soup_server_add_websocket_handler(server->soup_server, "/ws", NULL, NULL, websocket_cb, server, NULL);
+}
+
+static void
+ems_signaling_server_constructed(GObject *object)
+{
+	EmsSignalingServer *server = EMS_SIGNALING_SERVER(object);
+	GError *error = NULL;
 
-	soup_server_listen_all(server->soup_server, 8080, 0, &error);
+	G_OBJECT_CLASS(ems_signaling_server_parent_class)->constructed(object);
+
+	// Listens on the thread default main context of whoever creates us.
+	soup_server_listen_all(server->soup_server, server->port, 0, &error);
 	g_assert_no_error(error);
 }
 
+static void
+ems_signaling_server_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
+{
+	EmsSignalingServer *server = EMS_SIGNALING_SERVER(object);
+
+	switch (prop_id) {
+	case PROP_PORT: server->port = g_value_get_uint(value); break;
+	default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+	}
+}
+
+static void
+ems_signaling_server_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+	EmsSignalingServer *server = EMS_SIGNALING_SERVER(object);
+
+	switch (prop_id) {
+	case PROP_PORT: g_value_set_uint(value, server->port); break;
+	default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+	}
+}
+
 
 static void
 ems_signaling_server_send_to_websocket_client(EmsSignalingServer *server, EmsClientId client_id, JsonNode *msg)
@@ -301,6 +449,10 @@ ems_signaling_server_dispose(GObject *object)
 
 	soup_server_disconnect(self->soup_server);
 	g_clear_object(&self->soup_server);
+	if (self->local_server != NULL) {
+		soup_server_disconnect(self->local_server);
+		g_clear_object(&self->local_server);
+	}
 }
 
 static void
@@ -309,6 +461,14 @@ ems_signaling_server_class_init(EmsSignalingServerClass *klass)
 	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
 
 	gobject_class->dispose = ems_signaling_server_dispose;
+	gobject_class->constructed = ems_signaling_server_constructed;
+	gobject_class->set_property = ems_signaling_server_set_property;
+	gobject_class->get_property = ems_signaling_server_get_property;
+
+	properties[PROP_PORT] = g_param_spec_uint("port", "Port", "Port to listen for websocket clients on", 0,
+	                                          G_MAXUINT16, EMS_SIGNALING_SERVER_DEFAULT_PORT,
+	                                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+	g_object_class_install_properties(gobject_class, N_PROPERTIES, properties);
 
 	signals[SIGNAL_WS_CLIENT_CONNECTED] =
 	    g_signal_new("ws-client-connected", G_OBJECT_CLASS_TYPE(klass), G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
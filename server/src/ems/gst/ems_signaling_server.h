@@ -15,18 +15,58 @@
 
 #include <glib-object.h>
 
+#include <stdbool.h>
+
 #define EMS_TYPE_SIGNALING_SERVER ems_signaling_server_get_type()
 
 G_DECLARE_FINAL_TYPE(EmsSignalingServer, ems_signaling_server, EMS, SIGNALING_SERVER, GObject)
 
+#define EMS_SIGNALING_SERVER_DEFAULT_PORT 8080
+
+//! Local handlers are served on the signaling port plus this.
+#define EMS_SIGNALING_SERVER_LOCAL_PORT_OFFSET 1
+
 typedef gpointer EmsClientId;
 
 EmsSignalingServer *
-ems_signaling_server_new();
+ems_signaling_server_new(guint port);
 
 void
 ems_signaling_server_send_sdp_offer(EmsSignalingServer *server, EmsClientId client_id, const gchar *msg);
 
+/*!
+ * Returns the body for a GET request, newly allocated, it is freed once sent.
+ */
+typedef gchar *(*EmsTextHandlerFunc)(gpointer user_data);
+
+/*!
+ * Serve the output of @p func at @p path over plain HTTP, next to the websocket.
+ *
+ * @p func is called on the thread running the main context the server was created on.
+ */
+void
+ems_signaling_server_add_text_handler(EmsSignalingServer *server,
+                                      const char *path,
+                                      const char *content_type,
+                                      EmsTextHandlerFunc func,
+                                      gpointer user_data);
+
+/*!
+ * Serve the output of @p func at @p path over plain HTTP, on 127.0.0.1 only, at the signaling port plus
+ * EMS_SIGNALING_SERVER_LOCAL_PORT_OFFSET. For anything that should not be reachable from the network.
+ *
+ * The first call starts listening, on the thread default main context of the caller: make it the one the server
+ * was created on. @p func is called on the thread running it.
+ *
+ * @return false if the local port could not be listened on, nothing is served then.
+ */
+bool
+ems_signaling_server_add_local_text_handler(EmsSignalingServer *server,
+                                            const char *path,
+                                            const char *content_type,
+                                            EmsTextHandlerFunc func,
+                                            gpointer user_data);
+
 void
 ems_signaling_server_send_candidate(EmsSignalingServer *server,
                                     EmsClientId client_id,
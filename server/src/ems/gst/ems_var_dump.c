@@ -0,0 +1,89 @@
+// Copyright 2023, Pluto VR, Inc.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Plain text dump of the u_var tree
+ * @ingroup aux_util
+ */
+
+#include "ems_var_dump.h"
+
+#include "util/u_var.h"
+
+#include <inttypes.h>
+
+
+struct dump_state
+{
+	GString *out;
+	const char *root;
+};
+
+static void
+enter_root_cb(struct u_var_root_info *info, void *priv)
+{
+	struct dump_state *state = priv;
+
+	state->root = info->name;
+}
+
+static void
+exit_root_cb(struct u_var_root_info *info, void *priv)
+{
+	struct dump_state *state = priv;
+
+	state->root = NULL;
+}
+
+static void
+elem_cb(struct u_var_info *info, void *priv)
+{
+	struct dump_state *state = priv;
+	GString *out = state->out;
+	void *ptr = info->ptr;
+
+	// Only plain values, the rest (headers, images, curves, buttons) only make sense in the GUI.
+	switch (info->kind) {
+	case U_VAR_KIND_BOOL: g_string_append_printf(out, "%s/%s %d\n", state->root, info->name, *(bool *)ptr); break;
+	case U_VAR_KIND_U8:
+		g_string_append_printf(out, "%s/%s %u\n", state->root, info->name, (unsigned)*(uint8_t *)ptr);
+		break;
+	case U_VAR_KIND_I32:
+	case U_VAR_KIND_RO_I32:
+		g_string_append_printf(out, "%s/%s %" PRId32 "\n", state->root, info->name, *(int32_t *)ptr);
+		break;
+	case U_VAR_KIND_RO_U32:
+		g_string_append_printf(out, "%s/%s %" PRIu32 "\n", state->root, info->name, *(uint32_t *)ptr);
+		break;
+	case U_VAR_KIND_I64:
+	case U_VAR_KIND_RO_I64:
+		g_string_append_printf(out, "%s/%s %" PRId64 "\n", state->root, info->name, *(int64_t *)ptr);
+		break;
+	case U_VAR_KIND_U64:
+	case U_VAR_KIND_RO_U64:
+		g_string_append_printf(out, "%s/%s %" PRIu64 "\n", state->root, info->name, *(uint64_t *)ptr);
+		break;
+	case U_VAR_KIND_F32:
+	case U_VAR_KIND_RO_F32:
+		g_string_append_printf(out, "%s/%s %g\n", state->root, info->name, (double)*(float *)ptr);
+		break;
+	case U_VAR_KIND_F64:
+	case U_VAR_KIND_RO_F64:
+		g_string_append_printf(out, "%s/%s %g\n", state->root, info->name, *(double *)ptr);
+		break;
+	default: break;
+	}
+}
+
+gchar *
+ems_var_dump_text(gpointer user_data)
+{
+	struct dump_state state = {
+	    .out = g_string_new(NULL),
+	    .root = NULL,
+	};
+
+	u_var_visit(enter_root_cb, exit_root_cb, elem_cb, &state);
+
+	return g_string_free(state.out, FALSE);
+}
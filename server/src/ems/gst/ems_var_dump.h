@@ -0,0 +1,27 @@
+// Copyright 2023, Pluto VR, Inc.
+// SPDX-License-Identifier: BSL-1.0
+/*!
+ * @file
+ * @brief  Plain text dump of the u_var tree
+ * @ingroup aux_util
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * Render every numeric u_var as a `root/name value` line, for builds without the debug GUI.
+ *
+ * Nothing is tracked unless u_var is on, see u_var_force_on(). Returns a newly allocated string.
+ */
+gchar *
+ems_var_dump_text(gpointer user_data);
+
+#ifdef __cplusplus
+}
+#endif
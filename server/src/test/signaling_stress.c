@@ -0,0 +1,491 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Connects many WebRTC clients to the signaling server at once and reports per-client setup latency.
+ *
+ * Every client gets its own websocket and webrtcbin, all started at the same moment. For each one we record when
+ * the offer arrived and when the peer connection came up, relative to the websocket connecting. If the server
+ * serializes negotiations, the later clients show it as a staircase in those numbers.
+ *
+ * Run against a running server, e.g. `signaling_stress -n 48`.
+ */
+
+#include <glib-unix.h>
+#include <gst/gst.h>
+
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/webrtc.h>
+
+#include <libsoup/soup-message.h>
+#include <libsoup/soup-session.h>
+
+#include <json-glib/json-glib.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WEBSOCKET_URI_DEFAULT "ws://127.0.0.1:8080/ws"
+
+static gchar *websocket_uri = NULL;
+static gint num_clients = 32;
+static gint timeout_s = 30;
+
+static GOptionEntry options[] = {
+    {"websocket-uri", 'u', 0, G_OPTION_ARG_STRING, &websocket_uri, "Websocket URI of webrtc signaling connection",
+     "URI"},
+    {"clients", 'n', 0, G_OPTION_ARG_INT, &num_clients, "Number of clients to connect at once", "N"},
+    {"timeout", 't', 0, G_OPTION_ARG_INT, &timeout_s, "Give up on clients not connected after this", "SECONDS"},
+    {NULL}};
+
+struct stress_client
+{
+	guint index;
+	SoupWebsocketConnection *ws;
+	GstElement *pipeline;
+	GstElement *webrtcbin;
+
+	//! All in g_get_monotonic_time() microseconds, 0 if it didn't happen (yet).
+	gint64 start_us;
+	gint64 ws_open_us;
+	gint64 offer_us;
+	gint64 connected_us;
+	bool failed;
+};
+
+//! Protects the timestamps above, webrtcbin reports connection state from its own thread.
+static GMutex stats_lock;
+
+static struct stress_client *clients = NULL;
+static GMainLoop *loop = NULL;
+static gint64 deadline_us = 0;
+
+
+/*
+ *
+ * Helpers.
+ *
+ */
+
+static gint64
+elapsed_ms(gint64 from_us, gint64 to_us)
+{
+	return (from_us == 0 || to_us == 0) ? -1 : (to_us - from_us) / 1000;
+}
+
+struct send_data
+{
+	struct stress_client *client;
+	gchar *text;
+};
+
+static gboolean
+send_on_main(gpointer user_data)
+{
+	struct send_data *sd = user_data;
+
+	if (sd->client->ws != NULL &&
+	    soup_websocket_connection_get_state(sd->client->ws) == SOUP_WEBSOCKET_STATE_OPEN) {
+		soup_websocket_connection_send_text(sd->client->ws, sd->text);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+free_send_data(gpointer user_data)
+{
+	struct send_data *sd = user_data;
+
+	g_free(sd->text);
+	g_free(sd);
+}
+
+//! Websockets are not thread safe, webrtcbin calls us from its own threads: bounce sends to the main loop.
+static void
+send_json(struct stress_client *client, JsonBuilder *builder)
+{
+	JsonNode *root = json_builder_get_root(builder);
+
+	struct send_data *sd = g_new0(struct send_data, 1);
+	sd->client = client;
+	sd->text = json_to_string(root, FALSE);
+	g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, send_on_main, sd, free_send_data);
+
+	json_node_unref(root);
+}
+
+
+/*
+ *
+ * WebRTC.
+ *
+ */
+
+static void
+on_answer_created(GstPromise *promise, struct stress_client *client)
+{
+	GstWebRTCSessionDescription *answer = NULL;
+
+	gst_structure_get(gst_promise_get_reply(promise), "answer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &answer, NULL);
+	gst_promise_unref(promise);
+
+	if (answer == NULL) {
+		g_printerr("client %u: no answer\n", client->index);
+		return;
+	}
+
+	g_signal_emit_by_name(client->webrtcbin, "set-local-description", answer, NULL);
+
+	gchar *sdp = gst_sdp_message_as_text(answer->sdp);
+
+	JsonBuilder *builder = json_builder_new();
+	json_builder_begin_object(builder);
+	json_builder_set_member_name(builder, "msg");
+	json_builder_add_string_value(builder, "answer");
+	json_builder_set_member_name(builder, "sdp");
+	json_builder_add_string_value(builder, sdp);
+	json_builder_end_object(builder);
+	send_json(client, builder);
+	g_object_unref(builder);
+
+	g_free(sdp);
+	gst_webrtc_session_description_free(answer);
+}
+
+static void
+webrtc_on_ice_candidate_cb(GstElement *webrtcbin, guint mlineindex, gchar *candidate, struct stress_client *client)
+{
+	JsonBuilder *builder = json_builder_new();
+	json_builder_begin_object(builder);
+	json_builder_set_member_name(builder, "msg");
+	json_builder_add_string_value(builder, "candidate");
+	json_builder_set_member_name(builder, "candidate");
+	json_builder_begin_object(builder);
+	json_builder_set_member_name(builder, "candidate");
+	json_builder_add_string_value(builder, candidate);
+	json_builder_set_member_name(builder, "sdpMLineIndex");
+	json_builder_add_int_value(builder, mlineindex);
+	json_builder_end_object(builder);
+	json_builder_end_object(builder);
+	send_json(client, builder);
+	g_object_unref(builder);
+}
+
+static void
+webrtc_connection_state_cb(GstElement *webrtcbin, GParamSpec *pspec, struct stress_client *client)
+{
+	GstWebRTCPeerConnectionState state;
+	g_object_get(webrtcbin, "connection-state", &state, NULL);
+
+	g_mutex_lock(&stats_lock);
+	if (state == GST_WEBRTC_PEER_CONNECTION_STATE_CONNECTED && client->connected_us == 0) {
+		client->connected_us = g_get_monotonic_time();
+	} else if (state == GST_WEBRTC_PEER_CONNECTION_STATE_FAILED) {
+		client->failed = true;
+	}
+	g_mutex_unlock(&stats_lock);
+}
+
+static void
+webrtc_pad_added_cb(GstElement *webrtcbin, GstPad *pad, struct stress_client *client)
+{
+	if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC) {
+		return;
+	}
+
+	// We only care about negotiation, throw the media away.
+	GstElement *sink = gst_element_factory_make("fakesink", NULL);
+	g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+	gst_bin_add(GST_BIN(client->pipeline), sink);
+	gst_element_sync_state_with_parent(sink);
+
+	GstPad *sinkpad = gst_element_get_static_pad(sink, "sink");
+	gst_pad_link(pad, sinkpad);
+	gst_object_unref(sinkpad);
+}
+
+static void
+process_sdp_offer(struct stress_client *client, const gchar *sdp)
+{
+	GstSDPMessage *sdp_msg = NULL;
+
+	if (gst_sdp_message_new_from_text(sdp, &sdp_msg) != GST_SDP_OK) {
+		g_printerr("client %u: bad offer\n", client->index);
+		return;
+	}
+
+	GstWebRTCSessionDescription *desc = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_OFFER, sdp_msg);
+
+	// webrtcbin runs these in order, no need to wait for the first one.
+	g_signal_emit_by_name(client->webrtcbin, "set-remote-description", desc, NULL);
+	g_signal_emit_by_name(client->webrtcbin, "create-answer", NULL,
+	                      gst_promise_new_with_change_func((GstPromiseChangeFunc)on_answer_created, client, NULL));
+
+	gst_webrtc_session_description_free(desc);
+}
+
+
+/*
+ *
+ * Websocket.
+ *
+ */
+
+static void
+message_cb(SoupWebsocketConnection *connection, gint type, GBytes *message, struct stress_client *client)
+{
+	gsize length = 0;
+	const gchar *msg_data = g_bytes_get_data(message, &length);
+	JsonParser *parser = json_parser_new();
+	GError *error = NULL;
+
+	if (!json_parser_load_from_data(parser, msg_data, length, &error)) {
+		g_clear_error(&error);
+		goto out;
+	}
+
+	JsonObject *msg = json_node_get_object(json_parser_get_root(parser));
+	if (!json_object_has_member(msg, "msg")) {
+		goto out;
+	}
+
+	const gchar *msg_type = json_object_get_string_member(msg, "msg");
+
+	if (g_str_equal(msg_type, "offer")) {
+		g_mutex_lock(&stats_lock);
+		client->offer_us = g_get_monotonic_time();
+		g_mutex_unlock(&stats_lock);
+
+		process_sdp_offer(client, json_object_get_string_member(msg, "sdp"));
+	} else if (g_str_equal(msg_type, "candidate")) {
+		JsonObject *candidate = json_object_get_object_member(msg, "candidate");
+
+		g_signal_emit_by_name(client->webrtcbin, "add-ice-candidate",
+		                      (guint)json_object_get_int_member(candidate, "sdpMLineIndex"),
+		                      json_object_get_string_member(candidate, "candidate"));
+	}
+
+out:
+	g_object_unref(parser);
+}
+
+static void
+websocket_connected_cb(GObject *session, GAsyncResult *res, struct stress_client *client)
+{
+	GError *error = NULL;
+
+	client->ws = soup_session_websocket_connect_finish(SOUP_SESSION(session), res, &error);
+	if (error) {
+		g_printerr("client %u: websocket failed: %s\n", client->index, error->message);
+		g_clear_error(&error);
+		client->failed = true;
+		return;
+	}
+
+	g_mutex_lock(&stats_lock);
+	client->ws_open_us = g_get_monotonic_time();
+	g_mutex_unlock(&stats_lock);
+
+	g_signal_connect(client->ws, "message", G_CALLBACK(message_cb), client);
+
+	client->pipeline = gst_pipeline_new(NULL);
+	client->webrtcbin = gst_element_factory_make("webrtcbin", NULL);
+	g_object_set(client->webrtcbin, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, NULL);
+	gst_bin_add(GST_BIN(client->pipeline), client->webrtcbin);
+
+	g_signal_connect(client->webrtcbin, "on-ice-candidate", G_CALLBACK(webrtc_on_ice_candidate_cb), client);
+	g_signal_connect(client->webrtcbin, "notify::connection-state", G_CALLBACK(webrtc_connection_state_cb), client);
+	g_signal_connect(client->webrtcbin, "pad-added", G_CALLBACK(webrtc_pad_added_cb), client);
+
+	g_assert(gst_element_set_state(client->pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE);
+}
+
+
+/*
+ *
+ * Reporting.
+ *
+ */
+
+static int
+compare_gint64(const void *a, const void *b)
+{
+	gint64 x = *(const gint64 *)a;
+	gint64 y = *(const gint64 *)b;
+	return (x > y) - (x < y);
+}
+
+static void
+print_summary(const char *name, gint64 *values, guint count)
+{
+	if (count == 0) {
+		printf("%-24s no samples\n", name);
+		return;
+	}
+
+	qsort(values, count, sizeof(*values), compare_gint64);
+	printf("%-24s min %5" G_GINT64_FORMAT " ms  median %5" G_GINT64_FORMAT " ms  p90 %5" G_GINT64_FORMAT
+	       " ms  max %5" G_GINT64_FORMAT " ms\n",
+	       name, values[0], values[count / 2], values[(count * 9) / 10], values[count - 1]);
+}
+
+static void
+report(void)
+{
+	gint64 *to_offer = g_new0(gint64, num_clients);
+	gint64 *to_connected = g_new0(gint64, num_clients);
+	guint offers = 0;
+	guint connected = 0;
+
+	printf("%6s %10s %10s %12s\n", "client", "ws (ms)", "offer (ms)", "connected (ms)");
+
+	g_mutex_lock(&stats_lock);
+	for (gint i = 0; i < num_clients; i++) {
+		struct stress_client *c = &clients[i];
+		gint64 ws = elapsed_ms(c->start_us, c->ws_open_us);
+		gint64 offer = elapsed_ms(c->ws_open_us, c->offer_us);
+		gint64 conn = elapsed_ms(c->ws_open_us, c->connected_us);
+
+		printf("%6u %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %12" G_GINT64_FORMAT "%s\n", c->index, ws, offer,
+		       conn, c->failed ? "  FAILED" : "");
+
+		if (offer >= 0) {
+			to_offer[offers++] = offer;
+		}
+		if (conn >= 0) {
+			to_connected[connected++] = conn;
+		}
+	}
+	g_mutex_unlock(&stats_lock);
+
+	printf("\n%u/%d clients connected\n", connected, num_clients);
+	print_summary("websocket to offer", to_offer, offers);
+	print_summary("websocket to connected", to_connected, connected);
+
+	g_free(to_offer);
+	g_free(to_connected);
+}
+
+static gboolean
+check_done_cb(gpointer user_data)
+{
+	bool done = true;
+
+	g_mutex_lock(&stats_lock);
+	for (gint i = 0; i < num_clients; i++) {
+		if (clients[i].connected_us == 0 && !clients[i].failed) {
+			done = false;
+			break;
+		}
+	}
+	g_mutex_unlock(&stats_lock);
+
+	if (done || g_get_monotonic_time() > deadline_us) {
+		g_main_loop_quit(loop);
+		return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+sigint_handler(gpointer user_data)
+{
+	g_main_loop_quit(user_data);
+	return G_SOURCE_REMOVE;
+}
+
+int
+main(int argc, char *argv[])
+{
+	GOptionContext *option_context;
+	SoupSession *soup_session;
+	GError *error = NULL;
+
+	gst_init(&argc, &argv);
+
+	option_context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(option_context, options, NULL);
+
+	if (!g_option_context_parse(option_context, &argc, &argv, &error)) {
+		g_print("option parsing failed: %s\n", error->message);
+		exit(1);
+	}
+
+	if (!websocket_uri) {
+		websocket_uri = g_strdup(WEBSOCKET_URI_DEFAULT);
+	}
+	if (num_clients < 1) {
+		num_clients = 1;
+	}
+
+	soup_session = soup_session_new();
+	// The default per-host limit would queue our connections, which is not what we are measuring.
+	g_object_set(soup_session, "max-conns", num_clients + 2, "max-conns-per-host", num_clients + 2, NULL);
+
+	clients = g_new0(struct stress_client, num_clients);
+
+	gint64 start_us = g_get_monotonic_time();
+	for (gint i = 0; i < num_clients; i++) {
+		struct stress_client *client = &clients[i];
+		client->index = (guint)i;
+		client->start_us = start_us;
+
+#if !SOUP_CHECK_VERSION(3, 0, 0)
+		soup_session_websocket_connect_async(soup_session,                                       // session
+		                                     soup_message_new(SOUP_METHOD_GET, websocket_uri),   // message
+		                                     NULL,                                               // origin
+		                                     NULL,                                               // protocols
+		                                     NULL,                                               // cancellable
+		                                     (GAsyncReadyCallback)websocket_connected_cb,        // callback
+		                                     client);                                            // user_data
+#else
+		soup_session_websocket_connect_async(soup_session,                                       // session
+		                                     soup_message_new(SOUP_METHOD_GET, websocket_uri),   // message
+		                                     NULL,                                               // origin
+		                                     NULL,                                               // protocols
+		                                     0,                                                  // io_prority
+		                                     NULL,                                               // cancellable
+		                                     (GAsyncReadyCallback)websocket_connected_cb,        // callback
+		                                     client);                                            // user_data
+#endif
+	}
+
+	deadline_us = start_us + (gint64)timeout_s * G_USEC_PER_SEC;
+
+	loop = g_main_loop_new(NULL, FALSE);
+	g_unix_signal_add(SIGINT, sigint_handler, loop);
+	g_timeout_add(100, check_done_cb, NULL);
+
+	g_main_loop_run(loop);
+
+	report();
+
+	int ret = EXIT_SUCCESS;
+	for (gint i = 0; i < num_clients; i++) {
+		struct stress_client *c = &clients[i];
+		if (c->connected_us == 0) {
+			ret = EXIT_FAILURE;
+		}
+		if (c->pipeline != NULL) {
+			gst_element_set_state(c->pipeline, GST_STATE_NULL);
+			gst_clear_object(&c->pipeline);
+		}
+		if (c->ws != NULL) {
+			soup_websocket_connection_close(c->ws, 0, NULL);
+			g_clear_object(&c->ws);
+		}
+	}
+
+	g_main_loop_unref(loop);
+	g_free(clients);
+	g_object_unref(soup_session);
+	g_option_context_free(option_context);
+	g_clear_pointer(&websocket_uri, g_free);
+
+	return ret;
+}
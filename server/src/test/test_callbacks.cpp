@@ -0,0 +1,287 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Tests and dispatch benchmarks for ems_callbacks
+ * @ingroup aux_util
+ */
+
+#include "ems_callbacks.h"
+
+#include "electricmaple.pb.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Counter
+{
+	std::atomic<uint64_t> calls{0};
+	std::atomic<int64_t> last_id{0};
+	bool ordered = true;
+};
+
+void
+count_cb(enum ems_callbacks_event event, const em_proto_UpMessage *message, void *userdata)
+{
+	auto *counter = static_cast<Counter *>(userdata);
+	if (message->up_message_id <= counter->last_id.load()) {
+		counter->ordered = false;
+	}
+	counter->last_id.store(message->up_message_id);
+	counter->calls.fetch_add(1);
+}
+
+//! Only counts, for callbacks that run on several threads at once.
+void
+calls_cb(enum ems_callbacks_event event, const em_proto_UpMessage *message, void *userdata)
+{
+	static_cast<Counter *>(userdata)->calls.fetch_add(1);
+}
+
+void
+slow_cb(enum ems_callbacks_event event, const em_proto_UpMessage *message, void *userdata)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(200));
+	count_cb(event, message, userdata);
+}
+
+constexpr int64_t kPerProducer = 1000000;
+
+/*!
+ * Checks that messages from each producer arrive in order, the id being producer * kPerProducer + sequence.
+ *
+ * Only for the dispatch thread, which calls one callback at a time.
+ */
+struct ProducerOrder
+{
+	std::atomic<uint64_t> calls{0};
+	std::vector<int64_t> last;
+	bool ordered = true;
+
+	explicit ProducerOrder(size_t producers) : last(producers, 0) {}
+};
+
+void
+producer_order_cb(enum ems_callbacks_event event, const em_proto_UpMessage *message, void *userdata)
+{
+	auto *order = static_cast<ProducerOrder *>(userdata);
+	int64_t &last = order->last[message->up_message_id / kPerProducer];
+	int64_t sequence = message->up_message_id % kPerProducer;
+	if (sequence <= last) {
+		order->ordered = false;
+	}
+	last = sequence;
+	order->calls.fetch_add(1);
+}
+
+void
+send(struct ems_callbacks *callbacks, int64_t producer, int64_t count)
+{
+	em_proto_UpMessage message = em_proto_UpMessage_init_default;
+	for (int64_t i = 1; i <= count; i++) {
+		message.up_message_id = producer * kPerProducer + i;
+		ems_callbacks_call(callbacks, EMS_CALLBACKS_EVENT_TRACKING, &message);
+	}
+}
+
+template <typename F>
+bool
+wait_for(F &&pred)
+{
+	for (int i = 0; i < 2000; i++) {
+		if (pred()) {
+			return true;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return pred();
+}
+
+} // namespace
+
+TEST_CASE("ems_callbacks")
+{
+	struct ems_callbacks *callbacks = ems_callbacks_create();
+	REQUIRE(callbacks != nullptr);
+
+	em_proto_UpMessage message = em_proto_UpMessage_init_default;
+	Counter tracking;
+	Counter controller;
+
+	ems_callbacks_add(callbacks, EMS_CALLBACKS_EVENT_TRACKING, count_cb, &tracking);
+	ems_callbacks_add(callbacks, EMS_CALLBACKS_EVENT_CONTROLLER, count_cb, &controller);
+
+	SECTION("direct dispatch honors the event mask")
+	{
+		message.up_message_id = 1;
+		ems_callbacks_call(callbacks, EMS_CALLBACKS_EVENT_TRACKING, &message);
+		message.up_message_id = 2;
+		ems_callbacks_call(callbacks, EMS_CALLBACKS_EVENT_TRACKING, &message);
+
+		CHECK(tracking.calls == 2);
+		CHECK(controller.calls == 0);
+	}
+
+	SECTION("reset removes everything")
+	{
+		ems_callbacks_reset(callbacks);
+		message.up_message_id = 1;
+		ems_callbacks_call(callbacks, EMS_CALLBACKS_EVENT_TRACKING, &message);
+
+		CHECK(tracking.calls == 0);
+	}
+
+	SECTION("dispatch thread delivers in order")
+	{
+		REQUIRE(ems_callbacks_start_dispatch_thread(callbacks, 64));
+		REQUIRE_FALSE(ems_callbacks_start_dispatch_thread(callbacks, 64));
+
+		for (int64_t i = 1; i <= 32; i++) {
+			message.up_message_id = i;
+			ems_callbacks_call(callbacks, EMS_CALLBACKS_EVENT_TRACKING, &message);
+		}
+
+		CHECK(wait_for([&] { return tracking.calls == 32; }));
+		CHECK(tracking.ordered);
+		CHECK(ems_callbacks_get_dropped_count(callbacks) == 0);
+	}
+
+	SECTION("slow consumer drops the oldest messages")
+	{
+		Counter slow;
+		ems_callbacks_reset(callbacks);
+		ems_callbacks_add(callbacks, EMS_CALLBACKS_EVENT_TRACKING, slow_cb, &slow);
+		REQUIRE(ems_callbacks_start_dispatch_thread(callbacks, 4));
+
+		constexpr int64_t kCount = 1000;
+		for (int64_t i = 1; i <= kCount; i++) {
+			message.up_message_id = i;
+			ems_callbacks_call(callbacks, EMS_CALLBACKS_EVENT_TRACKING, &message);
+		}
+
+		uint64_t dropped = ems_callbacks_get_dropped_count(callbacks);
+		CHECK(dropped > 0);
+		CHECK(wait_for([&] { return slow.calls + dropped == (uint64_t)kCount; }));
+		CHECK(slow.ordered);
+		// The newest message always survives.
+		CHECK(slow.last_id == kCount);
+	}
+
+	SECTION("each producer's messages arrive in order")
+	{
+		constexpr size_t kProducers = 4;
+		constexpr int64_t kCount = 2000;
+		ProducerOrder order(kProducers);
+		ems_callbacks_reset(callbacks);
+		ems_callbacks_add(callbacks, EMS_CALLBACKS_EVENT_TRACKING, producer_order_cb, &order);
+		// Enough that nothing drops even if they finish before the dispatch thread gets going and share one queue.
+		REQUIRE(ems_callbacks_start_dispatch_thread(callbacks, kProducers * kCount));
+
+		std::vector<std::thread> threads;
+		for (size_t p = 0; p < kProducers; p++) {
+			threads.emplace_back(send, callbacks, p, kCount);
+		}
+		// Swapping the snapshot while they send must not lose or free anything under them.
+		for (int i = 0; i < 50; i++) {
+			ems_callbacks_add(callbacks, EMS_CALLBACKS_EVENT_CONTROLLER, count_cb, &controller);
+		}
+		for (std::thread &t : threads) {
+			t.join();
+		}
+
+		CHECK(wait_for([&] { return order.calls == kProducers * kCount; }));
+		CHECK(order.ordered);
+		CHECK(ems_callbacks_get_dropped_count(callbacks) == 0);
+	}
+
+	SECTION("more threads than queues, one after another and all at once")
+	{
+		constexpr size_t kThreads = 100;
+		constexpr int64_t kCount = 10;
+		ProducerOrder order(kThreads);
+		ems_callbacks_reset(callbacks);
+		ems_callbacks_add(callbacks, EMS_CALLBACKS_EVENT_TRACKING, producer_order_cb, &order);
+		REQUIRE(ems_callbacks_start_dispatch_thread(callbacks, kThreads * kCount));
+
+		// Each exits before the next starts, so they take over each other's queue.
+		for (size_t p = 0; p < kThreads / 2; p++) {
+			std::thread(send, callbacks, p, kCount).join();
+		}
+		// Some of these find every queue taken.
+		std::vector<std::thread> threads;
+		for (size_t p = kThreads / 2; p < kThreads; p++) {
+			threads.emplace_back(send, callbacks, p, kCount);
+		}
+		for (std::thread &t : threads) {
+			t.join();
+		}
+
+		CHECK(wait_for([&] { return order.calls == kThreads * kCount; }));
+		CHECK(ems_callbacks_get_dropped_count(callbacks) == 0);
+		CHECK(order.ordered);
+	}
+
+	SECTION("direct dispatch from many threads while callbacks change")
+	{
+		Counter all;
+		ems_callbacks_reset(callbacks);
+		ems_callbacks_add(callbacks, EMS_CALLBACKS_EVENT_TRACKING, calls_cb, &all);
+
+		std::vector<std::thread> threads;
+		for (size_t p = 0; p < 8; p++) {
+			threads.emplace_back(send, callbacks, 0, 1000);
+		}
+		for (int i = 0; i < 50; i++) {
+			ems_callbacks_add(callbacks, EMS_CALLBACKS_EVENT_CONTROLLER, count_cb, &controller);
+		}
+		for (std::thread &t : threads) {
+			t.join();
+		}
+
+		CHECK(all.calls == 8 * 1000);
+	}
+
+	ems_callbacks_destroy(&callbacks);
+	CHECK(callbacks == nullptr);
+}
+
+TEST_CASE("ems_callbacks dispatch throughput", "[!benchmark]")
+{
+	em_proto_UpMessage message = em_proto_UpMessage_init_default;
+	message.has_tracking = true;
+
+	for (size_t subscribers : {1, 2, 4, 8}) {
+		struct ems_callbacks *callbacks = ems_callbacks_create();
+		std::vector<Counter> counters(subscribers);
+		for (Counter &counter : counters) {
+			ems_callbacks_add(callbacks, EMS_CALLBACKS_EVENT_TRACKING, count_cb, &counter);
+		}
+
+		BENCHMARK("direct, " + std::to_string(subscribers) + " subscribers")
+		{
+			message.up_message_id++;
+			ems_callbacks_call(callbacks, EMS_CALLBACKS_EVENT_TRACKING, &message);
+			return message.up_message_id;
+		};
+
+		ems_callbacks_start_dispatch_thread(callbacks, 64);
+
+		BENCHMARK("dispatch thread, " + std::to_string(subscribers) + " subscribers")
+		{
+			message.up_message_id++;
+			ems_callbacks_call(callbacks, EMS_CALLBACKS_EVENT_TRACKING, &message);
+			return message.up_message_id;
+		};
+
+		ems_callbacks_destroy(&callbacks);
+	}
+}
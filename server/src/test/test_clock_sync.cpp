@@ -0,0 +1,159 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Tests for ems_clock_sync
+ * @ingroup aux_util
+ */
+
+#include "ems_clock_sync.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace {
+
+constexpr int64_t kMs = 1000 * 1000;
+constexpr int64_t kSecond = 1000 * kMs;
+
+//! A client whose clock reads server * (1 + drift) + offset.
+struct FakeClient
+{
+	int64_t offset_ns;
+	double drift;
+
+	int64_t
+	clock(int64_t server_ns) const
+	{
+		return server_ns + offset_ns + (int64_t)(drift * (double)server_ns);
+	}
+
+	//! One exchange, with the given one way delays and the client holding the ping for 50 us.
+	bool
+	exchange(struct ems_clock_sync *cs, int64_t server_send_ns, int64_t up_ns, int64_t down_ns) const
+	{
+		int64_t hold_ns = 50 * 1000;
+		int64_t arrive_ns = server_send_ns + up_ns;
+		return ems_clock_sync_add_sample(cs, server_send_ns, clock(arrive_ns), clock(arrive_ns + hold_ns),
+		                                 arrive_ns + hold_ns + down_ns);
+	}
+};
+
+int64_t
+abs64(int64_t v)
+{
+	return v < 0 ? -v : v;
+}
+
+} // namespace
+
+TEST_CASE("ems_clock_sync")
+{
+	struct ems_clock_sync *cs = ems_clock_sync_create();
+	REQUIRE(cs != nullptr);
+
+	FakeClient client{123456789012345, 0.0};
+	int64_t out = 42;
+
+	SECTION("no estimate before the first exchange")
+	{
+		CHECK_FALSE(ems_clock_sync_client_to_server(cs, 1000, &out));
+		CHECK_FALSE(ems_clock_sync_server_to_client(cs, 1000, &out));
+		CHECK(out == 42);
+
+		struct ems_clock_sync_stats stats;
+		ems_clock_sync_get_stats(cs, &stats);
+		CHECK_FALSE(stats.valid);
+	}
+
+	SECTION("symmetric delays give the exact offset")
+	{
+		REQUIRE(client.exchange(cs, 10 * kSecond, 2 * kMs, 2 * kMs));
+
+		struct ems_clock_sync_stats stats;
+		ems_clock_sync_get_stats(cs, &stats);
+		CHECK(stats.valid);
+		CHECK(stats.offset_ns == client.offset_ns);
+		CHECK(stats.rtt_ns == 4 * kMs);
+
+		REQUIRE(ems_clock_sync_client_to_server(cs, client.clock(11 * kSecond), &out));
+		CHECK(out == 11 * kSecond);
+		REQUIRE(ems_clock_sync_server_to_client(cs, 11 * kSecond, &out));
+		CHECK(out == client.clock(11 * kSecond));
+	}
+
+	SECTION("inconsistent timestamps are ignored")
+	{
+		// Pong received before the ping was sent.
+		CHECK_FALSE(ems_clock_sync_add_sample(cs, 10 * kSecond, 5, 6, 9 * kSecond));
+		// Client held it longer than the whole round trip.
+		CHECK_FALSE(ems_clock_sync_add_sample(cs, 10 * kSecond, 0, 5 * kMs, 10 * kSecond + kMs));
+
+		CHECK_FALSE(ems_clock_sync_client_to_server(cs, 1000, &out));
+	}
+
+	SECTION("a congested exchange doesn't move the estimate")
+	{
+		for (int64_t i = 0; i < 8; i++) {
+			client.exchange(cs, (10 + i) * kSecond, 2 * kMs, 2 * kMs);
+		}
+
+		// 40 ms stuck in a queue on the way out, taken at face value this is 20 ms off.
+		client.exchange(cs, 20 * kSecond, 42 * kMs, 2 * kMs);
+
+		struct ems_clock_sync_stats stats;
+		ems_clock_sync_get_stats(cs, &stats);
+		CHECK(stats.rejected == 1);
+		CHECK(stats.accepted == 8);
+		CHECK(stats.min_rtt_ns == 4 * kMs);
+		CHECK(abs64(stats.offset_ns - client.offset_ns) < kMs / 10);
+	}
+
+	SECTION("drift is fitted once there is enough history")
+	{
+		client.drift = 50e-6;
+
+		srand(1);
+		for (int64_t i = 0; i < EMS_CLOCK_SYNC_SAMPLE_COUNT; i++) {
+			int64_t jitter_up = rand() % (200 * 1000);
+			int64_t jitter_down = rand() % (200 * 1000);
+			client.exchange(cs, (10 + i) * kSecond, kMs + jitter_up, kMs + jitter_down);
+		}
+
+		struct ems_clock_sync_stats stats;
+		ems_clock_sync_get_stats(cs, &stats);
+		CHECK_THAT(stats.drift_ppm, Catch::Matchers::WithinAbs(50.0, 5.0));
+
+		// A second past the last exchange, where ignoring drift would put us 50 us off.
+		int64_t server_ns = (10 + EMS_CLOCK_SYNC_SAMPLE_COUNT) * kSecond;
+		REQUIRE(ems_clock_sync_server_to_client(cs, server_ns, &out));
+		CHECK(abs64(out - client.clock(server_ns)) < 20 * 1000);
+
+		// And back again.
+		REQUIRE(ems_clock_sync_client_to_server(cs, out, &out));
+		CHECK(abs64(out - server_ns) <= 1);
+	}
+
+	SECTION("reset forgets the previous client")
+	{
+		client.exchange(cs, 10 * kSecond, 2 * kMs, 2 * kMs);
+		ems_clock_sync_reset(cs);
+
+		CHECK_FALSE(ems_clock_sync_client_to_server(cs, 1000, &out));
+
+		FakeClient other{-5 * kSecond, 0.0};
+		other.exchange(cs, 11 * kSecond, kMs, kMs);
+
+		struct ems_clock_sync_stats stats;
+		ems_clock_sync_get_stats(cs, &stats);
+		CHECK(stats.offset_ns == other.offset_ns);
+	}
+
+	ems_clock_sync_destroy(&cs);
+	CHECK(cs == nullptr);
+}
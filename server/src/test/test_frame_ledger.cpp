@@ -0,0 +1,108 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Tests for ems_frame_ledger
+ * @ingroup aux_util
+ */
+
+#include "ems_frame_ledger.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <stdint.h>
+
+TEST_CASE("ems_frame_ledger")
+{
+	struct ems_frame_ledger *ledger = ems_frame_ledger_create();
+	REQUIRE(ledger != nullptr);
+
+	struct ems_frame_ledger_entry entry = {};
+	struct ems_frame_ledger_stats stats = {};
+
+	SECTION("a frame's points are joined by id and pts")
+	{
+		ems_frame_ledger_mark(ledger, 7, EMS_FRAME_POINT_POSE, 100);
+		ems_frame_ledger_mark(ledger, 7, EMS_FRAME_POINT_COMMITTED, 200);
+		ems_frame_ledger_set_pts(ledger, 7, 5000);
+		ems_frame_ledger_set_target_display_time(ledger, 7, 800);
+
+		struct xrt_pose pose = {{0.0f, 0.0f, 0.0f, 1.0f}, {0.1f, 1.6f, -0.2f}};
+		ems_frame_ledger_set_render_pose(ledger, 7, &pose);
+		ems_frame_ledger_set_tracking_sequence_idx(ledger, 7, 31);
+		ems_frame_ledger_mark(ledger, 7, EMS_FRAME_POINT_PUSHED, 300);
+
+		CHECK(ems_frame_ledger_mark_pts(ledger, 5000, EMS_FRAME_POINT_ENCODE_BEGIN, 400));
+		CHECK(ems_frame_ledger_mark_pts(ledger, 5000, EMS_FRAME_POINT_ENCODE_END, 500));
+
+		struct ems_frame_ledger_entry found = {};
+		REQUIRE(ems_frame_ledger_find_pts(ledger, 5000, &found));
+		CHECK(found.frame_id == 7);
+		CHECK(found.target_display_ns == 800);
+		CHECK(found.has_render_pose);
+		CHECK(found.render_pose.position.y == 1.6f);
+		CHECK(found.tracking_sequence_idx == 31);
+		CHECK(found.ns[EMS_FRAME_POINT_ENCODE_END] == 500);
+
+		ems_frame_ledger_mark(ledger, 7, EMS_FRAME_POINT_DECODED, 600);
+		ems_frame_ledger_mark(ledger, 7, EMS_FRAME_POINT_DISPLAYED, 700);
+
+		REQUIRE(ems_frame_ledger_take(ledger, 7, &entry));
+		CHECK(entry.frame_id == 7);
+		CHECK(entry.has_pts);
+		CHECK(entry.pts == 5000);
+		CHECK(entry.target_display_ns == 800);
+		for (int i = 0; i < EMS_FRAME_POINT_COUNT; i++) {
+			CHECK(entry.ns[i] == 100 * (i + 1));
+		}
+
+		// Gone once taken.
+		CHECK_FALSE(ems_frame_ledger_take(ledger, 7, &entry));
+		CHECK_FALSE(ems_frame_ledger_find_pts(ledger, 5000, &found));
+
+		ems_frame_ledger_get_stats(ledger, &stats);
+		CHECK(stats.joined == 1);
+		CHECK(stats.unmatched == 1);
+		CHECK(stats.evicted == 0);
+	}
+
+	SECTION("unknown pts are reported as such")
+	{
+		entry.frame_id = 42;
+		CHECK_FALSE(ems_frame_ledger_mark_pts(ledger, 1234, EMS_FRAME_POINT_ENCODE_BEGIN, 1));
+		CHECK_FALSE(ems_frame_ledger_find_pts(ledger, 1234, &entry));
+		CHECK(entry.frame_id == 42);
+	}
+
+	SECTION("old frames are pushed out by new ones")
+	{
+		for (int64_t id = 1; id <= EMS_FRAME_LEDGER_SIZE; id++) {
+			ems_frame_ledger_mark(ledger, id, EMS_FRAME_POINT_COMMITTED, id * 10);
+		}
+
+		ems_frame_ledger_get_stats(ledger, &stats);
+		CHECK(stats.evicted == 0);
+
+		// Lands in frame 1's slot.
+		ems_frame_ledger_mark(ledger, EMS_FRAME_LEDGER_SIZE + 1, EMS_FRAME_POINT_COMMITTED, 1);
+
+		ems_frame_ledger_get_stats(ledger, &stats);
+		CHECK(stats.evicted == 1);
+
+		// A late point for the evicted frame doesn't clobber the new one.
+		ems_frame_ledger_mark(ledger, 1, EMS_FRAME_POINT_DECODED, 999);
+		CHECK_FALSE(ems_frame_ledger_take(ledger, 1, &entry));
+
+		REQUIRE(ems_frame_ledger_take(ledger, EMS_FRAME_LEDGER_SIZE + 1, &entry));
+		CHECK(entry.ns[EMS_FRAME_POINT_COMMITTED] == 1);
+		CHECK(entry.ns[EMS_FRAME_POINT_DECODED] == 0);
+
+		REQUIRE(ems_frame_ledger_take(ledger, 2, &entry));
+		CHECK(entry.ns[EMS_FRAME_POINT_COMMITTED] == 20);
+	}
+
+	ems_frame_ledger_destroy(&ledger);
+	CHECK(ledger == nullptr);
+}
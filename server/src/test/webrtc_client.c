@@ -13,9 +13,15 @@
 
 #include <json-glib/json-glib.h>
 #include "stdio.h"
+#include "os/os_time.h"
 #include "util/u_logging.h"
 
+#include "pb_encode.h"
+#include "electricmaple.pb.h"
+
 static gchar *websocket_uri = NULL;
+static gint tracking_rate = 0;
+static gboolean tracking_reliable = FALSE;
 
 static GOptionEntry options[] = {{
                                      "websocket-uri",
@@ -26,6 +32,25 @@ static GOptionEntry options[] = {{
                                      "Websocket URI of webrtc signaling connection",
                                      "URI",
                                  },
+                                 {
+                                     "tracking-rate",
+                                     't',
+                                     0,
+                                     G_OPTION_ARG_INT,
+                                     &tracking_rate,
+                                     "Send a made up head pose this many times a second, like a headset would",
+                                     "HZ",
+                                 },
+                                 {
+                                     "tracking-reliable",
+                                     'r',
+                                     0,
+                                     G_OPTION_ARG_NONE,
+                                     &tracking_reliable,
+                                     "Send tracking over the reliable channel, like clients did before the tracking "
+                                     "channel, to compare against",
+                                     NULL,
+                                 },
                                  {NULL}};
 
 #define WEBSOCKET_URI_DEFAULT "ws://127.0.0.1:8080/ws"
@@ -35,6 +60,8 @@ static SoupWebsocketConnection *ws = NULL;
 static GstElement *pipeline = NULL;
 static GstElement *webrtcbin = NULL;
 static GstWebRTCDataChannel *datachannel = NULL;
+static GstWebRTCDataChannel *tracking_channel = NULL;
+static int64_t tracking_sequence_idx = 0;
 
 
 /*
@@ -79,18 +106,68 @@ datachannel_send_message(gpointer unused)
 	return G_SOURCE_CONTINUE;
 }
 
+/*!
+ * Send the next made up head pose, numbered and stamped like the real client does, for measuring how tracking gets
+ * through a lossy link: see scripts/tracking_loss_harness.sh.
+ */
+static gboolean
+send_tracking(gpointer unused)
+{
+	GstWebRTCDataChannel *channel = tracking_reliable || tracking_channel == NULL ? datachannel : tracking_channel;
+	if (channel == NULL) {
+		return G_SOURCE_CONTINUE;
+	}
+
+	em_proto_UpMessage msg = em_proto_UpMessage_init_default;
+	msg.up_message_id = ++tracking_sequence_idx;
+	msg.has_tracking = true;
+	msg.tracking.sequence_idx = tracking_sequence_idx;
+	msg.tracking.timestamp = (int64_t)os_monotonic_get_ns();
+	msg.tracking.has_P_localSpace_viewSpace = true;
+	msg.tracking.P_localSpace_viewSpace.has_position = true;
+	msg.tracking.P_localSpace_viewSpace.position.y = 1.6f;
+	msg.tracking.P_localSpace_viewSpace.has_orientation = true;
+	msg.tracking.P_localSpace_viewSpace.orientation.w = 1.0f;
+
+	uint8_t buffer[em_proto_UpMessage_size];
+	pb_ostream_t os = pb_ostream_from_buffer(buffer, sizeof(buffer));
+	if (!pb_encode(&os, &em_proto_UpMessage_msg, &msg)) {
+		U_LOG_E("Could not encode tracking: %s", PB_GET_ERROR(&os));
+		return G_SOURCE_CONTINUE;
+	}
+
+	GBytes *bytes = g_bytes_new(buffer, os.bytes_written);
+	gst_webrtc_data_channel_send_data(channel, bytes);
+	g_bytes_unref(bytes);
+
+	return G_SOURCE_CONTINUE;
+}
+
 static void
 webrtc_on_data_channel_cb(GstElement *webrtcbin, GstWebRTCDataChannel *data_channel, void *user_data)
 {
 	guint timeout_src_id;
+	gchar *label = NULL;
+
+	g_object_get(data_channel, "label", &label, NULL);
+	U_LOG_I("Successfully created datachannel %s", label);
 
-	U_LOG_I("Successfully created datachannel");
+	if (g_strcmp0(label, "tracking") == 0) {
+		g_free(label);
+		g_clear_object(&tracking_channel);
+		tracking_channel = g_object_ref(data_channel);
+		return;
+	}
+	g_free(label);
 
 	g_assert_null(datachannel);
 
 	datachannel = GST_WEBRTC_DATA_CHANNEL(data_channel);
 
 	timeout_src_id = g_timeout_add_seconds(3, datachannel_send_message, NULL);
+	if (tracking_rate > 0) {
+		g_timeout_add(MAX(1000 / tracking_rate, 1), send_tracking, NULL);
+	}
 
 	g_signal_connect(datachannel, "on-close", G_CALLBACK(data_channel_close_cb), GUINT_TO_POINTER(timeout_src_id));
 	g_signal_connect(datachannel, "on-error", G_CALLBACK(data_channel_error_cb), GUINT_TO_POINTER(timeout_src_id));
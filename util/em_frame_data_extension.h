@@ -0,0 +1,17 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  How the server tells the client which frame a video buffer is.
+ *
+ * The first RTP packet of every frame carries an encoded em_proto_DownMessage with just frame_data set, in a
+ * two-byte RTP header extension element (RFC 8285). The client hands the frame_sequence_id back in its
+ * em_proto_UpFrameMessage, which is how the server joins the client's timing with its own.
+ */
+
+#pragma once
+
+//! Element id of the frame data in the two-byte header extension.
+#define EM_FRAME_DATA_EXTENSION_ID 1
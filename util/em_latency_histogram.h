@@ -0,0 +1,210 @@
+// Copyright 2023, Pluto VR, Inc.
+//
+// SPDX-License-Identifier: BSL-1.0
+
+/*!
+ * @file
+ * @brief  Fixed size, log bucketed latency histogram, shared by client and server.
+ *
+ * Values are kept in microseconds, exactly below 32 us and within about 3% above that, up to a bit over two
+ * minutes. Every power of two is split into 32 equal buckets, like HdrHistogram with two significant digits.
+ *
+ * Recording is a handful of relaxed atomic adds: it never locks or allocates, so it is fine on streaming threads
+ * and in the compositor's frame loop. Give each recording thread its own histogram to keep the cache lines from
+ * bouncing, and have whoever reports drain or merge them into a snapshot now and then. Queries are only meant for
+ * snapshots, which nobody records into.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! Each power of two is split into 1 << this many buckets.
+#define EM_LATENCY_HISTOGRAM_SUB_BITS 5
+
+//! Values of 1 << this many microseconds and up all land in the last bucket.
+#define EM_LATENCY_HISTOGRAM_MAX_BITS 27
+
+#define EM_LATENCY_HISTOGRAM_BUCKET_COUNT                                                                              \
+	((EM_LATENCY_HISTOGRAM_MAX_BITS - EM_LATENCY_HISTOGRAM_SUB_BITS + 1) << EM_LATENCY_HISTOGRAM_SUB_BITS)
+
+/*!
+ * Counts per bucket, plus the totals. Zero initialize it, there is nothing else to set up.
+ */
+struct em_latency_histogram
+{
+	uint64_t counts[EM_LATENCY_HISTOGRAM_BUCKET_COUNT];
+
+	//! Number of values recorded.
+	uint64_t total;
+
+	//! Sum and largest of the values recorded, in microseconds.
+	uint64_t sum_us;
+	uint64_t max_us;
+};
+
+//! Which bucket @p us goes into.
+static inline uint32_t
+em_latency_histogram_bucket_for(uint64_t us)
+{
+	const uint64_t sub_count = 1u << EM_LATENCY_HISTOGRAM_SUB_BITS;
+
+	if (us < sub_count) {
+		return (uint32_t)us;
+	}
+	if (us >= ((uint64_t)1 << EM_LATENCY_HISTOGRAM_MAX_BITS)) {
+		return EM_LATENCY_HISTOGRAM_BUCKET_COUNT - 1;
+	}
+
+	// Highest set bit, at least SUB_BITS here. The top SUB_BITS + 1 bits pick the bucket within the octave.
+	uint32_t exponent = 63 - (uint32_t)__builtin_clzll(us);
+	uint32_t octave = exponent - EM_LATENCY_HISTOGRAM_SUB_BITS + 1;
+	uint64_t sub = (us >> (exponent - EM_LATENCY_HISTOGRAM_SUB_BITS)) - sub_count;
+
+	return (octave << EM_LATENCY_HISTOGRAM_SUB_BITS) + (uint32_t)sub;
+}
+
+//! Smallest value in bucket @p index, in microseconds.
+static inline uint64_t
+em_latency_histogram_bucket_lower_us(uint32_t index)
+{
+	const uint32_t sub_count = 1u << EM_LATENCY_HISTOGRAM_SUB_BITS;
+
+	uint32_t octave = index >> EM_LATENCY_HISTOGRAM_SUB_BITS;
+	if (octave == 0) {
+		return index;
+	}
+	uint64_t sub = index & (sub_count - 1);
+	return (sub_count + sub) << (octave - 1);
+}
+
+//! How many microseconds bucket @p index spans.
+static inline uint64_t
+em_latency_histogram_bucket_width_us(uint32_t index)
+{
+	uint32_t octave = index >> EM_LATENCY_HISTOGRAM_SUB_BITS;
+	return octave == 0 ? 1 : (uint64_t)1 << (octave - 1);
+}
+
+/*!
+ * Record one value, negative ones count as zero.
+ *
+ * Lock and allocation free, safe to call from any thread, even concurrently with drain and merge.
+ */
+static inline void
+em_latency_histogram_record_ns(struct em_latency_histogram *h, int64_t ns)
+{
+	uint64_t us = ns > 0 ? (uint64_t)ns / 1000 : 0;
+
+	__atomic_fetch_add(&h->counts[em_latency_histogram_bucket_for(us)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_us, us, __ATOMIC_RELAXED);
+
+	// Only loops when another thread raised the max at the same time.
+	uint64_t max_us = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+	while (us > max_us &&
+	       !__atomic_compare_exchange_n(&h->max_us, &max_us, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+/*!
+ * Add everything recorded in @p from to the snapshot @p into, @p from may be recorded into meanwhile.
+ */
+static inline void
+em_latency_histogram_merge(struct em_latency_histogram *into, const struct em_latency_histogram *from)
+{
+	for (uint32_t i = 0; i < EM_LATENCY_HISTOGRAM_BUCKET_COUNT; i++) {
+		into->counts[i] += __atomic_load_n(&from->counts[i], __ATOMIC_RELAXED);
+	}
+	into->total += __atomic_load_n(&from->total, __ATOMIC_RELAXED);
+	into->sum_us += __atomic_load_n(&from->sum_us, __ATOMIC_RELAXED);
+
+	uint64_t max_us = __atomic_load_n(&from->max_us, __ATOMIC_RELAXED);
+	if (max_us > into->max_us) {
+		into->max_us = max_us;
+	}
+}
+
+/*!
+ * Move everything recorded in @p from to the snapshot @p into, leaving @p from empty.
+ *
+ * Values recorded meanwhile end up in one or the other, none are lost. Only one thread may drain a histogram.
+ */
+static inline void
+em_latency_histogram_drain(struct em_latency_histogram *from, struct em_latency_histogram *into)
+{
+	for (uint32_t i = 0; i < EM_LATENCY_HISTOGRAM_BUCKET_COUNT; i++) {
+		// Most buckets are empty, no need to dirty their cache lines.
+		if (__atomic_load_n(&from->counts[i], __ATOMIC_RELAXED) != 0) {
+			into->counts[i] += __atomic_exchange_n(&from->counts[i], 0, __ATOMIC_RELAXED);
+		}
+	}
+	into->total += __atomic_exchange_n(&from->total, 0, __ATOMIC_RELAXED);
+	into->sum_us += __atomic_exchange_n(&from->sum_us, 0, __ATOMIC_RELAXED);
+
+	uint64_t max_us = __atomic_exchange_n(&from->max_us, 0, __ATOMIC_RELAXED);
+	if (max_us > into->max_us) {
+		into->max_us = max_us;
+	}
+}
+
+//! Empty a snapshot.
+static inline void
+em_latency_histogram_reset(struct em_latency_histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+/*!
+ * The value at quantile @p q (0 to 1) of a snapshot, in microseconds: the middle of the bucket it falls in, but
+ * never more than the largest value recorded. Returns 0 for an empty snapshot.
+ */
+static inline uint64_t
+em_latency_histogram_quantile_us(const struct em_latency_histogram *h, double q)
+{
+	if (h->total == 0) {
+		return 0;
+	}
+
+	// Nearest rank, counting from 1.
+	double exact_rank = q * (double)h->total;
+	uint64_t rank = (uint64_t)exact_rank;
+	if ((double)rank < exact_rank) {
+		rank++;
+	}
+	if (rank < 1) {
+		rank = 1;
+	}
+	if (rank > h->total) {
+		rank = h->total;
+	}
+
+	uint64_t seen = 0;
+	uint32_t i = 0;
+	for (; i < EM_LATENCY_HISTOGRAM_BUCKET_COUNT - 1; i++) {
+		seen += h->counts[i];
+		if (seen >= rank) {
+			break;
+		}
+	}
+
+	uint64_t value = em_latency_histogram_bucket_lower_us(i) + (em_latency_histogram_bucket_width_us(i) - 1) / 2;
+	return value < h->max_us ? value : h->max_us;
+}
+
+//! Mean of a snapshot in microseconds, 0 for an empty one.
+static inline double
+em_latency_histogram_mean_us(const struct em_latency_histogram *h)
+{
+	return h->total == 0 ? 0.0 : (double)h->sum_us / (double)h->total;
+}
+
+#ifdef __cplusplus
+}
+#endif